@@ -2,6 +2,7 @@
 #define _INCLUDE_APP_H_
 
 #include <sqlite3.h>
+#include <sys/socket.h>
 #include <event2/event.h>
 
 #include <onion.h>
@@ -16,6 +17,25 @@
 #include <ui_manager.h>
 #include <prot_main.h>
 #include <db_message.h>
+#include <queue.h>
+#include <hooks.h>
+#include <hash_table.h>
+
+// Number of seconds between checks for background database jobs
+#define APP_JOB_INTERVAL 1
+
+// Maximum number of syncs running at the same time
+#define APP_SYNC_MAX_ACTIVE 3
+// Number of seconds to wait before starting next queued sync
+#define APP_SYNC_SPREAD 2
+// Number of seconds between periodic syncs with mailbox and all contacts
+#define APP_SYNC_INTERVAL 600
+// Queued in place of contact id to sync with the mailbox
+#define APP_SYNC_MAILBOX 0
+// Number of seconds to wait before retrying after the first failed delivery,
+// delay is doubled with each next failure up to APP_OUTBOX_MAX_DELAY
+#define APP_OUTBOX_BASE_DELAY 15
+#define APP_OUTBOX_MAX_DELAY 3600
 
 // Log message to info UI window
 #define app_ui_info(app, ...) \
@@ -30,11 +50,13 @@ struct app_data {
 
     // Libevent event base
     struct event_base *base;
+    // Event running background database jobs
+    struct event *job_event;
 
-    // Contacts array
+    // Contacts array, only summaries are kept for the contact list
     int n_contacts;
-    struct db_contact **contacts;
-    struct db_contact *cont_selected;
+    struct db_contact_summary **contacts;
+    struct db_contact_summary *cont_selected;
 
     // Some useful stuff
     char nickname[CLIENT_NICK_MAX_LEN + 1];
@@ -48,6 +70,24 @@ struct app_data {
     // Last line read from tor process
     char *tor_line_buffer;
     int tor_line_buffer_len;
+    // Tor SOCKS server address, resolved once when tor is started
+    struct sockaddr_storage tor_socks_addr;
+    int tor_socks_addr_len;
+
+    // Sync scheduler (app_sync.c)
+    struct {
+        struct queue *queue;            // Contact ids waiting to be synced
+        int n_active;                   // Number of syncs in progress
+        struct event *next_event;       // Starts queued syncs
+        struct event *periodic_event;   // Queues all syncs periodically
+    } sync;
+
+    // Outbox retry engine (app_outbox.c)
+    struct {
+        struct event *event;                // Fires at the earliest next attempt
+        struct hash_table *in_flight;       // Number of open connections per contact id
+        struct hash_table *msg_in_flight;   // Number of open connections per message id
+    } outbox;
 
     // Paths for all files needed by application
     struct {
@@ -74,6 +114,8 @@ struct app_data {
         int manual_mode;
         // Send all messages to mailboxes instead of sending directlly
         int mb_direct;
+        // Number of database files mailbox storage is split into
+        int n_shards;
     } cf;
 
     // Global UI related data
@@ -104,6 +146,7 @@ enum app_event_priorities {
     APP_EV_PRIORITY_PRIMARY, // Any more important action
     APP_EV_PRIORITY_USER,    // User interactions (reading from stdin)
     APP_EV_PRIORITY_NET,     // Handling network traffic
+    APP_EV_PRIORITY_IDLE,    // Background work (database jobs)
     APP_EV_PRIORITY_COUNT,   // Number of event priorities
 };
 
@@ -124,6 +167,9 @@ void app_event_end(struct app_data *app);
 void app_tor_start(struct app_data *app);
 // Stop tor process and associated event
 void app_tor_end(struct app_data *app);
+// Connect given protocol handler to onion service over tor SOCKS server
+void app_tor_connect(struct app_data *app, struct prot_main *pmain,
+    const char *onion_address, const char *onion_port);
 
 // Init ncurses and all ui windows and components
 void app_ui_init(struct app_data *app);
@@ -149,6 +195,8 @@ void app_ui_chat_refresh(struct app_data *app, int keep_position);
 
 // Refresh displayed contacts list
 void app_update_contacts(struct app_data *app);
+// Update message counts of listed contacts without rebuilding the list
+void app_update_contact_counts(struct app_data *app);
 
 // Add hooks to main protocol handler for incomming connection (app_actions.c)
 void app_pmain_add_hooks(struct app_data *app, struct prot_main *pmain);
@@ -156,9 +204,45 @@ void app_pmain_add_hooks(struct app_data *app, struct prot_main *pmain);
 // Sync messages with given contact
 void app_contact_sync(struct app_data *app, struct db_contact *cont);
 
+// Same as app_contact_sync, done_cb is called with cbarg once
+// the connection is done or closed
+void app_contact_sync_notify(struct app_data *app, struct db_contact *cont,
+    hook_callback done_cb, void *cbarg);
+
 // Sync messages from your mailbox account
 void app_mailbox_sync(struct app_data *app);
 
+// Same as app_mailbox_sync, done_cb is called with cbarg once the connection
+// is done or closed, returns 0 if there is no mailbox to sync with
+int app_mailbox_sync_notify(struct app_data *app, hook_callback done_cb, void *cbarg);
+
+// Create sync scheduler events (app_sync.c)
+void app_sync_init(struct app_data *app);
+
+// Queue sync with the mailbox and all active contacts, contacts with
+// undelivered messages and recent activity are synced first, at most
+// APP_SYNC_MAX_ACTIVE syncs run at once
+void app_sync_all(struct app_data *app);
+
+// Check if sync with given contact id is waiting in the queue
+int app_sync_is_queued(struct app_data *app, int contact_id);
+
+// Queue sync with given contact unless it's already queued, it is
+// started once there is a free slot
+void app_sync_contact(struct app_data *app, int contact_id);
+
+// Create outbox retry timer (app_outbox.c)
+void app_outbox_init(struct app_data *app);
+
+// Arm outbox timer for the earliest next delivery attempt
+void app_outbox_schedule(struct app_data *app);
+
+// Watch connection to given contact which tries to deliver given messages
+// (n_ids IDs), those which are left undelivered once it is done or closed
+// get their next delivery attempt scheduled
+void app_outbox_watch(struct app_data *app, struct prot_main *pmain, int contact_id,
+    const int *ids, int n_ids);
+
 // Send message to associated contact (frees message by itself)
 void app_message_send(struct app_data *app, struct db_message *dbmsg);
 
@@ -0,0 +1,30 @@
+#ifndef _INCLUDE_ARENA_H_
+#define _INCLUDE_ARENA_H_
+
+#include <stdlib.h>
+
+// Default size of single arena chunk
+#define ARENA_CHUNK_SIZE 16384
+
+struct arena_chunk;
+
+// Bump allocator, memory is handed out from large chunks and
+// released all at once when the arena is freed
+struct arena {
+    size_t chunk_size;
+    struct arena_chunk *head;
+};
+
+// Allocate new arena, if chunk_size is 0 default chunk size is used
+struct arena * arena_new(size_t chunk_size);
+
+// Free arena and all memory allocated from it
+void arena_free(struct arena *a);
+
+// Allocate size bytes from the arena, memory is not initialized
+void * arena_alloc(struct arena *a, size_t size);
+
+// Allocate size bytes from the arena and copy data into them
+void * arena_memdup(struct arena *a, const void *data, size_t size);
+
+#endif
@@ -4,7 +4,9 @@
 #include <stdlib.h>
 #include <stdint.h>
 
-#define ARRAY_CHUNK_SIZE 8
+// Number of elements allocated for a new array, storage is at least
+// doubled every time array needs to grow
+#define ARRAY_INITIAL_CAPACITY 8
 
 // Allocate new array for given type
 #define array(type) \
@@ -12,7 +14,7 @@
 
 // Access given element of array, expand if needed
 #define array_at(arr, i) \
-    (arr)[(i) + ((uintptr_t)((arr) = _array_expand((arr), (i) + 1)) * 0)]
+    ((arr) = _array_expand((arr), (i) + 1), (arr))[(i)]
 
 // Set given element of array, expand if needed
 #define array_set(arr, i, value) \
@@ -22,23 +24,45 @@
 #define array_expand(arr, new_length) \
     ((arr) = _array_expand((arr), (new_length)))
 
+// Append given value to the end of the array
+#define array_push(arr, value) \
+    ((arr) = _array_push((arr)), (arr)[array_length(arr) - 1] = (value))
+
+// Remove the last element from the array and get it's value,
+// array must not be empty
+#define array_pop(arr) \
+    ((arr)[_array_pop((arr))])
+
 struct array_data {
     int length;
+    int capacity;
     size_t element_size;
 };
 
 // Create new dynamic array
 void * _array_new(size_t el_size);
 
-// Expand array to have at least given size
+// Expand array to have at least given length
 void * _array_expand(void *arr_s, int new_length);
 
+// Add one element to the end of the array, new element is not initialized
+void * _array_push(void *arr_s);
+
+// Remove the last element from the array, returns index of removed element
+int _array_pop(void *arr_s);
+
 // Free given dynamic array
 void array_free(void *arr_s);
 
-// Get current length of given array (elements allocated)
+// Get current length of given array (highest index used + 1)
 int array_length(void *arr_s);
 
+// Get number of elements array can hold without reallocation
+int array_capacity(void *arr_s);
+
+// Set array length to zero, allocated memory is kept
+void array_clear(void *arr_s);
+
 // Macro for function below
 #define array_strcpy(arr, str, maxlen) \
     ((arr) = _array_strcpy((arr), (str), (maxlen)))
@@ -0,0 +1,38 @@
+#ifndef _INCLUDE_BLOOM_H_
+#define _INCLUDE_BLOOM_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+
+// Number of bits used per expected item and number of hash functions,
+// together they give false positive rate of about 1%
+#define BLOOM_BITS_PER_ITEM 10
+#define BLOOM_N_HASHES 7
+
+// Bloom filter, set membership test which can give false positives but
+// never false negatives, items can't be removed from the filter
+struct bloom {
+    size_t n_items;
+    size_t capacity;
+    size_t n_bits;
+    uint8_t *bits;
+};
+
+// Allocate new bloom filter sized for given number of items
+struct bloom * bloom_new(size_t capacity);
+
+// Free given bloom filter
+void bloom_free(struct bloom *bf);
+
+// Add key to the filter
+void bloom_add(struct bloom *bf, const void *key, size_t key_len);
+
+// Check if key may be in the filter, returns 0 if key was
+// definitely never added and 1 if it might have been
+int bloom_maybe_contains(struct bloom *bf, const void *key, size_t key_len);
+
+// Check if more items than the filter was sized for were added, false
+// positive rate grows quickly from here so filter should be rebuilt
+int bloom_is_full(struct bloom *bf);
+
+#endif
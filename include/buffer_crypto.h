@@ -7,11 +7,27 @@
 
 // Take first len bytes in the given buffer, sign them using provided ed25519
 // private key and add signature to the end of buffer
-int ed25519_buffer_sign(struct evbuffer *buff, size_t len, uint8_t *priv_key);
+int ed25519_buffer_sign(struct evbuffer *buff, size_t len, const uint8_t *priv_key);
+
+// State of ed25519 signature over data which is not available all at once
+struct ed25519_stream;
+
+// Start signing data which is not available all at once, returns NULL on error
+struct ed25519_stream * ed25519_stream_new(const uint8_t *priv_key);
+
+// Add next part of the data to the stream, returns 0 on success
+int ed25519_stream_update(struct ed25519_stream *stream, const void *data, size_t len);
+
+// Sign all data passed to the stream and add signature to the end of
+// given buffer, stream is freed in any case, returns 0 on success
+int ed25519_stream_sign(struct ed25519_stream *stream, struct evbuffer *buff);
+
+// Free given stream without signing the data
+void ed25519_stream_free(struct ed25519_stream *stream);
 
 // Takes last ED25519_SIGNATURE_LEN bytes as a ed25519 signature and validates
 // it against other data using provided ed25519 public key
-int ed25519_buffer_validate(struct evbuffer *buff, size_t len, uint8_t *pub_key);
+int ed25519_buffer_validate(struct evbuffer *buff, size_t len, const uint8_t *pub_key);
 
 enum rsa_buffer_errors {
     RSA_BUFFER_ERR_NONE,
@@ -30,7 +46,7 @@ enum rsa_buffer_errors {
 //  >> DATA IV  (16 bytes)
 //
 // returns rsa buffer error code
-enum rsa_buffer_errors rsa_buffer_encrypt(struct evbuffer *plain, uint8_t *der_pub_key, struct evbuffer *enc, int *enc_len);
+enum rsa_buffer_errors rsa_buffer_encrypt(struct evbuffer *plain, const uint8_t *der_pub_key, struct evbuffer *enc, int *enc_len);
 
 // Takes buffer encrypted by rsa_buffer_encrypt function and decrypts it into plain buffer
 // using provided RSA 2048bit key in DER format, returns rsa buffer error code,
@@ -43,6 +59,6 @@ enum rsa_buffer_errors rsa_buffer_encrypt(struct evbuffer *plain, uint8_t *der_p
 //  >> DATA KEY (AES 256 bytes)
 //  >> DATA IV  (16 bytes)
 //
-enum rsa_buffer_errors rsa_buffer_decrypt(struct evbuffer *enc_buff, uint8_t *der_priv_key, struct evbuffer *plain_buff, int *enc_len);
+enum rsa_buffer_errors rsa_buffer_decrypt(struct evbuffer *enc_buff, const uint8_t *der_priv_key, struct evbuffer *plain_buff, int *enc_len);
 
 #endif
\ No newline at end of file
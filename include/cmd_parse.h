@@ -6,12 +6,15 @@
 // First argument of argv is command name
 typedef void (*cmd_cb)(int argc, char **argv, void *cbarg);
 
-// Array of this structures must be passed as command templates
+// Array of this structures must be passed as command templates, negative
+// arg_cnt means that command takes at least -arg_cnt arguments, when raw
+// is set rest of the line is passed as one argument exactly as it was typed
 struct cmd_template {
     char *name;
     int arg_cnt;
     cmd_cb cb;
     void *cbarg;
+    int raw;
 };
 
 // Returns NULL on success or empty command, returns error string on error
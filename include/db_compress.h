@@ -0,0 +1,40 @@
+#ifndef _INCLUDE_DB_COMPRESS_H_
+#define _INCLUDE_DB_COMPRESS_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+
+// Data shorter than this is never compressed
+#define DB_COMPRESS_MIN_LEN 64
+// Length of the original size header in front of compressed data
+#define DB_COMPRESS_HEADER_LEN 4
+
+// Format of the data stored in the database row
+enum db_compress_format {
+    // Data is stored as is
+    DB_FORMAT_RAW = 0,
+    // Original length followed by zlib stream
+    DB_FORMAT_ZLIB = 1,
+    // Mailbox message container without fields stored elsewhere in the database
+    DB_FORMAT_PACKED = 2,
+};
+
+// Enable or disable compression of newly saved data, data which
+// is already stored is always readable regardless of this setting
+void db_compress_set_enabled(int enabled);
+
+// Check if compression of newly saved data is enabled
+int db_compress_is_enabled(void);
+
+// Compress given data, returns newly allocated buffer and stores it's length
+// in out_len, returns NULL if compression is disabled or it would not make data smaller
+uint8_t * db_compress(const void *data, size_t len, size_t *out_len);
+
+// Get the original length of data compressed with db_compress
+size_t db_compress_original_len(const uint8_t *data, size_t len);
+
+// Decompress data compressed with db_compress into dest which must hold
+// original length bytes, returns 0 on success and 1 if data is corrupted
+int db_decompress(const uint8_t *data, size_t len, void *dest);
+
+#endif
@@ -44,6 +44,24 @@ struct db_contact {
     uint8_t remote_enc_key_pub[CLIENT_ENC_KEY_PUB_LEN];
 };
 
+// Lightweight projection of the contact used by list views, it has no keys,
+// full contact with keys is fetched by ID only when it's actually needed
+struct db_contact_summary {
+    int id;
+    enum db_contact_status status;
+    int deleted;
+    int has_mailbox;
+    char onion_address[ONION_ADDRESS_LEN + 1];
+    // Conversation state, kept up to date by database triggers
+    int last_message_id;
+    int n_unread;
+    int n_undelivered;
+    int64_t last_activity;
+    // Nickname is allocated together with the summary to fit exactly
+    int nickname_len;
+    char nickname[];
+};
+
 // Create new empty contact object
 struct db_contact * db_contact_new(void);
 
@@ -51,10 +69,12 @@ struct db_contact * db_contact_new(void);
 // you must first do so using save function
 void db_contact_free(struct db_contact *cont);
 
-// Save given contact to database
+// Save given contact to database, existing contacts only get changed columns updated,
+// when there is no stored copy in the directory of given connection every column is written
 void db_contact_save(sqlite3 *db, struct db_contact *cont);
 
-// Delete given contact
+// Delete given contact, it's marked as deleted right away and removed
+// together with all it's messages by background job
 void db_contact_delete(sqlite3 *db, struct db_contact *cont);
 
 // Pull new data from the database
@@ -70,6 +90,24 @@ struct db_contact * db_contact_get_by_onion(sqlite3 *db, const char *onion_addre
 // Get contact by ther remote signing key public
 struct db_contact * db_contact_get_by_rsk_pub(sqlite3 *db, uint8_t *key, struct db_contact *dest);
 
+// Contacts are also kept in the in-memory directory, functions below return
+// shared read-only references into it instead of copies, NULL when not found.
+// References stay valid until the contact is deleted or the directory is
+// cleared, changes made by db_contact_save() are visible through them.
+// Each connection has it's own directory, changes made through other connections
+// are picked up on the next lookup and references are updated in place
+
+// Get shared reference to contact by their local ID
+const struct db_contact * db_contact_ref_by_pk(sqlite3 *db, int id);
+// Get shared reference to contact by ther onion address
+const struct db_contact * db_contact_ref_by_onion(sqlite3 *db, const char *onion_address);
+// Get shared reference to contact by ther remote signing key public
+const struct db_contact * db_contact_ref_by_rsk_pub(sqlite3 *db, const uint8_t *key);
+
+// Drop in-memory contact directories of all connections, they will be reloaded on the next
+// lookup, directories of closed connections must be dropped before connection is opened again
+void db_contact_dir_clear(void);
+
 // Get all contacts from the db, they are returned as array of
 // pointers to contacts, n will be set to length of the array, if there are no
 // contacts in the db NULL is returned
@@ -78,6 +116,16 @@ struct db_contact ** db_contact_get_all(sqlite3 *db, int *n);
 // Free contact list fetched using db_contact_get_all()
 void db_contact_free_all(struct db_contact **conts, int n);
 
+// Get summaries of all contacts from the db, n will be set to length
+// of the array, if there are no contacts in the db NULL is returned
+struct db_contact_summary ** db_contact_get_summaries(sqlite3 *db, int *n);
+
+// Free summary list fetched using db_contact_get_summaries()
+void db_contact_free_summaries(struct db_contact_summary **conts, int n);
+
+// Mark all messages from given contact as read
+void db_contact_mark_read(sqlite3 *db, int contact_id);
+
 // Extract public key from stored onion address
 void db_contact_onion_extract_key(struct db_contact *cont);
 
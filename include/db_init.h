@@ -20,4 +20,7 @@ void db_init_global(const char *db_file_path);
 // Create database schema
 void db_init_schema(sqlite3 *db);
 
+// Create tables of mailbox data only, used for mailbox storage shards
+void db_init_mailbox_schema(sqlite3 *db);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,30 @@
+#ifndef _INCLUDE_DB_JOB_H_
+#define _INCLUDE_DB_JOB_H_
+
+#include <sqlite3.h>
+
+// Maximal number of rows removed by one run of a deletion job
+#define DB_JOB_CHUNK_SIZE 256
+
+enum db_job_kind {
+    DB_JOB_DELETE_CONTACT    = 1, // Client contact and all it's messages
+    DB_JOB_DELETE_MB_ACCOUNT = 2, // Mailbox account, it's contacts and messages
+};
+
+/**
+ * Background deletion jobs, deleting a contact or a mailbox account with long
+ * history in one statement would hold the write lock and block the event loop
+ * for a long time. Instead job is stored in delete_jobs table and rows are
+ * removed in chunks of DB_JOB_CHUNK_SIZE, children first, so cascades have
+ * nothing left to do when the row itself is deleted. Jobs are kept in the
+ * database until done, so they are resumed after a restart. Contact deletion
+ * is canceled if contact is restored (deleted flag removed) before it's done.
+ */
+
+// Add new deletion job, object should already be hidden from lookups
+void db_job_add(sqlite3 *db, enum db_job_kind kind, int target_id);
+
+// Run one chunk of the oldest job, returns 1 if there is more work to do
+int db_job_run(sqlite3 *db);
+
+#endif
@@ -22,7 +22,8 @@ void db_mb_account_free(struct db_mb_account *acc);
 // Save changes on given object to the database
 void db_mb_account_save(sqlite3 *db, struct db_mb_account *acc);
 
-// Delete given malilbox account from the database
+// Delete given account, it's hidden from lookups right away and it's rows
+// together with all contacts and messages are removed by background job
 void db_mb_account_delete(sqlite3 *db, struct db_mb_account *acc);
 
 // Pull new data from the database
@@ -34,7 +35,10 @@ void db_mb_account_refresh(sqlite3 *db, struct db_mb_account *acc);
 // Get mailbox account by id
 struct db_mb_account * db_mb_account_get_by_pk(sqlite3 *db, int id, struct db_mb_account *dest);
 
-// Get mailbox account by unique mailbox id
+// Get mailbox account by unique mailbox id, accounts found are kept in memory
 struct db_mb_account * db_mb_account_get_by_mbid(sqlite3 *db, uint8_t *mbid, struct db_mb_account *dest);
 
+// Drop all cached accounts
+void db_mb_account_cache_clear(void);
+
 #endif
\ No newline at end of file
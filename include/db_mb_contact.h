@@ -35,8 +35,15 @@ void db_mb_contact_refresh(sqlite3 *db, struct db_mb_contact *cont);
 // Get mailbox contact by id
 struct db_mb_contact * db_mb_contact_get_by_pk(sqlite3 *db, int id, struct db_mb_contact *dest);
 
-// Get mailbox contact by associated account and signing key
+// Get mailbox contact by associated account and signing key, all contacts
+// of the account are kept in memory after the first lookup
 struct db_mb_contact * db_mb_contact_get_by_acc_and_key(
     sqlite3 *db, struct db_mb_account *acc, uint8_t *key, struct db_mb_contact *dest);
 
+// Forget cached contacts of given account, they are loaded again on the next lookup
+void db_mb_contact_auth_drop(sqlite3 *db, int account_id);
+
+// Drop the whole authorization index
+void db_mb_contact_auth_clear(void);
+
 #endif
\ No newline at end of file
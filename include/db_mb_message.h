@@ -3,11 +3,18 @@
 
 #include <stdint.h>
 #include <sqlite3.h>
+#include <event2/buffer.h>
 #include <db_message.h>
 #include <db_mb_account.h>
 #include <constants.h>
+#include <arena.h>
 
 #define DB_MB_MESSAGE_CHUNK_SIZE 63
+// Limits of the in-memory queue of recently stored messages, per account and in total
+#define DB_MB_MESSAGE_HOT_ACCOUNT_MAX 128
+#define DB_MB_MESSAGE_HOT_MAX_BYTES (16 * 1024 * 1024)
+// Minimal number of messages global ID filter of one account is sized for
+#define DB_MB_MESSAGE_GID_FILTER_MIN 256
 
 struct db_mb_message {
     int id;
@@ -15,11 +22,35 @@ struct db_mb_message {
     int contact_id;
     uint8_t global_id[MESSAGE_ID_LEN];
 
+    // Whole message container as received from the client, when compression
+    // is enabled fields which are already stored in account and contact
+    // tables are left out of the database row and restored on read
     uint8_t *data;
     int data_len;
     int data_n_chunks;
+
+    // Messages fetched by get_stream_batch have no data loaded, data_len is
+    // still full container length and data is read from the database only
+    // when it's streamed, for packed data mailbox id and signing key needed
+    // to restore it are kept in data_pack_fields
+    int data_format;
+    uint8_t *data_pack_fields;
+
+    // Arena message memory was allocated from, NULL if message owns it's memory
+    struct arena *arena;
+};
+
+// Result of bulk read, all messages and their data are
+// allocated from one arena and released together
+struct db_mb_message_batch {
+    int n_msgs;
+    struct db_mb_message **msgs;
+    struct arena *arena;
 };
 
+// Called for data of every message while batch is streamed, before data is added to the buffer
+typedef void (*db_mb_message_stream_cb)(const uint8_t *data, size_t len, void *cbarg);
+
 // Create new empty mailbox message object
 struct db_mb_message * db_mb_message_new(void);
 
@@ -33,6 +64,11 @@ void db_mb_message_set_data(struct db_mb_message *msg, const uint8_t *data, int
 // Save changes on given object to database
 void db_mb_message_save(sqlite3 *db, struct db_mb_message *msg);
 
+// Store message container from given buffer as a new message of given account and contact,
+// data is written straight from the buffer memory into the database, returns id of the message
+int db_mb_message_store(
+    sqlite3 *db, int account_id, int contact_id, const uint8_t *gid, struct evbuffer *data);
+
 // Delete given message from the database
 void db_mb_message_delete(sqlite3 *db, struct db_mb_message *msg);
 
@@ -46,10 +82,43 @@ struct db_mb_message * db_mb_message_get_by_pk(sqlite3 *db, int id, struct db_mb
 struct db_mb_message * db_mb_message_get_by_acc_and_gid(
     sqlite3 *db, struct db_mb_account *acc, uint8_t *gid, struct db_mb_message *dest);
 
+// Check if message with given global id is stored for given account
+int db_mb_message_exists(sqlite3 *db, struct db_mb_account *acc, const uint8_t *gid);
+
 // Get all mailbox messages for given account
 struct db_mb_message ** db_mb_message_get_all(sqlite3 *db, struct db_mb_account *acc, int *n);
 
 // Free list of messages returned by get_all
 void db_mb_message_free_all(struct db_mb_message **msgs, int n);
 
+// Get all mailbox messages for given account into a batch, messages
+// belong to the batch and must not be freed one by one
+struct db_mb_message_batch * db_mb_message_get_batch(sqlite3 *db, struct db_mb_account *acc);
+
+// Get all mailbox messages for given account into a batch without reading
+// their data, data is read later by db_mb_message_stream_batch
+struct db_mb_message_batch * db_mb_message_get_stream_batch(sqlite3 *db, struct db_mb_account *acc);
+
+// Add data of all messages in the batch to given buffer, data which is not loaded is read
+// from the database straight into buffer memory, if cb is not NULL it is called for data
+// of every message, returns 1 if some message was deleted or changed since the batch was
+// fetched, buffer then holds only part of the data, otherwise 0
+int db_mb_message_stream_batch(
+    sqlite3 *db, struct db_mb_message_batch *batch,
+    struct evbuffer *buff, db_mb_message_stream_cb cb, void *cbarg);
+
+// Free given batch and all messages in it
+void db_mb_message_batch_free(struct db_mb_message_batch *batch);
+
+// Drop in-memory global ID filters of all connections, they will be rebuilt on the next lookup,
+// filters of closed connections must be dropped before connection is opened again
+void db_mb_message_gid_filter_clear(void);
+
+// Stop tracking messages of given account, must be called when account
+// messages are removed other than by db_mb_message_delete
+void db_mb_message_hot_drop(sqlite3 *db, int account_id);
+
+// Drop hot queues of all accounts, they are filled again as messages are stored
+void db_mb_message_hot_clear(void);
+
 #endif
\ No newline at end of file
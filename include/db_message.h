@@ -5,8 +5,13 @@
 #include <db_contact.h>
 #include <stdint.h>
 #include <constants.h>
+#include <arena.h>
 
 #define DB_MESSAGE_TEXT_CHUNK 32
+// Texts shorter than this are stored inside the message structure
+#define DB_MESSAGE_TEXT_INLINE 40
+// Minimal number of messages global ID filter is sized for
+#define DB_MESSAGE_GID_FILTER_MIN 1024
 
 enum db_message_types {
     DB_MESSAGE_TEXT = 0x01,
@@ -45,28 +50,96 @@ struct db_message {
     enum db_message_types type;
     uint8_t global_id[MESSAGE_ID_LEN];
 
-    char *body_text;
-    int body_text_len;
-    int body_text_n_chunks;
-
-    int body_nick_len;
-    char body_nick[CLIENT_NICK_MAX_LEN];
+    // Column values as they were when message was last fetched or saved,
+    // update only writes columns which changed since then
+    struct {
+        int contact_id;
+        uint8_t sender;
+        uint8_t status;
+        uint8_t type;
+        uint8_t global_id[MESSAGE_ID_LEN];
+    } saved;
+    // Set when text body is changed, other bodies are only written when
+    // message is inserted or it's type changes
+    int body_dirty;
+
+    // Arena message memory was allocated from, NULL if message owns it's memory
+    struct arena *arena;
+
+    // Only the body matching the message type is valid, messages allocated
+    // from an arena only have room for that body (see db_message_size)
+    union {
+        // DB_MESSAGE_TEXT
+        struct {
+            // Use db_message_get_text to read the text, it may not be
+            // decompressed yet when message is fetched from the database
+            char *body_text;
+            int body_text_len;
+            int body_text_n_chunks;
+
+            // Text in the form it is stored in the database, NULL if not compressed
+            uint8_t *body_packed;
+            int body_packed_len;
+
+            // Short texts are stored here and body_text points to it
+            char body_text_inline[DB_MESSAGE_TEXT_INLINE];
+        };
+
+        // DB_MESSAGE_NICK
+        struct {
+            int body_nick_len;
+            char body_nick[CLIENT_NICK_MAX_LEN];
+        };
+
+        // DB_MESSAGE_RECV
+        uint8_t body_recv_id[MESSAGE_ID_LEN];
+
+        // DB_MESSAGE_MBOX
+        struct {
+            uint8_t body_mbox_id[MAILBOX_ID_LEN];
+            uint8_t body_mbox_onion[ONION_ADDRESS_LEN + 1];
+        };
+    };
+};
 
-    uint8_t body_recv_id[MESSAGE_ID_LEN];
+// Outbox state of one contact, all undelivered messages of the contact
+// are retried together over one connection
+struct db_message_outbox {
+    int contact_id;
+    // Highest number of failed delivery attempts
+    int attempts;
+    // Unix time when messages should be sent again
+    int64_t next_attempt;
+};
 
-    uint8_t body_mbox_id[MAILBOX_ID_LEN];
-    uint8_t body_mbox_onion[ONION_ADDRESS_LEN + 1];
+// Result of bulk read, all messages and their text bodies are
+// allocated from one arena and released together
+struct db_message_batch {
+    int n_msgs;
+    struct db_message **msgs;
+    struct arena *arena;
 };
 
-// Create new empty message object
+// Create new empty message object, it has room for body of any type
 struct db_message * db_message_new(void);
+
+// Get number of bytes needed for message with body of given type
+size_t db_message_size(enum db_message_types type);
 // Free given message object, note that if you want to save changes you
 // made to the object you must first save it
 void db_message_free(struct db_message *msg);
 
-// Save all message data into database
+// Save message into database, existing messages only get changed columns updated
 void db_message_save(sqlite3 *db, struct db_message *msg);
 
+// Remember current column values as stored, so next save only updates what changed,
+// use it when message row was changed in the database without saving the object
+void db_message_mark_saved(struct db_message *msg);
+
+// Set status of all messages with given global IDs (n_gids IDs stored one after
+// another) using single transaction, in-memory messages are not updated
+void db_message_set_status_by_gids(sqlite3 *db, const uint8_t *gids, int n_gids, enum db_message_status status);
+
 // Delete given message
 void db_message_delete(sqlite3 *db, struct db_message *msg);
 
@@ -76,6 +149,13 @@ void db_message_refresh(sqlite3 *db, struct db_message *msg);
 // Write text_len characters of text into message text body
 void db_message_set_text(struct db_message *msg, const char *text, int text_len);
 
+// Get message text, compressed text is decompressed on first access
+const char * db_message_get_text(struct db_message *msg);
+
+// Register SQL functions used by message search index triggers on given connection,
+// every connection which writes messages must register them
+void db_message_register_functions(sqlite3 *db);
+
 // Generate random global message ID
 void db_message_gen_id(struct db_message *msg);
 
@@ -92,9 +172,37 @@ struct db_message * db_message_get_last(sqlite3 *db, struct db_contact *cont, st
 struct db_message * db_message_get_before(sqlite3 *db, struct db_message *current_msg, struct db_message *dest);
 
 // Fetch the list of messages for given contact with given status
-struct db_message ** db_message_get_all(sqlite3 *db, struct db_contact *cont, enum db_message_status status, int *n_msgs);
+struct db_message ** db_message_get_all(sqlite3 *db, const struct db_contact *cont, enum db_message_status status, int *n_msgs);
 
 // Free previously fetched message list
 void db_message_free_all(struct db_message **msgs, int n_msgs);
 
+// Fetch messages for given contact with given status into a batch, messages
+// belong to the batch and must not be freed one by one
+struct db_message_batch * db_message_get_batch(sqlite3 *db, const struct db_contact *cont, enum db_message_status status);
+
+// Free given batch and all messages in it
+void db_message_batch_free(struct db_message_batch *batch);
+
+// Fetch outbox state of all active contacts which have undelivered messages that
+// already failed to be delivered at least once, earliest next attempt comes first
+struct db_message_outbox * db_message_outbox_get(sqlite3 *db, int *n);
+
+// Count failed delivery attempt for given messages (n_ids IDs) which are still
+// undelivered, returns new highest number of attempts among them or 0 if all
+// of them were delivered in the meantime
+int db_message_outbox_failed(sqlite3 *db, const int *ids, int n_ids);
+
+// Set time of the next delivery attempt for given messages (n_ids IDs)
+// which are still undelivered
+void db_message_outbox_delay(sqlite3 *db, const int *ids, int n_ids, int64_t next_attempt);
+
+// Drop in-memory global ID filters of all connections, they will be rebuilt on the next lookup,
+// filters of closed connections must be dropped before connection is opened again
+void db_message_gid_filter_clear(void);
+
+// Search text messages using the full text index, returns batch with
+// at most limit messages, best matches come first
+struct db_message_batch * db_message_search(sqlite3 *db, const char *text, int limit);
+
 #endif
\ No newline at end of file
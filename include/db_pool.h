@@ -0,0 +1,39 @@
+#ifndef _INCLUDE_DB_POOL_H_
+#define _INCLUDE_DB_POOL_H_
+
+#include <sqlite3.h>
+
+// Number of read only connections opened by default
+#define DB_POOL_READERS 2
+// Maximal number of read only connections
+#define DB_POOL_MAX_READERS 8
+// How long connection waits for a lock before giving up (ms)
+#define DB_POOL_BUSY_TIMEOUT 5000
+
+/**
+ * Database access layer, application opens one connection which is used for
+ * all writes and pool opens a few read only connections to the same database
+ * file. Database is switched to WAL mode so readers never wait for the writer
+ * and the other way around. Model functions which only read pass their
+ * connection to db_pool_reader and run the query on the returned one.
+ */
+struct db_pool {
+    sqlite3 *writer;
+
+    int n_readers;
+    int next_reader;
+    sqlite3 *readers[DB_POOL_MAX_READERS];
+};
+
+// Open n_readers read only connections to database file opened by
+// given writer connection and switch database into WAL mode
+void db_pool_init(sqlite3 *writer, const char *db_file_path, int n_readers);
+
+// Get connection read only query should be run on, if given connection
+// has no pool or it's in the middle of transaction it is returned
+sqlite3 * db_pool_reader(sqlite3 *db);
+
+// Close all read only connections of given writer
+void db_pool_close(sqlite3 *writer);
+
+#endif
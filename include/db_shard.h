@@ -0,0 +1,45 @@
+#ifndef _INCLUDE_DB_SHARD_H_
+#define _INCLUDE_DB_SHARD_H_
+
+#include <stdint.h>
+#include <sqlite3.h>
+
+// Maximal number of database files mailbox data is split into
+#define DB_SHARD_MAX 16
+// Row IDs of mailbox tables in shard N start at N << DB_SHARD_ID_BITS, so
+// IDs are unique across shards and shard of each row is known from it's ID
+#define DB_SHARD_ID_BITS 27
+// Last row ID of shard with given index, inserts past it fail since with
+// DB_SHARD_MAX shards last ID of the last shard is INT_MAX
+#define DB_SHARD_ID_LAST(index) ((((sqlite3_int64)(index) + 1) << DB_SHARD_ID_BITS) - 1)
+
+/**
+ * Mailbox storage shards, mailbox accounts, their contacts and messages can be
+ * split over multiple database files. Account is placed into shard chosen by
+ * hash of it's mailbox ID and all it's contacts and messages are stored in the
+ * same file. Shard 0 is the main database, others are stored next to it in
+ * files named <database>.<shard>. Mailbox model functions are called with the
+ * main connection and route queries to the right shard themselves.
+ */
+struct db_shard {
+    sqlite3 *db;
+
+    int n_shards;
+    sqlite3 *shards[DB_SHARD_MAX];
+};
+
+// Split mailbox data of given main connection into n_shards files, number of shards
+// can't be changed after mailbox data is created, returns 1 if it doesn't match
+// number of shards database was created with, otherwise 0
+int db_shard_init(sqlite3 *db, const char *db_file_path, int n_shards);
+
+// Get connection to the shard mailbox with given mailbox ID is stored in
+sqlite3 * db_shard_by_mbid(sqlite3 *db, const uint8_t *mbid);
+
+// Get connection to the shard row with given ID is stored in
+sqlite3 * db_shard_by_id(sqlite3 *db, int id);
+
+// Close all shards of given main connection
+void db_shard_close(sqlite3 *db);
+
+#endif
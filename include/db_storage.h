@@ -0,0 +1,35 @@
+#ifndef _INCLUDE_DB_STORAGE_H_
+#define _INCLUDE_DB_STORAGE_H_
+
+#include <sqlite3.h>
+
+/**
+ * Database storage modes, all data always goes through sqlite and storage
+ * mode only decides where sqlite keeps it. File mode keeps databases in files
+ * on disk, memory mode opens each database as private sqlite :memory:
+ * database so nothing survives a restart, it's meant for ephemeral mailboxes
+ * and for measuring protocol and crypto throughput without the disk. This is
+ * not an abstraction over sqlite, model functions still run SQL directly.
+ * Connections of the main database, pool and shards are all opened here.
+ */
+struct db_storage {
+    const char *name;
+
+    // Open new connection to the database at given path
+    sqlite3 * (*open)(const char *db_file_path);
+    // Set if more than one connection can be opened to the same
+    // database, if not pool readers are not used
+    int shared;
+};
+
+// Select storage mode with given name, returns 1 if there is no such mode
+int db_storage_select(const char *name);
+
+// Get selected storage mode
+const struct db_storage * db_storage_get(void);
+
+// Open new connection to the database at given path using selected storage mode,
+// SQL functions used by schema triggers are registered on it
+sqlite3 * db_storage_open(const char *db_file_path);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef _INCLUDE_HASH_TABLE_H_
+#define _INCLUDE_HASH_TABLE_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+
+// Initial number of buckets, table is doubled when it gets too full
+#define HASH_TABLE_INITIAL_SIZE 16
+
+struct hash_table_node;
+
+// Callback called for every element in the table
+typedef void (*hash_table_cb)(const void *key, size_t key_len, void *value, void *cbarg);
+
+struct hash_table {
+    int length;
+    int n_buckets;
+
+    struct hash_table_node **buckets;
+};
+
+// Allocate new hash table
+struct hash_table * hash_table_new(void);
+
+// Free given hash table and all it's nodes, values are not freed
+void hash_table_free(struct hash_table *ht);
+
+// Calculate hash of given key (FNV-1a)
+uint64_t hash_table_hash(const void *key, size_t key_len);
+
+// Insert value under given key, key is copied, if key already
+// exists it's value will be replaced
+void hash_table_set(struct hash_table *ht, const void *key, size_t key_len, void *value);
+
+// Get value stored under given key, returns NULL if not found
+void * hash_table_get(struct hash_table *ht, const void *key, size_t key_len);
+
+// Remove given key from the table, returns 0 on success and 1 if not found
+int hash_table_remove(struct hash_table *ht, const void *key, size_t key_len);
+
+// Call given callback for each element in the table, table
+// must not be modified while iterating
+void hash_table_foreach(struct hash_table *ht, hash_table_cb cb, void *cbarg);
+
+// Get the number of elements in the table
+int hash_table_get_length(struct hash_table *ht);
+
+#endif
@@ -1,35 +1,69 @@
 #ifndef _INCLUDE_HOOKS_H_
 #define _INCLUDE_HOOKS_H_
 
+#include <event2/event.h>
+
+// Number of event buckets in a hook list, must be a power of two
+#define HOOK_LIST_BUCKETS 16
+
 // Callback called when event occurs
 typedef void (*hook_callback)(int event_type, void *data, void *cbarg);
 
+// Called to free event data once deferred dispatch is done
+typedef void (*hook_data_free)(void *data);
+
 // Hook data (used internally)
 struct hook {
     void *cbarg;        // User provided callback argument
     hook_callback cb;   // Callback function
     int hook_event;     // Event for which callback should be called
-    struct hook *next;  // Next hook in the list
+    int removed;        // Hook removed during dispatch, freed afterwards
+    struct hook *next;  // Next hook in the bucket
 };
 
-// List of hooks handled by an object
-struct hook_list {
+// Hooks for events which map to the same bucket
+struct hook_bucket {
     struct hook *head;
+    struct hook *tail;
+};
+
+// List of hooks handled by an object, hooks are grouped by event
+// so dispatch only visits hooks in the bucket of the given event
+struct hook_list {
+    struct hook_bucket buckets[HOOK_LIST_BUCKETS];
+
+    int dispatching;    // Number of hook_list_call calls in progress
+    int n_removed;      // Number of hooks waiting to be freed
+    int n_deferred;     // Number of deferred calls not dispatched yet
+    int free_pending;   // List should be freed once it's not in use
 };
 
 // Create new hook list to handle hooks
 struct hook_list * hook_list_new(void);
 
-// Free the hook list and all it's hooks
+// Free the hook list and all it's hooks, if list is being dispatched or
+// has deferred calls pending it is freed once they are done
 void hook_list_free(struct hook_list *list);
 
 // Add new hook to the hook list
 void hook_add(struct hook_list *list, int hevent, hook_callback cb, void *cbarg);
 
-// Remove hook with given data from the list
+// Remove hook with given data from the list, can be called from
+// inside of a hook callback
 void hook_remove(struct hook_list *list, int hevent, hook_callback cb, void *cbarg);
 
 // Call all hooks for given event
 void hook_list_call(struct hook_list *list, int hevent, void *data);
 
+// Call all hooks for given event from the event loop instead of the current
+// callback, list takes the ownership of data and frees it using free_cb, if
+// list is freed before the call is dispatched hooks are not called
+void hook_list_call_deferred(
+    struct hook_list *list,
+    struct event_base *base,
+    int hevent,
+    void *data,
+    hook_data_free free_cb
+);
+
 #endif
\ No newline at end of file
@@ -50,6 +50,7 @@ enum prot_status_codes {
     PROT_ERR_INVALID_MSG,
     PROT_ERR_UNEXPECTED_MSG,
     PROT_ERR_TRANSACTION,
+    PROT_ERR_SETUP,
 };
 
 enum prot_main_events {
@@ -156,7 +157,8 @@ void prot_main_free_on_done(struct prot_main *pmain, int yes);
 void prot_main_recv_done(struct prot_main *pmain);
 
 // Connect to given TOR client socks server and try to contact
-// deep messenger instance on given onion address
+// deep messenger instance on given onion address, every address
+// socks server resolves to is tried until connect succeeds
 void prot_main_connect(
     struct prot_main *pmain,
     const char *onion_address,
@@ -165,6 +167,16 @@ void prot_main_connect(
     const char *socks_server_port
 );
 
+// Same as prot_main_connect but socks server address is already resolved,
+// connect request is sent together with socks greeting
+void prot_main_connect_addr(
+    struct prot_main *pmain,
+    const char *onion_address,
+    const char *onion_port,
+    const struct sockaddr *socks_addr,
+    int socks_addr_len
+);
+
 // Assign protocol connection handler to given bufferevent
 void prot_main_assign(struct prot_main *pmain, struct bufferevent *bev);
 
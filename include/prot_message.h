@@ -27,7 +27,12 @@ struct prot_message {
     struct db_message *client_msg;
     struct db_contact *client_cont;
 
-    struct db_mb_message *mailbox_msg;
+    // Container received by the mailbox, it's moved out of the input
+    // buffer and stored once acknowledgement is sent
+    struct evbuffer *mailbox_data;
+    int mailbox_account_id;
+    int mailbox_contact_id;
+    uint8_t mailbox_gid[MESSAGE_ID_LEN];
 
     struct prot_tran_handler htran;
     struct prot_recv_handler hrecv;
@@ -26,7 +26,12 @@ struct prot_message_list {
     sqlite3 *db;
     enum prot_message_list_from from;
 
-    struct db_contact *client_cont;
+    // Shared reference from the contact directory
+    const struct db_contact *client_cont;
+
+    // Batches owned by the handler, messages below point into them
+    struct db_message_batch *client_batch;
+    struct db_mb_message_batch *mailbox_batch;
 
     int n_client_msgs;
     struct db_message **client_msgs;
@@ -37,18 +42,20 @@ struct prot_message_list {
     struct prot_recv_handler hrecv;
 };
 
-// Allocate new message list handler (when in the client mode)
+// Allocate new message list handler (when in the client mode), handler
+// takes ownership of given batch, batch can be NULL
 struct prot_message_list * prot_message_list_client_new(
-    sqlite3 *db, struct db_contact *cont, struct db_message **msgs, int n_msgs);
+    sqlite3 *db, const struct db_contact *cont, struct db_message_batch *batch);
 
-// Allocate new message list handler (when in the mailbox mode)
-struct prot_message_list * prot_message_list_mailbox_new(sqlite3 *db, struct db_mb_message **msgs, int n_msgs);
+// Allocate new message list handler (when in the mailbox mode), handler
+// takes ownership of given batch, batch can be NULL
+struct prot_message_list * prot_message_list_mailbox_new(sqlite3 *db, struct db_mb_message_batch *batch);
 
 // When creating message receive handler use this function to set where is the
 // message list comming from, is it from CLIENT or the MAILBOX, this is irelevant for transmission
 void prot_message_list_from(struct prot_message_list *msg, enum prot_message_list_from from);
 
-// Free given message list handler and messages given to new method
+// Free given message list handler and batch given to new method
 void prot_message_list_free(struct prot_message_list *msg);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef _INCLUDE_PROT_POOL_H_
+#define _INCLUDE_PROT_POOL_H_
+
+#include <stdlib.h>
+#include <event2/buffer.h>
+
+// Maximum number of idle evbuffers kept for reuse
+#define PROT_POOL_MAX_BUFFERS 64
+// Maximum number of idle objects kept by a single object pool
+#define PROT_POOL_MAX_OBJECTS 32
+
+// Pool of free objects of the same size, used for handler objects
+// which are allocated for every protocol message
+struct prot_pool {
+    size_t obj_size;
+    int n_free;
+    void *free[PROT_POOL_MAX_OBJECTS];
+};
+
+// Static initializer for pool of objects of given type
+#define PROT_POOL_INIT(type) \
+    { sizeof(type), 0, { NULL } }
+
+// Get an empty evbuffer, pooled one is reused if available
+struct evbuffer * prot_pool_buffer_get(void);
+
+// Empty given evbuffer and return it to the pool, buffer is freed if
+// pool is already full, does nothing if buff is NULL
+void prot_pool_buffer_put(struct evbuffer *buff);
+
+// Free all idle evbuffers held by the pool
+void prot_pool_buffer_clear(void);
+
+// Get zeroed object from given pool, new one is allocated if pool is empty
+void * prot_pool_alloc(struct prot_pool *pool, const char *error_str);
+
+// Return object to given pool, object is freed if pool is already full,
+// does nothing if obj is NULL
+void prot_pool_release(struct prot_pool *pool, void *obj);
+
+#endif
\ No newline at end of file
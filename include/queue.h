@@ -2,28 +2,33 @@
 #define _INCLUDE_QUEUE_H_
 
 #include <stdlib.h>
+#include <stdint.h>
 
-struct queue_node;
+// Initial number of items queue can hold, storage is doubled when full
+#define QUEUE_INITIAL_CAPACITY 8
 
+// Items are stored inline in a circular buffer, pointers returned by
+// queue_peek are valid only until the next enqueue into the same queue
 struct queue {
     int length;
     size_t item_size;
 
-    struct queue_node *rear;
-    struct queue_node *front;
+    int front;
+    int capacity;
+    uint8_t *items;
 };
 
 // Allocate new queue
 struct queue * queue_new(size_t item_size);
 
-// Free given queue and all it's elements (nodes)
+// Free given queue and all it's elements
 void queue_free(struct queue *q);
 
 // Insert given data into queue
 void queue_enqueue(struct queue *q, void *data);
 
 // Read data from queue to data, if data is NULL
-// queue node will be deleted, returns 0 on success and 1 on failure
+// front element is just removed, returns 0 on success and 1 on failure
 int queue_dequeue(struct queue *q, void *data);
 
 // Get a pointer to the queue element at given index
@@ -56,6 +56,7 @@ struct socks5_data {
 
     enum socks5_step step;       // Current step in connection process
     socks5_done_cb done_cb;      // Callback to call when done (or when failed)
+    int optimistic;              // Connect request sent together with greeting
 
     uint16_t port;                                // Port to connect to
     uint8_t onion_address[ONION_ADDRESS_LEN];  // Onion address to connect to
@@ -71,6 +72,17 @@ void socks5_connect_onion(
     void *attr
 );
 
+// Same as socks5_connect_onion, but connect request is sent right after
+// the method selection without waiting for the server to reply, both
+// replies are then handled in order, this saves one round trip
+void socks5_connect_onion_optimistic(
+    struct bufferevent *buffev,
+    const uint8_t *onion_address,
+    uint16_t port,
+    socks5_done_cb done_cb,
+    void *attr
+);
+
 // Convert socks error code to human readable error
 const char * socks5_error_string(enum socks5_errors err_code);
 
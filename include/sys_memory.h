@@ -25,4 +25,31 @@ void * safe_malloc(size_t chunk_size, const char *error_str);
 // Reallocate memory and exit program on fail
 void * safe_realloc(void * ptr, size_t chunk_size, const char *error_str);
 
+// Maximum number of allocation tags tracked separately by the profiler,
+// allocations with other tags are counted under one shared tag
+#define SYS_MEMSTAT_MAX_TAGS 1024
+
+// Allocation statistics for one tag (error string given to safe_malloc)
+struct sys_memstat {
+    const char *tag;        // Tag allocations are counted under
+    size_t live_bytes;      // Bytes currently allocated
+    size_t peak_bytes;      // Highest number of bytes allocated at once
+    long live_count;        // Number of allocations not freed yet
+    long n_allocs;          // Total number of allocations
+    double alloc_rate;      // Allocations per second since previous report
+};
+
+// Called for every allocation tag by sys_memstat_foreach
+typedef void (*sys_memstat_cb)(const struct sys_memstat *stat, void *cbarg);
+
+// Returns 1 if app is built with allocation profiler (make MEMSTAT=1)
+int sys_memstat_enabled(void);
+
+// Call cb for each allocation tag, ordered by live bytes, and start
+// a new allocation rate window, does nothing if profiler is disabled
+void sys_memstat_foreach(sys_memstat_cb cb, void *cbarg);
+
+// Format given statistics as a single line of text
+void sys_memstat_format(const struct sys_memstat *stat, char *dest, size_t dest_len);
+
 #endif
@@ -9,6 +9,7 @@
 #include <prot_client_fetch.h>
 #include <prot_mb_fetch.h>
 #include <prot_transaction.h>
+#include <sys_memory.h>
 #include <debug.h>
 #include <app.h>
 
@@ -43,6 +44,10 @@ static void hook_message(int ev, void *data, void *cbarg) {
             app_ui_chat_refresh(app, 0);
         if (msg->type == DB_MESSAGE_RECV)
             app_ui_chat_refresh(app, 1);
+    } else if (msg->type == DB_MESSAGE_TEXT) {
+        // Show new unread count next to the contact
+        app_update_contact_counts(app);
+        ui_stack_redraw(app->ui.stack);
     }
 
     debug("GOT NEW MESSAGE => REFRESH DONE");
@@ -116,14 +121,27 @@ static void hook_contact_sync(int ev, void *data, void *cbarg) {
         app_update_contacts(app);
         ui_stack_redraw(app->ui.stack);
         app_ui_info(app, "[Message] Your friend [%s] changed their nickname, refreshing UI", cont->nickname);
+    } else {
+        app_update_contact_counts(app);
+        ui_stack_redraw(app->ui.stack);
     }
     db_contact_free(cont);
 }
 
 // Sync messages with given contact
 void app_contact_sync(struct app_data *app, struct db_contact *cont) {
+    app_contact_sync_notify(app, cont, NULL, NULL);
+}
+
+// Same as app_contact_sync, done_cb is called with cbarg once
+// the connection is done or closed
+void app_contact_sync_notify(struct app_data *app, struct db_contact *cont,
+    hook_callback done_cb, void *cbarg
+) {
     int n_msgs, i;
+    int *msg_ids;
     struct db_message **msgs;
+    struct db_message_batch *batch;
     struct prot_main *pmain;
     struct prot_txn_req *treq;
     struct prot_client_fetch *clfet;
@@ -137,18 +155,20 @@ void app_contact_sync(struct app_data *app, struct db_contact *cont) {
     hook_add(pmain->hooks, PROT_CLIENT_FETCH_EV_FAIL, hook_contact_sync, app);
     prot_main_push_tran(pmain, &(treq->htran));
 
-    // Send all undelivered messages
+    // Send all undelivered messages, outbox watches them by id
     msgs = db_message_get_all(app->db, cont, DB_MESSAGE_STATUS_UNDELIVERED, &n_msgs);
+    msg_ids = safe_malloc(sizeof(int) * max(n_msgs, 1), "Failed to allocate sync message ids");
     for (i = 0; i < n_msgs; i++) {
         struct prot_message *msg;
+        msg_ids[i] = msgs[i]->id;
         msg = prot_message_to_client_new(app->db, msgs[i]);
         prot_main_push_tran(pmain, &(msg->htran));
     }
     free(msgs);  // Free just array, not messages
 
     // Send RECV for all unconfirmed messages
-    msgs = db_message_get_all(app->db, cont, DB_MESSAGE_STATUS_RECV, &n_msgs);
-    for (i = 0; i < n_msgs; i++) {
+    batch = db_message_get_batch(app->db, cont, DB_MESSAGE_STATUS_RECV);
+    for (i = 0; i < batch->n_msgs; i++) {
         struct db_message *recvmsg;
         struct prot_message *msg;
 
@@ -158,16 +178,23 @@ void app_contact_sync(struct app_data *app, struct db_contact *cont) {
         recvmsg->sender = DB_MESSAGE_SENDER_ME;
         recvmsg->status = DB_MESSAGE_STATUS_UNDELIVERED;
         db_message_gen_id(recvmsg);
-        memcpy(recvmsg->body_recv_id, msgs[i]->global_id, MESSAGE_ID_LEN);
+        memcpy(recvmsg->body_recv_id, batch->msgs[i]->global_id, MESSAGE_ID_LEN);
 
         msg = prot_message_to_client_new(app->db, recvmsg);
         prot_main_push_tran(pmain, &(msg->htran));
     }
-    db_message_free_all(msgs, n_msgs);
+    db_message_batch_free(batch);
 
     prot_main_push_tran(pmain, &(clfet->htran));
-    prot_main_connect(pmain, cont->onion_address,
-        app->cf.app_port, "127.0.0.1", app->cf.tor_port);
+
+    // Connection may fail right away, so hooks are added first
+    if (done_cb) {
+        hook_add(pmain->hooks, PROT_MAIN_EV_DONE, done_cb, cbarg);
+        hook_add(pmain->hooks, PROT_MAIN_EV_CLOSE, done_cb, cbarg);
+    }
+    app_outbox_watch(app, pmain, cont->id, msg_ids, n_msgs);
+    free(msg_ids);
+    app_tor_connect(app, pmain, cont->onion_address, app->cf.app_port);
 }
 
 // Handle mb sync response
@@ -199,17 +226,27 @@ static void hook_mb_sync(int ev, void *data, void *cbarg) {
     if (ref_contacts) {
         app_update_contacts(app);
         app_ui_info(app, "[Message] Someone changed their nickname, refreshing UI");
+    } else {
+        // Messages may be for contacts other than the opened one
+        app_update_contact_counts(app);
+        ui_stack_redraw(app->ui.stack);
     }
 }
 
 // Sync messages from your mailbox account
 void app_mailbox_sync(struct app_data *app) {
+    app_mailbox_sync_notify(app, NULL, NULL);
+}
+
+// Same as app_mailbox_sync, done_cb is called with cbarg once the connection
+// is done or closed, returns 0 if there is no mailbox to sync with
+int app_mailbox_sync_notify(struct app_data *app, hook_callback done_cb, void *cbarg) {
     struct prot_main *pmain;
     struct prot_txn_req *treq;
     struct prot_mb_fetch *mbfet;
 
-    if (!db_options_is_defined(app->db, "mailbox_onion_address", DB_OPTIONS_TEXT))
-        return;
+    if (!db_options_is_defined(app->db, "client_mailbox_onion_address", DB_OPTIONS_TEXT))
+        return 0;
 
     pmain = prot_main_new(app->base, app->db);
     treq = prot_txn_req_new();
@@ -221,6 +258,10 @@ void app_mailbox_sync(struct app_data *app) {
     prot_main_push_tran(pmain, &(treq->htran));
     prot_main_push_tran(pmain, &(mbfet->htran));
 
-    prot_main_connect(pmain, mbfet->mb_onion_address,
-        app->cf.mailbox_port, "127.0.0.1", app->cf.tor_port);
+    if (done_cb) {
+        hook_add(pmain->hooks, PROT_MAIN_EV_DONE, done_cb, cbarg);
+        hook_add(pmain->hooks, PROT_MAIN_EV_CLOSE, done_cb, cbarg);
+    }
+    app_tor_connect(app, pmain, mbfet->mb_onion_address, app->cf.mailbox_port);
+    return 1;
 }
\ No newline at end of file
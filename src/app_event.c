@@ -10,7 +10,9 @@
 #include <event2/bufferevent.h>
 #include <event2/listener.h>
 #include <sys_crash.h>
+#include <sys_memory.h>
 #include <prot_main.h>
+#include <db_job.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -24,6 +26,10 @@ static void app_stdin_read_cb(evutil_socket_t fd, short what, void *arg);
 static void app_winch_handle_cb(evutil_socket_t fd, short what, void *arg);
 // Handle app shutdown
 static void app_sigint_handle_cb(evutil_socket_t fd, short what, void *arg);
+// Run background database jobs
+static void app_job_cb(evutil_socket_t fd, short what, void *arg);
+// Dump allocation statistics (mailbox)
+static void app_memstat_handle_cb(evutil_socket_t fd, short what, void *arg);
 
 // Accept incomming connection
 static void app_accept_connection(struct evconnlistener *listener, 
@@ -35,6 +41,7 @@ void app_event_init(struct app_data *app) {
     struct event *sigint_ev;
     struct evconnlistener *listener;
     struct addrinfo hints, *servinfo, *aip;
+    struct timeval job_interval = { APP_JOB_INTERVAL, 0 };
 
     app->base = event_base_new();
     event_base_priority_init(app->base, APP_EV_PRIORITY_COUNT);
@@ -51,12 +58,30 @@ void app_event_init(struct app_data *app) {
         winch_ev = evsignal_new(app->base, SIGWINCH, app_winch_handle_cb, app);
         evsignal_add(winch_ev, NULL);
         event_priority_set(winch_ev, APP_EV_PRIORITY_USER);
+
+        // Syncs and outbox retries start once Tor is ready
+        app_sync_init(app);
+        app_outbox_init(app);
+    }
+
+    // Mailbox has no console, allocation statistics are dumped on SIGUSR1
+    if (app->cf.is_mailbox && sys_memstat_enabled()) {
+        struct event *memstat_ev;
+
+        memstat_ev = evsignal_new(app->base, SIGUSR1, app_memstat_handle_cb, app);
+        evsignal_add(memstat_ev, NULL);
+        event_priority_set(memstat_ev, APP_EV_PRIORITY_USER);
     }
 
     sigint_ev = evsignal_new(app->base, SIGINT, app_sigint_handle_cb, app);
     evsignal_add(sigint_ev, NULL);
     event_priority_set(sigint_ev, APP_EV_PRIORITY_PRIMARY);
 
+    // Jobs left from the last run are picked up by the first check
+    app->job_event = event_new(app->base, -1, EV_PERSIST, app_job_cb, app);
+    event_add(app->job_event, &job_interval);
+    event_priority_set(app->job_event, APP_EV_PRIORITY_IDLE);
+
     if (get_free_port(app->cf.app_local_port) == 0) {
         sys_crash("Network", "Failed to get free port for app to listen on");
     }
@@ -128,6 +153,30 @@ static void app_sigint_handle_cb(evutil_socket_t fd, short what, void *arg) {
     app_end(app);
 }
 
+// Run background database jobs
+static void app_job_cb(evutil_socket_t fd, short what, void *arg) {
+    struct app_data *app = arg;
+
+    // One chunk is done at a time, other events are handled between chunks
+    if (db_job_run(app->db))
+        event_active(app->job_event, EV_TIMEOUT, 0);
+}
+
+// Print one allocation tag to the standard output
+static void app_memstat_print_cb(const struct sys_memstat *stat, void *cbarg) {
+    char line[256];
+
+    sys_memstat_format(stat, line, sizeof(line));
+    printf("[Memstat] %s\n", line);
+}
+
+// Dump allocation statistics (mailbox)
+static void app_memstat_handle_cb(evutil_socket_t fd, short what, void *arg) {
+    printf("[Memstat] Allocation statistics:\n");
+    sys_memstat_foreach(app_memstat_print_cb, NULL);
+    fflush(stdout);
+}
+
 // Accept incomming connection
 static void app_accept_connection(struct evconnlistener *listener, 
     evutil_socket_t sock, struct sockaddr *addr, int len, void *ptr
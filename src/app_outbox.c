@@ -0,0 +1,183 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <event2/event.h>
+#include <openssl/rand.h>
+#include <hooks.h>
+#include <hash_table.h>
+#include <prot_main.h>
+#include <db_message.h>
+#include <sys_memory.h>
+#include <sys_crash.h>
+#include <debug.h>
+
+#include <app.h>
+
+// Connection watched by the outbox
+struct app_outbox_attempt {
+    struct app_data *app;
+    int contact_id;
+    int n_ids;
+    int ids[];      // Messages connection tries to deliver
+};
+
+// Get number of open connections for given id in given table
+static int app_outbox_in_flight(struct hash_table *table, int id) {
+    return (intptr_t)hash_table_get(table, &id, sizeof(int));
+}
+
+// Change number of open connections for given id in given table by diff,
+// returns the new number
+static int app_outbox_in_flight_add(struct hash_table *table, int id, int diff) {
+    intptr_t n = app_outbox_in_flight(table, id) + diff;
+
+    if (n > 0)
+        hash_table_set(table, &id, sizeof(int), (void *)n);
+    else
+        hash_table_remove(table, &id, sizeof(int));
+    return n;
+}
+
+// Get number of seconds to wait before the next attempt, delay grows
+// exponentially and a random half of it is added so contacts which
+// failed together are not all retried at once
+static int app_outbox_delay(int attempts) {
+    int delay = APP_OUTBOX_MAX_DELAY;
+    uint32_t jitter;
+
+    if (attempts < 16)
+        delay = min(APP_OUTBOX_MAX_DELAY, APP_OUTBOX_BASE_DELAY << (attempts - 1));
+
+    if (RAND_bytes((unsigned char *)&jitter, sizeof(jitter)) != 1)
+        jitter = 0;
+
+    return delay / 2 + jitter % (delay / 2 + 1);
+}
+
+// Retry delivery to all contacts whose next attempt is due, all undelivered
+// messages of a contact are sent over one sync connection, retries are
+// queued into the sync scheduler so they share it's connection limit
+static void app_outbox_cb(evutil_socket_t fd, short what, void *arg) {
+    int i, n;
+    int64_t now;
+    struct app_data *app = arg;
+    struct db_message_outbox *outbox;
+
+    now = time(NULL);
+    outbox = db_message_outbox_get(app->db, &n);
+
+    for (i = 0; i < n && outbox[i].next_attempt <= now; i++) {
+        if (app_outbox_in_flight(app->outbox.in_flight, outbox[i].contact_id))
+            continue;
+
+        debug("Outbox retry for contact %d, attempt %d",
+            outbox[i].contact_id, outbox[i].attempts + 1);
+        app_sync_contact(app, outbox[i].contact_id);
+    }
+    free(outbox);
+
+    app_outbox_schedule(app);
+}
+
+// Count failed attempt once watched connection is gone, messages which another
+// connection still tries to deliver are counted once that one is done too
+static void app_outbox_done_cb(evutil_socket_t fd, short what, void *arg) {
+    int i, n = 0;
+    int attempts, delay;
+    struct app_outbox_attempt *attempt = arg;
+    struct app_data *app = attempt->app;
+
+    app_outbox_in_flight_add(app->outbox.in_flight, attempt->contact_id, -1);
+
+    for (i = 0; i < attempt->n_ids; i++) {
+        if (app_outbox_in_flight_add(app->outbox.msg_in_flight, attempt->ids[i], -1) == 0)
+            attempt->ids[n++] = attempt->ids[i];
+    }
+
+    // Messages still undelivered failed this time
+    if ((attempts = db_message_outbox_failed(app->db, attempt->ids, n)) > 0) {
+        delay = app_outbox_delay(attempts);
+        db_message_outbox_delay(app->db, attempt->ids, n, time(NULL) + delay);
+        debug("Outbox delivery to contact %d failed %d time(s), retry in %ds",
+            attempt->contact_id, attempts, delay);
+    }
+    free(attempt);
+
+    app_outbox_schedule(app);
+}
+
+// Called once watched connection is done or closed, failure is counted from
+// the event loop since connection may still start mailbox fallback while
+// it's being freed
+static void app_outbox_done(int ev, void *data, void *cbarg) {
+    struct app_outbox_attempt *attempt = cbarg;
+
+    if (event_base_once(attempt->app->base, -1, EV_TIMEOUT, app_outbox_done_cb, attempt, NULL) != 0)
+        sys_crash("Outbox", "Failed to schedule delivery attempt check");
+}
+
+// Create outbox retry timer (app_outbox.c)
+void app_outbox_init(struct app_data *app) {
+    app->outbox.in_flight = hash_table_new();
+    app->outbox.msg_in_flight = hash_table_new();
+    app->outbox.event = evtimer_new(app->base, app_outbox_cb, app);
+    event_priority_set(app->outbox.event, APP_EV_PRIORITY_IDLE);
+}
+
+// Arm outbox timer for the earliest next delivery attempt
+void app_outbox_schedule(struct app_data *app) {
+    int i, n;
+    int64_t now;
+    struct timeval tv = { 0, 0 };
+    struct db_message_outbox *outbox;
+
+    evtimer_del(app->outbox.event);
+
+    // Messages are only sent to mailboxes in mbdirect mode
+    if (!app->tor_ready || app->cf.manual_mode || app->cf.mb_direct)
+        return;
+
+    now = time(NULL);
+    outbox = db_message_outbox_get(app->db, &n);
+
+    // Contacts with open or queued connection are scheduled again once it's done
+    for (i = 0; i < n; i++) {
+        if (app_outbox_in_flight(app->outbox.in_flight, outbox[i].contact_id) ||
+            app_sync_is_queued(app, outbox[i].contact_id)
+        ) {
+            continue;
+        }
+
+        if (outbox[i].next_attempt > now)
+            tv.tv_sec = outbox[i].next_attempt - now;
+        evtimer_add(app->outbox.event, &tv);
+        break;
+    }
+    free(outbox);
+}
+
+// Watch connection to given contact which tries to deliver given messages
+// (n_ids IDs), those which are left undelivered once it is done or closed
+// get their next delivery attempt scheduled
+void app_outbox_watch(struct app_data *app, struct prot_main *pmain, int contact_id,
+    const int *ids, int n_ids
+) {
+    int i;
+    struct app_outbox_attempt *attempt;
+
+    attempt = safe_malloc(sizeof(struct app_outbox_attempt) + sizeof(int) * n_ids,
+        "Failed to allocate outbox attempt");
+    attempt->app = app;
+    attempt->contact_id = contact_id;
+    attempt->n_ids = n_ids;
+    memcpy(attempt->ids, ids, sizeof(int) * n_ids);
+
+    app_outbox_in_flight_add(app->outbox.in_flight, contact_id, 1);
+    for (i = 0; i < n_ids; i++)
+        app_outbox_in_flight_add(app->outbox.msg_in_flight, ids[i], 1);
+
+    // Only one of these is called, connection is freed when done
+    hook_add(pmain->hooks, PROT_MAIN_EV_DONE, app_outbox_done, attempt);
+    hook_add(pmain->hooks, PROT_MAIN_EV_CLOSE, app_outbox_done, attempt);
+}
\ No newline at end of file
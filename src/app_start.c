@@ -16,9 +16,14 @@
 #include <helpers_crypto.h>
 #include <stdint.h>
 #include <db_options.h>
+#include <db_compress.h>
+#include <db_pool.h>
+#include <db_shard.h>
+#include <db_storage.h>
 #include <ui_stack.h>
 #include <ui_logger.h>
 #include <limits.h>
+#include <prot_pool.h>
 
 #include <app.h>
 
@@ -41,11 +46,14 @@ void app_start(struct app_data *app, int argc, char **argv) {
         {"keygen",       required_argument, 0, 'g'},
         {"keys",         no_argument,       0, 'k'},
         {"keydel",       required_argument, 0, 'r'},
+        {"compress",     no_argument,       0, 'z'},
+        {"shards",       required_argument, 0, 's'},
+        {"storage",      required_argument, 0, 'S'},
         {"version",      no_argument,       0, 'v'},
         {0,              0,                 0,  0 },
     };
 
-    const char short_options[] = "hmd:p:P:t:ug:kr:v";
+    const char short_options[] = "hmd:p:P:t:ug:kr:zs:S:v";
 
     int opt;
     int option_index = 0;
@@ -69,6 +77,9 @@ void app_start(struct app_data *app, int argc, char **argv) {
     app->path.tor_bin = array(char);
     array_strcpy(app->path.tor_bin, APP_DEFAULT_TOR_PATH, -1);
 
+    // Mailbox storage is not split by default
+    app->cf.n_shards = 1;
+
     // Set default application port
     app->cf.app_port = array(char);
     array_strcpy(app->cf.app_port, DEEP_MESSENGER_PORT, -1);
@@ -92,6 +103,9 @@ void app_start(struct app_data *app, int argc, char **argv) {
                 printf("  -g, --keygen <uses>       Generate new mailbox access key\n");
                 printf("  -k, --keys                Show list of all available mailbox access keys\n");
                 printf("  -r, --keydel <key>        Delete given mailbox access key\n");
+                printf("  -z, --compress            Compress stored message bodies and mailbox messages\n");
+                printf("  -s, --shards <n>          Split mailbox storage into n database files\n");
+                printf("  -S, --storage <mode>      Keep databases in files (default) or memory\n");
                 printf("  -v, --version             Show application version\n");
                 exit(EXIT_SUCCESS);
                 break;
@@ -155,6 +169,29 @@ void app_start(struct app_data *app, int argc, char **argv) {
                 array_strcpy(access_key, optarg, -1);
                 break;
             
+            case 'z':
+                // Compress data saved to the database
+                db_compress_set_enabled(1);
+                break;
+
+            case 's':
+                // Set number of mailbox database shards
+                if (sscanf(optarg, "%d", &(app->cf.n_shards)) != 1 ||
+                    app->cf.n_shards <= 0 || app->cf.n_shards > DB_SHARD_MAX
+                ) {
+                    printf("Invalid number of shards provided (1 - %d)\n", DB_SHARD_MAX);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'S':
+                // Select where database data is kept
+                if (db_storage_select(optarg)) {
+                    printf("Unknown storage mode %s (file, memory)\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
             case 'v':
                 // Print app version
                 printf("Deep Messenger version %s (protocol v%d)\n", 
@@ -220,11 +257,16 @@ void app_start(struct app_data *app, int argc, char **argv) {
     }
 
     // Try to open the database
-    if (sqlite3_open(app->path.db_file, &(app->db))) {
-        sys_db_crash(app->db, "Unable to start database engine");
-    }
+    app->db = db_storage_open(app->path.db_file);
     // Setup database tables
     db_init_schema(app->db);
+    // Open read only connections
+    db_pool_init(app->db, app->path.db_file, DB_POOL_READERS);
+    // Open mailbox storage shards
+    if (app->cf.is_mailbox && db_shard_init(app->db, app->path.db_file, app->cf.n_shards)) {
+        printf("Number of shards must match the one mailbox database was created with\n");
+        exit(EXIT_FAILURE);
+    }
 
     // List all available mailbox access keys
     if (key_operation == 'k') {
@@ -376,6 +418,9 @@ void app_end(struct app_data *app) {
 
     app_tor_end(app);
     app_event_end(app);
+    db_shard_close(app->db);
+    db_pool_close(app->db);
+    prot_pool_buffer_clear();
     printf("\nStopped Deep Messenger\n");
     exit(EXIT_SUCCESS);
 }
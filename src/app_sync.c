@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <event2/event.h>
+#include <queue.h>
+#include <hooks.h>
+#include <prot_main.h>
+#include <db_contact.h>
+#include <debug.h>
+
+#include <app.h>
+
+// Start queued syncs while there are free slots
+static void app_sync_next_cb(evutil_socket_t fd, short what, void *arg);
+// Queue all syncs again
+static void app_sync_periodic_cb(evutil_socket_t fd, short what, void *arg);
+
+// Contacts with undelivered messages go first, then most recently active
+static int app_sync_compare(const void *a, const void *b) {
+    const struct db_contact_summary *ca = *(struct db_contact_summary * const *)a;
+    const struct db_contact_summary *cb = *(struct db_contact_summary * const *)b;
+
+    if (ca->n_undelivered != cb->n_undelivered)
+        return cb->n_undelivered - ca->n_undelivered;
+    if (ca->last_activity != cb->last_activity)
+        return ca->last_activity < cb->last_activity ? 1 : -1;
+    return 0;
+}
+
+// Called once sync connection is done or closed, frees the slot
+static void app_sync_done(int ev, void *data, void *cbarg) {
+    struct app_data *app = cbarg;
+    struct timeval spread = { APP_SYNC_SPREAD, 0 };
+
+    --app->sync.n_active;
+    debug("Sync done, %d active, %d queued",
+        app->sync.n_active, queue_get_length(app->sync.queue));
+
+    // Next sync is started later, not from inside of the connection
+    if (!queue_is_empty(app->sync.queue) && !evtimer_pending(app->sync.next_event, NULL))
+        evtimer_add(app->sync.next_event, &spread);
+}
+
+// Start sync for given queued contact id, returns 1 if sync was started
+static int app_sync_start(struct app_data *app, int contact_id) {
+    struct db_contact *cont;
+
+    if (contact_id == APP_SYNC_MAILBOX)
+        return app_mailbox_sync_notify(app, app_sync_done, app);
+
+    // Contact may have changed while it was waiting in the queue
+    if (!(cont = db_contact_get_by_pk(app->db, contact_id, NULL)))
+        return 0;
+
+    if (cont->deleted || cont->status != DB_CONTACT_ACTIVE) {
+        db_contact_free(cont);
+        return 0;
+    }
+
+    app_contact_sync_notify(app, cont, app_sync_done, app);
+    return 1;
+}
+
+// Start queued syncs while there are free slots
+static void app_sync_next_cb(evutil_socket_t fd, short what, void *arg) {
+    int contact_id;
+    struct app_data *app = arg;
+
+    while (app->sync.n_active < APP_SYNC_MAX_ACTIVE && !queue_is_empty(app->sync.queue)) {
+        queue_dequeue(app->sync.queue, &contact_id);
+
+        // Slot is taken before connecting since connect may fail right away
+        ++app->sync.n_active;
+        if (!app_sync_start(app, contact_id))
+            --app->sync.n_active;
+    }
+}
+
+// Queue all syncs again
+static void app_sync_periodic_cb(evutil_socket_t fd, short what, void *arg) {
+    struct app_data *app = arg;
+
+    if (!app->tor_ready || app->cf.manual_mode)
+        return;
+
+    app_sync_all(app);
+}
+
+// Create sync scheduler events (app_sync.c)
+void app_sync_init(struct app_data *app) {
+    struct timeval interval = { APP_SYNC_INTERVAL, 0 };
+
+    app->sync.queue = queue_new(sizeof(int));
+    app->sync.n_active = 0;
+
+    app->sync.next_event = evtimer_new(app->base, app_sync_next_cb, app);
+    event_priority_set(app->sync.next_event, APP_EV_PRIORITY_IDLE);
+
+    app->sync.periodic_event = event_new(app->base, -1, EV_PERSIST, app_sync_periodic_cb, app);
+    event_priority_set(app->sync.periodic_event, APP_EV_PRIORITY_IDLE);
+    event_add(app->sync.periodic_event, &interval);
+}
+
+// Check if sync with given contact id is waiting in the queue
+int app_sync_is_queued(struct app_data *app, int contact_id) {
+    int i, n;
+
+    n = queue_get_length(app->sync.queue);
+    for (i = 0; i < n; i++) {
+        if (*(int *)queue_peek(app->sync.queue, i) == contact_id)
+            return 1;
+    }
+    return 0;
+}
+
+// Queue sync with given contact unless it's already queued, it is
+// started once there is a free slot
+void app_sync_contact(struct app_data *app, int contact_id) {
+    if (app_sync_is_queued(app, contact_id))
+        return;
+
+    queue_enqueue(app->sync.queue, &contact_id);
+    debug("Sync with contact %d queued, %d active, %d queued",
+        contact_id, app->sync.n_active, queue_get_length(app->sync.queue));
+
+    app_sync_next_cb(-1, 0, app);
+}
+
+// Queue sync with the mailbox and all active contacts, contacts with
+// undelivered messages and recent activity are synced first, at most
+// APP_SYNC_MAX_ACTIVE syncs run at once
+void app_sync_all(struct app_data *app) {
+    int i, n_conts, contact_id;
+    struct db_contact_summary **conts;
+
+    // Previous round is still running
+    if (app->sync.n_active > 0 || !queue_is_empty(app->sync.queue)) {
+        debug("Sync round skipped, previous one is still running");
+        return;
+    }
+
+    // Mailbox holds messages from all contacts, so it goes first
+    contact_id = APP_SYNC_MAILBOX;
+    queue_enqueue(app->sync.queue, &contact_id);
+
+    conts = db_contact_get_summaries(app->db, &n_conts);
+    qsort(conts, n_conts, sizeof(struct db_contact_summary *), app_sync_compare);
+
+    for (i = 0; i < n_conts; i++) {
+        if (!conts[i]->deleted && conts[i]->status == DB_CONTACT_ACTIVE)
+            queue_enqueue(app->sync.queue, &(conts[i]->id));
+    }
+    db_contact_free_summaries(conts, n_conts);
+
+    app_sync_next_cb(-1, 0, app);
+}
\ No newline at end of file
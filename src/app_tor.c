@@ -10,9 +10,41 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <db_contact.h>
+#include <string.h>
+#include <netdb.h>
+#include <sys/socket.h>
 
 #include <app.h>
 
+// Resolve tor SOCKS server address and store it, returns 1 on success
+static int app_tor_resolve_socks(struct app_data *app) {
+    int rc;
+    struct addrinfo hints, *servinfo;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST;
+
+    if ((rc = getaddrinfo("127.0.0.1", app->cf.tor_port, &hints, &servinfo)) != 0) {
+        debug("getaddrinfo: %s", gai_strerror(rc));
+        return 0;
+    }
+
+    memcpy(&app->tor_socks_addr, servinfo->ai_addr, servinfo->ai_addrlen);
+    app->tor_socks_addr_len = servinfo->ai_addrlen;
+    freeaddrinfo(servinfo);
+    return 1;
+}
+
+// Connect given protocol handler to onion service over tor SOCKS server
+void app_tor_connect(struct app_data *app, struct prot_main *pmain,
+    const char *onion_address, const char *onion_port
+) {
+    prot_main_connect_addr(pmain, onion_address, onion_port,
+        (struct sockaddr *)&app->tor_socks_addr, app->tor_socks_addr_len);
+}
+
 // End win on crash
 static void app_tor_crash(void *attr) {
     app_tor_end(attr);
@@ -55,19 +87,10 @@ static void tor_handle_output(evutil_socket_t fd, short what, void *arg) {
 
                     // If app is not running in manual mode run syncs
                     if (!app->cf.manual_mode) {
-                        int i, n_conts;
-                        struct db_contact **conts;
-                        // Sync with mailbox
-                        app_mailbox_sync(app);
-                        // Sync with friends
-                        conts = db_contact_get_all(app->db, &n_conts);
-                        for (i = 0; i < n_conts; i++) {
-                            if (!conts[i]->deleted && conts[i]->status == DB_CONTACT_ACTIVE)
-                                app_contact_sync(app, conts[i]);
-                            else
-                                db_contact_free(conts[i]);
-                        }
-                        free(conts); // Don't free contacts just the array
+                        // Sync with mailbox and friends, at most few at a time
+                        app_sync_all(app);
+                        // Retry messages which failed to be delivered last time
+                        app_outbox_schedule(app);
                     }
                 }
             }
@@ -106,6 +129,12 @@ void app_tor_start(struct app_data *app) {
         return;
     }
 
+    // Resolve SOCKS address once instead of on every connection
+    if (!app_tor_resolve_socks(app)) {
+        tor_err(app, "Failed to resolve Tor SOCKS server address");
+        return;
+    }
+
     if (!(torrc = fopen(app->path.torrc, "w"))) {
         tor_err(app, "Failed to open and write to torrc file");
         return;
@@ -40,6 +40,7 @@ void app_ui_chat_refresh(struct app_data *app, int keep_position) {
     int i, i_line, i_wrap;
     int n_messages;
     struct db_message **messages;
+    struct db_message_batch *batch;
 
     if (!app->cont_selected)
         return;
@@ -51,7 +52,10 @@ void app_ui_chat_refresh(struct app_data *app, int keep_position) {
     ui_logger_printf(app->ui.chat, "== Start of chat with [%s] == %s ==\n",
         app->cont_selected->nickname, app->cont_selected->onion_address);
 
-    messages = db_message_get_all(app->db, app->cont_selected, DB_MESSAGE_STATUS_ANY, &n_messages);
+    batch = db_message_get_batch(app->db,
+        db_contact_ref_by_pk(app->db, app->cont_selected->id), DB_MESSAGE_STATUS_ANY);
+    messages = batch->msgs;
+    n_messages = batch->n_msgs;
 
     for (i = 0; i < n_messages; i++) {
         wchar_t *text;
@@ -70,13 +74,20 @@ void app_ui_chat_refresh(struct app_data *app, int keep_position) {
 
         if (messages[i]->sender == DB_MESSAGE_SENDER_ME) {
             ui_logger_printf(app->ui.chat, "%*s[me] |%c| %s",
-                strlen(app->cont_selected->nickname) - 2, "", status, messages[i]->body_text);
+                strlen(app->cont_selected->nickname) - 2, "", status, db_message_get_text(messages[i]));
         } else {
             ui_logger_printf(app->ui.chat, "[%s] |%c| %s",
-                app->cont_selected->nickname, status, messages[i]->body_text);
+                app->cont_selected->nickname, status, db_message_get_text(messages[i]));
         }
     }
 
+    db_message_batch_free(batch);
+
+    // Everything in the chat is now shown to the user
+    db_contact_mark_read(app->db, app->cont_selected->id);
+    if (app->cont_selected->n_unread > 0)
+        app_update_contact_counts(app);
+
     if (keep_position) {
         app->ui.chat->i_line = i_line;
         app->ui.chat->i_wrap = i_wrap;
@@ -103,6 +114,14 @@ void app_ui_contact_select(struct ui_menu *menu, void *att) {
     app_ui_chat_refresh(app, 0);
 }
 
+// Write menu label for given contact, number of unread messages is shown next to the name
+static void app_contact_label(const struct db_contact_summary *cont, char *label) {
+    if (cont->n_unread > 0)
+        snprintf(label, UI_MENU_LABEL_SIZE - 1, "@%s (%d)", cont->nickname, cont->n_unread);
+    else
+        snprintf(label, UI_MENU_LABEL_SIZE - 1, "@%s", cont->nickname);
+}
+
 void app_update_contacts(struct app_data *app) {
     int i;
 
@@ -110,9 +129,9 @@ void app_update_contacts(struct app_data *app) {
         ui_menu_free(app->ui.contacts);
 
     if (app->n_contacts > 0)
-        db_contact_free_all(app->contacts, app->n_contacts);
+        db_contact_free_summaries(app->contacts, app->n_contacts);
 
-    app->contacts = db_contact_get_all(app->db, &(app->n_contacts));
+    app->contacts = db_contact_get_summaries(app->db, &(app->n_contacts));
 
     app->ui.contacts = ui_menu_new();
     ui_menu_attach(app->ui.contacts, app->ui.contactswin);
@@ -125,13 +144,38 @@ void app_update_contacts(struct app_data *app) {
         if (app->cont_selected->deleted || app->cont_selected->status != DB_CONTACT_ACTIVE)
             continue;
 
-        snprintf(label, UI_MENU_LABEL_SIZE - 1, "@%s", app->cont_selected->nickname);
+        app_contact_label(app->cont_selected, label);
         ui_menu_add(app->ui.contacts, i + 1, label, app_ui_contact_select, app);
     }
 
     app->cont_selected = NULL;
 }
 
+// Update message counts of listed contacts without rebuilding the list
+void app_update_contact_counts(struct app_data *app) {
+    int i, n;
+    char label[UI_MENU_LABEL_SIZE];
+    struct db_contact_summary **conts;
+
+    conts = db_contact_get_summaries(app->db, &n);
+
+    for (i = 0; i < n && i < app->n_contacts; i++) {
+        // Contacts added since the list was built are shown on the next rebuild
+        if (conts[i]->id != app->contacts[i]->id)
+            continue;
+
+        app->contacts[i]->last_message_id = conts[i]->last_message_id;
+        app->contacts[i]->n_unread = conts[i]->n_unread;
+        app->contacts[i]->n_undelivered = conts[i]->n_undelivered;
+        app->contacts[i]->last_activity = conts[i]->last_activity;
+
+        app_contact_label(app->contacts[i], label);
+        ui_menu_item_update(app->ui.contacts, i + 1, label);
+    }
+
+    db_contact_free_summaries(conts, n);
+}
+
 // Init all ui windows
 void app_ui_init(struct app_data *app) {
     initscr();
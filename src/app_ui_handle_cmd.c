@@ -1,6 +1,7 @@
 #include <ui_prompt.h>
 #include <ui_logger.h>
 #include <string.h>
+#include <time.h>
 #include <array.h>
 #include <cmd_parse.h>
 #include <constants.h>
@@ -8,6 +9,7 @@
 #include <db_options.h>
 #include <debug.h>
 #include <base32.h>
+#include <sys_memory.h>
 
 #include <prot_main.h>
 #include <db_message.h>
@@ -18,6 +20,12 @@
 
 #include <app.h>
 
+// Maximum number of messages printed by the search command
+#define SEARCH_MAX_RESULTS 20
+
+// Maximum number of allocation tags printed by the memstat command
+#define MEMSTAT_MAX_LINES 20
+
 // Print help message to the console
 static void command_help(int argc, char **argv, void *cbarg) {
     struct app_data *app = cbarg;
@@ -36,6 +44,8 @@ static void command_help(int argc, char **argv, void *cbarg) {
     app_ui_shell(app, "  mbcontacts          Upload contact list to mailbox server");
     app_ui_shell(app, "  mbsync              Fetch new messages from mailbox server");
     app_ui_shell(app, "  mbdirect <1/0>      Send messages only over mailbox (debug tool)");
+    app_ui_shell(app, "  search <text>       Search chat history for given words");
+    app_ui_shell(app, "  memstat             Print allocation statistics (MEMSTAT builds)");
     app_ui_shell(app, "  tor                 Start tor client (manual mode)");
     app_ui_shell(app, "  version             Prints app and protocol version");
     
@@ -162,7 +172,7 @@ static void command_mbreg(int argc, char **argv, void *cbarg) {
     prot_main_push_tran(pmain, &(txnreq->htran));
     prot_main_push_tran(pmain, &(accreg->htran));
 
-    prot_main_connect(pmain, argv[1], app->cf.mailbox_port, "127.0.0.1", app->cf.tor_port);
+    app_tor_connect(app, pmain, argv[1], app->cf.mailbox_port);
 }
 
 // Handle account remove status on pmain
@@ -217,7 +227,7 @@ static void command_mbrm(int argc, char **argv, void *cbarg) {
     prot_main_push_tran(pmain, &(txnreq->htran));
     prot_main_push_tran(pmain, &(accrm->htran));
 
-    prot_main_connect(pmain, mb_address, app->cf.mailbox_port, "127.0.0.1", app->cf.tor_port);
+    app_tor_connect(app, pmain, mb_address, app->cf.mailbox_port);
 }
 
 // Atempt to remove mailbox account
@@ -315,16 +325,16 @@ static void command_friendadd(int argc, char **argv, void *cbarg) {
     prot_main_push_tran(pmain, &(txnreq->htran));
     prot_main_push_tran(pmain, &(freq->htran));
 
-    prot_main_connect(pmain, argv[1], app->cf.app_port, "127.0.0.1", app->cf.tor_port);
+    app_tor_connect(app, pmain, argv[1], app->cf.app_port);
 }
 
 // Send friend request
 static void command_friends(int argc, char **argv, void *cbarg) {
     struct app_data *app = cbarg;
     int i, n_conts, non_del_cnt = 0;
-    struct db_contact **conts;
+    struct db_contact_summary **conts;
 
-    conts = db_contact_get_all(app->db, &n_conts);
+    conts = db_contact_get_summaries(app->db, &n_conts);
 
     app_ui_shell(app, "List of all your friends and their statuses: ");
 
@@ -350,6 +360,7 @@ static void command_friends(int argc, char **argv, void *cbarg) {
     }
 
     app_ui_shell(app, "Total: %d", non_del_cnt);
+    db_contact_free_summaries(conts, n_conts);
 }
 
 // Delete given friend
@@ -378,6 +389,40 @@ static void command_friendrm(int argc, char **argv, void *cbarg) {
     }
 }
 
+// Search chat history
+static void command_search(int argc, char **argv, void *cbarg) {
+    struct app_data *app = cbarg;
+    int i;
+    char *text = argv[1];   // Rest of the line as it was typed
+    double elapsed;
+    struct timespec start, end;
+    struct db_message_batch *batch;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    batch = db_message_search(app->db, text, SEARCH_MAX_RESULTS);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+    app_ui_shell(app, "Search results for \"%s\" (%.2f ms):", text, elapsed);
+
+    for (i = 0; i < batch->n_msgs; i++) {
+        struct db_message *msg = batch->msgs[i];
+        const struct db_contact *cont;
+
+        cont = db_contact_ref_by_pk(app->db, msg->contact_id);
+        if (!cont || cont->deleted)
+            continue;
+
+        app_ui_shell(app, "  - message %d, contact %d [%s] %s: %s", msg->id, cont->id, cont->nickname,
+            msg->sender == DB_MESSAGE_SENDER_ME ? "(me)" : "(friend)", db_message_get_text(msg));
+    }
+
+    if (batch->n_msgs == 0)
+        app_ui_shell(app, "  Nothing found");
+
+    db_message_batch_free(batch);
+}
+
 static void command_mbcontacts_hook_cb(int ev, void *data, void *cbarg) {
     struct app_data *app = cbarg;
     
@@ -427,7 +472,7 @@ static void command_mbcontacts(int argc, char **argv, void *cbarg) {
     prot_main_push_tran(pmain, &(txnreq->htran));
     prot_main_push_tran(pmain, &(setconts->htran));
 
-    prot_main_connect(pmain, mb_address, app->cf.mailbox_port, "127.0.0.1", app->cf.tor_port);
+    app_tor_connect(app, pmain, mb_address, app->cf.mailbox_port);
 }
 
 // Upload sync messages with another client
@@ -490,6 +535,39 @@ static void command_tor(int argc, char **argv, void *cbarg) {
     app_tor_start(app);
 }
 
+// Used to print allocation statistics
+struct memstat_print {
+    struct app_data *app;
+    int n_lines;
+    size_t live_bytes;
+};
+
+// Print one allocation tag to the console
+static void memstat_print_cb(const struct sys_memstat *stat, void *cbarg) {
+    char line[256];
+    struct memstat_print *mp = cbarg;
+
+    mp->live_bytes += stat->live_bytes;
+    if (mp->n_lines++ >= MEMSTAT_MAX_LINES)
+        return;
+
+    sys_memstat_format(stat, line, sizeof(line));
+    app_ui_shell(mp->app, "%s", line);
+}
+
+// Print allocation statistics collected by the allocation profiler
+static void command_memstat(int argc, char **argv, void *cbarg) {
+    struct memstat_print mp = { cbarg, 0, 0 };
+
+    if (!sys_memstat_enabled()) {
+        app_ui_shell(mp.app, "error: Allocation profiler is disabled, build the app with make MEMSTAT=1");
+        return;
+    }
+
+    sys_memstat_foreach(memstat_print_cb, &mp);
+    app_ui_shell(mp.app, "Total %zu B live in %d tag(s)", mp.live_bytes, mp.n_lines);
+}
+
 // Upload contact list
 static void command_nickname(int argc, char **argv, void *cbarg) {
     int i;
@@ -533,26 +611,28 @@ void app_ui_handle_cmd(struct ui_prompt *prt, void *att) {
 
     // Command templates
     struct cmd_template cmds[] = {
-        {"help",       0, command_help,       app},
-        {"info",       0, command_info,       app},
-        {"version",    0, command_version,    app},
-        {"mbreg",      2, command_mbreg,      app},
-        {"mbrm",       0, command_mbrm,       app},
-        {"mbrmlocal",  0, command_mbrmlocal,  app},
-        {"friendadd",  1, command_friendadd,  app},
-        {"friends",    0, command_friends,    app},
-        {"friendrm",   1, command_friendrm,   app},
-        {"mbcontacts", 0, command_mbcontacts, app},
-        {"sync",       1, command_sync,       app},
-        {"mbdirect",   1, command_mbdirect,   app},
-        {"mbsync",     0, command_mbsync,     app},
-        {"tor",        0, command_tor,        app},
-        {"nickname",   1, command_nickname,   app},
+        {"help",       0, command_help,       app, 0},
+        {"info",       0, command_info,       app, 0},
+        {"version",    0, command_version,    app, 0},
+        {"mbreg",      2, command_mbreg,      app, 0},
+        {"mbrm",       0, command_mbrm,       app, 0},
+        {"mbrmlocal",  0, command_mbrmlocal,  app, 0},
+        {"friendadd",  1, command_friendadd,  app, 0},
+        {"friends",    0, command_friends,    app, 0},
+        {"friendrm",   1, command_friendrm,   app, 0},
+        {"mbcontacts", 0, command_mbcontacts, app, 0},
+        {"sync",       1, command_sync,       app, 0},
+        {"mbdirect",   1, command_mbdirect,   app, 0},
+        {"mbsync",     0, command_mbsync,     app, 0},
+        {"tor",        0, command_tor,        app, 0},
+        {"nickname",   1, command_nickname,   app, 0},
+        {"search",    -1, command_search,     app, 1},
+        {"memstat",    0, command_memstat,    app, 0},
     };
 
     app_ui_shell(app, "> %ls", prt->input_buffer);
 
-    if (err = cmd_parse(cmds, 15, ui_prompt_get_input(prt))) {
+    if (err = cmd_parse(cmds, 17, ui_prompt_get_input(prt))) {
         app_ui_shell(app, "error: %s", err);
     }
     ui_prompt_clear(prt);
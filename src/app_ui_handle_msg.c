@@ -47,8 +47,9 @@ void app_message_send_mb(struct app_data *app, const struct db_message *msg) {
     prot_main_push_tran(pmain, &(treq->htran));
     prot_main_push_tran(pmain, &(pmsg->htran));
 
-    prot_main_connect(pmain, dbcont->mailbox_onion,
-        app->cf.mailbox_port, "127.0.0.1", app->cf.tor_port);
+    // Failed direct delivery is counted once the mailbox fails as well
+    app_outbox_watch(app, pmain, msg->contact_id, &(msg->id), 1);
+    app_tor_connect(app, pmain, dbcont->mailbox_onion, app->cf.mailbox_port);
     db_contact_free(dbcont);
 }
 
@@ -85,8 +86,9 @@ void app_message_send(struct app_data *app, struct db_message *dbmsg) {
     prot_main_push_tran(pmain, &(treq->htran));
     prot_main_push_tran(pmain, &(pmsg->htran));
 
-    prot_main_connect(pmain, cont->onion_address,
-        app->cf.app_port, "127.0.0.1", app->cf.tor_port);
+    // If direct delivery fails it is retried later by the outbox
+    app_outbox_watch(app, pmain, cont->id, &(dbmsg->id), 1);
+    app_tor_connect(app, pmain, cont->onion_address, app->cf.app_port);
     db_contact_free(cont);
 }
 
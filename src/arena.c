@@ -0,0 +1,89 @@
+#include <stdlib.h>
+#include <string.h>
+#include <arena.h>
+#include <sys_memory.h>
+
+// All allocations are aligned to this boundary
+#define ARENA_ALIGN 16
+
+struct arena_chunk {
+    size_t size;
+    size_t used;
+    struct arena_chunk *next;
+    // Chunk memory follows the header
+    _Alignas(ARENA_ALIGN) unsigned char data[];
+};
+
+// Allocate new chunk with given usable size and put it in front of the list
+static struct arena_chunk * arena_chunk_new(struct arena *a, size_t size) {
+    struct arena_chunk *chunk;
+
+    chunk = safe_malloc(sizeof(struct arena_chunk) + size, "Failed to allocate arena chunk");
+    chunk->size = size;
+    chunk->used = 0;
+    chunk->next = a->head;
+    a->head = chunk;
+
+    return chunk;
+}
+
+// Allocate new arena, if chunk_size is 0 default chunk size is used
+struct arena * arena_new(size_t chunk_size) {
+    struct arena *a;
+
+    a = safe_malloc(sizeof(struct arena), "Failed to allocate arena");
+    a->chunk_size = chunk_size ? chunk_size : ARENA_CHUNK_SIZE;
+    a->head = NULL;
+
+    return a;
+}
+
+// Free arena and all memory allocated from it
+void arena_free(struct arena *a) {
+    if (!a) return;
+
+    while (a->head) {
+        struct arena_chunk *next = a->head->next;
+
+        free(a->head);
+        a->head = next;
+    }
+    free(a);
+}
+
+// Allocate size bytes from the arena, memory is not initialized
+void * arena_alloc(struct arena *a, size_t size) {
+    void *ptr;
+    struct arena_chunk *chunk = a->head;
+
+    size = (size + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1);
+
+    if (!chunk || chunk->size - chunk->used < size) {
+        // Large allocations get their own chunk, so the current chunk
+        // is not wasted
+        if (size > a->chunk_size / 4) {
+            chunk = arena_chunk_new(a, size);
+            if (chunk->next) {
+                a->head = chunk->next;
+                chunk->next = a->head->next;
+                a->head->next = chunk;
+            }
+            chunk->used = size;
+            return chunk->data;
+        }
+        chunk = arena_chunk_new(a, a->chunk_size);
+    }
+
+    ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+// Allocate size bytes from the arena and copy data into them
+void * arena_memdup(struct arena *a, const void *data, size_t size) {
+    void *ptr;
+
+    ptr = arena_alloc(a, size);
+    memcpy(ptr, data, size);
+    return ptr;
+}
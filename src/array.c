@@ -1,58 +1,97 @@
 #include <array.h>
 #include <stdlib.h>
+#include <string.h>
 #include <debug.h>
 #include <sys_memory.h>
+#include <sys_crash.h>
+
+// Get array header from array data pointer
+static struct array_data * array_header(void *arr_s) {
+    return (struct array_data *)((uint8_t *)arr_s - sizeof(struct array_data));
+}
+
+// Grow array storage to hold at least given number of elements
+static void * array_grow(void *arr_s, int min_capacity) {
+    int capacity;
+    struct array_data *arr = array_header(arr_s);
+
+    // Grow geometrically so appending N elements is O(N)
+    capacity = arr->capacity * 2;
+    if (capacity < min_capacity)
+        capacity = min_capacity;
+
+    arr = safe_realloc(arr, sizeof(struct array_data) + arr->element_size * capacity,
+        "Failed to expand dynamic array");
+    arr->capacity = capacity;
+
+    return (uint8_t *)arr + sizeof(struct array_data);
+}
 
 // Create new dynamic array
 void * _array_new(size_t el_size) {
-    void *arr_void;
     struct array_data *arr;
 
-    arr_void = safe_malloc(sizeof(struct array_data) + el_size * ARRAY_CHUNK_SIZE,
+    arr = safe_malloc(sizeof(struct array_data) + el_size * ARRAY_INITIAL_CAPACITY,
         "Failed to allocate dynamic array");
 
-    arr = arr_void;
     arr->element_size = el_size;
-    arr->length = ARRAY_CHUNK_SIZE;
+    arr->capacity = ARRAY_INITIAL_CAPACITY;
+    arr->length = 0;
 
-    arr_void += sizeof(struct array_data);
-    return arr_void;
+    return (uint8_t *)arr + sizeof(struct array_data);
 }
 
-// Expand array to have at least given size
+// Expand array to have at least given length
 void * _array_expand(void *arr_s, int new_length) {
-    // Get original (malloc) array pointer
-    void *arr_void = arr_s - sizeof(struct array_data);
-    // Get structure pointer
-    struct array_data *arr = arr_void;
+    if (array_header(arr_s)->capacity < new_length)
+        arr_s = array_grow(arr_s, new_length);
 
-    if (arr->length < new_length) {
-        arr->length = (new_length / ARRAY_CHUNK_SIZE + 1) * ARRAY_CHUNK_SIZE;
+    if (array_header(arr_s)->length < new_length)
+        array_header(arr_s)->length = new_length;
 
-        arr_void = safe_realloc(arr_void, sizeof(struct array_data) + arr->element_size * arr->length,
-            "Failed to expand dynamic array");
-    }
+    return arr_s;
+}
+
+// Add one element to the end of the array, new element is not initialized
+void * _array_push(void *arr_s) {
+    return _array_expand(arr_s, array_header(arr_s)->length + 1);
+}
+
+// Remove the last element from the array, returns index of removed element
+int _array_pop(void *arr_s) {
+    struct array_data *arr = array_header(arr_s);
+
+    if (arr->length == 0)
+        sys_crash("Array", "Tried to pop an element from empty array");
 
-    arr_void += sizeof(struct array_data);
-    return arr_void;
+    return --arr->length;
 }
 
 // Free given dynamic array
 void array_free(void *arr_s) {
     if (arr_s)
-        free(arr_s - sizeof(struct array_data));
+        free(array_header(arr_s));
 }
 
-// Get current length of given array (elements allocated)
+// Get current length of given array (highest index used + 1)
 int array_length(void *arr_s) {
-    struct array_data *arr = arr_s - sizeof(struct array_data);
-    return arr->length;
+    return array_header(arr_s)->length;
+}
+
+// Get number of elements array can hold without reallocation
+int array_capacity(void *arr_s) {
+    return array_header(arr_s)->capacity;
+}
+
+// Set array length to zero, allocated memory is kept
+void array_clear(void *arr_s) {
+    array_header(arr_s)->length = 0;
 }
 
 // Copy given null terminated string into array, expand array as needed
 // function copies until it reaches null terminator or maxlen if maxlen is not -1
 void * _array_strcpy(void *arr_s, const char *str, int maxlen) {
-    int len, i;
+    int i;
     char *dest;
 
     if (maxlen == -1)
@@ -0,0 +1,78 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <bloom.h>
+#include <hash_table.h>
+#include <sys_memory.h>
+
+// Allocate new bloom filter sized for given number of items
+struct bloom * bloom_new(size_t capacity) {
+    struct bloom *bf;
+
+    bf = safe_malloc(sizeof(struct bloom), "Failed to allocate bloom filter");
+
+    if (capacity == 0)
+        capacity = 1;
+
+    bf->n_items = 0;
+    bf->capacity = capacity;
+
+    // Number of bits is rounded up to power of two
+    for (bf->n_bits = 64; bf->n_bits < capacity * BLOOM_BITS_PER_ITEM; bf->n_bits *= 2);
+
+    bf->bits = safe_malloc(bf->n_bits / 8, "Failed to allocate bloom filter bits");
+    memset(bf->bits, 0, bf->n_bits / 8);
+
+    return bf;
+}
+
+// Free given bloom filter
+void bloom_free(struct bloom *bf) {
+    if (!bf) return;
+
+    free(bf->bits);
+    free(bf);
+}
+
+// Bit positions are derived from two halves of one 64 bit hash
+// (double hashing), second half is odd so all positions differ
+#define bloom_bit(bf, hash, i) \
+    ((((hash) & 0xFFFFFFFF) + (i) * (((hash) >> 32) | 1)) & ((bf)->n_bits - 1))
+
+// Add key to the filter
+void bloom_add(struct bloom *bf, const void *key, size_t key_len) {
+    int i;
+    size_t bit;
+    uint64_t hash;
+
+    hash = hash_table_hash(key, key_len);
+
+    for (i = 0; i < BLOOM_N_HASHES; i++) {
+        bit = bloom_bit(bf, hash, i);
+        bf->bits[bit / 8] |= 1 << (bit % 8);
+    }
+    ++bf->n_items;
+}
+
+// Check if key may be in the filter, returns 0 if key was
+// definitely never added and 1 if it might have been
+int bloom_maybe_contains(struct bloom *bf, const void *key, size_t key_len) {
+    int i;
+    size_t bit;
+    uint64_t hash;
+
+    hash = hash_table_hash(key, key_len);
+
+    for (i = 0; i < BLOOM_N_HASHES; i++) {
+        bit = bloom_bit(bf, hash, i);
+        if (!(bf->bits[bit / 8] & (1 << (bit % 8))))
+            return 0;
+    }
+    return 1;
+}
+
+// Check if more items than the filter was sized for were added, false
+// positive rate grows quickly from here so filter should be rebuilt
+int bloom_is_full(struct bloom *bf) {
+    return bf->n_items > bf->capacity;
+}
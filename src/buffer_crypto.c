@@ -11,65 +11,81 @@
 #include <helpers.h>
 #include <helpers_crypto.h>
 
-// Take first len bytes in the given buffer, sign them using provided ed25519
-// private key and add signature to the end of buffer
-int ed25519_buffer_sign(struct evbuffer *buff, size_t len, uint8_t *priv_key) {
-    int i, is_err = 0;
-    int n_iv;
-    struct evbuffer_iovec *iv = NULL;
+struct ed25519_stream {
+    EVP_PKEY *pkey;
+    EVP_MD_CTX *hashctx;
+};
+
+// Free given stream without signing the data
+void ed25519_stream_free(struct ed25519_stream *stream) {
+    EVP_MD_CTX_free(stream->hashctx);
+    EVP_PKEY_free(stream->pkey);
+    free(stream);
+}
 
-    EVP_PKEY *pkey = NULL;
+// Start signing data which is not available all at once, returns NULL on error
+struct ed25519_stream * ed25519_stream_new(const uint8_t *priv_key) {
+    struct ed25519_stream *stream;
+
+    stream = safe_malloc(sizeof(struct ed25519_stream),
+        "Failed to allocate memory for ed25519 stream");
+    stream->pkey = NULL;
+
+    stream->hashctx = EVP_MD_CTX_new();
+    if (!EVP_DigestInit_ex2(stream->hashctx, EVP_sha512(), NULL))
+        goto err;
+
+    if (!(stream->pkey = EVP_PKEY_new_raw_private_key(EVP_PKEY_ED25519, NULL, priv_key, ED25519_PRIV_KEY_LEN)))
+        goto err;
+
+    return stream;
+
+    err:
+    debug("An error occured while starting ed25519 stream: %s",
+        ERR_error_string(ERR_get_error(), NULL));
+    ed25519_stream_free(stream);
+    return NULL;
+}
+
+// Add next part of the data to the stream, returns 0 on success
+int ed25519_stream_update(struct ed25519_stream *stream, const void *data, size_t len) {
+    if (!EVP_DigestUpdate(stream->hashctx, data, len)) {
+        debug("An error occured while updating ed25519 stream: %s",
+            ERR_error_string(ERR_get_error(), NULL));
+        return 1;
+    }
+    return 0;
+}
+
+// Sign all data passed to the stream and add signature to the end of
+// given buffer, stream is freed in any case, returns 0 on success
+int ed25519_stream_sign(struct ed25519_stream *stream, struct evbuffer *buff) {
+    int is_err = 0;
     EVP_MD_CTX *ctx = NULL;
-    EVP_MD_CTX *hashctx = NULL;
 
     uint8_t hash[EVP_MAX_MD_SIZE];
-    int hash_len = EVP_MAX_MD_SIZE;
+    unsigned int hash_len = EVP_MAX_MD_SIZE;
 
     uint8_t sig[ED25519_SIGNATURE_LEN];
     size_t sig_len = ED25519_SIGNATURE_LEN;
 
-    if (len == 0)
-        len = evbuffer_get_length(buff);
-
-    hashctx = EVP_MD_CTX_new();
-    if (!EVP_DigestInit_ex2(hashctx, EVP_sha512(), NULL)) {
-        is_err = 1; goto err;
-    }
-
-    if (!(pkey = EVP_PKEY_new_raw_private_key(EVP_PKEY_ED25519, NULL, priv_key, ED25519_PRIV_KEY_LEN))) {
+    if (!EVP_DigestFinal_ex(stream->hashctx, hash, &hash_len)) {
         is_err = 1; goto err;
     }
 
     ctx = EVP_MD_CTX_new();
-    if (!EVP_DigestSignInit(ctx, NULL, NULL, NULL, pkey)) {
+    if (!EVP_DigestSignInit(ctx, NULL, NULL, NULL, stream->pkey)) {
         is_err = 1; goto err;
     }
 
-    n_iv = evbuffer_peek(buff, len, NULL, NULL, 0);
-    iv = safe_malloc((sizeof(struct evbuffer_iovec) * n_iv),
-        "Failed to allocate memory for evbuffer iovec(s), on buffer sign");
-
-    n_iv = evbuffer_peek(buff, len, NULL, iv, n_iv);
-
-    for (i = 0; i < n_iv; i++) {
-        if (!EVP_DigestUpdate(hashctx, iv[i].iov_base, min(iv[i].iov_len, len))) {
-            is_err = 1; goto err;
-        }
-        len -= iv[i].iov_len;
-    }
-
-    if (!EVP_DigestFinal_ex(hashctx, hash, &hash_len)) {
+    if (!EVP_DigestSign(ctx, sig, &sig_len, hash, hash_len)) {
         is_err = 1; goto err;
     }
-
-    EVP_DigestSign(ctx, sig, &sig_len, hash, hash_len);
     evbuffer_add(buff, sig, sig_len);
 
     err:
-    free(iv);
     EVP_MD_CTX_free(ctx);
-    EVP_MD_CTX_free(hashctx);
-    EVP_PKEY_free(pkey);
+    ed25519_stream_free(stream);
 
     if (is_err) {
         debug("An error occured while signing the buffer: %s", 
@@ -80,9 +96,41 @@ int ed25519_buffer_sign(struct evbuffer *buff, size_t len, uint8_t *priv_key) {
     return 0;
 }
 
+// Take first len bytes in the given buffer, sign them using provided ed25519
+// private key and add signature to the end of buffer
+int ed25519_buffer_sign(struct evbuffer *buff, size_t len, const uint8_t *priv_key) {
+    int i, n_iv;
+    struct evbuffer_iovec *iv;
+    struct ed25519_stream *stream;
+
+    if (len == 0)
+        len = evbuffer_get_length(buff);
+
+    if (!(stream = ed25519_stream_new(priv_key)))
+        return 1;
+
+    n_iv = evbuffer_peek(buff, len, NULL, NULL, 0);
+    iv = safe_malloc((sizeof(struct evbuffer_iovec) * n_iv),
+        "Failed to allocate memory for evbuffer iovec(s), on buffer sign");
+
+    n_iv = evbuffer_peek(buff, len, NULL, iv, n_iv);
+
+    for (i = 0; i < n_iv; i++) {
+        if (ed25519_stream_update(stream, iv[i].iov_base, min(iv[i].iov_len, len))) {
+            free(iv);
+            ed25519_stream_free(stream);
+            return 1;
+        }
+        len -= iv[i].iov_len;
+    }
+
+    free(iv);
+    return ed25519_stream_sign(stream, buff);
+}
+
 // Takes last ED25519_SIGNATURE_LEN bytes as a ed25519 signature and validates
 // it against other data using provided ed25519 public key
-int ed25519_buffer_validate(struct evbuffer *buff, size_t len, uint8_t *pub_key) {
+int ed25519_buffer_validate(struct evbuffer *buff, size_t len, const uint8_t *pub_key) {
     int i, j, n_iv, i_sig;
     int is_err = 0, is_valid = 0;
     struct evbuffer_ptr ptr;
@@ -161,7 +209,7 @@ int ed25519_buffer_validate(struct evbuffer *buff, size_t len, uint8_t *pub_key)
 //  >> DATA IV  (16 bytes)
 //
 // returns rsa buffer error code
-enum rsa_buffer_errors rsa_buffer_encrypt(struct evbuffer *plain, uint8_t *der_pub_key, struct evbuffer *enc, int *enc_len) {
+enum rsa_buffer_errors rsa_buffer_encrypt(struct evbuffer *plain, const uint8_t *der_pub_key, struct evbuffer *enc, int *enc_len) {
     int i, temp_len;
     int err_code = RSA_BUFFER_ERR_NONE; // Set error code to no error
     uint32_t encrypted_len;             // Ciphertext length
@@ -253,7 +301,7 @@ enum rsa_buffer_errors rsa_buffer_encrypt(struct evbuffer *plain, uint8_t *der_p
 //  >> DATA KEY (AES 256 bytes)
 //  >> DATA IV  (16 bytes)
 //
-enum rsa_buffer_errors rsa_buffer_decrypt(struct evbuffer *enc_buff, uint8_t *der_priv_key, struct evbuffer *plain_buff, int *enc_len) {
+enum rsa_buffer_errors rsa_buffer_decrypt(struct evbuffer *enc_buff, const uint8_t *der_priv_key, struct evbuffer *plain_buff, int *enc_len) {
     int i;
     int err_code = RSA_BUFFER_ERR_NONE;
     size_t len;
@@ -7,14 +7,15 @@
 
 // Returns NULL on success or empty command, returns error string on error
 const char * cmd_parse(const struct cmd_template *cmds, int cmdc, const char *cmdstr) {
-    int i, argc;
-    char *input, **argv, *res;
+    int i, argc, len, rest_len;
+    char *input, **argv, *res, *rest;
     static char error_str[CMD_MAX_ERR_LEN];
 
     res = NULL;
     argv = array(char*);
     input = array(char);
     array_strcpy(input, cmdstr, -1);
+    len = strlen(cmdstr);
 
     if (array_set(argv, 0, strtok(input, " \n")) == NULL)
         goto end;
@@ -30,10 +31,32 @@ const char * cmd_parse(const struct cmd_template *cmds, int cmdc, const char *cm
         goto end;
     }
 
-    for (argc = 1; array_set(argv, argc, strtok(NULL, " \n")) != NULL; argc++)
-        /* Do nothing */;
+    if (cmds[i].raw) {
+        // Rest of the line is one argument, only surrounding whitespace is removed
+        rest = argv[0] + strlen(argv[0]);
+        if (rest - input < len)
+            rest += 1 + strspn(rest + 1, " \n");
 
-    if (argc - 1 != cmds[i].arg_cnt) {
+        rest_len = strlen(rest);
+        while (rest_len > 0 && strchr(" \n", rest[rest_len - 1]))
+            rest[--rest_len] = '\0';
+
+        argc = (rest_len > 0) ? 2 : 1;
+        array_set(argv, 1, rest_len > 0 ? rest : NULL);
+        array_set(argv, argc, NULL);
+    } else {
+        for (argc = 1; array_set(argv, argc, strtok(NULL, " \n")) != NULL; argc++)
+            /* Do nothing */;
+    }
+
+    if (cmds[i].arg_cnt < 0 && argc - 1 < -cmds[i].arg_cnt) {
+        snprintf(error_str, CMD_MAX_ERR_LEN, 
+            "Wrong number of arguments for command %s, expected at least %d but got %d", cmds[i].name, -cmds[i].arg_cnt, argc - 1);
+        res = error_str;
+        goto end;
+    }
+
+    if (cmds[i].arg_cnt >= 0 && argc - 1 != cmds[i].arg_cnt) {
         snprintf(error_str, CMD_MAX_ERR_LEN, 
             "Wrong number of arguments for command %s, expected %d but got %d", cmds[i].name, cmds[i].arg_cnt, argc - 1);
         res = error_str;
@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <zlib.h>
+#include <db_compress.h>
+#include <sys_memory.h>
+
+static int compress_enabled = 0;
+
+// Enable or disable compression of newly saved data, data which
+// is already stored is always readable regardless of this setting
+void db_compress_set_enabled(int enabled) {
+    compress_enabled = enabled;
+}
+
+// Check if compression of newly saved data is enabled
+int db_compress_is_enabled(void) {
+    return compress_enabled;
+}
+
+// Compress given data, returns newly allocated buffer and stores it's length
+// in out_len, returns NULL if compression is disabled or it would not make data smaller
+uint8_t * db_compress(const void *data, size_t len, size_t *out_len) {
+    uint8_t *buff;
+    uLongf buff_len;
+
+    if (!compress_enabled || len < DB_COMPRESS_MIN_LEN || len > UINT32_MAX)
+        return NULL;
+
+    buff_len = compressBound(len);
+    buff = safe_malloc(DB_COMPRESS_HEADER_LEN + buff_len, "Failed to allocate compression buffer");
+
+    if (compress2(buff + DB_COMPRESS_HEADER_LEN, &buff_len, data, len, Z_BEST_COMPRESSION) != Z_OK ||
+        DB_COMPRESS_HEADER_LEN + buff_len >= len
+    ) {
+        free(buff);
+        return NULL;
+    }
+
+    // Original length is stored in network byte order
+    buff[0] = (len >> 24) & 0xFF;
+    buff[1] = (len >> 16) & 0xFF;
+    buff[2] = (len >> 8) & 0xFF;
+    buff[3] = len & 0xFF;
+
+    *out_len = DB_COMPRESS_HEADER_LEN + buff_len;
+    return buff;
+}
+
+// Get the original length of data compressed with db_compress
+size_t db_compress_original_len(const uint8_t *data, size_t len) {
+    if (len < DB_COMPRESS_HEADER_LEN)
+        return 0;
+
+    return ((size_t)data[0] << 24) | ((size_t)data[1] << 16) |
+        ((size_t)data[2] << 8) | (size_t)data[3];
+}
+
+// Decompress data compressed with db_compress into dest which must hold
+// original length bytes, returns 0 on success and 1 if data is corrupted
+int db_decompress(const uint8_t *data, size_t len, void *dest) {
+    uLongf dest_len;
+
+    dest_len = db_compress_original_len(data, len);
+    if (dest_len == 0)
+        return 1;
+
+    if (uncompress(dest, &dest_len, data + DB_COMPRESS_HEADER_LEN, len - DB_COMPRESS_HEADER_LEN) != Z_OK)
+        return 1;
+
+    return dest_len != db_compress_original_len(data, len);
+}
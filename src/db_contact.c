@@ -1,15 +1,24 @@
 #include <onion.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <sqlite3.h>
 #include <db_init.h>
+#include <db_pool.h>
 #include <db_contact.h>
+#include <db_job.h>
 #include <sys_memory.h>
 #include <helpers.h>
+#include <hash_table.h>
 #include <constants.h>
 #include <debug.h>
 
+static const struct db_contact * db_contact_dir_stored(sqlite3 *db, int id);
+static void db_contact_dir_store(sqlite3 *db, struct db_contact *cont);
+static void db_contact_dir_remove(sqlite3 *db, int id);
+
 // Create new empty contact object
 struct db_contact * db_contact_new(void) {
     struct db_contact *cont;
@@ -26,34 +35,73 @@ void db_contact_free(struct db_contact *cont) {
     free(cont);
 }
 
-// Save given contact to database
+// Build update query for columns which differ from the stored contact, parameters are
+// numbered same as in the insert query, returns 0 if nothing changed
+static int db_contact_update_sql(
+    const struct db_contact *old, const struct db_contact *cont, char *sql, size_t sql_size
+) {
+    int n = 0;
+    size_t len;
+
+    len = snprintf(sql, sql_size, "UPDATE client_contacts SET ");
+
+    // Without stored copy every column is written
+#define DB_CONTACT_UPDATE_COL(cmp, col) \
+    if (!old || (cmp)) \
+        len += snprintf(sql + len, sql_size - len, "%s" col, n++ ? ", " : "")
+#define DB_CONTACT_UPDATE_MEM(field, col) \
+    DB_CONTACT_UPDATE_COL(memcmp(old->field, cont->field, sizeof(cont->field)), col)
+
+    DB_CONTACT_UPDATE_COL(old->status != cont->status, "status = ?1");
+    DB_CONTACT_UPDATE_COL(old->deleted != cont->deleted, "deleted = ?2");
+    DB_CONTACT_UPDATE_COL(strcmp(old->nickname, cont->nickname), "nickname = ?3");
+    DB_CONTACT_UPDATE_MEM(onion_address, "onion_address = ?4");
+    DB_CONTACT_UPDATE_MEM(onion_pub_key, "onion_pub_key = ?5");
+    DB_CONTACT_UPDATE_COL(old->has_mailbox != cont->has_mailbox, "has_mailbox = ?6");
+    DB_CONTACT_UPDATE_MEM(mailbox_id, "mailbox_id = ?7");
+    DB_CONTACT_UPDATE_MEM(mailbox_onion, "mailbox_onion = ?8");
+    DB_CONTACT_UPDATE_MEM(local_sig_key_pub, "local_sig_key_pub = ?9");
+    DB_CONTACT_UPDATE_MEM(local_sig_key_priv, "local_sig_key_priv = ?10");
+    DB_CONTACT_UPDATE_MEM(local_enc_key_pub, "local_enc_key_pub = ?11");
+    DB_CONTACT_UPDATE_MEM(local_enc_key_priv, "local_enc_key_priv = ?12");
+    DB_CONTACT_UPDATE_MEM(remote_sig_key_pub, "remote_sig_key_pub = ?13");
+    DB_CONTACT_UPDATE_MEM(remote_enc_key_pub, "remote_enc_key_pub = ?14");
+
+#undef DB_CONTACT_UPDATE_MEM
+#undef DB_CONTACT_UPDATE_COL
+
+    snprintf(sql + len, sql_size - len, " WHERE id = ?15");
+    return n;
+}
+
+// Save given contact to database, existing contacts only get changed columns updated,
+// when there is no stored copy in the directory of given connection every column is written
 void db_contact_save(sqlite3 *db, struct db_contact *cont) {
     const char *sql;
     sqlite3_stmt *stmt;
+    char sql_update[512];
 
     const char sql_insert[] = 
         "INSERT INTO client_contacts "
         "(status, deleted, nickname, onion_address, onion_pub_key, has_mailbox, mailbox_id, "
             "mailbox_onion, local_sig_key_pub, local_sig_key_priv, local_enc_key_pub, "
             "local_enc_key_priv, remote_sig_key_pub, remote_enc_key_pub) "
-        "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+        "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, ?13, ?14)";
 
-    const char sql_update[] = 
-        "UPDATE client_contacts SET "
-            "status = ?, deleted = ?, nickname = ?, onion_address = ?, onion_pub_key = ?, "
-            "has_mailbox = ?, mailbox_id = ?, mailbox_onion = ?, "
-            "local_sig_key_pub = ?, local_sig_key_priv = ?, local_enc_key_pub = ?, "
-            "local_enc_key_priv = ?, remote_sig_key_pub = ?, remote_enc_key_pub = ? "
-        "WHERE id = ?";
+    // Extract onion key from given onion address
+    onion_extract_key(cont->onion_address, cont->onion_pub_key);
 
-    sql = (cont->id > 0) ? sql_update : sql_insert;
+    if (cont->id > 0) {
+        if (!db_contact_update_sql(db_contact_dir_stored(db, cont->id), cont, sql_update, sizeof(sql_update)))
+            return;
+        sql = sql_update;
+    } else {
+        sql = sql_insert;
+    }
 
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to save database contact");
 
-    // Extract onion key from given onion address
-    onion_extract_key(cont->onion_address, cont->onion_pub_key);
-
     if (
         SQLITE_OK != sqlite3_bind_int(stmt, 1, cont->status) ||
         SQLITE_OK != sqlite3_bind_int(stmt, 2, cont->deleted) ||
@@ -85,6 +133,7 @@ void db_contact_save(sqlite3 *db, struct db_contact *cont) {
         cont->id = sqlite3_last_insert_rowid(db);
 
     sqlite3_finalize(stmt);
+    db_contact_dir_store(db, cont);
 }
 
 // Process next step of statement, allocate and populate contact object with fetched data
@@ -151,61 +200,304 @@ static struct db_contact * db_contact_process_row(sqlite3 *db, sqlite3_stmt *stm
     return cont;
 }
 
-// Get contact by their local ID
-struct db_contact * db_contact_get_by_pk(sqlite3 *db, int id, struct db_contact *dest) {
-    sqlite3_stmt *stmt;
-    struct db_contact *cont;
+/**
+ * Contact directory, every contact row is kept in memory and indexed by primary
+ * key, onion address and remote signing key so lookups done while handling
+ * messages don't have to query and decode the row again. Each connection gets
+ * it's own directory, it is loaded on the first lookup through that connection
+ * and updated by save and delete functions called with it. Other connections may
+ * be open to the same database, so their directories are marked stale on every
+ * change and reloaded on their next lookup, entries are updated in place so
+ * references handed out earlier remain valid.
+ */
+struct db_contact_dir {
+    int stale;
+    struct hash_table *by_pk;
+    struct hash_table *by_onion;
+    struct hash_table *by_rsk_pub;
+};
+
+static struct hash_table *dirs = NULL;
+
+// Used when searching for another contact with the same key
+struct db_contact_dir_search {
+    size_t offset;
+    size_t key_len;
+    const struct db_contact *skip;
+    struct db_contact *found;
+};
+
+// Check if given key is all zeros (not yet set)
+static int db_contact_key_empty(const uint8_t *key, size_t len) {
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        if (key[i] != 0)
+            return 0;
+    return 1;
+}
 
-    const char sql[] = "SELECT * FROM client_contacts WHERE id = ?";
+// Add given entry to directory indexes, if other contact already owns
+// onion or signing key, contact with lower ID keeps the index
+static void db_contact_dir_index(struct db_contact_dir *dir, struct db_contact *entry) {
+    struct db_contact *owner;
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
-        sys_db_crash(db, "Failed to fetch database contact (by pk)");
+    hash_table_set(dir->by_pk, &(entry->id), sizeof(entry->id), entry);
 
-    if (sqlite3_bind_int(stmt, 1, id) != SQLITE_OK)
-        sys_db_crash(db, "Failed to bind contact id, when fetching");
+    owner = hash_table_get(dir->by_onion, entry->onion_address, ONION_ADDRESS_LEN);
+    if (!owner || owner->id > entry->id)
+        hash_table_set(dir->by_onion, entry->onion_address, ONION_ADDRESS_LEN, entry);
 
-    cont = db_contact_process_row(db, stmt, dest);
+    if (db_contact_key_empty(entry->remote_sig_key_pub, CLIENT_SIG_KEY_PUB_LEN))
+        return;
 
-    sqlite3_finalize(stmt);
-    return cont;
+    owner = hash_table_get(dir->by_rsk_pub, entry->remote_sig_key_pub, CLIENT_SIG_KEY_PUB_LEN);
+    if (!owner || owner->id > entry->id)
+        hash_table_set(dir->by_rsk_pub, entry->remote_sig_key_pub, CLIENT_SIG_KEY_PUB_LEN, entry);
 }
 
-// Get contact by ther onion address
-struct db_contact * db_contact_get_by_onion(sqlite3 *db, const char *onion_address, struct db_contact *dest) {
-    sqlite3_stmt *stmt;
-    struct db_contact *cont;
+// Find contact other than the skipped one with same key on given offset
+static void db_contact_dir_search_cb(const void *key, size_t key_len, void *value, void *cbarg) {
+    struct db_contact *cont = value;
+    struct db_contact_dir_search *search = cbarg;
 
-    const char sql[] = "SELECT * FROM client_contacts WHERE onion_address = ?";
+    if (cont == search->skip)
+        return;
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
-        sys_db_crash(db, "Failed to fetch database contact (by onion)");
+    if (memcmp((uint8_t *)cont + search->offset, (uint8_t *)search->skip + search->offset, search->key_len))
+        return;
+
+    if (!search->found || search->found->id > cont->id)
+        search->found = cont;
+}
 
-    if (sqlite3_bind_text(stmt, 1, onion_address, ONION_ADDRESS_LEN, NULL) != SQLITE_OK)
-        sys_db_crash(db, "Failed to bind contact onion address, when fetching");
+// Remove given key from index if it belongs to given entry, if some other
+// contact has the same key it will take over the index
+static void db_contact_dir_unindex_key(
+    struct db_contact_dir *dir,
+    struct hash_table *index,
+    struct db_contact *entry,
+    size_t offset,
+    size_t key_len
+) {
+    const uint8_t *key = (uint8_t *)entry + offset;
+    struct db_contact_dir_search search = { offset, key_len, entry, NULL };
+
+    if (hash_table_get(index, key, key_len) != entry)
+        return;
 
-    cont = db_contact_process_row(db, stmt, dest);
+    hash_table_remove(index, key, key_len);
+    hash_table_foreach(dir->by_pk, db_contact_dir_search_cb, &search);
 
-    sqlite3_finalize(stmt);
-    return cont;
+    if (search.found)
+        hash_table_set(index, key, key_len, search.found);
 }
 
-// Get contact by ther remote signing key public
-struct db_contact * db_contact_get_by_rsk_pub(sqlite3 *db, uint8_t *key, struct db_contact *dest) {
+// Remove given entry from all directory indexes
+static void db_contact_dir_unindex(struct db_contact_dir *dir, struct db_contact *entry) {
+    hash_table_remove(dir->by_pk, &(entry->id), sizeof(entry->id));
+
+    db_contact_dir_unindex_key(dir, dir->by_onion, entry,
+        offsetof(struct db_contact, onion_address), ONION_ADDRESS_LEN);
+    db_contact_dir_unindex_key(dir, dir->by_rsk_pub, entry,
+        offsetof(struct db_contact, remote_sig_key_pub), CLIENT_SIG_KEY_PUB_LEN);
+}
+
+// Free directory entry
+static void db_contact_dir_free_cb(const void *key, size_t key_len, void *value, void *cbarg) {
+    db_contact_free(value);
+}
+
+// Free directory of one connection
+static void db_contact_dir_free_db_cb(const void *key, size_t key_len, void *value, void *cbarg) {
+    struct db_contact_dir *dir = value;
+
+    hash_table_foreach(dir->by_pk, db_contact_dir_free_cb, NULL);
+    hash_table_free(dir->by_pk);
+    hash_table_free(dir->by_onion);
+    hash_table_free(dir->by_rsk_pub);
+    free(dir);
+}
+
+// Drop in-memory contact directories of all connections, they will be reloaded on the next
+// lookup, directories of closed connections must be dropped before connection is opened again
+void db_contact_dir_clear(void) {
+    if (!dirs)
+        return;
+
+    hash_table_foreach(dirs, db_contact_dir_free_db_cb, NULL);
+    hash_table_free(dirs);
+    dirs = NULL;
+}
+
+// Get directory of given connection, NULL if it's not loaded
+static struct db_contact_dir * db_contact_dir_get(sqlite3 *db) {
+    if (!dirs)
+        return NULL;
+
+    return hash_table_get(dirs, &db, sizeof(db));
+}
+
+// Mark directories of all connections other than given one as stale
+static void db_contact_dir_stale_cb(const void *key, size_t key_len, void *value, void *cbarg) {
+    struct db_contact_dir *dir = value;
+
+    if (memcmp(key, &cbarg, sizeof(cbarg)) != 0)
+        dir->stale = 1;
+}
+
+// Contact was changed through given connection, directories of other connections
+// no longer match the database
+static void db_contact_dir_changed(sqlite3 *db) {
+    if (dirs)
+        hash_table_foreach(dirs, db_contact_dir_stale_cb, db);
+}
+
+// Load all contacts from given database into the directory of the connection, stale
+// directory is reloaded, entries of contacts which still exist are updated in place
+static struct db_contact_dir * db_contact_dir_load(sqlite3 *db) {
+    sqlite3 *rdb;
     sqlite3_stmt *stmt;
-    struct db_contact *cont;
+    struct db_contact *entry, *old;
+    struct db_contact_dir *dir;
+    struct hash_table *old_by_pk = NULL;
 
-    const char sql[] = "SELECT * FROM client_contacts WHERE remote_sig_key_pub = ?";
+    const char sql[] = "SELECT * FROM client_contacts ORDER BY id";
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
-        sys_db_crash(db, "Failed to fetch database contact (by rsk pub)");
+    if ((dir = db_contact_dir_get(db)) && !dir->stale)
+        return dir;
 
-    if (sqlite3_bind_blob(stmt, 1, key, CLIENT_SIG_KEY_PUB_LEN, NULL) != SQLITE_OK)
-        sys_db_crash(db, "Failed to bind contact onion address, when fetching");
+    if (!dirs)
+        dirs = hash_table_new();
 
-    cont = db_contact_process_row(db, stmt, dest);
+    if (dir) {
+        old_by_pk = dir->by_pk;
+        hash_table_free(dir->by_onion);
+        hash_table_free(dir->by_rsk_pub);
+    } else {
+        dir = safe_malloc(sizeof(struct db_contact_dir), "Failed to allocate contact directory");
+        hash_table_set(dirs, &db, sizeof(db), dir);
+    }
+
+    dir->stale = 0;
+    dir->by_pk = hash_table_new();
+    dir->by_onion = hash_table_new();
+    dir->by_rsk_pub = hash_table_new();
+    rdb = db_pool_reader(db);
+
+    if (sqlite3_prepare_v2(rdb, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(rdb, "Failed to load contact directory");
+
+    while ((entry = db_contact_process_row(rdb, stmt, NULL))) {
+        // Entries of contacts which still exist are kept, so references remain valid
+        if (old_by_pk && (old = hash_table_get(old_by_pk, &(entry->id), sizeof(entry->id)))) {
+            hash_table_remove(old_by_pk, &(entry->id), sizeof(entry->id));
+            memcpy(old, entry, sizeof(struct db_contact));
+            db_contact_free(entry);
+            entry = old;
+        }
+        db_contact_dir_index(dir, entry);
+    }
 
     sqlite3_finalize(stmt);
-    return cont;
+
+    // Entries left in the old index were removed from the database
+    if (old_by_pk) {
+        hash_table_foreach(old_by_pk, db_contact_dir_free_cb, NULL);
+        hash_table_free(old_by_pk);
+    }
+    return dir;
+}
+
+// Get contact as it is currently stored through given connection, NULL if it is
+// not known, directory is not loaded just for this and it's never taken from
+// directory of another connection or from directory which is stale
+static const struct db_contact * db_contact_dir_stored(sqlite3 *db, int id) {
+    struct db_contact_dir *dir = db_contact_dir_get(db);
+
+    if (!dir || dir->stale)
+        return NULL;
+
+    return hash_table_get(dir->by_pk, &id, sizeof(id));
+}
+
+// Store saved contact into directory, existing entry is updated in place
+// so references handed out earlier remain valid
+static void db_contact_dir_store(sqlite3 *db, struct db_contact *cont) {
+    struct db_contact *entry;
+    struct db_contact_dir *dir = db_contact_dir_get(db);
+
+    db_contact_dir_changed(db);
+
+    // Directory will pick up the change when it's loaded
+    if (!dir || dir->stale)
+        return;
+
+    if ((entry = hash_table_get(dir->by_pk, &(cont->id), sizeof(cont->id))))
+        db_contact_dir_unindex(dir, entry);
+    else
+        entry = db_contact_new();
+
+    memcpy(entry, cont, sizeof(struct db_contact));
+    db_contact_dir_index(dir, entry);
+}
+
+// Remove deleted contact from the directory
+static void db_contact_dir_remove(sqlite3 *db, int id) {
+    struct db_contact *entry;
+    struct db_contact_dir *dir = db_contact_dir_get(db);
+
+    db_contact_dir_changed(db);
+
+    if (!dir || dir->stale)
+        return;
+
+    if ((entry = hash_table_get(dir->by_pk, &id, sizeof(id)))) {
+        db_contact_dir_unindex(dir, entry);
+        db_contact_free(entry);
+    }
+}
+
+// Copy contact from the directory into dest, or newly allocated object
+static struct db_contact * db_contact_dir_copy(const struct db_contact *entry, struct db_contact *dest) {
+    if (!entry)
+        return NULL;
+
+    if (dest == NULL)
+        dest = db_contact_new();
+
+    memcpy(dest, entry, sizeof(struct db_contact));
+    return dest;
+}
+
+// Get shared reference to contact by their local ID
+const struct db_contact * db_contact_ref_by_pk(sqlite3 *db, int id) {
+    return hash_table_get(db_contact_dir_load(db)->by_pk, &id, sizeof(id));
+}
+
+// Get shared reference to contact by ther onion address
+const struct db_contact * db_contact_ref_by_onion(sqlite3 *db, const char *onion_address) {
+    return hash_table_get(db_contact_dir_load(db)->by_onion, onion_address, ONION_ADDRESS_LEN);
+}
+
+// Get shared reference to contact by ther remote signing key public
+const struct db_contact * db_contact_ref_by_rsk_pub(sqlite3 *db, const uint8_t *key) {
+    return hash_table_get(db_contact_dir_load(db)->by_rsk_pub, key, CLIENT_SIG_KEY_PUB_LEN);
+}
+
+// Get contact by their local ID
+struct db_contact * db_contact_get_by_pk(sqlite3 *db, int id, struct db_contact *dest) {
+    return db_contact_dir_copy(db_contact_ref_by_pk(db, id), dest);
+}
+
+// Get contact by ther onion address
+struct db_contact * db_contact_get_by_onion(sqlite3 *db, const char *onion_address, struct db_contact *dest) {
+    return db_contact_dir_copy(db_contact_ref_by_onion(db, onion_address), dest);
+}
+
+// Get contact by ther remote signing key public
+struct db_contact * db_contact_get_by_rsk_pub(sqlite3 *db, uint8_t *key, struct db_contact *dest) {
+    return db_contact_dir_copy(db_contact_ref_by_rsk_pub(db, key), dest);
 }
 
 // Pull new data from the database
@@ -227,6 +519,9 @@ struct db_contact ** db_contact_get_all(sqlite3 *db, int *n) {
     const char sql[] = "SELECT * FROM client_contacts";
     const char sql_count[] = "SELECT COUNT(*) AS n FROM client_contacts";
 
+    // Query is run on one of the read only connections
+    db = db_pool_reader(db);
+
     if (sqlite3_prepare_v2(db, sql_count, -1, &stmt, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to count all database contacts");
 
@@ -262,11 +557,114 @@ void db_contact_free_all(struct db_contact **conts, int n) {
     free(conts);
 }
 
-// Delete given contact
+// Get summaries of all contacts from the db, n will be set to length
+// of the array, if there are no contacts in the db NULL is returned
+struct db_contact_summary ** db_contact_get_summaries(sqlite3 *db, int *n) {
+    int i, len;
+    sqlite3_stmt *stmt;
+    struct db_contact_summary **conts;
+
+    // Only columns needed by summary are fetched, keys are never decoded,
+    // contacts without any messages have no conversation summary row
+    const char sql[] =
+        "SELECT c.id, c.status, c.deleted, c.has_mailbox, c.onion_address, c.nickname, "
+            "IFNULL(s.last_message_id, 0), IFNULL(s.n_unread, 0), "
+            "IFNULL(s.n_undelivered, 0), IFNULL(s.last_activity, 0) "
+        "FROM client_contacts AS c "
+        "LEFT JOIN client_contact_summary AS s ON s.contact_id = c.id "
+        "ORDER BY c.id";
+    const char sql_count[] = "SELECT COUNT(*) AS n FROM client_contacts";
+
+    // Query is run on one of the read only connections
+    db = db_pool_reader(db);
+
+    if (sqlite3_prepare_v2(db, sql_count, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to count all database contacts");
+
+    if (sqlite3_step(stmt) != SQLITE_ROW)
+        sys_db_crash(db, "Failed to count all database contacts (step)");
+
+    *n = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+
+    if (*n == 0) return NULL;
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to fetch contact summaries");
+
+    conts = safe_malloc((sizeof(struct db_contact_summary *) * (*n)),
+        "Failed to allocate memory for contact summary list");
+
+    for (i = 0; i < *n; i++) {
+        if (sqlite3_step(stmt) != SQLITE_ROW)
+            sys_db_crash(db, "Failed to fetch contact summaries (step)");
+
+        len = min(CLIENT_NICK_MAX_LEN, sqlite3_column_bytes(stmt, 5));
+        conts[i] = safe_malloc(sizeof(struct db_contact_summary) + len + 1,
+            "Failed to allocate contact summary");
+        memset(conts[i], 0, sizeof(struct db_contact_summary));
+
+        conts[i]->id = sqlite3_column_int(stmt, 0);
+        conts[i]->status = sqlite3_column_int(stmt, 1);
+        conts[i]->deleted = sqlite3_column_int(stmt, 2);
+        conts[i]->has_mailbox = sqlite3_column_int(stmt, 3);
+
+        memcpy(conts[i]->onion_address, sqlite3_column_text(stmt, 4),
+            min(ONION_ADDRESS_LEN, sqlite3_column_bytes(stmt, 4)));
+
+        conts[i]->nickname_len = len;
+        memcpy(conts[i]->nickname, sqlite3_column_text(stmt, 5), len);
+        conts[i]->nickname[len] = '\0';
+
+        conts[i]->last_message_id = sqlite3_column_int(stmt, 6);
+        conts[i]->n_unread = sqlite3_column_int(stmt, 7);
+        conts[i]->n_undelivered = sqlite3_column_int(stmt, 8);
+        conts[i]->last_activity = sqlite3_column_int64(stmt, 9);
+    }
+
+    sqlite3_finalize(stmt);
+    return conts;
+}
+
+// Free summary list fetched using db_contact_get_summaries()
+void db_contact_free_summaries(struct db_contact_summary **conts, int n) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        free(conts[i]);
+    }
+    free(conts);
+}
+
+// Mark all messages from given contact as read
+void db_contact_mark_read(sqlite3 *db, int contact_id) {
+    sqlite3_stmt *stmt;
+
+    // Row is only written when there is something to mark
+    const char sql[] =
+        "UPDATE client_contact_summary SET last_read_id = last_message_id, n_unread = 0 "
+        "WHERE contact_id = ? AND n_unread > 0";
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to mark contact messages as read");
+
+    if (sqlite3_bind_int(stmt, 1, contact_id) != SQLITE_OK)
+        sys_db_crash(db, "Failed to bind contact id, when marking messages read");
+
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+        sys_db_crash(db, "Failed to mark contact messages as read (step)");
+
+    sqlite3_finalize(stmt);
+}
+
+// Delete given contact, it's marked as deleted right away and removed
+// together with all it's messages by background job
 void db_contact_delete(sqlite3 *db, struct db_contact *cont) {
     sqlite3_stmt *stmt;
 
-    const char sql[] = "DELETE FROM client_contacts WHERE id = ?";
+    // Contact is only marked as deleted here, row and all it's
+    // messages are removed by background job
+    const char sql[] = "UPDATE client_contacts SET deleted = 1 WHERE id = ?";
 
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to delete database contact");
@@ -278,6 +676,9 @@ void db_contact_delete(sqlite3 *db, struct db_contact *cont) {
         sys_db_crash(db, "Failed to delete database contact (step)");
 
     sqlite3_finalize(stmt);
+    cont->deleted = 1;
+    db_contact_dir_remove(db, cont->id);
+    db_job_add(db, DB_JOB_DELETE_CONTACT, cont->id);
 }
 
 void db_contact_onion_extract_key(struct db_contact *cont) {
@@ -1,18 +1,140 @@
 #include <sqlite3.h>
 #include <db_init.h>
+#include <db_storage.h>
+#include <db_message.h>
 #include <stdlib.h>
 
 sqlite3 *dbg = NULL;
 
 // Try to open database file on global connection
 void db_init_global(const char *db_file_path) {
-    if (sqlite3_open(db_file_path, &dbg)) {
-        sys_db_crash(dbg, "Unable to start database engine");
+    dbg = db_storage_open(db_file_path);
+}
+
+// Check if table with given name exists in the database
+static int db_init_table_exists(sqlite3 *db, const char *name) {
+    int exists;
+    sqlite3_stmt *stmt;
+
+    const char sql[] = "SELECT 1 FROM sqlite_master WHERE name = ?";
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to check if table exists");
+
+    if (sqlite3_bind_text(stmt, 1, name, -1, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to bind table name");
+
+    exists = sqlite3_step(stmt) == SQLITE_ROW;
+
+    sqlite3_finalize(stmt);
+    return exists;
+}
+
+// Add column to the table if it does not exist, used to upgrade
+// databases created by older versions of the application
+static void db_init_add_column(sqlite3 *db, const char *table, const char *column, const char *decl) {
+    int exists;
+    char *sql;
+    sqlite3_stmt *stmt;
+
+    const char sql_check[] = "SELECT 1 FROM pragma_table_info(?) WHERE name = ?";
+
+    if (sqlite3_prepare_v2(db, sql_check, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to check if column exists");
+
+    if (
+        SQLITE_OK != sqlite3_bind_text(stmt, 1, table, -1, NULL) ||
+        SQLITE_OK != sqlite3_bind_text(stmt, 2, column, -1, NULL)
+    ) {
+        sys_db_crash(db, "Failed to bind table and column name");
     }
+
+    exists = sqlite3_step(stmt) == SQLITE_ROW;
+    sqlite3_finalize(stmt);
+
+    if (exists)
+        return;
+
+    sql = sqlite3_mprintf("ALTER TABLE %s ADD COLUMN %s %s", table, column, decl);
+
+    if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to add missing column");
+
+    sqlite3_free(sql);
+}
+
+// Check if search index is the old one which reads text directly from
+// the messages table, it can't index compressed text so it's replaced
+static int db_init_fts_is_external(sqlite3 *db) {
+    int external;
+    sqlite3_stmt *stmt;
+
+    const char sql[] =
+        "SELECT 1 FROM sqlite_master WHERE name = 'client_messages_fts' "
+        "AND sql LIKE '%content=''client_messages''%'";
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to check search index type");
+
+    external = sqlite3_step(stmt) == SQLITE_ROW;
+
+    sqlite3_finalize(stmt);
+    return external;
+}
+
+// Create tables of mailbox data only, used for mailbox storage shards
+void db_init_mailbox_schema(sqlite3 *db) {
+    // Mailbox accounts, contacts and messages, these tables may be split
+    // across multiple database files (see db_shard.h)
+    const char sql[] =
+        "CREATE TABLE IF NOT EXISTS mailbox_accounts ("
+            "id INTEGER,"
+            "mailbox_id BLOB,"
+            "signing_pub_key BLOB,"
+            "PRIMARY KEY(id AUTOINCREMENT)"
+        ");"
+        "CREATE TABLE IF NOT EXISTS mailbox_contacts ("
+            "id INTEGER,"
+            "account_id INTEGER,"
+            "signing_pub_key BLOB,"
+            "PRIMARY KEY(id AUTOINCREMENT),"
+            "FOREIGN KEY(account_id) REFERENCES mailbox_accounts(id) ON DELETE CASCADE"
+        ");"
+        "CREATE TABLE IF NOT EXISTS mailbox_messages ("
+            "id INTEGER,"
+            "account_id INTEGER,"
+            "contact_id INTEGER,"
+            "global_id BLOB,"
+            "data BLOB,"
+            "data_format INTEGER DEFAULT 0,"
+            "PRIMARY KEY(id AUTOINCREMENT),"
+            "FOREIGN KEY(account_id) REFERENCES mailbox_accounts(id) ON DELETE CASCADE,"
+            "FOREIGN KEY(contact_id) REFERENCES mailbox_contacts(id) ON DELETE CASCADE"
+        ");"
+
+        // Used to look messages up by global ID
+        "CREATE INDEX IF NOT EXISTS mailbox_messages_account_global_id "
+            "ON mailbox_messages (account_id, global_id);"
+        // Used to look mailbox accounts and their contacts up
+        "CREATE INDEX IF NOT EXISTS mailbox_accounts_mailbox_id "
+            "ON mailbox_accounts (mailbox_id);"
+        "CREATE INDEX IF NOT EXISTS mailbox_contacts_account_key "
+            "ON mailbox_contacts (account_id, signing_pub_key);"
+
+        "PRAGMA foreign_keys = ON;"
+    ;
+
+    if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to init mailbox database schema");
+
+    // Columns added after the first version
+    db_init_add_column(db, "mailbox_messages", "data_format", "INTEGER DEFAULT 0");
 }
 
 // Create database schema
 void db_init_schema(sqlite3 *db) {
+    int fts_exists;
+    int summary_exists;
 
     const char sql[] = 
         "CREATE TABLE IF NOT EXISTS options ("
@@ -52,6 +174,9 @@ void db_init_schema(sqlite3 *db) {
             "body_nick TEXT,"
             "body_mbox_id BLOB,"
             "body_mbox_onion TEXT,"
+            "body_format INTEGER DEFAULT 0,"
+            "attempts INTEGER DEFAULT 0,"
+            "next_attempt INTEGER DEFAULT 0,"
             "PRIMARY KEY(id AUTOINCREMENT),"
             "FOREIGN KEY(contact_id) REFERENCES client_contacts(id) ON DELETE CASCADE"
         ");"
@@ -61,33 +186,163 @@ void db_init_schema(sqlite3 *db) {
             "uses_left INTEGER,"
             "PRIMARY KEY(id AUTOINCREMENT)"
         ");"
-        "CREATE TABLE IF NOT EXISTS mailbox_accounts ("
+        // Deletions of large amount of rows done in background (see db_job.h)
+        "CREATE TABLE IF NOT EXISTS delete_jobs ("
             "id INTEGER,"
-            "mailbox_id BLOB,"
-            "signing_pub_key BLOB,"
+            "kind INTEGER,"
+            "target_id INTEGER,"
+            "n_deleted INTEGER DEFAULT 0,"
             "PRIMARY KEY(id AUTOINCREMENT)"
         ");"
-        "CREATE TABLE IF NOT EXISTS mailbox_contacts ("
-            "id INTEGER,"
-            "account_id INTEGER,"
-            "signing_pub_key BLOB,"
-            "PRIMARY KEY(id AUTOINCREMENT),"
-            "FOREIGN KEY(account_id) REFERENCES mailbox_accounts(id) ON DELETE CASCADE"
+
+        // Used to rebuild global ID filters and look messages up by global ID
+        "CREATE INDEX IF NOT EXISTS client_messages_global_id "
+            "ON client_messages (global_id);"
+        // Used to find messages of given contact, newest first
+        "CREATE INDEX IF NOT EXISTS client_messages_contact "
+            "ON client_messages (contact_id, id);"
+        // Used by outbox to find contacts with undelivered messages
+        "CREATE INDEX IF NOT EXISTS client_messages_outbox "
+            "ON client_messages (contact_id) WHERE status = 0;"
+
+        "PRAGMA foreign_keys = ON;"
+    ;
+
+    // Full text index over text messages, it does not store the text
+    // itself and it is kept in sync by triggers, since text may be
+    // compressed triggers pass it through db_message_text function
+    // which every connection writing messages has to register
+    const char sql_fts[] =
+        "CREATE VIRTUAL TABLE IF NOT EXISTS client_messages_fts USING fts5("
+            "body_text,"
+            "content=''"
         ");"
-        "CREATE TABLE IF NOT EXISTS mailbox_messages ("
-            "id INTEGER,"
-            "account_id INTEGER,"
+        "CREATE TRIGGER IF NOT EXISTS client_messages_fts_insert "
+        "AFTER INSERT ON client_messages WHEN new.type = 1 BEGIN "
+            "INSERT INTO client_messages_fts (rowid, body_text) "
+                "VALUES (new.id, db_message_text(new.body_text, new.body_format));"
+        "END;"
+        "CREATE TRIGGER IF NOT EXISTS client_messages_fts_delete "
+        "AFTER DELETE ON client_messages WHEN old.type = 1 BEGIN "
+            "INSERT INTO client_messages_fts (client_messages_fts, rowid, body_text) "
+                "VALUES ('delete', old.id, db_message_text(old.body_text, old.body_format));"
+        "END;"
+        "CREATE TRIGGER IF NOT EXISTS client_messages_fts_update "
+        "AFTER UPDATE OF type, body_text, body_format ON client_messages "
+        "WHEN old.type IS NOT new.type OR old.body_text IS NOT new.body_text "
+            "OR old.body_format IS NOT new.body_format BEGIN "
+            "INSERT INTO client_messages_fts (client_messages_fts, rowid, body_text) "
+                "SELECT 'delete', old.id, db_message_text(old.body_text, old.body_format) "
+                "WHERE old.type = 1;"
+            "INSERT INTO client_messages_fts (rowid, body_text) "
+                "SELECT new.id, db_message_text(new.body_text, new.body_format) "
+                "WHERE new.type = 1;"
+        "END;"
+    ;
+
+    // Conversation state of each contact, kept up to date by triggers so the
+    // contact list doesn't have to aggregate messages, unread are text messages
+    // from the friend newer than last_read_id, undelivered are messages with
+    // status 0 (DB_MESSAGE_STATUS_UNDELIVERED)
+    const char sql_summary[] =
+        "CREATE TABLE IF NOT EXISTS client_contact_summary ("
             "contact_id INTEGER,"
-            "global_id BLOB,"
-            "data BLOB,"
-            "PRIMARY KEY(id AUTOINCREMENT),"
-            "FOREIGN KEY(account_id) REFERENCES mailbox_accounts(id) ON DELETE CASCADE,"
-            "FOREIGN KEY(contact_id) REFERENCES mailbox_contacts(id) ON DELETE CASCADE"
+            "last_message_id INTEGER DEFAULT 0,"
+            "last_read_id INTEGER DEFAULT 0,"
+            "n_unread INTEGER DEFAULT 0,"
+            "n_undelivered INTEGER DEFAULT 0,"
+            "last_activity INTEGER DEFAULT 0,"
+            "PRIMARY KEY(contact_id),"
+            "FOREIGN KEY(contact_id) REFERENCES client_contacts(id) ON DELETE CASCADE"
         ");"
+        "CREATE TRIGGER IF NOT EXISTS client_contact_summary_insert "
+        "AFTER INSERT ON client_messages BEGIN "
+            "INSERT OR IGNORE INTO client_contact_summary (contact_id) VALUES (new.contact_id);"
+            "UPDATE client_contact_summary SET "
+                "last_message_id = new.id,"
+                "n_unread = n_unread + (new.sender = 1 AND new.type = 1),"
+                "n_undelivered = n_undelivered + (new.status = 0),"
+                "last_activity = CAST(strftime('%s', 'now') AS INTEGER) "
+            "WHERE contact_id = new.contact_id;"
+        "END;"
+        "CREATE TRIGGER IF NOT EXISTS client_contact_summary_delete "
+        "AFTER DELETE ON client_messages BEGIN "
+            "UPDATE client_contact_summary SET "
+                "n_unread = n_unread - (old.sender = 1 AND old.type = 1 AND old.id > last_read_id),"
+                "n_undelivered = n_undelivered - (old.status = 0),"
+                "last_message_id = CASE WHEN last_message_id = old.id THEN IFNULL("
+                    "(SELECT MAX(id) FROM client_messages WHERE contact_id = old.contact_id), 0) "
+                    "ELSE last_message_id END "
+            "WHERE contact_id = old.contact_id;"
+        "END;"
+        "CREATE TRIGGER IF NOT EXISTS client_contact_summary_status "
+        "AFTER UPDATE OF status ON client_messages "
+        "WHEN (old.status = 0) IS NOT (new.status = 0) BEGIN "
+            "UPDATE client_contact_summary SET "
+                "n_undelivered = n_undelivered + (new.status = 0) - (old.status = 0) "
+            "WHERE contact_id = new.contact_id;"
+        "END;"
+    ;
 
-        "PRAGMA foreign_keys = ON;"
+    // Build summaries for messages saved before summary table existed,
+    // all existing messages are considered read
+    const char sql_summary_fill[] =
+        "INSERT INTO client_contact_summary "
+            "(contact_id, last_message_id, last_read_id, n_undelivered) "
+            "SELECT contact_id, MAX(id), MAX(id), SUM(status = 0) "
+            "FROM client_messages GROUP BY contact_id"
+    ;
+
+    // Replace search index created by older versions
+    const char sql_fts_drop[] =
+        "DROP TRIGGER IF EXISTS client_messages_fts_insert;"
+        "DROP TRIGGER IF EXISTS client_messages_fts_delete;"
+        "DROP TRIGGER IF EXISTS client_messages_fts_update;"
+        "DROP TABLE client_messages_fts;"
     ;
 
+    // Index messages saved before search index existed
+    const char sql_fts_fill[] =
+        "INSERT INTO client_messages_fts (rowid, body_text) "
+            "SELECT id, db_message_text(body_text, body_format) "
+            "FROM client_messages WHERE type = 1"
+    ;
+
+    // Functions used by triggers must exist on every connection
+    db_message_register_functions(db);
+
     if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to init database schema");
+
+    db_init_mailbox_schema(db);
+
+    // Columns added after the first version
+    db_init_add_column(db, "client_messages", "body_format", "INTEGER DEFAULT 0");
+    db_init_add_column(db, "client_messages", "attempts", "INTEGER DEFAULT 0");
+    db_init_add_column(db, "client_messages", "next_attempt", "INTEGER DEFAULT 0");
+
+    if (db_init_fts_is_external(db)) {
+        if (sqlite3_exec(db, sql_fts_drop, NULL, NULL, NULL) != SQLITE_OK)
+            sys_db_crash(db, "Failed to drop old message search index");
+    }
+
+    fts_exists = db_init_table_exists(db, "client_messages_fts");
+
+    if (sqlite3_exec(db, sql_fts, NULL, NULL, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to init message search index");
+
+    if (!fts_exists) {
+        if (sqlite3_exec(db, sql_fts_fill, NULL, NULL, NULL) != SQLITE_OK)
+            sys_db_crash(db, "Failed to build message search index");
+    }
+
+    summary_exists = db_init_table_exists(db, "client_contact_summary");
+
+    if (sqlite3_exec(db, sql_summary, NULL, NULL, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to init contact summary table");
+
+    if (!summary_exists) {
+        if (sqlite3_exec(db, sql_summary_fill, NULL, NULL, NULL) != SQLITE_OK)
+            sys_db_crash(db, "Failed to build contact summaries");
+    }
 }
\ No newline at end of file
@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <sqlite3.h>
+#include <db_init.h>
+#include <db_shard.h>
+#include <db_job.h>
+#include <debug.h>
+
+// Table rows of which are deleted in one step of a job
+struct db_job_step {
+    const char *table;
+    const char *column;
+};
+
+// Steps of mailbox account deletion, all tables are in account's shard
+static const struct db_job_step db_job_mb_account[] = {
+    { "mailbox_messages", "account_id" },
+    { "mailbox_contacts", "account_id" },
+    { "mailbox_accounts", "id" },
+    { NULL, NULL },
+};
+
+// Steps of client contact deletion
+static const struct db_job_step db_job_contact[] = {
+    { "client_messages", "contact_id" },
+    { "client_contacts", "id" },
+    { NULL, NULL },
+};
+
+// Unknown jobs have nothing to delete and are dropped
+static const struct db_job_step db_job_unknown[] = {
+    { NULL, NULL },
+};
+
+// Set to 0 once there are no jobs left, so idle runs don't query the database
+static struct {
+    sqlite3 *db;
+    int pending;
+} state = { NULL, 1 };
+
+// Add new deletion job, object should already be hidden from lookups
+void db_job_add(sqlite3 *db, enum db_job_kind kind, int target_id) {
+    sqlite3_stmt *stmt;
+
+    const char sql[] = "INSERT INTO delete_jobs (kind, target_id) VALUES (?, ?)";
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to add delete job");
+
+    if (
+        SQLITE_OK != sqlite3_bind_int(stmt, 1, kind) ||
+        SQLITE_OK != sqlite3_bind_int(stmt, 2, target_id)
+    ) {
+        sys_db_crash(db, "Failed to bind delete job fields");
+    }
+
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+        sys_db_crash(db, "Failed to add delete job (step)");
+
+    sqlite3_finalize(stmt);
+
+    state.db = db;
+    state.pending = 1;
+}
+
+// Delete next chunk of rows in given table, returns number of deleted rows
+static int db_job_delete_chunk(sqlite3 *db, const struct db_job_step *step, int target_id) {
+    int n;
+    char sql[256];
+    sqlite3_stmt *stmt;
+
+    snprintf(sql, sizeof(sql),
+        "DELETE FROM %s WHERE id IN (SELECT id FROM %s WHERE %s = ? LIMIT %d)",
+        step->table, step->table, step->column, DB_JOB_CHUNK_SIZE);
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to run delete job");
+
+    if (sqlite3_bind_int(stmt, 1, target_id) != SQLITE_OK)
+        sys_db_crash(db, "Failed to bind delete job target");
+
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+        sys_db_crash(db, "Failed to run delete job (step)");
+
+    n = sqlite3_changes(db);
+    sqlite3_finalize(stmt);
+    return n;
+}
+
+// Update job progress, or remove the job if it's done
+static void db_job_update(sqlite3 *db, int id, int n_deleted) {
+    sqlite3_stmt *stmt;
+
+    const char sql_progress[] = "UPDATE delete_jobs SET n_deleted = n_deleted + ? WHERE id = ?";
+    const char sql_done[] = "DELETE FROM delete_jobs WHERE id = ?";
+
+    if (sqlite3_prepare_v2(db, n_deleted ? sql_progress : sql_done, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to update delete job");
+
+    if (n_deleted && sqlite3_bind_int(stmt, 1, n_deleted) != SQLITE_OK)
+        sys_db_crash(db, "Failed to bind delete job progress");
+
+    if (sqlite3_bind_int(stmt, n_deleted ? 2 : 1, id) != SQLITE_OK)
+        sys_db_crash(db, "Failed to bind delete job id");
+
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+        sys_db_crash(db, "Failed to update delete job (step)");
+
+    sqlite3_finalize(stmt);
+}
+
+// Check if contact was restored (deleted flag removed) after it's deletion
+// job was added, job must not remove it's rows then
+static int db_job_contact_restored(sqlite3 *db, int contact_id) {
+    int restored;
+    sqlite3_stmt *stmt;
+
+    const char sql[] = "SELECT 1 FROM client_contacts WHERE id = ? AND deleted = 0";
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to check delete job contact");
+
+    if (sqlite3_bind_int(stmt, 1, contact_id) != SQLITE_OK)
+        sys_db_crash(db, "Failed to bind delete job contact id");
+
+    restored = sqlite3_step(stmt) == SQLITE_ROW;
+
+    sqlite3_finalize(stmt);
+    return restored;
+}
+
+// Run one chunk of the oldest job, returns 1 if there is more work to do
+int db_job_run(sqlite3 *db) {
+    int id, kind, target_id, n = 0;
+    sqlite3 *tdb;
+    sqlite3_stmt *stmt;
+    const struct db_job_step *step;
+
+    const char sql[] = "SELECT id, kind, target_id FROM delete_jobs ORDER BY id LIMIT 1";
+
+    if (state.db == db && !state.pending)
+        return 0;
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to fetch delete job");
+
+    if (sqlite3_step(stmt) != SQLITE_ROW) {
+        sqlite3_finalize(stmt);
+
+        state.db = db;
+        state.pending = 0;
+        return 0;
+    }
+
+    id = sqlite3_column_int(stmt, 0);
+    kind = sqlite3_column_int(stmt, 1);
+    target_id = sqlite3_column_int(stmt, 2);
+    sqlite3_finalize(stmt);
+
+    switch (kind) {
+        case DB_JOB_DELETE_MB_ACCOUNT:
+            step = db_job_mb_account;
+            tdb = db_shard_by_id(db, target_id);
+            break;
+        case DB_JOB_DELETE_CONTACT:
+            // Contact is checked before each chunk, it may be restored any time
+            if (db_job_contact_restored(db, target_id)) {
+                debug("Delete job %d canceled, contact %d was restored", id, target_id);
+                db_job_update(db, id, 0);
+                return 1;
+            }
+            step = db_job_contact;
+            tdb = db;
+            break;
+        default:
+            step = db_job_unknown;
+            tdb = db;
+    }
+
+    // Tables are emptied in order, so first step with rows left is the current one
+    for (; step->table && n == 0; step++)
+        n = db_job_delete_chunk(tdb, step, target_id);
+
+    debug("Delete job %d removed %d rows", id, n);
+    db_job_update(db, id, n);
+    return 1;
+}
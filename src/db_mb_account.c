@@ -1,11 +1,18 @@
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sqlite3.h>
 #include <helpers.h>
 #include <sys_memory.h>
 #include <db_init.h>
+#include <db_pool.h>
+#include <hash_table.h>
+#include <db_shard.h>
 #include <db_contact.h>
 #include <db_mb_account.h>
+#include <db_mb_contact.h>
+#include <db_mb_message.h>
+#include <db_job.h>
 #include <constants.h>
 
 // Create new empty account object
@@ -24,8 +31,76 @@ void db_mb_account_free(struct db_mb_account *acc) {
     free(acc);
 }
 
+/**
+ * Accounts by mailbox ID, every message stored on the mailbox and every fetch
+ * look the account up, so accounts which were found are kept in memory. Cache
+ * is updated by save and delete functions, same entries are also indexed by
+ * account id so old mailbox ID can be dropped when it's changed.
+ */
+static struct {
+    sqlite3 *db;
+    struct hash_table *by_mbid;
+    struct hash_table *by_id;
+} cache = { NULL, NULL, NULL };
+
+// Free cached account
+static void db_mb_account_cache_free_cb(const void *key, size_t key_len, void *value, void *cbarg) {
+    db_mb_account_free(value);
+}
+
+// Drop all cached accounts
+void db_mb_account_cache_clear(void) {
+    if (cache.by_mbid) {
+        hash_table_foreach(cache.by_mbid, db_mb_account_cache_free_cb, NULL);
+        hash_table_free(cache.by_mbid);
+        hash_table_free(cache.by_id);
+    }
+
+    cache.by_mbid = NULL;
+    cache.by_id = NULL;
+    cache.db = NULL;
+}
+
+// Store copy of given account into the cache
+static void db_mb_account_cache_store(sqlite3 *db, const struct db_mb_account *acc) {
+    struct db_mb_account *entry;
+
+    if (cache.db != db) {
+        db_mb_account_cache_clear();
+        cache.by_mbid = hash_table_new();
+        cache.by_id = hash_table_new();
+        cache.db = db;
+    }
+
+    // Account may be cached under the mailbox ID it had before
+    if ((entry = hash_table_get(cache.by_id, &(acc->id), sizeof(int)))) {
+        if (memcmp(entry->mailbox_id, acc->mailbox_id, MAILBOX_ID_LEN) != 0)
+            hash_table_remove(cache.by_mbid, entry->mailbox_id, MAILBOX_ID_LEN);
+    } else {
+        entry = db_mb_account_new();
+        hash_table_set(cache.by_id, &(acc->id), sizeof(int), entry);
+    }
+    memcpy(entry, acc, sizeof(struct db_mb_account));
+    hash_table_set(cache.by_mbid, entry->mailbox_id, MAILBOX_ID_LEN, entry);
+}
+
+// Remove given account from the cache
+static void db_mb_account_cache_remove(sqlite3 *db, const struct db_mb_account *acc) {
+    struct db_mb_account *entry;
+
+    if (cache.db != db)
+        return;
+
+    if ((entry = hash_table_get(cache.by_id, &(acc->id), sizeof(int)))) {
+        hash_table_remove(cache.by_mbid, entry->mailbox_id, MAILBOX_ID_LEN);
+        hash_table_remove(cache.by_id, &(acc->id), sizeof(int));
+        db_mb_account_free(entry);
+    }
+}
+
 // Save changes on given object to the database
 void db_mb_account_save(sqlite3 *db, struct db_mb_account *acc) {
+    sqlite3 *sdb;
     const char *sql;
     sqlite3_stmt *stmt;
 
@@ -40,28 +115,32 @@ void db_mb_account_save(sqlite3 *db, struct db_mb_account *acc) {
 
     sql = (acc->id > 0) ? sql_update : sql_insert;
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
-        sys_db_crash(db, "Failed to save mailbox account into database");
+    // New accounts are placed into the shard chosen by their mailbox ID
+    sdb = (acc->id > 0) ? db_shard_by_id(db, acc->id) : db_shard_by_mbid(db, acc->mailbox_id);
+
+    if (sqlite3_prepare_v2(sdb, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(sdb, "Failed to save mailbox account into database");
 
     if (
         SQLITE_OK != sqlite3_bind_blob(stmt, 1, acc->mailbox_id, MAILBOX_ID_LEN, NULL) ||
         SQLITE_OK != sqlite3_bind_blob(stmt, 2, acc->signing_pub_key, MAILBOX_ACCOUNT_KEY_PUB_LEN, NULL)
     ) {
-        sys_db_crash(db, "Failed to bind mailbox account fields");
+        sys_db_crash(sdb, "Failed to bind mailbox account fields");
     }
 
     if (acc->id > 0) {
         if (sqlite3_bind_int(stmt, 3, acc->id) != SQLITE_OK)
-            sys_db_crash(db, "Failed to bind mailbox account id");
+            sys_db_crash(sdb, "Failed to bind mailbox account id");
     }
 
     if (sqlite3_step(stmt) != SQLITE_DONE)
-        sys_db_crash(db, "Failed to save mailbox account into database (step)");
+        sys_db_crash(sdb, "Failed to save mailbox account into database (step)");
 
     if (acc->id == 0)
-        acc->id = sqlite3_last_insert_rowid(db);
+        acc->id = sqlite3_last_insert_rowid(sdb);
 
     sqlite3_finalize(stmt);
+    db_mb_account_cache_store(db, acc);
 }
 
 // Process next step of the statement and allocate or populate given object with row data
@@ -99,6 +178,9 @@ struct db_mb_account * db_mb_account_get_by_pk(sqlite3 *db, int id, struct db_mb
 
     const char sql[] = "SELECT * FROM mailbox_accounts WHERE id = ?";
 
+    // Query is run on one of the read only connections of account's shard
+    db = db_pool_reader(db_shard_by_id(db, id));
+
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to fetch mailbox account from database (by pk)");
 
@@ -111,20 +193,33 @@ struct db_mb_account * db_mb_account_get_by_pk(sqlite3 *db, int id, struct db_mb
     return acc;
 }
 
-// Get mailbox account by unique mailbox id
+// Get mailbox account by unique mailbox id, accounts found are kept in memory
 struct db_mb_account * db_mb_account_get_by_mbid(sqlite3 *db, uint8_t *mbid, struct db_mb_account *dest) {
+    sqlite3 *rdb;
     sqlite3_stmt *stmt;
     struct db_mb_account *acc;
 
     const char sql[] = "SELECT * FROM mailbox_accounts WHERE mailbox_id = ?";
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
-        sys_db_crash(db, "Failed to fetch mailbox account from database (by mailbox id)");
+    if (cache.db == db && (acc = hash_table_get(cache.by_mbid, mbid, MAILBOX_ID_LEN))) {
+        if (dest == NULL)
+            dest = db_mb_account_new();
+
+        memcpy(dest, acc, sizeof(struct db_mb_account));
+        return dest;
+    }
+
+    // Query is run on one of the read only connections of account's shard
+    rdb = db_pool_reader(db_shard_by_mbid(db, mbid));
+
+    if (sqlite3_prepare_v2(rdb, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(rdb, "Failed to fetch mailbox account from database (by mailbox id)");
 
     if (sqlite3_bind_blob(stmt, 1, mbid, MAILBOX_ID_LEN, NULL) != SQLITE_OK)
-        sys_db_crash(db, "Failed to bind mailbox account mailbox id, when fetching");
+        sys_db_crash(rdb, "Failed to bind mailbox account mailbox id, when fetching");
 
-    acc = db_mb_account_process_row(db, stmt, dest);
+    if ((acc = db_mb_account_process_row(rdb, stmt, dest)))
+        db_mb_account_cache_store(db, acc);
 
     sqlite3_finalize(stmt);
     return acc;
@@ -138,20 +233,29 @@ void db_mb_account_refresh(sqlite3 *db, struct db_mb_account *acc) {
     db_mb_account_get_by_pk(db, acc->id, acc);
 }
 
-// Delete given contact
+// Delete given account, it's hidden from lookups right away and it's rows
+// together with all contacts and messages are removed by background job
 void db_mb_account_delete(sqlite3 *db, struct db_mb_account *acc) {
+    sqlite3 *sdb;
     sqlite3_stmt *stmt;
 
-    const char sql[] = "DELETE FROM mailbox_accounts WHERE id = ?";
+    const char sql[] = "UPDATE mailbox_accounts SET mailbox_id = NULL WHERE id = ?";
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
-        sys_db_crash(db, "Failed to delete mailbox account");
+    db_mb_account_cache_remove(db, acc);
+    db_mb_contact_auth_drop(db, acc->id);
+    db_mb_message_hot_drop(db, acc->id);
+
+    sdb = db_shard_by_id(db, acc->id);
+
+    if (sqlite3_prepare_v2(sdb, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(sdb, "Failed to delete mailbox account");
 
     if (sqlite3_bind_int(stmt, 1, acc->id) != SQLITE_OK)
-        sys_db_crash(db, "Failed to bind mailbox account id, when deleting");
+        sys_db_crash(sdb, "Failed to bind mailbox account id, when deleting");
 
     if (sqlite3_step(stmt) != SQLITE_DONE)
-        sys_db_crash(db, "Failed to delete mailbox account (step)");
+        sys_db_crash(sdb, "Failed to delete mailbox account (step)");
 
     sqlite3_finalize(stmt);
+    db_job_add(db, DB_JOB_DELETE_MB_ACCOUNT, acc->id);
 }
\ No newline at end of file
@@ -1,11 +1,16 @@
 #include <stdint.h>
+#include <string.h>
 #include <sqlite3.h>
 #include <helpers.h>
 #include <sys_memory.h>
 #include <db_init.h>
+#include <db_pool.h>
+#include <hash_table.h>
+#include <db_shard.h>
 #include <db_contact.h>
 #include <db_mb_account.h>
 #include <db_mb_contact.h>
+#include <db_mb_message.h>
 #include <constants.h>
 
 // Create new empty contact object
@@ -24,8 +29,137 @@ void db_mb_contact_free(struct db_mb_contact *cont) {
     free(cont);
 }
 
+/**
+ * Authorization index, contacts are kept in memory grouped by account and
+ * indexed by their signing key, so checking if sender of the message stored
+ * on the mailbox is allowed to do so is a hash lookup. Contacts of an account
+ * are loaded all at once on the first lookup for that account and are updated
+ * by save and delete functions. Contacts never move to another account.
+ */
+static struct {
+    sqlite3 *db;
+    struct hash_table *by_account;
+} auth = { NULL, NULL };
+
+static struct db_mb_contact * db_mb_contact_process_row(sqlite3 *db, sqlite3_stmt *stmt, struct db_mb_contact *dest);
+
+// Free cached contact
+static void db_mb_contact_auth_free_cb(const void *key, size_t key_len, void *value, void *cbarg) {
+    db_mb_contact_free(value);
+}
+
+// Free contacts of one account
+static void db_mb_contact_auth_free_table(struct hash_table *by_key) {
+    if (!by_key)
+        return;
+
+    hash_table_foreach(by_key, db_mb_contact_auth_free_cb, NULL);
+    hash_table_free(by_key);
+}
+
+// Free contacts of one account, called for each account in the index
+static void db_mb_contact_auth_free_account_cb(const void *key, size_t key_len, void *value, void *cbarg) {
+    db_mb_contact_auth_free_table(value);
+}
+
+// Drop the whole authorization index
+void db_mb_contact_auth_clear(void) {
+    if (auth.by_account) {
+        hash_table_foreach(auth.by_account, db_mb_contact_auth_free_account_cb, NULL);
+        hash_table_free(auth.by_account);
+    }
+
+    auth.by_account = NULL;
+    auth.db = NULL;
+}
+
+// Forget cached contacts of given account, they are loaded again on the next lookup
+void db_mb_contact_auth_drop(sqlite3 *db, int account_id) {
+    if (auth.db != db)
+        return;
+
+    db_mb_contact_auth_free_table(hash_table_get(auth.by_account, &account_id, sizeof(account_id)));
+    hash_table_remove(auth.by_account, &account_id, sizeof(account_id));
+}
+
+// Get contacts of given account indexed by signing key, if they are
+// not in memory yet all contacts of the account are loaded
+static struct hash_table * db_mb_contact_auth_load(sqlite3 *db, int account_id) {
+    sqlite3 *rdb;
+    sqlite3_stmt *stmt;
+    struct hash_table *by_key;
+    struct db_mb_contact *cont;
+
+    const char sql[] = "SELECT * FROM mailbox_contacts WHERE account_id = ?";
+
+    if (auth.db != db) {
+        db_mb_contact_auth_clear();
+        auth.by_account = hash_table_new();
+        auth.db = db;
+    }
+
+    if ((by_key = hash_table_get(auth.by_account, &account_id, sizeof(account_id))))
+        return by_key;
+
+    by_key = hash_table_new();
+    rdb = db_pool_reader(db_shard_by_id(db, account_id));
+
+    if (sqlite3_prepare_v2(rdb, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(rdb, "Failed to load mailbox contacts of account");
+
+    if (sqlite3_bind_int(stmt, 1, account_id) != SQLITE_OK)
+        sys_db_crash(rdb, "Failed to bind account id, when loading mailbox contacts");
+
+    while ((cont = db_mb_contact_process_row(rdb, stmt, NULL))) {
+        // Older versions could store the same contact more than once
+        db_mb_contact_free(hash_table_get(by_key, cont->signing_pub_key, CLIENT_SIG_KEY_PUB_LEN));
+        hash_table_set(by_key, cont->signing_pub_key, CLIENT_SIG_KEY_PUB_LEN, cont);
+    }
+
+    sqlite3_finalize(stmt);
+
+    hash_table_set(auth.by_account, &account_id, sizeof(account_id), by_key);
+    return by_key;
+}
+
+// Store copy of saved contact into the index, if it's account is loaded
+static void db_mb_contact_auth_store(sqlite3 *db, const struct db_mb_contact *cont) {
+    struct hash_table *by_key;
+    struct db_mb_contact *entry;
+
+    if (auth.db != db)
+        return;
+
+    if (!(by_key = hash_table_get(auth.by_account, &(cont->account_id), sizeof(cont->account_id))))
+        return;
+
+    if (!(entry = hash_table_get(by_key, cont->signing_pub_key, CLIENT_SIG_KEY_PUB_LEN))) {
+        entry = db_mb_contact_new();
+        hash_table_set(by_key, cont->signing_pub_key, CLIENT_SIG_KEY_PUB_LEN, entry);
+    }
+    memcpy(entry, cont, sizeof(struct db_mb_contact));
+}
+
+// Remove deleted contact from the index
+static void db_mb_contact_auth_remove(sqlite3 *db, const struct db_mb_contact *cont) {
+    struct hash_table *by_key;
+    struct db_mb_contact *entry;
+
+    if (auth.db != db)
+        return;
+
+    if (!(by_key = hash_table_get(auth.by_account, &(cont->account_id), sizeof(cont->account_id))))
+        return;
+
+    if ((entry = hash_table_get(by_key, cont->signing_pub_key, CLIENT_SIG_KEY_PUB_LEN)) && entry->id == cont->id) {
+        hash_table_remove(by_key, cont->signing_pub_key, CLIENT_SIG_KEY_PUB_LEN);
+        db_mb_contact_free(entry);
+    }
+}
+
 // Save changes on given object to the database
 void db_mb_contact_save(sqlite3 *db, struct db_mb_contact *cont) {
+    sqlite3 *sdb;
     sqlite3_stmt *stmt;
     const char *sql;
 
@@ -39,28 +173,32 @@ void db_mb_contact_save(sqlite3 *db, struct db_mb_contact *cont) {
 
     sql = (cont->id > 0) ? sql_update : sql_insert;
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
-        sys_db_crash(db, "Failed to save mailbox contact into database");
+    // Contacts are stored in the same shard as their account
+    sdb = db_shard_by_id(db, cont->account_id);
+
+    if (sqlite3_prepare_v2(sdb, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(sdb, "Failed to save mailbox contact into database");
 
     if (
         SQLITE_OK != sqlite3_bind_int(stmt, 1, cont->account_id) ||
         SQLITE_OK != sqlite3_bind_blob(stmt, 2, cont->signing_pub_key, CLIENT_SIG_KEY_PUB_LEN, NULL)
     ) {
-        sys_db_crash(db, "Failed to bind mailbox contact fields");
+        sys_db_crash(sdb, "Failed to bind mailbox contact fields");
     }
 
     if (cont->id > 0) {
         if (sqlite3_bind_int(stmt, 3, cont->id) != SQLITE_OK)
-            sys_db_crash(db, "Failed to bind mailbox contact id");
+            sys_db_crash(sdb, "Failed to bind mailbox contact id");
     }
 
     if (sqlite3_step(stmt) != SQLITE_DONE)
-        sys_db_crash(db, "Failed to save mailbox contact into database (step)");
+        sys_db_crash(sdb, "Failed to save mailbox contact into database (step)");
 
     if (cont->id == 0)
-        cont->id = sqlite3_last_insert_rowid(db);
+        cont->id = sqlite3_last_insert_rowid(sdb);
 
     sqlite3_finalize(stmt);
+    db_mb_contact_auth_store(db, cont);
 }
 
 // Remove given contact from the database
@@ -70,6 +208,11 @@ void db_mb_contact_delete(sqlite3 *db, struct db_mb_contact *cont) {
     const char sql[] =
         "DELETE FROM mailbox_contacts WHERE id = ?";
 
+    // Contact messages are deleted together with the contact
+    db_mb_contact_auth_remove(db, cont);
+    db_mb_message_hot_drop(db, cont->account_id);
+    db = db_shard_by_id(db, cont->id);
+
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to delete mailbox conact");
 
@@ -89,6 +232,10 @@ void db_mb_contact_delete_all(sqlite3 *db, struct db_mb_account *acc) {
     const char sql[] =
         "DELETE FROM mailbox_contacts WHERE account_id = ?";
 
+    db_mb_contact_auth_drop(db, acc->id);
+    db_mb_message_hot_drop(db, acc->id);
+    db = db_shard_by_id(db, acc->id);
+
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to delete all mailbox conacts for given account");
 
@@ -133,6 +280,9 @@ struct db_mb_contact * db_mb_contact_get_by_pk(sqlite3 *db, int id, struct db_mb
     const char sql[] =
         "SELECT * FROM mailbox_contacts WHERE id = ?";
 
+    // Query is run on one of the read only connections of contact's shard
+    db = db_pool_reader(db_shard_by_id(db, id));
+
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to fetch mailbox contact (by pk)");
 
@@ -145,29 +295,23 @@ struct db_mb_contact * db_mb_contact_get_by_pk(sqlite3 *db, int id, struct db_mb
     return cont;
 }
 
-// Get mailbox contact by associated account and signing key
+// Get mailbox contact by associated account and signing key, all contacts
+// of the account are kept in memory after the first lookup
 struct db_mb_contact * db_mb_contact_get_by_acc_and_key(
     sqlite3 *db, struct db_mb_account *acc, uint8_t *key, struct db_mb_contact *dest
 ) {
-    sqlite3_stmt *stmt;
     struct db_mb_contact *cont;
 
-    const char sql[] =
-        "SELECT * FROM mailbox_contacts WHERE account_id = ? AND signing_pub_key = ?";
+    // Answered from the authorization index
+    cont = hash_table_get(db_mb_contact_auth_load(db, acc->id), key, CLIENT_SIG_KEY_PUB_LEN);
+    if (!cont)
+        return NULL;
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
-        sys_db_crash(db, "Failed to fetch mailbox contact (by acc and key)");
-
-    if (
-        SQLITE_OK != sqlite3_bind_int(stmt, 1, acc->id)  ||
-        SQLITE_OK != sqlite3_bind_blob(stmt, 2, key, CLIENT_SIG_KEY_PUB_LEN, NULL)
-    )
-        sys_db_crash(db, "Failed to bind mailbox contact fields, when fetching");
+    if (dest == NULL)
+        dest = db_mb_contact_new();
 
-    cont = db_mb_contact_process_row(db, stmt, dest);
-
-    sqlite3_finalize(stmt);
-    return cont;
+    memcpy(dest, cont, sizeof(struct db_mb_contact));
+    return dest;
 }
 
 // Pull new data from the database
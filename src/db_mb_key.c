@@ -1,4 +1,5 @@
 #include <db_init.h>
+#include <db_pool.h>
 #include <db_mb_key.h>
 #include <sqlite3.h>
 #include <stdint.h>
@@ -111,6 +112,9 @@ struct db_mb_key * db_mb_key_get_by_pk(sqlite3 *db, int id, struct db_mb_key *de
 
     const char sql[] = "SELECT * FROM mailbox_keys WHERE id = ?";
 
+    // Query is run on one of the read only connections
+    db = db_pool_reader(db);
+
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to fetch mailbox key from database (by pk)");
 
@@ -130,6 +134,9 @@ struct db_mb_key * db_mb_key_get_by_key(sqlite3 *db, uint8_t *access_key, struct
 
     const char sql[] = "SELECT * FROM mailbox_keys WHERE key = ?";
 
+    // Query is run on one of the read only connections
+    db = db_pool_reader(db);
+
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to fetch mailbox key from database (by key)");
 
@@ -161,6 +168,9 @@ struct db_mb_key ** db_mb_key_get_all(sqlite3 *db, int *n) {
     const char sql[] = "SELECT * FROM mailbox_keys";
     const char sql_count[] = "SELECT COUNT(*) FROM mailbox_keys";
 
+    // Query is run on one of the read only connections
+    db = db_pool_reader(db);
+
     if (sqlite3_prepare_v2(db, sql_count, -1, &stmt, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to count all mailbox keys");
 
@@ -1,15 +1,29 @@
 #include <stdint.h>
+#include <limits.h>
 #include <sqlite3.h>
 #include <stdlib.h>
 #include <helpers.h>
 #include <sys_memory.h>
 #include <db_init.h>
+#include <db_pool.h>
+#include <db_shard.h>
 #include <db_message.h>
 #include <db_mb_account.h>
 #include <db_mb_message.h>
 #include <constants.h>
+#include <arena.h>
+#include <db_compress.h>
+#include <prot_main.h>
+#include <bloom.h>
+#include <hash_table.h>
 #include <debug.h>
 
+// Offset of the mailbox id in the stored message container, it is followed
+// by the signing key and global id of the message which are all stored
+// in other columns or tables, so packed format leaves them out
+#define DB_MB_MESSAGE_PACK_OFFSET (PROT_HEADER_LEN + TRANSACTION_ID_LEN)
+#define DB_MB_MESSAGE_PACK_GAP (MAILBOX_ID_LEN + CLIENT_SIG_KEY_PUB_LEN + MESSAGE_ID_LEN)
+
 // Create new empty mailbox message object
 struct db_mb_message * db_mb_message_new(void) {
     struct db_mb_message *msg;
@@ -23,99 +37,696 @@ struct db_mb_message * db_mb_message_new(void) {
 // Free given mailbox message object, if you want to save it
 // call the save function first
 void db_mb_message_free(struct db_mb_message *msg) {
-    if (msg && msg->data)
-        free(msg->data);
+    // Messages allocated from an arena are freed with the arena
+    if (!msg || msg->arena)
+        return;
 
+    free(msg->data);
     free(msg);
 }
 
-// Set message content
-void db_mb_message_set_data(struct db_mb_message *msg, const uint8_t *data, int data_len) {
-    int i;
+// Make sure message data can hold data_len bytes
+static void db_mb_message_alloc_data(struct db_mb_message *msg, int data_len) {
     int new_len;
 
     new_len = (data_len / DB_MB_MESSAGE_CHUNK_SIZE + 1) * DB_MB_MESSAGE_CHUNK_SIZE;
     msg->data_len = data_len;
 
-    if (!msg->data) {
+    // Messages from an arena take new data from the arena too
+    if (msg->arena && (!msg->data || msg->data_n_chunks < new_len)) {
+        msg->data_n_chunks = new_len;
+        msg->data = arena_alloc(msg->arena, sizeof(uint8_t) * new_len);
+
+    } else if (!msg->data) {
         msg->data_n_chunks = new_len;
         msg->data = safe_malloc((sizeof(uint8_t) * new_len),
             "Failed to allocate mailbox message data");
 
-    } else if (msg->data_len < new_len) {
+    } else if (msg->data_n_chunks < new_len) {
         msg->data_n_chunks = new_len;
         msg->data = safe_realloc(msg->data, (sizeof(uint8_t) * new_len), 
             "Failed to realloc mailbox message data");
     }
+}
+
+// Set message content
+void db_mb_message_set_data(struct db_mb_message *msg, const uint8_t *data, int data_len) {
+    db_mb_message_alloc_data(msg, data_len);
+    memcpy(msg->data, data, data_len);
+}
+
+// Check if message data can be stored in packed format, only message
+// containers with global id matching the one of the message are packed
+static int db_mb_message_can_pack(struct db_mb_message *msg) {
+    if (msg->data_len <= DB_MB_MESSAGE_PACK_OFFSET + DB_MB_MESSAGE_PACK_GAP)
+        return 0;
+
+    return memcmp(msg->data + DB_MB_MESSAGE_PACK_OFFSET + MAILBOX_ID_LEN + CLIENT_SIG_KEY_PUB_LEN,
+        msg->global_id, MESSAGE_ID_LEN) == 0;
+}
+
+// Allocate copy of message data without the gap
+static uint8_t * db_mb_message_pack(struct db_mb_message *msg) {
+    uint8_t *packed;
+
+    packed = safe_malloc(msg->data_len - DB_MB_MESSAGE_PACK_GAP, "Failed to allocate packed mailbox message");
+
+    memcpy(packed, msg->data, DB_MB_MESSAGE_PACK_OFFSET);
+    memcpy(packed + DB_MB_MESSAGE_PACK_OFFSET,
+        msg->data + DB_MB_MESSAGE_PACK_OFFSET + DB_MB_MESSAGE_PACK_GAP,
+        msg->data_len - DB_MB_MESSAGE_PACK_OFFSET - DB_MB_MESSAGE_PACK_GAP);
+
+    return packed;
+}
+
+// Restore message container from packed data, mailbox id and signing
+// key are taken from the account and contact the message belongs to
+static void db_mb_message_unpack(
+    struct db_mb_message *msg, const uint8_t *packed, int packed_len,
+    const uint8_t *mailbox_id, const uint8_t *signing_pub_key
+) {
+    uint8_t *p;
+
+    db_mb_message_alloc_data(msg, packed_len + DB_MB_MESSAGE_PACK_GAP);
+
+    p = msg->data;
+    memcpy(p, packed, DB_MB_MESSAGE_PACK_OFFSET);
+    p += DB_MB_MESSAGE_PACK_OFFSET;
+    memcpy(p, mailbox_id, MAILBOX_ID_LEN);
+    p += MAILBOX_ID_LEN;
+    memcpy(p, signing_pub_key, CLIENT_SIG_KEY_PUB_LEN);
+    p += CLIENT_SIG_KEY_PUB_LEN;
+    memcpy(p, msg->global_id, MESSAGE_ID_LEN);
+    p += MESSAGE_ID_LEN;
+    memcpy(p, packed + DB_MB_MESSAGE_PACK_OFFSET, packed_len - DB_MB_MESSAGE_PACK_OFFSET);
+}
+
+/**
+ * Filters of global IDs of stored messages, one for each account. Messages
+ * clients send are almost always new, so lookup by global ID which misses the
+ * filter doesn't have to query the database. Each connection gets it's own
+ * filters, filter of the account is built on the first lookup for that account
+ * through that connection. Stored messages are added to filters of all
+ * connections, other connections may be open to the same database and extra
+ * IDs only cost a query on lookup.
+ */
+static struct hash_table *gid_filters = NULL;
+
+// Global ID of stored message which is added to filters of all connections
+struct db_mb_message_gid_filter_entry {
+    int account_id;
+    const uint8_t *gid;
+};
+
+// Free filter of one account
+static void db_mb_message_gid_filter_free_cb(const void *key, size_t key_len, void *value, void *cbarg) {
+    bloom_free(value);
+}
+
+// Free filters of one connection
+static void db_mb_message_gid_filter_free_db_cb(const void *key, size_t key_len, void *value, void *cbarg) {
+    hash_table_foreach(value, db_mb_message_gid_filter_free_cb, NULL);
+    hash_table_free(value);
+}
+
+// Drop in-memory global ID filters of all connections, they will be rebuilt on the next lookup,
+// filters of closed connections must be dropped before connection is opened again
+void db_mb_message_gid_filter_clear(void) {
+    if (!gid_filters)
+        return;
+
+    hash_table_foreach(gid_filters, db_mb_message_gid_filter_free_db_cb, NULL);
+    hash_table_free(gid_filters);
+    gid_filters = NULL;
+}
+
+// Get global ID filter of given account, filter is built from the database
+// if connection does not have it or if it has more messages than it was sized for
+static struct bloom * db_mb_message_gid_filter_load(sqlite3 *db, int account_id) {
+    int n;
+    sqlite3 *rdb;
+    sqlite3_stmt *stmt;
+    struct bloom *bf;
+    struct hash_table *by_account;
+
+    const char sql_count[] = "SELECT COUNT(*) FROM mailbox_messages WHERE account_id = ?";
+    const char sql[] = "SELECT global_id FROM mailbox_messages WHERE account_id = ?";
+
+    if (!gid_filters)
+        gid_filters = hash_table_new();
+
+    if (!(by_account = hash_table_get(gid_filters, &db, sizeof(db)))) {
+        by_account = hash_table_new();
+        hash_table_set(gid_filters, &db, sizeof(db), by_account);
+    }
+
+    bf = hash_table_get(by_account, &account_id, sizeof(account_id));
+    if (bf && !bloom_is_full(bf))
+        return bf;
+
+    bloom_free(bf);
+    rdb = db_pool_reader(db_shard_by_id(db, account_id));
+
+    if (sqlite3_prepare_v2(rdb, sql_count, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(rdb, "Failed to count mailbox messages");
+
+    if (sqlite3_bind_int(stmt, 1, account_id) != SQLITE_OK)
+        sys_db_crash(rdb, "Failed to bind account id when counting mb messages");
+
+    if (sqlite3_step(stmt) != SQLITE_ROW)
+        sys_db_crash(rdb, "Failed to count mailbox messages (step)");
+
+    n = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+
+    // Leave room for new messages
+    bf = bloom_new(max(n * 2, DB_MB_MESSAGE_GID_FILTER_MIN));
+
+    if (sqlite3_prepare_v2(rdb, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(rdb, "Failed to load mailbox message global IDs");
+
+    if (sqlite3_bind_int(stmt, 1, account_id) != SQLITE_OK)
+        sys_db_crash(rdb, "Failed to bind account id when loading mb message global IDs");
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        bloom_add(bf, sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0));
+    }
+
+    sqlite3_finalize(stmt);
+
+    hash_table_set(by_account, &account_id, sizeof(account_id), bf);
+    return bf;
+}
+
+/**
+ * Hot queue of recently stored messages. Fetch asks for all messages of the
+ * account and most accounts hold only a few messages which arrived shortly
+ * before, so copies of stored containers are kept in memory, per account and
+ * in one global queue (oldest first) used to keep total size under the cap.
+ * Messages are only ever evicted from the front, so queue of each account
+ * always holds it's newest messages, fetch takes them from memory and reads
+ * only older ones from the database. Number of messages each account has in
+ * the database is tracked too, if all of them are in the queue database is
+ * not touched at all.
+ */
+struct db_mb_message_hot {
+    int id;
+    int account_id;
+    int contact_id;
+    uint8_t global_id[MESSAGE_ID_LEN];
+
+    uint8_t *data;
+    int data_len;
+
+    struct db_mb_message_hot *acc_prev, *acc_next;
+    struct db_mb_message_hot *prev, *next;
+};
+
+struct db_mb_message_hot_account {
+    int n_stored;
+    int n_msgs;
+    struct db_mb_message_hot *first, *last;
+};
+
+static struct {
+    sqlite3 *db;
+    struct hash_table *by_account;
+
+    size_t n_bytes;
+    struct db_mb_message_hot *first, *last;
+} hot = { NULL, NULL, 0, NULL, NULL };
+
+// Free hot queue of one account
+static void db_mb_message_hot_free_cb(const void *key, size_t key_len, void *value, void *cbarg) {
+    free(value);
+}
+
+// Drop hot queues of all accounts, they are filled again as messages are stored
+void db_mb_message_hot_clear(void) {
+    struct db_mb_message_hot *entry;
+
+    while ((entry = hot.first)) {
+        hot.first = entry->next;
+        free(entry->data);
+        free(entry);
+    }
 
-    for (i = 0; i < data_len; i++) {
-        msg->data[i] = data[i];
+    if (hot.by_account) {
+        hash_table_foreach(hot.by_account, db_mb_message_hot_free_cb, NULL);
+        hash_table_free(hot.by_account);
     }
+
+    hot.by_account = NULL;
+    hot.db = NULL;
+    hot.n_bytes = 0;
+    hot.last = NULL;
+}
+
+// Get hot queue of given account, NULL if it's not tracked
+static struct db_mb_message_hot_account * db_mb_message_hot_account(sqlite3 *db, int account_id) {
+    if (hot.db != db) {
+        db_mb_message_hot_clear();
+        hot.by_account = hash_table_new();
+        hot.db = db;
+    }
+
+    return hash_table_get(hot.by_account, &account_id, sizeof(account_id));
+}
+
+// Start tracking given account which has n_stored messages in the database
+static struct db_mb_message_hot_account * db_mb_message_hot_account_new(
+    sqlite3 *db, int account_id, int n_stored
+) {
+    struct db_mb_message_hot_account *acc;
+
+    acc = safe_malloc(sizeof(struct db_mb_message_hot_account),
+        "Failed to allocate mailbox message hot queue");
+    memset(acc, 0, sizeof(struct db_mb_message_hot_account));
+    acc->n_stored = n_stored;
+
+    hash_table_set(hot.by_account, &account_id, sizeof(account_id), acc);
+    return acc;
+}
+
+// Remove given entry from both queues and free it
+static void db_mb_message_hot_unlink(
+    struct db_mb_message_hot_account *acc, struct db_mb_message_hot *entry
+) {
+    if (entry->acc_prev) entry->acc_prev->acc_next = entry->acc_next;
+    else acc->first = entry->acc_next;
+    if (entry->acc_next) entry->acc_next->acc_prev = entry->acc_prev;
+    else acc->last = entry->acc_prev;
+
+    if (entry->prev) entry->prev->next = entry->next;
+    else hot.first = entry->next;
+    if (entry->next) entry->next->prev = entry->prev;
+    else hot.last = entry->prev;
+
+    --acc->n_msgs;
+    hot.n_bytes -= entry->data_len;
+
+    free(entry->data);
+    free(entry);
+}
+
+// Find entry of given message in the account queue
+static struct db_mb_message_hot * db_mb_message_hot_find(struct db_mb_message_hot_account *acc, int id) {
+    struct db_mb_message_hot *entry;
+
+    for (entry = acc->first; entry != NULL; entry = entry->acc_next) {
+        if (entry->id == id)
+            return entry;
+    }
+    return NULL;
+}
+
+// Add newly stored message to the hot queue, returns memory message data has to be copied to
+// or NULL if message is not kept, oldest messages are evicted when account or global limit is reached
+static uint8_t * db_mb_message_hot_push(
+    sqlite3 *db, int id, int account_id, int contact_id, const uint8_t *gid, int data_len
+) {
+    int n;
+    sqlite3 *rdb;
+    sqlite3_stmt *stmt;
+    struct db_mb_message_hot *entry;
+    struct db_mb_message_hot_account *acc;
+
+    const char sql_count[] = "SELECT COUNT(*) FROM mailbox_messages WHERE account_id = ?";
+
+    if ((acc = db_mb_message_hot_account(db, account_id))) {
+        ++acc->n_stored;
+    } else {
+        // Count includes message which was just stored
+        rdb = db_pool_reader(db_shard_by_id(db, account_id));
+
+        if (sqlite3_prepare_v2(rdb, sql_count, -1, &stmt, NULL) != SQLITE_OK)
+            sys_db_crash(rdb, "Failed to count mailbox messages");
+
+        if (sqlite3_bind_int(stmt, 1, account_id) != SQLITE_OK)
+            sys_db_crash(rdb, "Failed to bind account id when counting mb messages");
+
+        if (sqlite3_step(stmt) != SQLITE_ROW)
+            sys_db_crash(rdb, "Failed to count mailbox messages (step)");
+
+        n = sqlite3_column_int(stmt, 0);
+        sqlite3_finalize(stmt);
+
+        acc = db_mb_message_hot_account_new(db, account_id, n);
+    }
+
+    // Message which alone takes a big part of the cap is left in the database,
+    // older messages are dropped too so queue still holds only the newest ones
+    if (data_len > DB_MB_MESSAGE_HOT_MAX_BYTES / 16) {
+        while (acc->first)
+            db_mb_message_hot_unlink(acc, acc->first);
+        return NULL;
+    }
+
+    entry = safe_malloc(sizeof(struct db_mb_message_hot), "Failed to allocate hot mailbox message");
+    entry->id = id;
+    entry->account_id = account_id;
+    entry->contact_id = contact_id;
+    memcpy(entry->global_id, gid, MESSAGE_ID_LEN);
+    entry->data = safe_malloc(data_len, "Failed to allocate hot mailbox message data");
+    entry->data_len = data_len;
+
+    entry->acc_next = NULL;
+    entry->acc_prev = acc->last;
+    if (acc->last) acc->last->acc_next = entry;
+    else acc->first = entry;
+    acc->last = entry;
+
+    entry->next = NULL;
+    entry->prev = hot.last;
+    if (hot.last) hot.last->next = entry;
+    else hot.first = entry;
+    hot.last = entry;
+
+    ++acc->n_msgs;
+    hot.n_bytes += data_len;
+
+    if (acc->n_msgs > DB_MB_MESSAGE_HOT_ACCOUNT_MAX)
+        db_mb_message_hot_unlink(acc, acc->first);
+
+    // New entry is never evicted here, it's smaller than the cap
+    while (hot.n_bytes > DB_MB_MESSAGE_HOT_MAX_BYTES) {
+        struct db_mb_message_hot *oldest = hot.first;
+        db_mb_message_hot_unlink(db_mb_message_hot_account(db, oldest->account_id), oldest);
+    }
+
+    return entry->data;
+}
+
+// Replace data of given message in the hot queue, if it's there
+static void db_mb_message_hot_update(sqlite3 *db, struct db_mb_message *msg) {
+    struct db_mb_message_hot *entry;
+    struct db_mb_message_hot_account *acc;
+
+    if (!(acc = db_mb_message_hot_account(db, msg->account_id)))
+        return;
+    if (!(entry = db_mb_message_hot_find(acc, msg->id)))
+        return;
+
+    hot.n_bytes += msg->data_len - entry->data_len;
+    entry->data = safe_realloc(entry->data, msg->data_len, "Failed to realloc hot mailbox message data");
+    entry->data_len = msg->data_len;
+    entry->contact_id = msg->contact_id;
+    memcpy(entry->data, msg->data, msg->data_len);
+}
+
+// Remove deleted message from the hot queue of it's account
+static void db_mb_message_hot_remove(sqlite3 *db, struct db_mb_message *msg) {
+    struct db_mb_message_hot *entry;
+    struct db_mb_message_hot_account *acc;
+
+    if (!(acc = db_mb_message_hot_account(db, msg->account_id)))
+        return;
+    if ((entry = db_mb_message_hot_find(acc, msg->id)))
+        db_mb_message_hot_unlink(acc, entry);
+
+    --acc->n_stored;
+}
+
+// Stop tracking messages of given account, must be called when account
+// messages are removed other than by db_mb_message_delete
+void db_mb_message_hot_drop(sqlite3 *db, int account_id) {
+    struct db_mb_message_hot_account *acc;
+
+    if (!(acc = db_mb_message_hot_account(db, account_id)))
+        return;
+
+    while (acc->first)
+        db_mb_message_hot_unlink(acc, acc->first);
+
+    hash_table_remove(hot.by_account, &account_id, sizeof(account_id));
+    free(acc);
+}
+
+// Copy messages from the hot queue of given account into msgs, oldest first
+static void db_mb_message_hot_copy(
+    struct db_mb_message_hot_account *acc, struct db_mb_message **msgs, struct arena *arena
+) {
+    int i;
+    struct db_mb_message *msg;
+    struct db_mb_message_hot *entry;
+
+    for (i = 0, entry = acc->first; entry != NULL; i++, entry = entry->acc_next) {
+        msg = arena_alloc(arena, sizeof(struct db_mb_message));
+        memset(msg, 0, sizeof(struct db_mb_message));
+        msg->arena = arena;
+
+        msg->id = entry->id;
+        msg->account_id = entry->account_id;
+        msg->contact_id = entry->contact_id;
+        memcpy(msg->global_id, entry->global_id, MESSAGE_ID_LEN);
+        db_mb_message_set_data(msg, entry->data, entry->data_len);
+
+        msgs[i] = msg;
+    }
+}
+
+// Add global ID of a stored message to filter of it's account on one connection
+static void db_mb_message_gid_filter_add_cb(const void *key, size_t key_len, void *value, void *cbarg) {
+    struct bloom *bf;
+    struct db_mb_message_gid_filter_entry *entry = cbarg;
+
+    bf = hash_table_get(value, &(entry->account_id), sizeof(entry->account_id));
+    if (bf && !bloom_maybe_contains(bf, entry->gid, MESSAGE_ID_LEN))
+        bloom_add(bf, entry->gid, MESSAGE_ID_LEN);
+}
+
+// Add global ID of a stored message to the filter of it's account on every connection,
+// only filters which are already built are updated
+static void db_mb_message_gid_filter_add(int account_id, const uint8_t *gid) {
+    struct db_mb_message_gid_filter_entry entry = { account_id, gid };
+
+    if (gid_filters)
+        hash_table_foreach(gid_filters, db_mb_message_gid_filter_add_cb, &entry);
 }
 
 // Save changes on given object to database
 void db_mb_message_save(sqlite3 *db, struct db_mb_message *msg) {
+    sqlite3 *sdb;
     sqlite3_stmt *stmt;
     const char *sql;
+    int packed;
 
     const char sql_insert[] = 
-        "INSERT INTO mailbox_messages (account_id, contact_id, global_id, data) "
-        "VALUES (?, ?, ?, ?)";
+        "INSERT INTO mailbox_messages (account_id, contact_id, global_id, data, data_format) "
+        "VALUES (?, ?, ?, ?, ?)";
 
     const char sql_update[] =
-        "UPDATE mailbox_messages SET account_id = ?, contact_id = ?, global_id = ?, data = ? "
+        "UPDATE mailbox_messages SET account_id = ?, contact_id = ?, global_id = ?, data = ?, "
+            "data_format = ? "
         "WHERE id = ?";
 
     sql = (msg->id > 0) ? sql_update : sql_insert;
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
-        sys_db_crash(db, "Failed to save mailbox message");
+    // Messages are stored in the same shard as their account, filters
+    // are still kept for the main connection
+    sdb = db_shard_by_id(db, msg->account_id);
+
+    if (sqlite3_prepare_v2(sdb, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(sdb, "Failed to save mailbox message");
+
+    // Encrypted part of the message does not compress, but fields
+    // which are already known don't have to be stored again
+    packed = db_compress_is_enabled() && db_mb_message_can_pack(msg);
 
     if (
         SQLITE_OK != sqlite3_bind_int(stmt, 1, msg->account_id) ||
         SQLITE_OK != sqlite3_bind_int(stmt, 2, msg->contact_id) ||
         SQLITE_OK != sqlite3_bind_blob(stmt, 3, msg->global_id, MESSAGE_ID_LEN, NULL) ||
-        SQLITE_OK != sqlite3_bind_blob(stmt, 4, msg->data, msg->data_len, NULL)
+        SQLITE_OK != sqlite3_bind_int(stmt, 5, packed ? DB_FORMAT_PACKED : DB_FORMAT_RAW)
     ) {
-        sys_db_crash(db, "Failed to bind mailbox message fields");
+        sys_db_crash(sdb, "Failed to bind mailbox message fields");
+    }
+
+    if (packed) {
+        if (sqlite3_bind_blob(stmt, 4, db_mb_message_pack(msg),
+            msg->data_len - DB_MB_MESSAGE_PACK_GAP, free) != SQLITE_OK
+        ) {
+            sys_db_crash(sdb, "Failed to bind mailbox message data");
+        }
+    } else {
+        if (sqlite3_bind_blob(stmt, 4, msg->data, msg->data_len, NULL) != SQLITE_OK)
+            sys_db_crash(sdb, "Failed to bind mailbox message data");
     }
 
     if (msg->id > 0) {
-        if (sqlite3_bind_int(stmt, 4, msg->id) != SQLITE_OK)
-            sys_db_crash(db, "Failed to bind mailbox message id");
+        if (sqlite3_bind_int(stmt, 6, msg->id) != SQLITE_OK)
+            sys_db_crash(sdb, "Failed to bind mailbox message id");
     }
 
     if (sqlite3_step(stmt) != SQLITE_DONE)
-        sys_db_crash(db, "Failed to save mailbox message (step)");
+        sys_db_crash(sdb, "Failed to save mailbox message (step)");
+
+    if (msg->id == 0) {
+        uint8_t *hot_data;
 
-    if (msg->id == 0)
-        msg->id = sqlite3_last_insert_rowid(db);
+        msg->id = sqlite3_last_insert_rowid(sdb);
 
+        hot_data = db_mb_message_hot_push(db, msg->id, msg->account_id,
+            msg->contact_id, msg->global_id, msg->data_len);
+        if (hot_data)
+            memcpy(hot_data, msg->data, msg->data_len);
+    } else {
+        db_mb_message_hot_update(db, msg);
+    }
+
+    db_mb_message_gid_filter_add(msg->account_id, msg->global_id);
     sqlite3_finalize(stmt);
 }
 
+// Write part of message container which starts at pos into the blob, when data
+// is packed part of the container which falls into the gap is skipped
+static void db_mb_message_store_part(
+    sqlite3 *db, sqlite3_blob *blob, const uint8_t *part, int len, int pos, int packed
+) {
+    int n;
+
+    if (packed) {
+        // Part before the gap is written as is
+        if (pos < DB_MB_MESSAGE_PACK_OFFSET) {
+            n = min(len, DB_MB_MESSAGE_PACK_OFFSET - pos);
+            if (sqlite3_blob_write(blob, part, n, pos) != SQLITE_OK)
+                sys_db_crash(db, "Failed to write mailbox message data (blob)");
+            part += n; pos += n; len -= n;
+        }
+        // Part in the gap is left out
+        if (pos < DB_MB_MESSAGE_PACK_OFFSET + DB_MB_MESSAGE_PACK_GAP) {
+            n = min(len, DB_MB_MESSAGE_PACK_OFFSET + DB_MB_MESSAGE_PACK_GAP - pos);
+            part += n; pos += n; len -= n;
+        }
+        pos -= DB_MB_MESSAGE_PACK_GAP;
+    }
+
+    if (len > 0 && sqlite3_blob_write(blob, part, len, pos) != SQLITE_OK)
+        sys_db_crash(db, "Failed to write mailbox message data (blob)");
+}
+
+// Store message container from given buffer as a new message of given account and contact,
+// data is written straight from the buffer memory into the database, returns id of the message
+int db_mb_message_store(
+    sqlite3 *db, int account_id, int contact_id, const uint8_t *gid, struct evbuffer *data
+) {
+    int i, n_iv, id, pos, data_len, packed = 0;
+    sqlite3 *sdb;
+    sqlite3_stmt *stmt;
+    sqlite3_blob *blob;
+    struct evbuffer_ptr ptr;
+    struct evbuffer_iovec *iv;
+    uint8_t *hot_data;
+    uint8_t data_gid[MESSAGE_ID_LEN];
+
+    const char sql[] =
+        "INSERT INTO mailbox_messages (account_id, contact_id, global_id, data, data_format) "
+        "VALUES (?, ?, ?, zeroblob(?), ?)";
+
+    data_len = evbuffer_get_length(data);
+
+    // Same rule as db_mb_message_can_pack, checked on the buffer
+    if (db_compress_is_enabled() && data_len > DB_MB_MESSAGE_PACK_OFFSET + DB_MB_MESSAGE_PACK_GAP) {
+        evbuffer_ptr_set(data, &ptr, DB_MB_MESSAGE_PACK_OFFSET + MAILBOX_ID_LEN +
+            CLIENT_SIG_KEY_PUB_LEN, EVBUFFER_PTR_SET);
+        evbuffer_copyout_from(data, &ptr, data_gid, MESSAGE_ID_LEN);
+        packed = memcmp(data_gid, gid, MESSAGE_ID_LEN) == 0;
+    }
+
+    sdb = db_shard_by_id(db, account_id);
+
+    // Row is inserted with empty data first, so both are in one savepoint
+    if (sqlite3_exec(sdb, "SAVEPOINT db_mb_message_store", NULL, NULL, NULL) != SQLITE_OK)
+        sys_db_crash(sdb, "Failed to start mailbox message store");
+
+    if (sqlite3_prepare_v2(sdb, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(sdb, "Failed to store mailbox message");
+
+    if (
+        SQLITE_OK != sqlite3_bind_int(stmt, 1, account_id) ||
+        SQLITE_OK != sqlite3_bind_int(stmt, 2, contact_id) ||
+        SQLITE_OK != sqlite3_bind_blob(stmt, 3, gid, MESSAGE_ID_LEN, NULL) ||
+        SQLITE_OK != sqlite3_bind_int(stmt, 4, packed ? data_len - DB_MB_MESSAGE_PACK_GAP : data_len) ||
+        SQLITE_OK != sqlite3_bind_int(stmt, 5, packed ? DB_FORMAT_PACKED : DB_FORMAT_RAW)
+    ) {
+        sys_db_crash(sdb, "Failed to bind mailbox message fields");
+    }
+
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+        sys_db_crash(sdb, "Failed to store mailbox message (step)");
+
+    id = sqlite3_last_insert_rowid(sdb);
+    sqlite3_finalize(stmt);
+
+    if (sqlite3_blob_open(sdb, "main", "mailbox_messages", "data", id, 1, &blob) != SQLITE_OK)
+        sys_db_crash(sdb, "Failed to open mailbox message data (blob)");
+
+    n_iv = evbuffer_peek(data, -1, NULL, NULL, 0);
+    iv = safe_malloc(sizeof(struct evbuffer_iovec) * n_iv,
+        "Failed to allocate memory for evbuffer iovec(s), on mailbox message store");
+    n_iv = evbuffer_peek(data, -1, NULL, iv, n_iv);
+
+    for (i = 0, pos = 0; i < n_iv; i++) {
+        db_mb_message_store_part(sdb, blob, iv[i].iov_base, iv[i].iov_len, pos, packed);
+        pos += iv[i].iov_len;
+    }
+    free(iv);
+
+    if (sqlite3_blob_close(blob) != SQLITE_OK)
+        sys_db_crash(sdb, "Failed to write mailbox message data (blob close)");
+
+    if (sqlite3_exec(sdb, "RELEASE db_mb_message_store", NULL, NULL, NULL) != SQLITE_OK)
+        sys_db_crash(sdb, "Failed to finish mailbox message store");
+
+    if ((hot_data = db_mb_message_hot_push(db, id, account_id, contact_id, gid, data_len)))
+        evbuffer_copyout(data, hot_data, data_len);
+
+    db_mb_message_gid_filter_add(account_id, gid);
+    return id;
+}
+
 // Delete given message from the database
 void db_mb_message_delete(sqlite3 *db, struct db_mb_message *msg) {
+    sqlite3 *sdb;
     sqlite3_stmt *stmt;
 
     const char sql[] = 
         "DELETE FROM mailbox_messages WHERE id = ?";
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
-        sys_db_crash(db, "Failed to delete mailbox massage form db");
+    sdb = db_shard_by_id(db, msg->id);
+
+    if (sqlite3_prepare_v2(sdb, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(sdb, "Failed to delete mailbox massage form db");
 
     if (sqlite3_bind_int(stmt, 1, msg->id) != SQLITE_OK)
-        sys_db_crash(db, "Failed to bind mailbox message id, while deleting");
+        sys_db_crash(sdb, "Failed to bind mailbox message id, while deleting");
 
     if (sqlite3_step(stmt) != SQLITE_DONE)
-        sys_db_crash(db, "Failed to delete mailbox massage form db (step)");
+        sys_db_crash(sdb, "Failed to delete mailbox massage form db (step)");
 
     sqlite3_finalize(stmt);
+    db_mb_message_hot_remove(db, msg);
 }
 
-// Process next step for given statement and allocate or populate given object with row data
+// Columns fetched for each message, mailbox id and signing key are
+// needed to restore data stored in packed format
+#define DB_MB_MESSAGE_SELECT \
+    "SELECT m.*, a.mailbox_id, c.signing_pub_key FROM mailbox_messages AS m " \
+    "LEFT JOIN mailbox_accounts AS a ON a.id = m.account_id " \
+    "LEFT JOIN mailbox_contacts AS c ON c.id = m.contact_id "
+
+// Same columns as above, but only length of the data is fetched
+#define DB_MB_MESSAGE_SELECT_STREAM \
+    "SELECT m.id, m.account_id, m.contact_id, m.global_id, length(m.data), m.data_format, " \
+    "a.mailbox_id, c.signing_pub_key FROM mailbox_messages AS m " \
+    "LEFT JOIN mailbox_accounts AS a ON a.id = m.account_id " \
+    "LEFT JOIN mailbox_contacts AS c ON c.id = m.contact_id "
+
+// Process next step for given statement and allocate or populate given object with row data,
+// if arena is not NULL new object and it's data are allocated from the arena, if stream is set
+// row is expected to be selected with DB_MB_MESSAGE_SELECT_STREAM (arena must be given)
 static struct db_mb_message * db_mb_message_process_row(
-    sqlite3 *db, sqlite3_stmt *stmt, struct db_mb_message *dest
+    sqlite3 *db, sqlite3_stmt *stmt, struct db_mb_message *dest, struct arena *arena, int stream
 ) {
     int rc;
     struct db_mb_message *msg = dest;
@@ -128,8 +739,13 @@ static struct db_mb_message * db_mb_message_process_row(
         sys_db_crash(db, "Failed to fetch mailbox message from database (step)");
     }
 
-    if (msg == NULL)
+    if (msg == NULL && arena) {
+        msg = arena_alloc(arena, sizeof(struct db_mb_message));
+        memset(msg, 0, sizeof(struct db_mb_message));
+        msg->arena = arena;
+    } else if (msg == NULL) {
         msg = db_mb_message_new();
+    }
 
     msg->id = sqlite3_column_int(stmt, 0);
     msg->account_id = sqlite3_column_int(stmt, 1);
@@ -138,7 +754,42 @@ static struct db_mb_message * db_mb_message_process_row(
     memcpy(msg->global_id, sqlite3_column_blob(stmt, 3),
         min(MESSAGE_ID_LEN, sqlite3_column_bytes(stmt, 3)));
 
-    db_mb_message_set_data(msg, sqlite3_column_blob(stmt, 4), sqlite3_column_bytes(stmt, 4));
+    msg->data_format = sqlite3_column_int(stmt, 5);
+
+    if (stream) {
+        msg->data = NULL;
+        msg->data_len = sqlite3_column_int(stmt, 4);
+        msg->data_pack_fields = NULL;
+
+        if (msg->data_format == DB_FORMAT_PACKED) {
+            if (
+                msg->data_len < DB_MB_MESSAGE_PACK_OFFSET ||
+                sqlite3_column_bytes(stmt, 6) != MAILBOX_ID_LEN ||
+                sqlite3_column_bytes(stmt, 7) != CLIENT_SIG_KEY_PUB_LEN
+            ) {
+                sys_crash(CRASH_SOURCE_DB, "Failed to unpack mailbox message %d", msg->id);
+            }
+
+            msg->data_len += DB_MB_MESSAGE_PACK_GAP;
+            msg->data_pack_fields = arena_alloc(arena, MAILBOX_ID_LEN + CLIENT_SIG_KEY_PUB_LEN);
+            memcpy(msg->data_pack_fields, sqlite3_column_blob(stmt, 6), MAILBOX_ID_LEN);
+            memcpy(msg->data_pack_fields + MAILBOX_ID_LEN,
+                sqlite3_column_blob(stmt, 7), CLIENT_SIG_KEY_PUB_LEN);
+        }
+    } else if (msg->data_format == DB_FORMAT_PACKED) {
+        if (
+            sqlite3_column_bytes(stmt, 4) < DB_MB_MESSAGE_PACK_OFFSET ||
+            sqlite3_column_bytes(stmt, 6) != MAILBOX_ID_LEN ||
+            sqlite3_column_bytes(stmt, 7) != CLIENT_SIG_KEY_PUB_LEN
+        ) {
+            sys_crash(CRASH_SOURCE_DB, "Failed to unpack mailbox message %d", msg->id);
+        }
+
+        db_mb_message_unpack(msg, sqlite3_column_blob(stmt, 4), sqlite3_column_bytes(stmt, 4),
+            sqlite3_column_blob(stmt, 6), sqlite3_column_blob(stmt, 7));
+    } else {
+        db_mb_message_set_data(msg, sqlite3_column_blob(stmt, 4), sqlite3_column_bytes(stmt, 4));
+    }
     return msg;
 }
 
@@ -147,7 +798,10 @@ struct db_mb_message * db_mb_message_get_by_pk(sqlite3 *db, int id, struct db_mb
     sqlite3_stmt *stmt;
     struct db_mb_message *msg;
 
-    const char sql[] = "SELECT * FROM mailbox_messages WHERE id = ?";
+    const char sql[] = DB_MB_MESSAGE_SELECT "WHERE m.id = ?";
+
+    // Query is run on one of the read only connections of message's shard
+    db = db_pool_reader(db_shard_by_id(db, id));
 
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to fetch mailbox message from db (by pk)");
@@ -155,7 +809,7 @@ struct db_mb_message * db_mb_message_get_by_pk(sqlite3 *db, int id, struct db_mb
     if (sqlite3_bind_int(stmt, 1, id) != SQLITE_OK)
         sys_db_crash(db, "Failed to bind mailbox message id, while fetching");
 
-    msg = db_mb_message_process_row(db, stmt, dest);
+    msg = db_mb_message_process_row(db, stmt, dest, NULL, 0);
 
     sqlite3_finalize(stmt);
     return msg;
@@ -169,7 +823,14 @@ struct db_mb_message * db_mb_message_get_by_acc_and_gid(
     struct db_mb_message *msg;
 
     const char sql[] = 
-        "SELECT * FROM mailbox_messages WHERE account_id = ? AND global_id = ?";
+        DB_MB_MESSAGE_SELECT "WHERE m.account_id = ? AND m.global_id = ?";
+
+    // Message with given global ID surely does not exist
+    if (!bloom_maybe_contains(db_mb_message_gid_filter_load(db, acc->id), gid, MESSAGE_ID_LEN))
+        return NULL;
+
+    // Query is run on one of the read only connections of account's shard
+    db = db_pool_reader(db_shard_by_id(db, acc->id));
 
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to fetch mailbox message from db (by acc and gid)");
@@ -180,62 +841,279 @@ struct db_mb_message * db_mb_message_get_by_acc_and_gid(
     )
         sys_db_crash(db, "Failed to bind mailbox message fields, while fetching");
 
-    msg = db_mb_message_process_row(db, stmt, dest);
+    msg = db_mb_message_process_row(db, stmt, dest, NULL, 0);
 
     sqlite3_finalize(stmt);
     return msg;
 }
 
-// Get all mailbox messages for given account
-struct db_mb_message ** db_mb_message_get_all(sqlite3 *db, struct db_mb_account *acc, int *n) {
-    int i;
+// Check if message with given global id is stored for given account
+int db_mb_message_exists(sqlite3 *db, struct db_mb_account *acc, const uint8_t *gid) {
+    int exists;
+    sqlite3_stmt *stmt;
+
+    const char sql[] =
+        "SELECT 1 FROM mailbox_messages WHERE account_id = ? AND global_id = ?";
+
+    if (!bloom_maybe_contains(db_mb_message_gid_filter_load(db, acc->id), gid, MESSAGE_ID_LEN))
+        return 0;
+
+    db = db_pool_reader(db_shard_by_id(db, acc->id));
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to check if mailbox message exists");
+
+    if (
+        SQLITE_OK != sqlite3_bind_int(stmt, 1, acc->id) ||
+        SQLITE_OK != sqlite3_bind_blob(stmt, 2, gid, MESSAGE_ID_LEN, NULL)
+    )
+        sys_db_crash(db, "Failed to bind mailbox message fields, while checking");
+
+    if ((exists = sqlite3_step(stmt)) != SQLITE_ROW && exists != SQLITE_DONE)
+        sys_db_crash(db, "Failed to check if mailbox message exists (step)");
+
+    sqlite3_finalize(stmt);
+    return exists == SQLITE_ROW;
+}
+
+// Get all mailbox messages for given account, if arena is not NULL list and all
+// messages are allocated from it, if stream is set message data is not read
+static struct db_mb_message ** db_mb_message_get_list(
+    sqlite3 *db, struct db_mb_account *acc, int *n, struct arena *arena, int stream
+) {
+    int i, n_db, n_hot = 0, before_id = INT_MAX;
+    sqlite3 *rdb;
     sqlite3_stmt *stmt;
     struct db_mb_message **msgs;
+    struct db_mb_message_hot_account *hacc = NULL;
 
     debug("Get all start");
 
-    const char sql[] = 
-        "SELECT * FROM mailbox_messages WHERE account_id = ?";
+    const char *sql = stream
+        ? DB_MB_MESSAGE_SELECT_STREAM "WHERE m.account_id = ? AND m.id < ?"
+        : DB_MB_MESSAGE_SELECT "WHERE m.account_id = ? AND m.id < ?";
     const char sql_count[] =
-        "SELECT COUNT(*) FROM mailbox_messages WHERE account_id = ?";
+        "SELECT COUNT(*) FROM mailbox_messages WHERE account_id = ? AND id < ?";
+
+    // Lists which are released together can be served from memory, newest
+    // messages are taken from the hot queue and only older ones are read
+    if (arena && (hacc = db_mb_message_hot_account(db, acc->id)) && hacc->n_msgs > 0) {
+        n_hot = hacc->n_msgs;
+        before_id = hacc->first->id;
+    }
+
+    if (hacc && n_hot == hacc->n_stored) {
+        *n = n_hot;
+        if (*n == 0) return NULL;
+
+        msgs = arena_alloc(arena, sizeof(struct db_mb_message *) * (*n));
+        db_mb_message_hot_copy(hacc, msgs, arena);
+        return msgs;
+    }
+
+    // Query is run on one of the read only connections of account's shard
+    rdb = db_pool_reader(db_shard_by_id(db, acc->id));
 
-    if (sqlite3_prepare_v2(db, sql_count, -1, &stmt, NULL) != SQLITE_OK)
-        sys_db_crash(db, "Failed to count mailbox messages");
+    if (sqlite3_prepare_v2(rdb, sql_count, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(rdb, "Failed to count mailbox messages");
 
-    if (sqlite3_bind_int(stmt, 1, acc->id) != SQLITE_OK)
-        sys_db_crash(db, "Failed to bind account id when counting mb messages");
+    if (
+        SQLITE_OK != sqlite3_bind_int(stmt, 1, acc->id) ||
+        SQLITE_OK != sqlite3_bind_int(stmt, 2, before_id)
+    ) {
+        sys_db_crash(rdb, "Failed to bind account id when counting mb messages");
+    }
 
     if (sqlite3_step(stmt) != SQLITE_ROW)
-        sys_db_crash(db, "Failed to count mailbox messages (step)");
+        sys_db_crash(rdb, "Failed to count mailbox messages (step)");
 
-    *n = sqlite3_column_int(stmt, 0);
+    n_db = sqlite3_column_int(stmt, 0);
     sqlite3_finalize(stmt);
     debug("Get all got cnt");
 
+    // Count is known now, so messages stored from now on can be tracked
+    if (!db_mb_message_hot_account(db, acc->id))
+        db_mb_message_hot_account_new(db, acc->id, n_db);
+
+    *n = n_db + n_hot;
     if (*n == 0) return NULL;
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
-        sys_db_crash(db, "Failed to mailbox messages");
+    if (arena) {
+        msgs = arena_alloc(arena, sizeof(struct db_mb_message *) * (*n));
+    } else {
+        msgs = safe_malloc((sizeof(struct db_mb_message *) * (*n)),
+            "Failed to allocate memory for mailbox message list");
+    }
 
-    if (sqlite3_bind_int(stmt, 1, acc->id) != SQLITE_OK)
-        sys_db_crash(db, "Failed to bind account id when fetching mb messages");
+    if (n_db > 0) {
+        if (sqlite3_prepare_v2(rdb, sql, -1, &stmt, NULL) != SQLITE_OK)
+            sys_db_crash(rdb, "Failed to mailbox messages");
 
-    msgs = safe_malloc((sizeof(struct db_mb_message *) * (*n)),
-        "Failed to allocate memory for mailbox message list");
+        if (
+            SQLITE_OK != sqlite3_bind_int(stmt, 1, acc->id) ||
+            SQLITE_OK != sqlite3_bind_int(stmt, 2, before_id)
+        ) {
+            sys_db_crash(rdb, "Failed to bind account id when fetching mb messages");
+        }
 
-    debug("Before process row");
+        debug("Before process row");
 
-    for (i = 0; i < *n; i++) {
-        msgs[i] = db_mb_message_process_row(db, stmt, NULL);
+        for (i = 0; i < n_db; i++) {
+            msgs[i] = db_mb_message_process_row(rdb, stmt, NULL, arena, stream);
+        }
+
+        debug("After process row");
+        sqlite3_finalize(stmt);
     }
 
-    debug("After process row");
+    // Newest messages follow the ones read from the database
+    if (n_hot > 0)
+        db_mb_message_hot_copy(hacc, msgs + n_db, arena);
 
-    sqlite3_finalize(stmt);
     debug("Get all end");
     return msgs;
 }
 
+// Get all mailbox messages for given account
+struct db_mb_message ** db_mb_message_get_all(sqlite3 *db, struct db_mb_account *acc, int *n) {
+    return db_mb_message_get_list(db, acc, n, NULL, 0);
+}
+
+// Get all mailbox messages for given account into a batch, messages
+// belong to the batch and must not be freed one by one
+struct db_mb_message_batch * db_mb_message_get_batch(sqlite3 *db, struct db_mb_account *acc) {
+    struct db_mb_message_batch *batch;
+
+    batch = safe_malloc(sizeof(struct db_mb_message_batch), "Failed to allocate mailbox message batch");
+    batch->arena = arena_new(0);
+    batch->msgs = db_mb_message_get_list(db, acc, &(batch->n_msgs), batch->arena, 0);
+
+    return batch;
+}
+
+// Get all mailbox messages for given account into a batch without reading
+// their data, data is read later by db_mb_message_stream_batch
+struct db_mb_message_batch * db_mb_message_get_stream_batch(sqlite3 *db, struct db_mb_account *acc) {
+    struct db_mb_message_batch *batch;
+
+    batch = safe_malloc(sizeof(struct db_mb_message_batch), "Failed to allocate mailbox message batch");
+    batch->arena = arena_new(0);
+    batch->msgs = db_mb_message_get_list(db, acc, &(batch->n_msgs), batch->arena, 1);
+
+    return batch;
+}
+
+// Read data of given message from the blob into dest, packed data is restored on the way,
+// returns 1 if row was changed since the batch was fetched, otherwise 0
+static int db_mb_message_stream_read(
+    sqlite3 *db, sqlite3_blob *blob, struct db_mb_message *msg, uint8_t *dest
+) {
+    int stored_len = msg->data_len;
+
+    if (msg->data_format == DB_FORMAT_PACKED)
+        stored_len -= DB_MB_MESSAGE_PACK_GAP;
+
+    if (sqlite3_blob_bytes(blob) != stored_len) {
+        debug("Mailbox message %d changed while streaming", msg->id);
+        return 1;
+    }
+
+    // Reads only fail if row was changed after blob was opened
+    if (msg->data_format != DB_FORMAT_PACKED) {
+        if (sqlite3_blob_read(blob, dest, stored_len, 0) != SQLITE_OK) {
+            debug("Failed to read mailbox message %d: %s", msg->id, sqlite3_errmsg(db));
+            return 1;
+        }
+        return 0;
+    }
+
+    if (
+        SQLITE_OK != sqlite3_blob_read(blob, dest, DB_MB_MESSAGE_PACK_OFFSET, 0) ||
+        SQLITE_OK != sqlite3_blob_read(blob, dest + DB_MB_MESSAGE_PACK_OFFSET + DB_MB_MESSAGE_PACK_GAP,
+            stored_len - DB_MB_MESSAGE_PACK_OFFSET, DB_MB_MESSAGE_PACK_OFFSET)
+    ) {
+        debug("Failed to read packed mailbox message %d: %s", msg->id, sqlite3_errmsg(db));
+        return 1;
+    }
+
+    dest += DB_MB_MESSAGE_PACK_OFFSET;
+    memcpy(dest, msg->data_pack_fields, MAILBOX_ID_LEN + CLIENT_SIG_KEY_PUB_LEN);
+    dest += MAILBOX_ID_LEN + CLIENT_SIG_KEY_PUB_LEN;
+    memcpy(dest, msg->global_id, MESSAGE_ID_LEN);
+    return 0;
+}
+
+// Add data of all messages in the batch to given buffer, data which is not loaded is read
+// from the database straight into buffer memory, if cb is not NULL it is called for data
+// of every message, returns 1 if some message was deleted or changed since the batch was
+// fetched, buffer then holds only part of the data, otherwise 0
+int db_mb_message_stream_batch(
+    sqlite3 *db, struct db_mb_message_batch *batch,
+    struct evbuffer *buff, db_mb_message_stream_cb cb, void *cbarg
+) {
+    int i, rc;
+    sqlite3 *shard = NULL, *rdb = NULL;
+    sqlite3_blob *blob = NULL;
+    struct evbuffer_iovec vec;
+
+    for (i = 0; i < batch->n_msgs; i++) {
+        struct db_mb_message *msg = batch->msgs[i];
+
+        if (msg->data) {
+            if (cb)
+                cb(msg->data, msg->data_len, cbarg);
+            evbuffer_add(buff, msg->data, msg->data_len);
+            continue;
+        }
+
+        // One blob handle is moved from row to row, as long as rows are in the same shard
+        if (blob && shard != db_shard_by_id(db, msg->id)) {
+            sqlite3_blob_close(blob);
+            blob = NULL;
+        }
+
+        if (blob) {
+            rc = sqlite3_blob_reopen(blob, msg->id);
+        } else {
+            shard = db_shard_by_id(db, msg->id);
+            rdb = db_pool_reader(shard);
+            rc = sqlite3_blob_open(rdb, "main", "mailbox_messages", "data", msg->id, 0, &blob);
+        }
+
+        // Message may have been deleted since the batch was fetched
+        if (rc != SQLITE_OK) {
+            debug("Failed to open mailbox message %d: %s", msg->id, sqlite3_errmsg(rdb));
+            sqlite3_blob_close(blob);
+            return 1;
+        }
+
+        if (evbuffer_reserve_space(buff, msg->data_len, &vec, 1) < 1)
+            sys_memory_crash("Failed to reserve buffer space for mailbox message");
+
+        if (db_mb_message_stream_read(rdb, blob, msg, vec.iov_base)) {
+            sqlite3_blob_close(blob);
+            return 1;
+        }
+        if (cb)
+            cb(vec.iov_base, msg->data_len, cbarg);
+
+        vec.iov_len = msg->data_len;
+        if (evbuffer_commit_space(buff, &vec, 1) != 0)
+            sys_memory_crash("Failed to commit buffer space for mailbox message");
+    }
+
+    sqlite3_blob_close(blob);
+    return 0;
+}
+
+// Free given batch and all messages in it
+void db_mb_message_batch_free(struct db_mb_message_batch *batch) {
+    if (!batch) return;
+
+    arena_free(batch->arena);
+    free(batch);
+}
+
 // Free list of messages returned by get_all
 void db_mb_message_free_all(struct db_mb_message **msgs, int n) {
     int i;
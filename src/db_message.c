@@ -1,17 +1,24 @@
 #include <onion.h>
 #include <db_contact.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <db_message.h>
 #include <sys_memory.h>
 #include <db_init.h>
+#include <db_pool.h>
 #include <helpers.h>
 #include <sqlite3.h>
 #include <constants.h>
+#include <arena.h>
+#include <db_compress.h>
+#include <bloom.h>
+#include <hash_table.h>
 #include <openssl/rand.h>
 
-// Create new empty message object
+// Create new empty message object, it has room for body of any type
 struct db_message * db_message_new(void) {
     struct db_message *msg;
 
@@ -21,37 +28,209 @@ struct db_message * db_message_new(void) {
     return msg;
 }
 
+// Get number of bytes needed for message with body of given type
+size_t db_message_size(enum db_message_types type) {
+    switch (type) {
+        case DB_MESSAGE_TEXT:
+            return offsetof(struct db_message, body_text_inline) + DB_MESSAGE_TEXT_INLINE;
+        case DB_MESSAGE_NICK:
+            return offsetof(struct db_message, body_nick) + CLIENT_NICK_MAX_LEN;
+        case DB_MESSAGE_MBOX:
+            return offsetof(struct db_message, body_mbox_onion) + ONION_ADDRESS_LEN + 1;
+        case DB_MESSAGE_RECV:
+            return offsetof(struct db_message, body_recv_id) + MESSAGE_ID_LEN;
+    }
+    return sizeof(struct db_message);
+}
+
+// Free memory owned by message body and clear it, called
+// before message is overwritten with another body
+static void db_message_body_release(struct db_message *msg) {
+    if (msg->type == DB_MESSAGE_TEXT && !msg->arena) {
+        if (msg->body_text != msg->body_text_inline)
+            free(msg->body_text);
+        free(msg->body_packed);
+    }
+
+    memset((uint8_t *)msg + offsetof(struct db_message, body_text), 0,
+        db_message_size(msg->type) - offsetof(struct db_message, body_text));
+}
+
 // Free given message object, note that if you want to save changes you
 // made to the object you must first save it
 void db_message_free(struct db_message *msg) {
-    if (msg && msg->body_text)
-        free(msg->body_text);
+    // Messages allocated from an arena are freed with the arena
+    if (!msg || msg->arena)
+        return;
+
+    db_message_body_release(msg);
     free(msg);
 }
 
-// Save all message data into database
+// Store copy of compressed text in the message
+static void db_message_set_packed(struct db_message *msg, const uint8_t *packed, int packed_len) {
+    if (msg->arena) {
+        msg->body_packed = arena_memdup(msg->arena, packed, packed_len);
+    } else {
+        free(msg->body_packed);
+        msg->body_packed = safe_malloc(packed_len, "Failed to allocate compressed message body");
+        memcpy(msg->body_packed, packed, packed_len);
+    }
+    msg->body_packed_len = packed_len;
+}
+
+// Drop compressed text, called when text is changed
+static void db_message_drop_packed(struct db_message *msg) {
+    if (!msg->arena)
+        free(msg->body_packed);
+
+    msg->body_packed = NULL;
+    msg->body_packed_len = 0;
+}
+
+/**
+ * Filters of global IDs of all stored messages, most messages received are new
+ * so lookup by global ID which misses the filter doesn't have to query the
+ * database. Each connection gets it's own filter, it is built on the first lookup
+ * through that connection. Saved messages are added to filters of all connections,
+ * other connections may be open to the same database and extra IDs only cost
+ * a query on lookup.
+ */
+static struct hash_table *gid_filters = NULL;
+
+// Free filter of one connection
+static void db_message_gid_filter_free_cb(const void *key, size_t key_len, void *value, void *cbarg) {
+    bloom_free(value);
+}
+
+// Drop in-memory global ID filters of all connections, they will be rebuilt on the next lookup,
+// filters of closed connections must be dropped before connection is opened again
+void db_message_gid_filter_clear(void) {
+    if (!gid_filters)
+        return;
+
+    hash_table_foreach(gid_filters, db_message_gid_filter_free_cb, NULL);
+    hash_table_free(gid_filters);
+    gid_filters = NULL;
+}
+
+// Add global ID of saved message to filter of every connection
+static void db_message_gid_filter_add_cb(const void *key, size_t key_len, void *value, void *cbarg) {
+    // Message may be saved many times, so it's added only if not already there
+    if (!bloom_maybe_contains(value, cbarg, MESSAGE_ID_LEN))
+        bloom_add(value, cbarg, MESSAGE_ID_LEN);
+}
+
+// Get global ID filter of given connection, filter is built from all messages in the
+// database when connection has none, it's also rebuilt when it gets more messages than
+// it was sized for
+static struct bloom * db_message_gid_filter_load(sqlite3 *db) {
+    int n;
+    sqlite3 *rdb;
+    sqlite3_stmt *stmt;
+    struct bloom *bf;
+
+    const char sql_count[] = "SELECT COUNT(*) FROM client_messages";
+    const char sql[] = "SELECT global_id FROM client_messages";
+
+    if (!gid_filters)
+        gid_filters = hash_table_new();
+
+    bf = hash_table_get(gid_filters, &db, sizeof(db));
+    if (bf && !bloom_is_full(bf))
+        return bf;
+
+    bloom_free(bf);
+    rdb = db_pool_reader(db);
+
+    if (sqlite3_prepare_v2(rdb, sql_count, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(rdb, "Failed to count client messages");
+
+    if (sqlite3_step(stmt) != SQLITE_ROW)
+        sys_db_crash(rdb, "Failed to count client messages (step)");
+
+    n = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+
+    // Leave room for new messages
+    bf = bloom_new(max(n * 2, DB_MESSAGE_GID_FILTER_MIN));
+
+    if (sqlite3_prepare_v2(rdb, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(rdb, "Failed to load message global IDs");
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        bloom_add(bf, sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0));
+    }
+
+    sqlite3_finalize(stmt);
+    hash_table_set(gid_filters, &db, sizeof(db), bf);
+    return bf;
+}
+
+// Remember current column values as stored, so next save only updates what changed,
+// use it when message row was changed in the database without saving the object
+void db_message_mark_saved(struct db_message *msg) {
+    msg->saved.contact_id = msg->contact_id;
+    msg->saved.sender = msg->sender;
+    msg->saved.status = msg->status;
+    msg->saved.type = msg->type;
+    memcpy(msg->saved.global_id, msg->global_id, MESSAGE_ID_LEN);
+    msg->body_dirty = 0;
+}
+
+// Build update query for columns which changed since message was last saved,
+// parameters are numbered same as in the insert query, returns 0 if nothing changed
+static int db_message_update_sql(struct db_message *msg, char *sql, size_t sql_size) {
+    int n = 0;
+    size_t len;
+
+    len = snprintf(sql, sql_size, "UPDATE client_messages SET ");
+
+#define DB_MESSAGE_UPDATE_COL(cond, col) \
+    if (cond) \
+        len += snprintf(sql + len, sql_size - len, "%s" col, n++ ? ", " : "")
+
+    DB_MESSAGE_UPDATE_COL(memcmp(msg->saved.global_id, msg->global_id, MESSAGE_ID_LEN), "global_id = ?1");
+    DB_MESSAGE_UPDATE_COL(msg->saved.contact_id != msg->contact_id, "contact_id = ?2");
+    DB_MESSAGE_UPDATE_COL(msg->saved.sender != msg->sender, "sender = ?3");
+    DB_MESSAGE_UPDATE_COL(msg->saved.status != msg->status, "status = ?4");
+    DB_MESSAGE_UPDATE_COL(msg->saved.type != msg->type, "type = ?5");
+    DB_MESSAGE_UPDATE_COL(msg->body_dirty || msg->saved.type != msg->type,
+        "body_text = ?6, body_nick = ?7, body_mbox_id = ?8, body_mbox_onion = ?9, body_format = ?10");
+
+#undef DB_MESSAGE_UPDATE_COL
+
+    snprintf(sql + len, sql_size - len, " WHERE id = ?11");
+    return n;
+}
+
+// Save message into database, existing messages only get changed columns updated
 void db_message_save(sqlite3 *db, struct db_message *msg) {
     const char *sql;
     sqlite3_stmt *stmt;
+    uint8_t *packed;
+    size_t packed_len;
+    char sql_update[256];
 
     const char sql_insert[] =
         "INSERT INTO client_messages "
         "(global_id, contact_id, sender, status, type, body_text, body_nick, "
-            "body_mbox_id, body_mbox_onion) "
-        "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)";
-
-    const char sql_update[] = 
-        "UPDATE client_messages SET "
-            "global_id = ?, contact_id = ?, sender = ?, status = ?, type = ?, "
-            "body_text = ?, body_nick = ?, body_mbox_id = ?, body_mbox_onion = ? "
-        "WHERE id = ?";
-
-    sql = (msg->id > 0) ? sql_update : sql_insert;
+            "body_mbox_id, body_mbox_onion, body_format) "
+        "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10)";
 
     // RECV is virtual type, it should never be saved to the database
     if (msg->type == DB_MESSAGE_RECV)
         return;
 
+    if (msg->id > 0) {
+        // Nothing changed since the last save
+        if (!db_message_update_sql(msg, sql_update, sizeof(sql_update)))
+            return;
+        sql = sql_update;
+    } else {
+        sql = sql_insert;
+    }
+
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to save message into database");
 
@@ -65,10 +244,23 @@ void db_message_save(sqlite3 *db, struct db_message *msg) {
         sys_db_crash(db, "Failed to bind required message fields");
     }
 
+    // Compress text if it's not already compressed and it's going to be written
     if (
-        ((msg->type == DB_MESSAGE_TEXT) ?
-            sqlite3_bind_text(stmt, 6, msg->body_text, -1, NULL) :
-            sqlite3_bind_null(stmt, 6))
+        msg->type == DB_MESSAGE_TEXT && !msg->body_packed && msg->body_text &&
+        (msg->id == 0 || msg->body_dirty || msg->saved.type != msg->type)
+    ) {
+        if ((packed = db_compress(msg->body_text, msg->body_text_len, &packed_len))) {
+            db_message_set_packed(msg, packed, packed_len);
+            free(packed);
+        }
+    }
+
+    if (
+        ((msg->type != DB_MESSAGE_TEXT) ?
+            sqlite3_bind_null(stmt, 6) :
+        (msg->body_packed) ?
+            sqlite3_bind_blob(stmt, 6, msg->body_packed, msg->body_packed_len, NULL) :
+            sqlite3_bind_text(stmt, 6, msg->body_text, -1, NULL))
         != SQLITE_OK ||
 
         ((msg->type == DB_MESSAGE_NICK) ?
@@ -84,13 +276,17 @@ void db_message_save(sqlite3 *db, struct db_message *msg) {
         ((msg->type == DB_MESSAGE_MBOX) ? 
             sqlite3_bind_text(stmt, 9, msg->body_mbox_onion, -1, NULL) :
             sqlite3_bind_null(stmt, 9))
+        != SQLITE_OK ||
+
+        sqlite3_bind_int(stmt, 10, (msg->type == DB_MESSAGE_TEXT && msg->body_packed) ?
+            DB_FORMAT_ZLIB : DB_FORMAT_RAW)
         != SQLITE_OK
     ) {
         sys_db_crash(db, "Failed to bind message body");
     }
 
     if (msg->id > 0) {
-        if (sqlite3_bind_int(stmt, 10, msg->id) != SQLITE_OK)
+        if (sqlite3_bind_int(stmt, 11, msg->id) != SQLITE_OK)
             sys_db_crash(db, "Failed to bind message id");
     }
 
@@ -100,7 +296,52 @@ void db_message_save(sqlite3 *db, struct db_message *msg) {
     if (msg->id == 0)
         msg->id = sqlite3_last_insert_rowid(db);
 
+    // Only filters which are already built are updated
+    if (gid_filters)
+        hash_table_foreach(gid_filters, db_message_gid_filter_add_cb, msg->global_id);
+
     sqlite3_finalize(stmt);
+    db_message_mark_saved(msg);
+}
+
+// Set status of all messages with given global IDs (n_gids IDs stored one after
+// another) using single transaction, in-memory messages are not updated
+void db_message_set_status_by_gids(sqlite3 *db, const uint8_t *gids, int n_gids, enum db_message_status status) {
+    int i;
+    int own_tran;
+    sqlite3_stmt *stmt;
+
+    const char sql[] = "UPDATE client_messages SET status = ? WHERE global_id = ?";
+
+    if (n_gids <= 0)
+        return;
+
+    // Join transaction caller already started
+    if ((own_tran = sqlite3_get_autocommit(db))) {
+        if (sqlite3_exec(db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK)
+            sys_db_crash(db, "Failed to begin message status transaction");
+    }
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to prepare message status update");
+
+    if (sqlite3_bind_int(stmt, 1, status) != SQLITE_OK)
+        sys_db_crash(db, "Failed to bind message status");
+
+    for (i = 0; i < n_gids; i++) {
+        if (sqlite3_bind_blob(stmt, 2, gids + i * MESSAGE_ID_LEN, MESSAGE_ID_LEN, NULL) != SQLITE_OK)
+            sys_db_crash(db, "Failed to bind message global id");
+
+        if (sqlite3_step(stmt) != SQLITE_DONE)
+            sys_db_crash(db, "Failed to update message status (step)");
+
+        sqlite3_reset(stmt);
+    }
+
+    sqlite3_finalize(stmt);
+
+    if (own_tran && sqlite3_exec(db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to commit message status transaction");
 }
 
 // Write text_len characters of text into message text body
@@ -114,7 +355,26 @@ void db_message_set_text(struct db_message *msg, const char *text, int text_len)
     new_arr_len = (text_len / DB_MESSAGE_TEXT_CHUNK + 1) * DB_MESSAGE_TEXT_CHUNK;
     msg->body_text_len = text_len;
 
-    if (!msg->body_text) {
+    // Stored compressed text is no longer valid
+    db_message_drop_packed(msg);
+    msg->body_dirty = 1;
+
+    // Short text is stored inside the message
+    if (text_len < DB_MESSAGE_TEXT_INLINE) {
+        if (msg->body_text != msg->body_text_inline && !msg->arena)
+            free(msg->body_text);
+
+        msg->body_text_n_chunks = DB_MESSAGE_TEXT_INLINE;
+        msg->body_text = msg->body_text_inline;
+
+    // Messages from an arena take new text from the arena too
+    } else if (msg->arena && (
+        !msg->body_text || msg->body_text == msg->body_text_inline || msg->body_text_n_chunks < new_arr_len)
+    ) {
+        msg->body_text_n_chunks = new_arr_len;
+        msg->body_text = arena_alloc(msg->arena, sizeof(char) * new_arr_len);
+
+    } else if (!msg->body_text || msg->body_text == msg->body_text_inline) {
         msg->body_text_n_chunks = new_arr_len;
         msg->body_text = safe_malloc((sizeof(char) * new_arr_len),
             "Failed to allocate chars for message body");
@@ -132,9 +392,70 @@ void db_message_set_text(struct db_message *msg, const char *text, int text_len)
     msg->body_text[i] = '\0';
 }
 
-// Process the next step of given statement and allocate or populate given object with the row data
-static struct db_message * db_message_process_row(sqlite3 *db, sqlite3_stmt *stmt, struct db_message *dest) {
+// Get message text, compressed text is decompressed on first access
+const char * db_message_get_text(struct db_message *msg) {
+    if (msg->body_text || !msg->body_packed)
+        return msg->body_text;
+
+    msg->body_text_n_chunks = msg->body_text_len + 1;
+
+    if (msg->body_text_len < DB_MESSAGE_TEXT_INLINE) {
+        msg->body_text_n_chunks = DB_MESSAGE_TEXT_INLINE;
+        msg->body_text = msg->body_text_inline;
+    } else if (msg->arena) {
+        msg->body_text = arena_alloc(msg->arena, msg->body_text_n_chunks);
+    } else {
+        msg->body_text = safe_malloc(msg->body_text_n_chunks, "Failed to allocate chars for message body");
+    }
+
+    if (db_decompress(msg->body_packed, msg->body_packed_len, msg->body_text))
+        sys_crash(CRASH_SOURCE_DB, "Failed to decompress text of message %d", msg->id);
+
+    msg->body_text[msg->body_text_len] = '\0';
+    return msg->body_text;
+}
+
+// SQL function db_message_text(body_text, body_format), returns text
+// of the message decompressing it if needed, used by search index triggers
+static void db_message_sql_text(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+    int len;
+    char *text;
+    const uint8_t *packed;
+
+    if (sqlite3_value_int(argv[1]) != DB_FORMAT_ZLIB) {
+        sqlite3_result_value(ctx, argv[0]);
+        return;
+    }
+
+    packed = sqlite3_value_blob(argv[0]);
+    len = db_compress_original_len(packed, sqlite3_value_bytes(argv[0]));
+    text = safe_malloc(len + 1, "Failed to allocate chars for message body");
+
+    if (db_decompress(packed, sqlite3_value_bytes(argv[0]), text)) {
+        free(text);
+        sqlite3_result_error(ctx, "Failed to decompress message text", -1);
+        return;
+    }
+    sqlite3_result_text(ctx, text, len, free);
+}
+
+// Register SQL functions used by message search index triggers on given connection,
+// every connection which writes messages must register them
+void db_message_register_functions(sqlite3 *db) {
+    if (sqlite3_create_function(db, "db_message_text", 2, SQLITE_UTF8 | SQLITE_DETERMINISTIC |
+        SQLITE_INNOCUOUS, NULL, db_message_sql_text, NULL, NULL) != SQLITE_OK
+    ) {
+        sys_db_crash(db, "Failed to register message SQL functions");
+    }
+}
+
+// Process the next step of given statement and allocate or populate given object with the row data,
+// if arena is not NULL new object and it's text are allocated from the arena
+static struct db_message * db_message_process_row(
+    sqlite3 *db, sqlite3_stmt *stmt, struct db_message *dest, struct arena *arena
+) {
     int rc;
+    enum db_message_types type;
     struct db_message *msg = dest;
 
     // Check if there are no results or an error occurred
@@ -145,8 +466,18 @@ static struct db_message * db_message_process_row(sqlite3 *db, sqlite3_stmt *stm
         sys_db_crash(db, "Failed to fetch message from database (step)");
     }
 
-    if (msg == NULL)
+    type = sqlite3_column_int(stmt, 5);
+
+    // Messages in an arena only get space for their own body
+    if (msg == NULL && arena) {
+        msg = arena_alloc(arena, db_message_size(type));
+        memset(msg, 0, db_message_size(type));
+        msg->arena = arena;
+    } else if (msg == NULL) {
         msg = db_message_new();
+    } else if (msg->type != type) {
+        db_message_body_release(msg);
+    }
 
     msg->id = sqlite3_column_int(stmt, 0);
 
@@ -156,9 +487,22 @@ static struct db_message * db_message_process_row(sqlite3 *db, sqlite3_stmt *stm
     msg->contact_id = sqlite3_column_int(stmt, 2);
     msg->sender = sqlite3_column_int(stmt, 3);
     msg->status = sqlite3_column_int(stmt, 4);
-    msg->type = sqlite3_column_int(stmt, 5);
+    msg->type = type;
+
+    if (msg->type == DB_MESSAGE_TEXT && sqlite3_column_int(stmt, 10) == DB_FORMAT_ZLIB) {
+        const uint8_t *packed = sqlite3_column_blob(stmt, 6);
+        int packed_len = sqlite3_column_bytes(stmt, 6);
+
+        // Text is decompressed when it's first accessed
+        if (!msg->arena && msg->body_text != msg->body_text_inline)
+            free(msg->body_text);
+        msg->body_text = NULL;
+        msg->body_text_n_chunks = 0;
+        msg->body_text_len = db_compress_original_len(packed, packed_len);
 
-    if (msg->type == DB_MESSAGE_TEXT) {
+        db_message_set_packed(msg, packed, packed_len);
+
+    } else if (msg->type == DB_MESSAGE_TEXT) {
         db_message_set_text(msg, sqlite3_column_text(stmt, 6), sqlite3_column_bytes(stmt, 6));
     }
 
@@ -172,9 +516,10 @@ static struct db_message * db_message_process_row(sqlite3 *db, sqlite3_stmt *stm
         memcpy(msg->body_mbox_id, sqlite3_column_text(stmt, 8),
             min(MAILBOX_ID_LEN, sqlite3_column_bytes(stmt, 8)));
         memcpy(msg->body_mbox_onion, sqlite3_column_text(stmt, 9),
-            min(MAILBOX_ID_LEN, sqlite3_column_bytes(stmt, 9)));
+            min(ONION_ADDRESS_LEN, sqlite3_column_bytes(stmt, 9)));
     }
 
+    db_message_mark_saved(msg);
     return msg;
 }
 
@@ -185,32 +530,42 @@ struct db_message * db_message_get_by_pk(sqlite3 *db, int id, struct db_message
 
     const char sql[] = "SELECT * FROM client_messages WHERE id = ?";
 
+    // Query is run on one of the read only connections
+    db = db_pool_reader(db);
+
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to fetch message from database (by pk)");
 
     if (sqlite3_bind_int(stmt, 1, id) != SQLITE_OK)
         sys_db_crash(db, "Failed to bind message id, when fetching");
 
-    msg = db_message_process_row(db, stmt, dest);
+    msg = db_message_process_row(db, stmt, dest, NULL);
 
     sqlite3_finalize(stmt);
     return msg;
 }
 
-// Get message by it's local ID
+// Get message by global message id
 struct db_message * db_message_get_by_gid(sqlite3 *db, uint8_t *gid, struct db_message *dest) {
     sqlite3_stmt *stmt;
     struct db_message *msg;
 
     const char sql[] = "SELECT * FROM client_messages WHERE global_id = ?";
 
+    // Message with given global ID surely does not exist
+    if (!bloom_maybe_contains(db_message_gid_filter_load(db), gid, MESSAGE_ID_LEN))
+        return NULL;
+
+    // Query is run on one of the read only connections
+    db = db_pool_reader(db);
+
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to fetch message from database (by gid)");
 
     if (sqlite3_bind_blob(stmt, 1, gid, MESSAGE_ID_LEN, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to bind message id, when fetching");
 
-    msg = db_message_process_row(db, stmt, dest);
+    msg = db_message_process_row(db, stmt, dest, NULL);
 
     sqlite3_finalize(stmt);
     return msg;
@@ -221,19 +576,24 @@ struct db_message * db_message_get_last(sqlite3 *db, struct db_contact *cont, st
     sqlite3_stmt *stmt;
     struct db_message *msg;
 
-    const char sql[] = 
-        "SELECT * FROM client_messages WHERE contact_id = ? ORDER BY id DESC LIMIT 1";
+    // Last message ID is kept in the contact summary
+    const char sql[] =
+        "SELECT * FROM client_messages WHERE id = "
+            "(SELECT last_message_id FROM client_contact_summary WHERE contact_id = ?)";
 
     if (!cont)
         return NULL;
 
+    // Query is run on one of the read only connections
+    db = db_pool_reader(db);
+
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to fetch message from database (by contact)");
 
     if (sqlite3_bind_int(stmt, 1, cont->id) != SQLITE_OK)
         sys_db_crash(db, "Failed to bind message id, when fetching");
 
-    msg = db_message_process_row(db, stmt, dest);
+    msg = db_message_process_row(db, stmt, dest, NULL);
 
     sqlite3_finalize(stmt);
     return msg;
@@ -247,6 +607,9 @@ struct db_message * db_message_get_before(sqlite3 *db, struct db_message *curren
         "SELECT * FROM client_messages "
         "WHERE id < ? AND contact_id = ? ORDER BY id DESC LIMIT 1";
 
+    // Query is run on one of the read only connections
+    db = db_pool_reader(db);
+
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to fetch message from database (one before)");
 
@@ -256,7 +619,7 @@ struct db_message * db_message_get_before(sqlite3 *db, struct db_message *curren
     )
         sys_db_crash(db, "Failed to bind message fields, when fetching (one before)");
 
-    msg = db_message_process_row(db, stmt, dest);
+    msg = db_message_process_row(db, stmt, dest, NULL);
 
     sqlite3_finalize(stmt);
     return msg;
@@ -288,14 +651,155 @@ void db_message_delete(sqlite3 *db, struct db_message *msg) {
     sqlite3_finalize(stmt);
 }
 
+// Fetch outbox state of all active contacts which have undelivered messages that
+// already failed to be delivered at least once, earliest next attempt comes first
+struct db_message_outbox * db_message_outbox_get(sqlite3 *db, int *n) {
+    int rc, size = 8;
+    sqlite3_stmt *stmt;
+    struct db_message_outbox *outbox;
+
+    // Messages which were never tried are sent by whoever created them
+    const char sql[] =
+        "SELECT m.contact_id, MAX(m.attempts), MIN(m.next_attempt) "
+        "FROM client_messages AS m "
+        "JOIN client_contacts AS c ON c.id = m.contact_id "
+        "WHERE m.status = 0 AND m.sender = ? AND m.attempts > 0 "
+            "AND c.status = ? AND c.deleted = 0 "
+        "GROUP BY m.contact_id ORDER BY 3";
+
+    db = db_pool_reader(db);
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to fetch outbox");
+
+    if (
+        SQLITE_OK != sqlite3_bind_int(stmt, 1, DB_MESSAGE_SENDER_ME) ||
+        SQLITE_OK != sqlite3_bind_int(stmt, 2, DB_CONTACT_ACTIVE)
+    ) {
+        sys_db_crash(db, "Failed to bind outbox query values");
+    }
+
+    *n = 0;
+    outbox = safe_malloc(sizeof(struct db_message_outbox) * size,
+        "Failed to allocate outbox");
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (*n == size) {
+            size *= 2;
+            outbox = safe_realloc(outbox, sizeof(struct db_message_outbox) * size,
+                "Failed to expand outbox");
+        }
+
+        outbox[*n].contact_id = sqlite3_column_int(stmt, 0);
+        outbox[*n].attempts = sqlite3_column_int(stmt, 1);
+        outbox[*n].next_attempt = sqlite3_column_int64(stmt, 2);
+        ++(*n);
+    }
+
+    if (rc != SQLITE_DONE)
+        sys_db_crash(db, "Failed to fetch outbox (step)");
+
+    sqlite3_finalize(stmt);
+    return outbox;
+}
+
+// Count failed delivery attempt for given messages (n_ids IDs) which are still
+// undelivered, returns new highest number of attempts among them or 0 if all
+// of them were delivered in the meantime
+int db_message_outbox_failed(sqlite3 *db, const int *ids, int n_ids) {
+    int i, rc;
+    int own_tran, attempts = 0;
+    sqlite3_stmt *stmt;
+
+    const char sql[] =
+        "UPDATE client_messages SET attempts = attempts + 1 "
+        "WHERE id = ? AND status = 0 RETURNING attempts";
+
+    if (n_ids <= 0)
+        return 0;
+
+    // Join transaction caller already started
+    if ((own_tran = sqlite3_get_autocommit(db))) {
+        if (sqlite3_exec(db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK)
+            sys_db_crash(db, "Failed to begin failed delivery transaction");
+    }
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to count failed delivery attempt");
+
+    for (i = 0; i < n_ids; i++) {
+        if (sqlite3_bind_int(stmt, 1, ids[i]) != SQLITE_OK)
+            sys_db_crash(db, "Failed to bind message id, when counting failed attempt");
+
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+            attempts = max(attempts, sqlite3_column_int(stmt, 0));
+
+        if (rc != SQLITE_DONE)
+            sys_db_crash(db, "Failed to count failed delivery attempt (step)");
+
+        sqlite3_reset(stmt);
+    }
+
+    sqlite3_finalize(stmt);
+
+    if (own_tran && sqlite3_exec(db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to commit failed delivery transaction");
+
+    return attempts;
+}
+
+// Set time of the next delivery attempt for given messages (n_ids IDs)
+// which are still undelivered
+void db_message_outbox_delay(sqlite3 *db, const int *ids, int n_ids, int64_t next_attempt) {
+    int i;
+    int own_tran;
+    sqlite3_stmt *stmt;
+
+    const char sql[] =
+        "UPDATE client_messages SET next_attempt = ? WHERE id = ? AND status = 0";
+
+    if (n_ids <= 0)
+        return;
+
+    // Join transaction caller already started
+    if ((own_tran = sqlite3_get_autocommit(db))) {
+        if (sqlite3_exec(db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK)
+            sys_db_crash(db, "Failed to begin next delivery attempt transaction");
+    }
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to set next delivery attempt");
+
+    if (sqlite3_bind_int64(stmt, 1, next_attempt) != SQLITE_OK)
+        sys_db_crash(db, "Failed to bind next delivery attempt");
+
+    for (i = 0; i < n_ids; i++) {
+        if (sqlite3_bind_int(stmt, 2, ids[i]) != SQLITE_OK)
+            sys_db_crash(db, "Failed to bind message id, when setting next delivery attempt");
+
+        if (sqlite3_step(stmt) != SQLITE_DONE)
+            sys_db_crash(db, "Failed to set next delivery attempt (step)");
+
+        sqlite3_reset(stmt);
+    }
+
+    sqlite3_finalize(stmt);
+
+    if (own_tran && sqlite3_exec(db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to commit next delivery attempt transaction");
+}
+
 // Generate random global message ID
 void db_message_gen_id(struct db_message *msg) {
     if (msg)
         RAND_bytes(msg->global_id, MESSAGE_ID_LEN);
 }
 
-// Fetch the list of messages for given contact with given status
-struct db_message ** db_message_get_all(sqlite3 *db, struct db_contact *cont, enum db_message_status status, int *n_msgs) {
+// Fetch the list of messages for given contact with given status, if arena is
+// not NULL list and all messages are allocated from it
+static struct db_message ** db_message_get_list(
+    sqlite3 *db, const struct db_contact *cont, enum db_message_status status, int *n_msgs, struct arena *arena
+) {
     int i;
     sqlite3_stmt *stmt;
     struct db_message **msgs;
@@ -309,6 +813,9 @@ struct db_message ** db_message_get_all(sqlite3 *db, struct db_contact *cont, en
     const char sql_count_any[] =
         "SELECT COUNT(*) FROM client_messages WHERE contact_id = ? AND (status = ? OR 1 = 1)";
 
+    // Query is run on one of the read only connections
+    db = db_pool_reader(db);
+
     if (sqlite3_prepare_v2(db, status == DB_MESSAGE_STATUS_ANY ? sql_count_any : sql_count, -1, &stmt, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to count client messages");
 
@@ -337,17 +844,124 @@ struct db_message ** db_message_get_all(sqlite3 *db, struct db_contact *cont, en
         sys_db_crash(db, "Failed to bind fields when fetching client messages");
     }
 
-    msgs = safe_malloc((sizeof(struct db_message *) * (*n_msgs)),
-        "Failed to allocate memory for client message list");
+    if (arena) {
+        msgs = arena_alloc(arena, sizeof(struct db_message *) * (*n_msgs));
+    } else {
+        msgs = safe_malloc((sizeof(struct db_message *) * (*n_msgs)),
+            "Failed to allocate memory for client message list");
+    }
 
     for (i = 0; i < *n_msgs; i++) {
-        msgs[i] = db_message_process_row(db, stmt, NULL);
+        msgs[i] = db_message_process_row(db, stmt, NULL, arena);
     }
 
     sqlite3_finalize(stmt);
     return msgs;
 }
 
+// Fetch the list of messages for given contact with given status
+struct db_message ** db_message_get_all(sqlite3 *db, const struct db_contact *cont, enum db_message_status status, int *n_msgs) {
+    return db_message_get_list(db, cont, status, n_msgs, NULL);
+}
+
+// Fetch messages for given contact with given status into a batch, messages
+// belong to the batch and must not be freed one by one
+struct db_message_batch * db_message_get_batch(sqlite3 *db, const struct db_contact *cont, enum db_message_status status) {
+    struct db_message_batch *batch;
+
+    batch = safe_malloc(sizeof(struct db_message_batch), "Failed to allocate message batch");
+    batch->arena = arena_new(0);
+    batch->msgs = db_message_get_list(db, cont, status, &(batch->n_msgs), batch->arena);
+
+    return batch;
+}
+
+// Free given batch and all messages in it
+void db_message_batch_free(struct db_message_batch *batch) {
+    if (!batch) return;
+
+    arena_free(batch->arena);
+    free(batch);
+}
+
+// Convert user provided text into FTS query, every word is quoted
+// so it's matched literally, query is allocated from given arena
+static char * db_message_search_query(struct arena *arena, const char *text) {
+    int in_word = 0;
+    char *query, *q;
+
+    q = query = arena_alloc(arena, strlen(text) * 3 + 3);
+
+    for (; *text != '\0'; text++) {
+        if (*text == ' ' || *text == '\t' || *text == '\n') {
+            if (in_word)
+                *q++ = '"';
+            in_word = 0;
+            continue;
+        }
+
+        if (!in_word) {
+            if (q != query)
+                *q++ = ' ';
+            *q++ = '"';
+            in_word = 1;
+        }
+
+        // Quotes are escaped by doubling them
+        if (*text == '"')
+            *q++ = '"';
+        *q++ = *text;
+    }
+
+    if (in_word)
+        *q++ = '"';
+    *q = '\0';
+
+    return query;
+}
+
+// Search text messages using the full text index, returns batch with
+// at most limit messages, best matches come first
+struct db_message_batch * db_message_search(sqlite3 *db, const char *text, int limit) {
+    char *query;
+    sqlite3_stmt *stmt;
+    struct db_message *msg;
+    struct db_message_batch *batch;
+
+    const char sql[] =
+        "SELECT m.* FROM client_messages_fts AS f "
+        "JOIN client_messages AS m ON m.id = f.rowid "
+        "WHERE client_messages_fts MATCH ? ORDER BY f.rank LIMIT ?";
+
+    batch = safe_malloc(sizeof(struct db_message_batch), "Failed to allocate message batch");
+    batch->arena = arena_new(0);
+    batch->n_msgs = 0;
+    batch->msgs = arena_alloc(batch->arena, sizeof(struct db_message *) * limit);
+
+    query = db_message_search_query(batch->arena, text);
+    if (query[0] == '\0')
+        return batch;
+
+    // Query is run on one of the read only connections
+    db = db_pool_reader(db);
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to search client messages");
+
+    if (
+        SQLITE_OK != sqlite3_bind_text(stmt, 1, query, -1, NULL) ||
+        SQLITE_OK != sqlite3_bind_int(stmt, 2, limit)
+    ) {
+        sys_db_crash(db, "Failed to bind fields when searching client messages");
+    }
+
+    while (batch->n_msgs < limit && (msg = db_message_process_row(db, stmt, NULL, batch->arena)))
+        batch->msgs[batch->n_msgs++] = msg;
+
+    sqlite3_finalize(stmt);
+    return batch;
+}
+
 // Free previously fetched message list
 void db_message_free_all(struct db_message **msgs, int n_msgs) {
     int i;
@@ -1,4 +1,5 @@
 #include <db_init.h>
+#include <db_pool.h>
 #include <db_options.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,6 +34,9 @@ static int db_options_row_exists(sqlite3 *db, const char *key, enum db_options_t
         "SELECT COUNT(*) FROM options WHERE key = ? AND text_value IS NOT NULL"
     };
 
+    // Query is run on one of the read only connections
+    db = db_pool_reader(db);
+
     if (sqlite3_prepare_v2(db, has_value ? sql_has_val[type] : sql_row_exists[type], -1, &stmt, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to fetch option count from db");
 
@@ -60,14 +64,19 @@ int db_options_get_int(sqlite3 *db, const char *key) {
 
     const char sql[] = "SELECT int_value FROM options WHERE key = ?";
 
+    // Query is run on one of the read only connections
+    db = db_pool_reader(db);
+
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to fetch option of type int");
 
     if (sqlite3_bind_text(stmt, 1, key, -1, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to bind option key text when fetching int option");
 
-    if (sqlite3_step(stmt) != SQLITE_ROW)
+    if (sqlite3_step(stmt) != SQLITE_ROW) {
+        sqlite3_finalize(stmt);
         return 0;
+    }
 
     value = sqlite3_column_int(stmt, 0);
     sqlite3_finalize(stmt);
@@ -107,14 +116,19 @@ int db_options_get_bin(sqlite3 *db, const char *key, void *value, int value_len)
 
     const char sql[] = "SELECT bin_value FROM options WHERE key = ?";
 
+    // Query is run on one of the read only connections
+    db = db_pool_reader(db);
+
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to fetch option of type binary");
 
     if (sqlite3_bind_text(stmt, 1, key, -1, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to bind key when fetching binary option value");
 
-    if (sqlite3_step(stmt) != SQLITE_ROW)
+    if (sqlite3_step(stmt) != SQLITE_ROW) {
+        sqlite3_finalize(stmt);
         return 0;
+    }
 
     db_value = sqlite3_column_blob(stmt, 0);
     db_value_len = sqlite3_column_bytes(stmt, 0);
@@ -156,14 +170,19 @@ int db_options_get_text(sqlite3 *db, const char *key, char *value, int value_len
 
     const char sql[] = "SELECT text_value FROM options WHERE key = ?";
 
+    // Query is run on one of the read only connections
+    db = db_pool_reader(db);
+
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to fetch option of type binary");
 
     if (sqlite3_bind_text(stmt, 1, key, -1, NULL) != SQLITE_OK)
         sys_db_crash(db, "Failed to bind key when fetching text option value");
 
-    if (sqlite3_step(stmt) != SQLITE_ROW)
+    if (sqlite3_step(stmt) != SQLITE_ROW) {
+        sqlite3_finalize(stmt);
         return 0;
+    }
 
     db_value = sqlite3_column_text(stmt, 0);
     db_value_len = sqlite3_column_bytes(stmt, 0);
@@ -0,0 +1,74 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include <db_init.h>
+#include <db_pool.h>
+#include <db_storage.h>
+#include <helpers.h>
+
+static struct db_pool pool = { 0 };
+
+// Open n_readers read only connections to database file opened by
+// given writer connection and switch database into WAL mode
+void db_pool_init(sqlite3 *writer, const char *db_file_path, int n_readers) {
+    int i;
+
+    const char sql_writer[] =
+        "PRAGMA journal_mode = WAL;"
+        // In WAL mode this is still safe from corruption, only last
+        // transactions may be lost on power failure
+        "PRAGMA synchronous = NORMAL;"
+    ;
+
+    db_pool_close(pool.writer);
+
+    if (sqlite3_exec(writer, sql_writer, NULL, NULL, NULL) != SQLITE_OK)
+        sys_db_crash(writer, "Failed to switch database into WAL mode");
+
+    sqlite3_busy_timeout(writer, DB_POOL_BUSY_TIMEOUT);
+
+    // Readers would not see data of storage modes which can't share the database
+    if (!db_storage_get()->shared)
+        n_readers = 0;
+
+    pool.writer = writer;
+    pool.n_readers = min(n_readers, DB_POOL_MAX_READERS);
+    pool.next_reader = 0;
+
+    for (i = 0; i < pool.n_readers; i++) {
+        if (sqlite3_open_v2(db_file_path, &(pool.readers[i]), SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
+            sys_db_crash(pool.readers[i], "Failed to open read only database connection");
+
+        sqlite3_busy_timeout(pool.readers[i], DB_POOL_BUSY_TIMEOUT);
+    }
+}
+
+// Get connection read only query should be run on, if given connection
+// has no pool or it's in the middle of transaction it is returned
+sqlite3 * db_pool_reader(sqlite3 *db) {
+    sqlite3 *reader;
+
+    if (db != pool.writer || pool.n_readers == 0)
+        return db;
+
+    // Readers would not see changes which are not yet commited
+    if (!sqlite3_get_autocommit(db))
+        return db;
+
+    reader = pool.readers[pool.next_reader];
+    pool.next_reader = (pool.next_reader + 1) % pool.n_readers;
+    return reader;
+}
+
+// Close all read only connections of given writer
+void db_pool_close(sqlite3 *writer) {
+    int i;
+
+    if (!writer || writer != pool.writer)
+        return;
+
+    for (i = 0; i < pool.n_readers; i++)
+        sqlite3_close(pool.readers[i]);
+
+    memset(&pool, 0, sizeof(pool));
+}
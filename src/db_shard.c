@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include <db_init.h>
+#include <db_pool.h>
+#include <db_shard.h>
+#include <db_storage.h>
+#include <db_options.h>
+#include <hash_table.h>
+#include <sys_memory.h>
+#include <constants.h>
+
+static struct db_shard shard = { 0 };
+
+// Get number of accounts stored in the main database
+static int db_shard_count_accounts(sqlite3 *db) {
+    int n;
+    sqlite3_stmt *stmt;
+
+    const char sql[] = "SELECT COUNT(*) FROM mailbox_accounts";
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to count mailbox accounts");
+
+    if (sqlite3_step(stmt) != SQLITE_ROW)
+        sys_db_crash(db, "Failed to count mailbox accounts (step)");
+
+    n = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+    return n;
+}
+
+static const char *db_shard_tables[] = { "mailbox_accounts", "mailbox_contacts", "mailbox_messages" };
+
+// Make inserts fail once shard with given index runs out of row IDs, next
+// ID would already belong to the next shard and rows would be misrouted
+static void db_shard_set_limit(sqlite3 *db, int index) {
+    size_t i;
+    char *sql;
+
+    for (i = 0; i < sizeof(db_shard_tables) / sizeof(db_shard_tables[0]); i++) {
+        sql = sqlite3_mprintf(
+            "CREATE TRIGGER IF NOT EXISTS %s_shard_limit "
+            "AFTER INSERT ON %s WHEN new.id > %lld BEGIN "
+                "SELECT RAISE(ABORT, 'Mailbox shard %d is full');"
+            "END;",
+            db_shard_tables[i], db_shard_tables[i],
+            DB_SHARD_ID_LAST(index), index
+        );
+
+        if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK)
+            sys_db_crash(db, "Failed to set mailbox shard ID limit");
+
+        sqlite3_free(sql);
+    }
+}
+
+// Open database file of shard with given index
+static sqlite3 * db_shard_open(const char *db_file_path, int index) {
+    size_t i;
+    char *path;
+    sqlite3 *db;
+    sqlite3_stmt *stmt;
+
+    const char sql_mode[] =
+        "PRAGMA journal_mode = WAL;"
+        "PRAGMA synchronous = NORMAL;"
+    ;
+
+    // Sequence is only set when table has no rows yet
+    const char sql_seq[] =
+        "INSERT INTO sqlite_sequence (name, seq) "
+            "SELECT ?1, ?2 WHERE NOT EXISTS (SELECT 1 FROM sqlite_sequence WHERE name = ?1)";
+
+    path = safe_malloc(strlen(db_file_path) + 16, "Failed to allocate shard path");
+    sprintf(path, "%s.%d", db_file_path, index);
+
+    db = db_storage_open(path);
+    free(path);
+
+    // Shards only hold mailbox data
+    db_init_mailbox_schema(db);
+
+    if (sqlite3_exec(db, sql_mode, NULL, NULL, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to switch mailbox shard into WAL mode");
+
+    sqlite3_busy_timeout(db, DB_POOL_BUSY_TIMEOUT);
+
+    if (sqlite3_prepare_v2(db, sql_seq, -1, &stmt, NULL) != SQLITE_OK)
+        sys_db_crash(db, "Failed to set mailbox shard ID range");
+
+    for (i = 0; i < sizeof(db_shard_tables) / sizeof(db_shard_tables[0]); i++) {
+        if (
+            SQLITE_OK != sqlite3_bind_text(stmt, 1, db_shard_tables[i], -1, NULL) ||
+            SQLITE_OK != sqlite3_bind_int64(stmt, 2, (sqlite3_int64)index << DB_SHARD_ID_BITS)
+        ) {
+            sys_db_crash(db, "Failed to bind mailbox shard ID range");
+        }
+
+        if (sqlite3_step(stmt) != SQLITE_DONE)
+            sys_db_crash(db, "Failed to set mailbox shard ID range (step)");
+
+        sqlite3_reset(stmt);
+    }
+
+    sqlite3_finalize(stmt);
+
+    db_shard_set_limit(db, index);
+    return db;
+}
+
+// Split mailbox data of given main connection into n_shards files, number of shards
+// can't be changed after mailbox data is created, returns 1 if it doesn't match
+// number of shards database was created with, otherwise 0
+int db_shard_init(sqlite3 *db, const char *db_file_path, int n_shards) {
+    int i;
+
+    db_shard_close(shard.db);
+
+    // Databases created before shards existed keep everything in the main file
+    if (!db_options_is_defined(db, "mailbox_shards", DB_OPTIONS_INT)) {
+        if (n_shards > 1 && db_shard_count_accounts(db) > 0)
+            return 1;
+        db_options_set_int(db, "mailbox_shards", n_shards);
+    }
+
+    if (db_options_get_int(db, "mailbox_shards") != n_shards)
+        return 1;
+
+    shard.db = db;
+    shard.n_shards = n_shards;
+    shard.shards[0] = db;
+
+    // Without shards IDs are not used for routing so they are not limited
+    if (n_shards > 1)
+        db_shard_set_limit(db, 0);
+
+    for (i = 1; i < n_shards; i++)
+        shard.shards[i] = db_shard_open(db_file_path, i);
+
+    return 0;
+}
+
+// Get connection to the shard mailbox with given mailbox ID is stored in
+sqlite3 * db_shard_by_mbid(sqlite3 *db, const uint8_t *mbid) {
+    if (db != shard.db || shard.n_shards <= 1)
+        return db;
+
+    return shard.shards[hash_table_hash(mbid, MAILBOX_ID_LEN) % shard.n_shards];
+}
+
+// Get connection to the shard row with given ID is stored in
+sqlite3 * db_shard_by_id(sqlite3 *db, int id) {
+    int index;
+
+    if (db != shard.db || shard.n_shards <= 1)
+        return db;
+
+    index = id >> DB_SHARD_ID_BITS;
+    if (index < 0 || index >= shard.n_shards)
+        sys_crash(CRASH_SOURCE_DB, "Row ID %d does not belong to any mailbox shard", id);
+
+    return shard.shards[index];
+}
+
+// Close all shards of given main connection
+void db_shard_close(sqlite3 *db) {
+    int i;
+
+    if (!db || db != shard.db)
+        return;
+
+    // Main connection is closed by it's owner
+    for (i = 1; i < shard.n_shards; i++)
+        sqlite3_close(shard.shards[i]);
+
+    memset(&shard, 0, sizeof(shard));
+}
@@ -0,0 +1,59 @@
+#include <string.h>
+#include <sqlite3.h>
+#include <db_init.h>
+#include <db_message.h>
+#include <db_storage.h>
+
+// Open connection to the database file
+static sqlite3 * db_storage_file_open(const char *db_file_path) {
+    sqlite3 *db;
+
+    if (sqlite3_open(db_file_path, &db) != SQLITE_OK)
+        sys_db_crash(db, "Unable to open database file");
+
+    return db;
+}
+
+// Open new private in-memory database, path is not used
+static sqlite3 * db_storage_memory_open(const char *db_file_path) {
+    sqlite3 *db;
+
+    if (sqlite3_open(":memory:", &db) != SQLITE_OK)
+        sys_db_crash(db, "Unable to open in-memory database");
+
+    return db;
+}
+
+static const struct db_storage storages[] = {
+    { "file", db_storage_file_open, 1 },
+    { "memory", db_storage_memory_open, 0 },
+};
+
+static const struct db_storage *selected = &storages[0];
+
+// Select storage mode with given name, returns 1 if there is no such mode
+int db_storage_select(const char *name) {
+    size_t i;
+
+    for (i = 0; i < sizeof(storages) / sizeof(storages[0]); i++) {
+        if (strcmp(storages[i].name, name) == 0) {
+            selected = &storages[i];
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Get selected storage mode
+const struct db_storage * db_storage_get(void) {
+    return selected;
+}
+
+// Open new connection to the database at given path using selected storage mode,
+// SQL functions used by schema triggers are registered on it
+sqlite3 * db_storage_open(const char *db_file_path) {
+    sqlite3 *db = selected->open(db_file_path);
+
+    db_message_register_functions(db);
+    return db;
+}
@@ -0,0 +1,185 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <hash_table.h>
+#include <sys_memory.h>
+
+struct hash_table_node {
+    uint64_t hash;
+    void *value;
+    size_t key_len;
+    struct hash_table_node *next;
+    // Key is stored right after the node
+    uint8_t key[];
+};
+
+// Allocate new hash table
+struct hash_table * hash_table_new(void) {
+    struct hash_table *ht;
+
+    ht = safe_malloc(sizeof(struct hash_table), "Failed to allocate hash table");
+
+    ht->length = 0;
+    ht->n_buckets = HASH_TABLE_INITIAL_SIZE;
+    ht->buckets = safe_malloc(sizeof(struct hash_table_node *) * ht->n_buckets,
+        "Failed to allocate hash table buckets");
+    memset(ht->buckets, 0, sizeof(struct hash_table_node *) * ht->n_buckets);
+
+    return ht;
+}
+
+// Free given hash table and all it's nodes, values are not freed
+void hash_table_free(struct hash_table *ht) {
+    int i;
+
+    if (!ht) return;
+
+    for (i = 0; i < ht->n_buckets; i++) {
+        while (ht->buckets[i] != NULL) {
+            struct hash_table_node *next = ht->buckets[i]->next;
+
+            free(ht->buckets[i]);
+            ht->buckets[i] = next;
+        }
+    }
+
+    free(ht->buckets);
+    free(ht);
+}
+
+// Calculate hash of given key (FNV-1a)
+uint64_t hash_table_hash(const void *key, size_t key_len) {
+    size_t i;
+    const uint8_t *bytes = key;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (i = 0; i < key_len; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Double the number of buckets and move all nodes into new buckets
+static void hash_table_grow(struct hash_table *ht) {
+    int i, n_buckets;
+    struct hash_table_node **buckets;
+
+    n_buckets = ht->n_buckets * 2;
+    buckets = safe_malloc(sizeof(struct hash_table_node *) * n_buckets,
+        "Failed to expand hash table buckets");
+    memset(buckets, 0, sizeof(struct hash_table_node *) * n_buckets);
+
+    for (i = 0; i < ht->n_buckets; i++) {
+        while (ht->buckets[i] != NULL) {
+            struct hash_table_node *node = ht->buckets[i];
+            int index = node->hash & (n_buckets - 1);
+
+            ht->buckets[i] = node->next;
+            node->next = buckets[index];
+            buckets[index] = node;
+        }
+    }
+
+    free(ht->buckets);
+    ht->buckets = buckets;
+    ht->n_buckets = n_buckets;
+}
+
+// Find node with given key, if prev is not NULL it will be set to
+// pointer which points to the found node
+static struct hash_table_node * hash_table_find(
+    struct hash_table *ht,
+    const void *key,
+    size_t key_len,
+    uint64_t hash,
+    struct hash_table_node ***prev
+) {
+    struct hash_table_node **node;
+
+    node = &(ht->buckets[hash & (ht->n_buckets - 1)]);
+
+    for (; *node != NULL; node = &((*node)->next)) {
+        if (
+            (*node)->hash == hash && (*node)->key_len == key_len &&
+            memcmp((*node)->key, key, key_len) == 0
+        ) {
+            if (prev)
+                *prev = node;
+            return *node;
+        }
+    }
+    return NULL;
+}
+
+// Insert value under given key, key is copied, if key already
+// exists it's value will be replaced
+void hash_table_set(struct hash_table *ht, const void *key, size_t key_len, void *value) {
+    int index;
+    uint64_t hash;
+    struct hash_table_node *node;
+
+    hash = hash_table_hash(key, key_len);
+
+    if ((node = hash_table_find(ht, key, key_len, hash, NULL))) {
+        node->value = value;
+        return;
+    }
+
+    // Keep load factor under 3/4
+    if ((ht->length + 1) * 4 > ht->n_buckets * 3)
+        hash_table_grow(ht);
+
+    node = safe_malloc(sizeof(struct hash_table_node) + key_len,
+        "Failed to allocate hash table node");
+    node->hash = hash;
+    node->value = value;
+    node->key_len = key_len;
+    memcpy(node->key, key, key_len);
+
+    index = hash & (ht->n_buckets - 1);
+    node->next = ht->buckets[index];
+    ht->buckets[index] = node;
+
+    ++ht->length;
+}
+
+// Get value stored under given key, returns NULL if not found
+void * hash_table_get(struct hash_table *ht, const void *key, size_t key_len) {
+    struct hash_table_node *node;
+
+    node = hash_table_find(ht, key, key_len, hash_table_hash(key, key_len), NULL);
+    return node ? node->value : NULL;
+}
+
+// Remove given key from the table, returns 0 on success and 1 if not found
+int hash_table_remove(struct hash_table *ht, const void *key, size_t key_len) {
+    struct hash_table_node *node, **prev;
+
+    node = hash_table_find(ht, key, key_len, hash_table_hash(key, key_len), &prev);
+    if (!node)
+        return 1;
+
+    *prev = node->next;
+    free(node);
+
+    --ht->length;
+    return 0;
+}
+
+// Call given callback for each element in the table, table
+// must not be modified while iterating
+void hash_table_foreach(struct hash_table *ht, hash_table_cb cb, void *cbarg) {
+    int i;
+    struct hash_table_node *node;
+
+    for (i = 0; i < ht->n_buckets; i++) {
+        for (node = ht->buckets[i]; node != NULL; node = node->next)
+            cb(node->key, node->key_len, node->value, cbarg);
+    }
+}
+
+// Get the number of elements in the table
+int hash_table_get_length(struct hash_table *ht) {
+    return ht->length;
+}
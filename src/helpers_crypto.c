@@ -72,7 +72,7 @@ void rsa_2048bit_keygen(uint8_t *public_key, uint8_t *private_key) {
 
 // Decodes given RSA public key encoded in DER format and returns pointer to
 // EVP_PKEY on success or NULL on failure
-EVP_PKEY * rsa_2048bit_pub_key_decode(uint8_t *public_key) {
+EVP_PKEY * rsa_2048bit_pub_key_decode(const uint8_t *public_key) {
     int is_err = 0;
     size_t len;
     const uint8_t *der_ptr;
@@ -99,7 +99,7 @@ EVP_PKEY * rsa_2048bit_pub_key_decode(uint8_t *public_key) {
 
 // Decodes given RSA private key encoded in DER format and returns pointer to
 // EVP_PKEY on success or NULL on failure
-EVP_PKEY * rsa_2048bit_priv_key_decode(uint8_t *private_key) {
+EVP_PKEY * rsa_2048bit_priv_key_decode(const uint8_t *private_key) {
     int is_err = 0;
     size_t len;
     const uint8_t *der_ptr;
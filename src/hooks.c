@@ -1,6 +1,76 @@
 #include <hooks.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys_memory.h>
+#include <sys_crash.h>
+#include <event2/event.h>
+
+// Pending deferred hook call
+struct hook_deferred {
+    struct hook_list *list;
+    int hook_event;
+    void *data;
+    hook_data_free free_cb;
+};
+
+// Get bucket which holds hooks for given event
+static struct hook_bucket * hook_bucket_get(struct hook_list *list, int hevent) {
+    uint32_t hash = (uint32_t)hevent * 2654435761u;
+    return &(list->buckets[(hash >> 16) & (HOOK_LIST_BUCKETS - 1)]);
+}
+
+// Actually free the list and all hooks in it
+static void hook_list_destroy(struct hook_list *list) {
+    int i;
+
+    for (i = 0; i < HOOK_LIST_BUCKETS; i++) {
+        struct hook *hk = list->buckets[i].head;
+
+        while (hk != NULL) {
+            struct hook *hk_free = hk;
+
+            hk = hk->next;
+            free(hk_free);
+        }
+    }
+
+    free(list);
+}
+
+// Free hooks removed during dispatch, or the whole list if freeing
+// it was requested while it was in use
+static void hook_list_release(struct hook_list *list) {
+    int i;
+
+    if (list->dispatching > 0)
+        return;
+
+    if (list->free_pending) {
+        if (list->n_deferred == 0)
+            hook_list_destroy(list);
+        return;
+    }
+
+    for (i = 0; list->n_removed > 0 && i < HOOK_LIST_BUCKETS; i++) {
+        struct hook *hk, **link;
+        struct hook_bucket *bucket = &(list->buckets[i]);
+
+        link = &(bucket->head);
+        bucket->tail = NULL;
+
+        while ((hk = *link) != NULL) {
+            if (hk->removed) {
+                *link = hk->next;
+                free(hk);
+                --list->n_removed;
+            } else {
+                bucket->tail = hk;
+                link = &(hk->next);
+            }
+        }
+    }
+}
 
 // Create new hook list to handle hooks
 struct hook_list * hook_list_new(void) {
@@ -8,81 +78,132 @@ struct hook_list * hook_list_new(void) {
 
     list = safe_malloc(sizeof(struct hook_list),
         "Failed to allocate hook list");
+    memset(list, 0, sizeof(struct hook_list));
 
-    list->head = NULL;
     return list;
 }
 
-// Free the hook list and all it's hooks
+// Free the hook list and all it's hooks, if list is being dispatched or
+// has deferred calls pending it is freed once they are done
 void hook_list_free(struct hook_list *list) {
-    struct hook *hk;
-
-    // Free all hooks in the list
-    hk = list->head;
-    while (hk != NULL) {
-        struct hook *hk_free = hk;
+    if (!list) return;
 
-        hk = hk->next;
-        free(hk_free);
-    }
-
-    free(list);
+    list->free_pending = 1;
+    hook_list_release(list);
 }
 
 // Add new hook to the hook list
 void hook_add(struct hook_list *list, int hevent, hook_callback cb, void *cbarg) {
     struct hook *hk;
+    struct hook_bucket *bucket;
 
     hk = safe_malloc(sizeof(struct hook), "Failed to allocate hook");
     hk->cb = cb;
     hk->cbarg = cbarg;
     hk->hook_event = hevent;
+    hk->removed = 0;
     hk->next = NULL;
 
-    if (list->head == NULL) {
-        list->head = hk;
-    } else {
-        struct hook *last_hk;
+    bucket = hook_bucket_get(list, hevent);
 
-        // Find the last hook in the list
-        for (last_hk = list->head; last_hk->next != NULL; last_hk = last_hk->next)
-            /* Do nothing */;
-
-        last_hk->next = hk;
-    }
+    if (bucket->tail == NULL)
+        bucket->head = hk;
+    else
+        bucket->tail->next = hk;
+    bucket->tail = hk;
 }
 
-// Remove hook with given data from the list
+// Remove hook with given data from the list, can be called from
+// inside of a hook callback
 void hook_remove(struct hook_list *list, int hevent, hook_callback cb, void *cbarg) {
-    struct hook *hk;
+    struct hook *hk, *prev = NULL;
+    struct hook_bucket *bucket;
 
-    hk = list->head;
-    // If the first hook is the one
-    if (hk->hook_event == hevent && hk->cb == cb && hk->cbarg == cbarg) {
-        list->head = hk->next;
-        free(hk);
-        return;
+    if (!list) return;
+
+    bucket = hook_bucket_get(list, hevent);
+
+    // Search for matching hook in the bucket
+    for (hk = bucket->head; hk != NULL; prev = hk, hk = hk->next) {
+        if (!hk->removed && hk->hook_event == hevent && hk->cb == cb && hk->cbarg == cbarg)
+            break;
     }
 
-    // Search for matching hook in the list
-    for (; hk->next != NULL; hk = hk->next) {
-        struct hook *hkn = hk->next;
+    if (hk == NULL)
+        return;
 
-        if (hkn->hook_event == hevent && hkn->cb == cb && hkn->cbarg == cbarg) {
-            hk->next = hkn->next;
-            free(hkn);
-            return;
-        }
+    // Someone may be iterating over this hook, free it later
+    if (list->dispatching > 0) {
+        hk->removed = 1;
+        ++list->n_removed;
+        return;
     }
+
+    if (prev)
+        prev->next = hk->next;
+    else
+        bucket->head = hk->next;
+
+    if (bucket->tail == hk)
+        bucket->tail = prev;
+
+    free(hk);
 }
 
 // Call all hooks for given event
 void hook_list_call(struct hook_list *list, int hevent, void *data) {
     struct hook *hk;
 
-    for (hk = list->head; hk != NULL; hk = hk->next) {
-        if (hk->hook_event == hevent) {
+    ++list->dispatching;
+
+    for (hk = hook_bucket_get(list, hevent)->head; hk != NULL; hk = hk->next) {
+        if (!hk->removed && hk->hook_event == hevent) {
             hk->cb(hevent, data, hk->cbarg);
         }
     }
+
+    --list->dispatching;
+    hook_list_release(list);
+}
+
+// Dispatch deferred hook call from the event loop
+static void hook_deferred_cb(evutil_socket_t fd, short events, void *arg) {
+    struct hook_deferred *def = arg;
+    struct hook_list *list = def->list;
+
+    // Pending call keeps the list alive, but once the owner freed it hooks
+    // are not called since whatever they would report about is gone
+    if (!list->free_pending)
+        hook_list_call(list, def->hook_event, def->data);
+    --list->n_deferred;
+
+    if (def->free_cb)
+        def->free_cb(def->data);
+    free(def);
+
+    hook_list_release(list);
+}
+
+// Call all hooks for given event from the event loop instead of the current
+// callback, list takes the ownership of data and frees it using free_cb, if
+// list is freed before the call is dispatched hooks are not called
+void hook_list_call_deferred(
+    struct hook_list *list,
+    struct event_base *base,
+    int hevent,
+    void *data,
+    hook_data_free free_cb
+) {
+    struct hook_deferred *def;
+
+    def = safe_malloc(sizeof(struct hook_deferred), "Failed to allocate deferred hook call");
+    def->list = list;
+    def->hook_event = hevent;
+    def->data = data;
+    def->free_cb = free_cb;
+
+    if (event_base_once(base, -1, EV_TIMEOUT, hook_deferred_cb, def, NULL) != 0)
+        sys_crash("Hooks", "Failed to schedule deferred hook call");
+
+    ++list->n_deferred;
 }
\ No newline at end of file
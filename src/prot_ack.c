@@ -7,6 +7,10 @@
 #include <event2/bufferevent.h>
 #include <buffer_crypto.h>
 #include <debug.h>
+#include <prot_pool.h>
+
+// ACK is sent for every message, objects are reused
+static struct prot_pool ack_pool = PROT_POOL_INIT(struct prot_ack_ed25519);
 
 // Free ACK handler memory
 static void tran_cleanup(struct prot_main *pmain, struct prot_tran_handler *phand) {
@@ -84,8 +88,7 @@ struct prot_ack_ed25519 * prot_ack_ed25519_new(
 ) {
     struct prot_ack_ed25519 *ack;
 
-    ack = safe_malloc(sizeof(struct prot_ack_ed25519), "Failed to allocate ACK message");
-    memset(ack, 0, sizeof(struct prot_ack_ed25519));
+    ack = prot_pool_alloc(&ack_pool, "Failed to allocate ACK message");
     
     ack->cb = cb;
     ack->cbarg = cbarg;
@@ -100,7 +103,7 @@ struct prot_ack_ed25519 * prot_ack_ed25519_new(
     ack->htran.done_cb = tran_done;
     ack->htran.setup_cb = tran_setup;
     ack->htran.cleanup_cb = tran_cleanup;
-    ack->htran.buffer = evbuffer_new();
+    ack->htran.buffer = NULL;
 
     ack->hrecv.msg = ack;
     ack->hrecv.msg_code = msg_code;
@@ -113,7 +116,7 @@ struct prot_ack_ed25519 * prot_ack_ed25519_new(
 
 // Free memory for given ack
 void prot_ack_ed25519_free(struct prot_ack_ed25519 *ack) {
-    if (ack && ack->htran.buffer)
-        evbuffer_free(ack->htran.buffer);
-    free(ack);
+    if (ack)
+        prot_pool_buffer_put(ack->htran.buffer);
+    prot_pool_release(&ack_pool, ack);
 }
\ No newline at end of file
@@ -8,16 +8,15 @@
 #include <debug.h>
 #include <buffer_crypto.h>
 #include <prot_message_list.h>
+#include <prot_pool.h>
 
 // Called when fetch request is sent successfully
 static void tran_done(struct prot_main *pmain, struct prot_tran_handler *phand) {
     struct prot_client_fetch *msg = phand->msg;
     struct prot_message_list *msg_list;
 
-    msg_list = prot_message_list_client_new(msg->db, msg->cont, NULL, 0);
+    msg_list = prot_message_list_client_new(msg->db, db_contact_ref_by_pk(msg->db, msg->cont->id), NULL);
     prot_main_push_recv(pmain, &(msg_list->hrecv));
-    // Don't free the contact
-    msg->cont = NULL;
 }
 
 // Called to free fetch request memory
@@ -54,10 +53,9 @@ static void recv_handle(struct prot_main *pmain, struct prot_recv_handler *phand
     struct prot_client_fetch *msg = phand->msg;
     struct evbuffer *input;
     struct evbuffer_ptr pos;
-    struct db_contact *cont;
+    const struct db_contact *cont;
 
-    int n_msgs;
-    struct db_message **msgs;
+    struct db_message_batch *batch;
     struct prot_message_list *msg_list;
     uint8_t sig_pub_key[CLIENT_SIG_KEY_PUB_LEN];
 
@@ -82,16 +80,16 @@ static void recv_handle(struct prot_main *pmain, struct prot_recv_handler *phand
     }
 
     if (
-        !(cont = db_contact_get_by_rsk_pub(msg->db, sig_pub_key, NULL))
+        !(cont = db_contact_ref_by_rsk_pub(msg->db, sig_pub_key))
         || cont->status != DB_CONTACT_ACTIVE || cont->deleted
     ) {
         prot_main_set_error(pmain, PROT_ERR_INVALID_MSG);
         return;
     }
 
-    msgs = db_message_get_all(msg->db, cont, DB_MESSAGE_STATUS_UNDELIVERED, &n_msgs);
-    debug(">>>>>>>>>>>>>>>>>> Found messages %d", n_msgs);
-    msg_list = prot_message_list_client_new(msg->db, cont, msgs, n_msgs);
+    batch = db_message_get_batch(msg->db, cont, DB_MESSAGE_STATUS_UNDELIVERED);
+    debug(">>>>>>>>>>>>>>>>>> Found messages %d", batch->n_msgs);
+    msg_list = prot_message_list_client_new(msg->db, cont, batch);
     prot_main_push_tran(pmain, &(msg_list->htran));
 
     evbuffer_drain(input, message_len);
@@ -114,7 +112,7 @@ struct prot_client_fetch * prot_client_fetch_new(sqlite3 *db, struct db_contact
     msg->htran.done_cb = tran_done;
     msg->htran.setup_cb = tran_setup;
     msg->htran.cleanup_cb = tran_cleanup;
-    msg->htran.buffer = evbuffer_new();
+    msg->htran.buffer = NULL;
 
     msg->hrecv.msg = msg;
     msg->hrecv.msg_code = PROT_CLIENT_FETCH;
@@ -129,7 +127,7 @@ struct prot_client_fetch * prot_client_fetch_new(sqlite3 *db, struct db_contact
 void prot_client_fetch_free(struct prot_client_fetch *msg) {
     debug("PCF FREE called");
     if (msg) {
-        evbuffer_free(msg->htran.buffer);
+        prot_pool_buffer_put(msg->htran.buffer);
         if (msg->cont)
             db_contact_free(msg->cont);
     }
@@ -15,6 +15,7 @@
 #include <openssl/rsa.h>
 #include <openssl/encoder.h>
 #include <helpers_crypto.h>
+#include <prot_pool.h>
 
 // Called when ACK message is received (or cleaned up)
 static void ack_received_cb(int ack_success, struct prot_main *pmain, void *arg) {
@@ -108,12 +109,20 @@ static void recv_cleanup(struct prot_main *pmain, struct prot_recv_handler *phan
     prot_friend_req_free(msg);
 }
 
+// Free contact passed to deferred hooks
+static void friend_free(void *data) {
+    db_contact_free(data);
+}
+
 static void ack_sent_cb(int ack_success, struct prot_main *pmain, void *arg) {
     struct prot_friend_req *msg = arg;
 
     if (ack_success) {
         db_contact_save(msg->db, msg->friend);
-        hook_list_call(pmain->hooks, PROT_FRIEND_REQ_EV_INCOMMING, msg->friend);
+        // UI is notified from the event loop, contact is handed over to the hook list
+        hook_list_call_deferred(pmain->hooks, pmain->event_base,
+            PROT_FRIEND_REQ_EV_INCOMMING, msg->friend, friend_free);
+        msg->friend = NULL;
     }
 
     prot_friend_req_free(msg);
@@ -256,7 +265,7 @@ struct prot_friend_req * prot_friend_req_new(sqlite3 *db, const char *onion_addr
     msg->htran.done_cb = tran_done;
     msg->htran.setup_cb = tran_setup;
     msg->htran.cleanup_cb = tran_cleanup;
-    msg->htran.buffer = evbuffer_new();
+    msg->htran.buffer = NULL;
 
     return msg;
 }
@@ -265,8 +274,8 @@ struct prot_friend_req * prot_friend_req_new(sqlite3 *db, const char *onion_addr
 void prot_friend_req_free(struct prot_friend_req *msg) {
     if (msg && msg->friend)
         db_contact_free(msg->friend);
-    if (msg && msg->htran.buffer)
-        evbuffer_free(msg->htran.buffer);
+    if (msg)
+        prot_pool_buffer_put(msg->htran.buffer);
 
     free(msg);
 }
\ No newline at end of file
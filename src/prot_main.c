@@ -21,6 +21,7 @@
 #include <prot_mb_account.h>
 #include <prot_mb_set_contacts.h>
 #include <prot_mb_fetch.h>
+#include <prot_pool.h>
 
 // Internal bufferevent callbacks
 static void prot_main_bev_read_cb(struct bufferevent *bev, void *ctx);
@@ -29,6 +30,15 @@ static void prot_main_bev_event_cb(struct bufferevent *bev, short events, void *
 
 // Socks5 done callback, called to setup
 static void prot_main_socks5_cb(struct bufferevent *bev, enum socks5_errors err, void *attr);
+// Start connecting to socks server on given address, bufferevent is created
+// on the first attempt, returns 0 on success
+static int prot_main_socks_connect(
+    struct prot_main *pmain,
+    const struct sockaddr *socks_addr,
+    int socks_addr_len
+);
+// Send socks greeting together with connect request for given onion service
+static void prot_main_socks_request(struct prot_main *pmain, const char *onion_address, const char *onion_port);
 
 // Call close callback and free protocol main
 static void prot_main_fail(struct prot_main *pmain, enum prot_status_codes status) {
@@ -69,8 +79,9 @@ struct prot_main *prot_main_new(struct event_base *base, sqlite3 *db) {
     pmain->hooks = hook_list_new();
 
     // Allocate queues
-    pmain->tran_q = queue_new(sizeof(struct prot_tran_handler));
-    pmain->recv_q = queue_new(sizeof(struct prot_recv_handler));
+    // Queues hold pointers, handlers live inside their message objects
+    pmain->tran_q = queue_new(sizeof(struct prot_tran_handler *));
+    pmain->recv_q = queue_new(sizeof(struct prot_recv_handler *));
 
     // Transmission is enabled by default
     pmain->tran_enabled = 1;
@@ -82,7 +93,7 @@ struct prot_main *prot_main_new(struct event_base *base, sqlite3 *db) {
 void prot_main_free(struct prot_main *pmain) {
     // Run cleanup function for all handlers in Receive queue
     while (!queue_is_empty(pmain->recv_q)) {
-        struct prot_recv_handler *phand = queue_peek(pmain->recv_q, 0);
+        struct prot_recv_handler *phand = *(struct prot_recv_handler **) queue_peek(pmain->recv_q, 0);
 
         phand->success = 0;
         if (phand->cleanup_cb)
@@ -93,7 +104,7 @@ void prot_main_free(struct prot_main *pmain) {
 
     // Run cleanup function for all handlers in Transmit queue
     while (!queue_is_empty(pmain->tran_q)) {
-        struct prot_tran_handler *phand = queue_peek(pmain->tran_q, 0);
+        struct prot_tran_handler *phand = *(struct prot_tran_handler **) queue_peek(pmain->tran_q, 0);
 
         phand->success = 0;
         if (phand->cleanup_cb)
@@ -122,7 +133,8 @@ void prot_main_free_on_done(struct prot_main *pmain, int yes) {
 }
 
 // Connect to given TOR client socks server and try to contact
-// deep messenger instance on given onion address
+// deep messenger instance on given onion address, every address
+// socks server resolves to is tried until connect succeeds
 void prot_main_connect(
     struct prot_main *pmain,
     const char *onion_address,
@@ -131,18 +143,8 @@ void prot_main_connect(
     const char *socks_server_port
 ) {
     int rc;
-    uint16_t onion_port_parsed;
     struct addrinfo hints, *servinfo, *aip;
 
-    pmain->bev = bufferevent_socket_new(pmain->event_base, -1, BEV_OPT_CLOSE_ON_FREE);
-    if (!pmain->bev) {
-        prot_main_fail(pmain, PROT_ERR_SOCKS_CONN_FAIL);
-        return;
-    }
-    bufferevent_enable(pmain->bev, EV_READ | EV_WRITE);
-
-    debug("Got socket");
-
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
@@ -156,14 +158,63 @@ void prot_main_connect(
     debug("Got addrinfo addresses");
 
     for (aip = servinfo; aip != NULL; aip = aip->ai_next) {
-        if (bufferevent_socket_connect(pmain->bev, aip->ai_addr, aip->ai_addrlen) == 0)
+        if (prot_main_socks_connect(pmain, aip->ai_addr, aip->ai_addrlen) == 0)
             break;
     }
     freeaddrinfo(servinfo);
 
-    debug("Got socket connected");
+    if (aip == NULL) {
+        prot_main_fail(pmain, PROT_ERR_SOCKS_CONN_FAIL);
+        return;
+    }
+
+    prot_main_socks_request(pmain, onion_address, onion_port);
+}
+
+// Same as prot_main_connect but socks server address is already resolved,
+// connect request is sent together with socks greeting
+void prot_main_connect_addr(
+    struct prot_main *pmain,
+    const char *onion_address,
+    const char *onion_port,
+    const struct sockaddr *socks_addr,
+    int socks_addr_len
+) {
+    if (prot_main_socks_connect(pmain, socks_addr, socks_addr_len) != 0) {
+        prot_main_fail(pmain, PROT_ERR_SOCKS_CONN_FAIL);
+        return;
+    }
+
+    prot_main_socks_request(pmain, onion_address, onion_port);
+}
+
+// Start connecting to socks server on given address, bufferevent is created
+// on the first attempt, returns 0 on success
+static int prot_main_socks_connect(
+    struct prot_main *pmain,
+    const struct sockaddr *socks_addr,
+    int socks_addr_len
+) {
+    if (!pmain->bev) {
+        pmain->bev = bufferevent_socket_new(pmain->event_base, -1, BEV_OPT_CLOSE_ON_FREE);
+        if (!pmain->bev)
+            return 1;
+        bufferevent_enable(pmain->bev, EV_READ | EV_WRITE);
+
+        debug("Got socket");
+    }
+
+    if (socks_addr_len <= 0)
+        return 1;
+
+    return bufferevent_socket_connect(pmain->bev, (struct sockaddr *)socks_addr, socks_addr_len) != 0;
+}
 
-    if (aip == NULL || sscanf(onion_port, "%d", &onion_port_parsed) != 1) {
+// Send socks greeting together with connect request for given onion service
+static void prot_main_socks_request(struct prot_main *pmain, const char *onion_address, const char *onion_port) {
+    int onion_port_parsed;
+
+    if (sscanf(onion_port, "%d", &onion_port_parsed) != 1) {
         prot_main_fail(pmain, PROT_ERR_SOCKS_CONN_FAIL);
         return;
     }
@@ -171,7 +222,7 @@ void prot_main_connect(
     debug("Connecting to onion");
 
     // Connect to onion service
-    socks5_connect_onion(pmain->bev, onion_address,
+    socks5_connect_onion_optimistic(pmain->bev, (uint8_t *)onion_address,
         onion_port_parsed, prot_main_socks5_cb, pmain);
 }
 
@@ -209,7 +260,7 @@ void prot_main_recv_done(struct prot_main *pmain) {
 void prot_main_push_tran(struct prot_main *pmain, struct prot_tran_handler *phand) {
     // Insert handler into queue
     debug("pushing into T queue %p", phand);
-    queue_enqueue(pmain->tran_q, phand);
+    queue_enqueue(pmain->tran_q, &phand);
     debug("pushed into T queue");
 
     // If bufferevent is ready and no transmission is in progress
@@ -225,7 +276,7 @@ void prot_main_push_tran(struct prot_main *pmain, struct prot_tran_handler *phan
 // expecting message to arrive (response), returns zero on success
 void prot_main_push_recv(struct prot_main *pmain, struct prot_recv_handler *phand) {
     // Insert handler into queue
-    queue_enqueue(pmain->recv_q, phand);
+    queue_enqueue(pmain->recv_q, &phand);
 }
 
 // Assign protocol connection handler to given bufferevent
@@ -263,7 +314,7 @@ static void prot_main_bev_read_cb(struct bufferevent *bev, void *ctx) {
         debug("Found something to read");
 
         if (!queue_is_empty(pmain->recv_q))
-            phand = queue_peek(pmain->recv_q, 0);
+            phand = *(struct prot_recv_handler **) queue_peek(pmain->recv_q, 0);
 
         debug("Queue not empty");
 
@@ -302,7 +353,7 @@ static void prot_main_bev_read_cb(struct bufferevent *bev, void *ctx) {
                 }
 
                 // Add new handler to the queue
-                queue_enqueue(pmain->recv_q, phand);
+                queue_enqueue(pmain->recv_q, &phand);
                 pmain->current_recv_done = 0;
 
                 // Otherwise check if current handler is expecting this message type
@@ -402,7 +453,7 @@ static void prot_main_bev_write_cb(struct bufferevent *bev, void *ctx) {
     if (queue_is_empty(pmain->tran_q))
         return;
 
-    phand = queue_peek(pmain->tran_q, 0);
+    phand = *(struct prot_tran_handler **) queue_peek(pmain->tran_q, 0);
 
     debug("Got handler to write %p", phand);
 
@@ -437,7 +488,7 @@ static void prot_main_bev_write_cb(struct bufferevent *bev, void *ctx) {
         if (queue_is_empty(pmain->tran_q))
             return;
 
-        phand = queue_peek(pmain->tran_q, 0);
+        phand = *(struct prot_tran_handler **) queue_peek(pmain->tran_q, 0);
     }
 
     // Abort if transmission is disabled
@@ -445,6 +496,10 @@ static void prot_main_bev_write_cb(struct bufferevent *bev, void *ctx) {
         return;
 
     debug("Writing data to output buffer");
+    // Transmission buffers are taken from the pool only when needed
+    if (!phand->buffer)
+        phand->buffer = prot_pool_buffer_get();
+
     // Run transmission setup and add data to the buffer
     if (phand->setup_cb) {
         phand->setup_cb(pmain, phand);
@@ -456,6 +511,10 @@ static void prot_main_bev_write_cb(struct bufferevent *bev, void *ctx) {
     }
     evbuffer_add_buffer(buff, phand->buffer);
     pmain->tran_in_progress = 1;
+
+    // Buffer is empty now, give it back until next transmission
+    prot_pool_buffer_put(phand->buffer);
+    phand->buffer = NULL;
 }
 
 static void prot_main_bev_event_cb(struct bufferevent *bev, short events, void *ctx) {
@@ -504,6 +563,9 @@ const char *prot_main_error_string(enum prot_status_codes err_code) {
     case PROT_ERR_TRANSACTION:
         strcpy(e, "Transaction is invalid, or not started but message type requires it");
         break;
+    case PROT_ERR_SETUP:
+        strcpy(e, "Failed to prepare message for transmission");
+        break;
 
     default:
         strcpy(e, "Unknown error code, this should never happen");
@@ -11,6 +11,7 @@
 #include <db_options.h>
 #include <buffer_crypto.h>
 #include <debug.h>
+#include <prot_pool.h>
 
 // Called when ack is received after transmission
 static void ack_received(int ack_success, struct prot_main *pmain, void *cbarg) {
@@ -131,7 +132,7 @@ struct prot_mb_acc * prot_mb_acc_delete_new(sqlite3 *db, const char *onion_addre
     acc->htran.done_cb = tran_done;
     acc->htran.setup_cb = tran_setup;
     acc->htran.cleanup_cb = tran_cleanup;
-    acc->htran.buffer = evbuffer_new();
+    acc->htran.buffer = NULL;
 
     acc->hrecv.msg = acc;
     acc->hrecv.msg_code = PROT_MAILBOX_DEL_ACCOUNT;
@@ -151,5 +152,6 @@ void prot_mb_acc_delete_free(struct prot_mb_acc *msg) {
     if (msg->mb_acc)
         db_mb_account_free(msg->mb_acc);
 
+    prot_pool_buffer_put(msg->htran.buffer);
     free(msg);
 }
\ No newline at end of file
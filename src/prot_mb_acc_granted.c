@@ -11,6 +11,7 @@
 #include <db_options.h>
 #include <buffer_crypto.h>
 #include <debug.h>
+#include <prot_pool.h>
 
 // Called when transmission finished successfully
 static void tran_done(struct prot_main *pmain, struct prot_tran_handler *phand) {
@@ -92,7 +93,7 @@ struct prot_mb_acc * prot_mb_acc_granted_new(struct prot_mb_acc *acc_reg_req) {
     acc->htran.done_cb = tran_done;
     acc->htran.setup_cb = tran_setup;
     acc->htran.cleanup_cb = tran_cleanup;
-    acc->htran.buffer = evbuffer_new();
+    acc->htran.buffer = NULL;
 
     acc->hrecv.msg = acc;
     acc->hrecv.msg_code = PROT_MAILBOX_GRANTED;
@@ -112,6 +113,6 @@ void prot_mb_acc_granted_free(struct prot_mb_acc *msg) {
     if (msg->mb_acc)
         db_mb_account_free(msg->mb_acc);
 
-    evbuffer_free(msg->htran.buffer);
+    prot_pool_buffer_put(msg->htran.buffer);
     free(msg);
 }
\ No newline at end of file
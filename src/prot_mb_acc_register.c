@@ -11,6 +11,7 @@
 #include <event2/bufferevent.h>
 #include <openssl/rand.h>
 #include <debug.h>
+#include <prot_pool.h>
 
 // Called if request is sent successfully
 static void tran_done(struct prot_main *pmain, struct prot_tran_handler *phand) {
@@ -132,7 +133,7 @@ struct prot_mb_acc * prot_mb_acc_register_new(sqlite3 *db, const char *onion_add
     msg->htran.done_cb = tran_done;
     msg->htran.setup_cb = tran_setup;
     msg->htran.cleanup_cb = tran_cleanup;
-    msg->htran.buffer = evbuffer_new();
+    msg->htran.buffer = NULL;
 
     msg->hrecv.msg = msg;
     msg->hrecv.msg_code = PROT_MAILBOX_REGISTER;
@@ -154,6 +155,6 @@ void prot_mb_acc_register_free(struct prot_mb_acc *msg) {
     if (msg->mb_acc)
         db_mb_account_free(msg->mb_acc);
     
-    evbuffer_free(msg->htran.buffer);
+    prot_pool_buffer_put(msg->htran.buffer);
     free(msg);
 }
@@ -10,13 +10,14 @@
 #include <buffer_crypto.h>
 #include <prot_message_list.h>
 #include <db_mb_message.h>
+#include <prot_pool.h>
 
 // Called when fetch request is sent successfully
 static void tran_done(struct prot_main *pmain, struct prot_tran_handler *phand) {
     struct prot_mb_fetch *msg = phand->msg;
     struct prot_message_list *msg_list;
 
-    msg_list = prot_message_list_client_new(msg->db, NULL, NULL, 0);
+    msg_list = prot_message_list_client_new(msg->db, NULL, NULL);
     prot_message_list_from(msg_list, PROT_MESSAGE_LIST_FROM_MAILBOX);
     prot_main_push_recv(pmain, &(msg_list->hrecv));
 }
@@ -51,11 +52,10 @@ static void recv_handle(struct prot_main *pmain, struct prot_recv_handler *phand
     struct prot_mb_fetch *msg = phand->msg;
     struct evbuffer *input;
     struct evbuffer_ptr pos;
-    struct db_mb_account *acc;
+    struct db_mb_account acc;
     uint8_t mb_onion_priv_key[ONION_PRIV_KEY_LEN];
 
-    int n_msgs;
-    struct db_mb_message **msgs;
+    struct db_mb_message_batch *batch;
     struct prot_message_list *msg_list;
     uint8_t message_len = PROT_HEADER_LEN + TRANSACTION_ID_LEN +
         MAILBOX_ID_LEN + ED25519_SIGNATURE_LEN;
@@ -71,17 +71,19 @@ static void recv_handle(struct prot_main *pmain, struct prot_recv_handler *phand
     evbuffer_ptr_set(input, &pos, PROT_HEADER_LEN + TRANSACTION_ID_LEN, EVBUFFER_PTR_SET);
     evbuffer_copyout_from(input, &pos, msg->mb_id, MAILBOX_ID_LEN);
 
-    acc = db_mb_account_get_by_mbid(msg->db, msg->mb_id, NULL);
-    if (!acc || !ed25519_buffer_validate(input, message_len, acc->signing_pub_key)) {
+    if (
+        !db_mb_account_get_by_mbid(msg->db, msg->mb_id, &acc) ||
+        !ed25519_buffer_validate(input, message_len, acc.signing_pub_key)
+    ) {
         prot_main_set_error(pmain, PROT_ERR_INVALID_MSG);
         return;
     }
 
     debug("ACCOUNT FOUND, SIG OK");
 
-    msgs = db_mb_message_get_all(msg->db, acc, &n_msgs);
-    debug("Found %d new messages to deliver", n_msgs);
-    msg_list = prot_message_list_mailbox_new(msg->db, msgs, n_msgs);
+    batch = db_mb_message_get_stream_batch(msg->db, &acc);
+    debug("Found %d new messages to deliver", batch->n_msgs);
+    msg_list = prot_message_list_mailbox_new(msg->db, batch);
     prot_main_push_tran(pmain, &(msg_list->htran));
 
     debug("PUSHED MSG LIST");
@@ -107,7 +109,7 @@ struct prot_mb_fetch * prot_mb_fetch_new(sqlite3 *db) {
     msg->htran.done_cb = tran_done;
     msg->htran.setup_cb = tran_setup;
     msg->htran.cleanup_cb = tran_cleanup;
-    msg->htran.buffer = evbuffer_new();
+    msg->htran.buffer = NULL;
 
     msg->hrecv.msg = msg;
     msg->hrecv.msg_code = PROT_MAILBOX_FETCH;
@@ -128,7 +130,7 @@ struct prot_mb_fetch * prot_mb_fetch_new(sqlite3 *db) {
 // Free mailbox fetch handler
 void prot_mb_fetch_free(struct prot_mb_fetch *msg) {
     if (msg) {
-        evbuffer_free(msg->htran.buffer);
+        prot_pool_buffer_put(msg->htran.buffer);
     }
     free(msg);
 }
\ No newline at end of file
@@ -15,6 +15,7 @@
 #include <constants.h>
 #include <db_options.h>
 #include <debug.h>
+#include <prot_pool.h>
 
 // Called when ack is received after transmission
 static void ack_received(int ack_success, struct prot_main *pmain, void *cbarg) {
@@ -70,8 +71,13 @@ static void ack_sent(int ack_success, struct prot_main *pmain, void *cbarg) {
 
     if (ack_success) {
         int i;
-        for (i = 0; i < msg->n_mb_conts; i++)
-            db_mb_contact_save(msg->db, msg->mb_conts[i]);
+        struct db_mb_contact existing;
+
+        // Contacts which are already allowed are not stored again
+        for (i = 0; i < msg->n_mb_conts; i++) {
+            if (!db_mb_contact_get_by_acc_and_key(msg->db, msg->mb_acc, msg->mb_conts[i]->signing_pub_key, &existing))
+                db_mb_contact_save(msg->db, msg->mb_conts[i]);
+        }
     }
     prot_mb_set_contacts_free(msg);
 }
@@ -172,7 +178,7 @@ struct prot_mb_set_contacts * prot_mb_set_contacts_new(
     msg->htran.done_cb = tran_done;
     msg->htran.setup_cb = tran_setup;
     msg->htran.cleanup_cb = tran_cleanup;
-    msg->htran.buffer = evbuffer_new();
+    msg->htran.buffer = NULL;
     
     msg->hrecv.msg = msg;
     msg->hrecv.msg_code = PROT_MAILBOX_SET_CONTACTS;
@@ -200,5 +206,6 @@ void prot_mb_set_contacts_free(struct prot_mb_set_contacts *msg) {
         array_free(msg->mb_conts);
     }
 
+    prot_pool_buffer_put(msg->htran.buffer);
     free(msg);
 }
\ No newline at end of file
@@ -15,6 +15,10 @@
 #include <buffer_crypto.h>
 #include <debug.h>
 #include <hooks.h>
+#include <prot_pool.h>
+
+// Message handlers are allocated for every message, objects are reused
+static struct prot_pool message_pool = PROT_POOL_INIT(struct prot_message);
 
 // Called when ACK is arrived or failed to arrive
 static void ack_received(int ack_success, struct prot_main *pmain, void *arg) {
@@ -23,14 +27,8 @@ static void ack_received(int ack_success, struct prot_main *pmain, void *arg) {
     if (ack_success) {
         // If this is RECV message set it's message to CONFIRMED
         if (msg->client_msg->type == DB_MESSAGE_RECV) {
-            struct db_message *to_conf;
-
-            to_conf = db_message_get_by_gid(msg->db, msg->client_msg->body_recv_id, NULL);
-            if (to_conf) {
-                to_conf->status = DB_MESSAGE_STATUS_RECV_CONFIRMED;
-                db_message_save(msg->db, to_conf);
-                db_message_free(to_conf);
-            }
+            db_message_set_status_by_gids(msg->db, msg->client_msg->body_recv_id, 1,
+                DB_MESSAGE_STATUS_RECV_CONFIRMED);
         } else {
             db_message_save(msg->db, msg->client_msg);
         }
@@ -84,7 +82,7 @@ static void tran_setup(struct prot_main *pmain, struct prot_tran_handler *phand)
         uint8_t ctype;
         struct evbuffer *plain;
 
-        plain = evbuffer_new();
+        plain = prot_pool_buffer_get();
 
         evbuffer_add(phand->buffer, prot_header(PROT_MESSAGE_CONTAINER), PROT_HEADER_LEN);
         evbuffer_add(phand->buffer, pmain->transaction_id, TRANSACTION_ID_LEN);
@@ -99,7 +97,7 @@ static void tran_setup(struct prot_main *pmain, struct prot_tran_handler *phand)
 
         switch (ctype) {
             case DB_MESSAGE_TEXT:
-                evbuffer_add(plain, msg->client_msg->body_text, msg->client_msg->body_text_len);
+                evbuffer_add(plain, db_message_get_text(msg->client_msg), msg->client_msg->body_text_len);
                 break;
             case DB_MESSAGE_NICK:
                 evbuffer_add(plain, msg->client_msg->body_nick, msg->client_msg->body_nick_len);
@@ -119,10 +117,15 @@ static void tran_setup(struct prot_main *pmain, struct prot_tran_handler *phand)
 
         debug("Created with len (%d)", evbuffer_get_length(phand->buffer));
 
-        evbuffer_free(plain);
+        prot_pool_buffer_put(plain);
     }
 }
 
+// Free message passed to deferred hooks
+static void client_msg_free(void *data) {
+    db_message_free(data);
+}
+
 // Called when ACK is sent successfully or the sending failed
 static void ack_sent(int ack_success, struct prot_main *pmain, void *arg) {
     struct prot_message *msg = arg;
@@ -130,14 +133,23 @@ static void ack_sent(int ack_success, struct prot_main *pmain, void *arg) {
     if (ack_success) {
         if (msg->client_msg)
             db_message_save(msg->db, msg->client_msg);
-        if (msg->client_cont)
+        // Only nickname and mailbox messages change the contact
+        if (msg->client_cont && msg->client_msg && (
+            msg->client_msg->type == DB_MESSAGE_NICK || msg->client_msg->type == DB_MESSAGE_MBOX
+        )) {
             db_contact_save(msg->db, msg->client_cont);
+        }
 
-        if (msg->mailbox_msg)
-            db_mb_message_save(msg->db, msg->mailbox_msg);
+        if (msg->mailbox_data) {
+            db_mb_message_store(msg->db, msg->mailbox_account_id, msg->mailbox_contact_id,
+                msg->mailbox_gid, msg->mailbox_data);
+        }
 
+        // UI is notified from the event loop, message is handed over to the hook list
         if (pmain->mode == PROT_MODE_CLIENT) {
-            hook_list_call(pmain->hooks, PROT_MESSAGE_EV_INCOMMING, msg->client_msg);
+            hook_list_call_deferred(pmain->hooks, pmain->event_base,
+                PROT_MESSAGE_EV_INCOMMING, msg->client_msg, client_msg_free);
+            msg->client_msg = NULL;
         }
     }
 
@@ -205,6 +217,7 @@ static void recv_handle(struct prot_main *pmain, struct prot_recv_handler *phand
         size_t plain_len;
         uint8_t *plain_data;
         struct evbuffer *plain = NULL;
+        const struct db_contact *cont;
 
         debug("Working as a client");
 
@@ -214,12 +227,13 @@ static void recv_handle(struct prot_main *pmain, struct prot_recv_handler *phand
 
         // If given contact doesn't exist quit
         if(
-            !(msg->client_cont = db_contact_get_by_rsk_pub(msg->db, signing_pub_key, NULL)) 
-            || msg->client_cont->status != DB_CONTACT_ACTIVE || msg->client_cont->deleted
+            !(cont = db_contact_ref_by_rsk_pub(msg->db, signing_pub_key)) 
+            || cont->status != DB_CONTACT_ACTIVE || cont->deleted
         ) {
             prot_main_set_error(pmain, PROT_ERR_INVALID_MSG);
             goto cl_err;
         }
+        msg->client_cont = db_contact_get_by_pk(msg->db, cont->id, NULL);
 
         // If this message is already here skip processing
         msg->client_msg = db_message_get_by_gid(msg->db, message_gid, NULL);
@@ -232,7 +246,7 @@ static void recv_handle(struct prot_main *pmain, struct prot_recv_handler *phand
         msg->client_msg->sender = DB_MESSAGE_SENDER_FRIEND;
         memcpy(msg->client_msg->global_id, message_gid, MESSAGE_ID_LEN);
 
-        plain = evbuffer_new();
+        plain = prot_pool_buffer_get();
         if (rc = rsa_buffer_decrypt(input, msg->client_cont->local_enc_key_priv, plain, NULL)) {
             prot_main_set_error(pmain, PROT_ERR_INVALID_MSG);
             goto cl_err;
@@ -312,41 +326,43 @@ static void recv_handle(struct prot_main *pmain, struct prot_recv_handler *phand
 
         cl_err:
         if (plain)
-            evbuffer_free(plain);
+            prot_pool_buffer_put(plain);
         evbuffer_drain(input, sizeof(data_len) + data_len + AES_ENC_KEY_LENGTH + AES_IV_LENGTH + ED25519_SIGNATURE_LEN);
         return;
     }
 
     if (pmain->mode == PROT_MODE_MAILBOX) {
-        uint8_t *message_data;
-        struct db_mb_account *mb_account = NULL;
-        struct db_mb_contact *mb_contact = NULL;
+        struct db_mb_account mb_account;
+        struct db_mb_contact mb_contact;
         uint8_t mb_onion_priv_key[ONION_PRIV_KEY_LEN];
 
         // Get mailbox ID from the buffer
         evbuffer_ptr_set(input, &pos, PROT_HEADER_LEN + TRANSACTION_ID_LEN, EVBUFFER_PTR_SET);
         evbuffer_copyout_from(input, &pos, mailbox_id, MAILBOX_ID_LEN);
 
-        if (!(mb_account = db_mb_account_get_by_mbid(msg->db, mailbox_id, NULL))) {
+        // Both lookups are answered from memory
+        if (!db_mb_account_get_by_mbid(msg->db, mailbox_id, &mb_account)) {
             prot_main_set_error(pmain, PROT_ERR_INVALID_MSG);
             goto mb_err;
         }
 
-        if (!(mb_contact = db_mb_contact_get_by_acc_and_key(msg->db, mb_account, signing_pub_key, NULL))) {
+        if (!db_mb_contact_get_by_acc_and_key(msg->db, &mb_account, signing_pub_key, &mb_contact)) {
             prot_main_set_error(pmain, PROT_ERR_INVALID_MSG);
             goto mb_err;
         }
 
-        if (msg->mailbox_msg = db_mb_message_get_by_acc_and_gid(msg->db, mb_account, message_gid, NULL))
+        // Message which is already stored is only acknowledged again
+        if (db_mb_message_exists(msg->db, &mb_account, message_gid))
             goto mb_ack_send;
 
-        msg->mailbox_msg = db_mb_message_new();
-        msg->mailbox_msg->account_id = mb_account->id;
-        msg->mailbox_msg->contact_id = mb_contact->id;
-        memcpy(msg->mailbox_msg->global_id, message_gid, MESSAGE_ID_LEN);
+        msg->mailbox_account_id = mb_account.id;
+        msg->mailbox_contact_id = mb_contact.id;
+        memcpy(msg->mailbox_gid, message_gid, MESSAGE_ID_LEN);
 
-        message_data = evbuffer_pullup(input, message_len);
-        db_mb_message_set_data(msg->mailbox_msg, message_data, message_len);
+        // Container is moved out of the input buffer without copying
+        msg->mailbox_data = prot_pool_buffer_get();
+        evbuffer_remove_buffer(input, msg->mailbox_data, message_len);
+        message_len = 0;
 
         mb_ack_send:
         db_options_get_bin(msg->db, "onion_private_key", mb_onion_priv_key, ONION_PRIV_KEY_LEN);
@@ -358,8 +374,6 @@ static void recv_handle(struct prot_main *pmain, struct prot_recv_handler *phand
 
         mb_err:
         evbuffer_drain(input, message_len);
-        db_mb_account_free(mb_account);
-        db_mb_contact_free(mb_contact);
         return;
     }
 }
@@ -368,9 +382,7 @@ static void recv_handle(struct prot_main *pmain, struct prot_recv_handler *phand
 static struct prot_message * prot_message_new(sqlite3 *db, struct db_message *dbmsg) {
     struct prot_message *msg;
 
-    msg = safe_malloc(sizeof(struct prot_message),
-        "Failed to allocate message protocol handler");
-    memset(msg, 0, sizeof(struct prot_message));
+    msg = prot_pool_alloc(&message_pool, "Failed to allocate message protocol handler");
 
     msg->db = db;
     msg->client_msg = dbmsg;
@@ -385,10 +397,12 @@ static struct prot_message * prot_message_new(sqlite3 *db, struct db_message *db
 
     msg->htran.msg = msg;
     msg->htran.msg_code = PROT_MESSAGE_CONTAINER;
-    msg->htran.buffer = evbuffer_new();
+    msg->htran.buffer = NULL;
     msg->htran.done_cb = tran_done;
     msg->htran.setup_cb = tran_setup;
     msg->htran.cleanup_cb = tran_cleanup;
+
+    return msg;
 }
 
 // Allocate new message handler for sending message between clients
@@ -418,9 +432,7 @@ void prot_message_free(struct prot_message *msg) {
         db_message_free(msg->client_msg);
     if (msg->client_cont)
         db_contact_free(msg->client_cont);
-    if (msg->mailbox_msg)
-        db_mb_message_free(msg->mailbox_msg);
-
-    evbuffer_free(msg->htran.buffer);
-    free(msg);
+    prot_pool_buffer_put(msg->mailbox_data);
+    prot_pool_buffer_put(msg->htran.buffer);
+    prot_pool_release(&message_pool, msg);
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include <string.h>
 #include <sqlite3.h>
 #include <prot_main.h>
+#include <db_contact.h>
 #include <db_message.h>
 #include <db_mb_message.h>
 #include <prot_message_list.h>
@@ -16,25 +17,35 @@
 #include <array.h>
 #include <prot_client_fetch.h>
 #include <prot_mb_fetch.h>
+#include <prot_pool.h>
 
 // Called when message list is sent successfully
 static void tran_done(struct prot_main *pmain, struct prot_tran_handler *phand) {
-    int i;
+    int i, n_gids = 0;
+    uint8_t *gids;
     struct prot_message_list *msg = phand->msg;
     struct prot_message_list_ev_data evdata =
         { msg->n_client_msgs, msg->client_msgs };
 
     debug("DONE PML messages %d %p %p", msg->n_client_msgs, msg->client_msgs, msg->client_cont);
-    
+
+    gids = safe_malloc(MESSAGE_ID_LEN * (msg->n_client_msgs + 1),
+        "Failed to allocate confirmed message IDs");
+
     for (i = 0; i < msg->n_client_msgs; i++) {
         struct db_message *dbmsg = msg->client_msgs[i];
 
         if (dbmsg->status == DB_MESSAGE_STATUS_UNDELIVERED) {
             dbmsg->status = DB_MESSAGE_STATUS_SENT_CONFIRMED;
-            db_message_save(msg->db, dbmsg);
+            db_message_mark_saved(dbmsg);
+            memcpy(gids + MESSAGE_ID_LEN * n_gids++, dbmsg->global_id, MESSAGE_ID_LEN);
         }
     }
 
+    // All messages are confirmed with a single transaction
+    db_message_set_status_by_gids(msg->db, gids, n_gids, DB_MESSAGE_STATUS_SENT_CONFIRMED);
+    free(gids);
+
     if (pmain->mode == PROT_MODE_CLIENT) {
         hook_list_call(pmain->hooks, PROT_CLIENT_FETCH_EV_INCOMMING, &evdata);
     }
@@ -46,6 +57,11 @@ static void tran_cleanup(struct prot_main *pmain, struct prot_tran_handler *phan
     prot_message_list_free(msg);
 }
 
+// Called for data of each mailbox message as it is added to the buffer
+static void stream_cb(const uint8_t *data, size_t len, void *cbarg) {
+    ed25519_stream_update(cbarg, data, len);
+}
+
 // Called to serilize message and put it into buffer
 static void tran_setup(struct prot_main *pmain, struct prot_tran_handler *phand) {
     struct prot_message_list *msg = phand->msg;
@@ -55,7 +71,7 @@ static void tran_setup(struct prot_main *pmain, struct prot_tran_handler *phand)
     debug("Transmission setup PML");
 
     if (pmain->mode == PROT_MODE_CLIENT) {
-        struct db_contact *cont = msg->client_cont;
+        const struct db_contact *cont = msg->client_cont;
 
         for (i = 0; i < msg->n_client_msgs; i++) {
             struct db_message *dbmsg = msg->client_msgs[i];
@@ -67,7 +83,7 @@ static void tran_setup(struct prot_main *pmain, struct prot_tran_handler *phand)
             if (dbmsg->contact_id != cont->id)
                 continue;
 
-            plain = evbuffer_new();
+            plain = prot_pool_buffer_get();
             encrypted = evbuffer_new();
 
             evbuffer_add(encrypted, prot_header(PROT_MESSAGE_CONTAINER), PROT_HEADER_LEN);
@@ -80,7 +96,7 @@ static void tran_setup(struct prot_main *pmain, struct prot_tran_handler *phand)
 
             switch (dbmsg->type) {
                 case DB_MESSAGE_TEXT:
-                    evbuffer_add(plain, dbmsg->body_text, dbmsg->body_text_len);
+                    evbuffer_add(plain, db_message_get_text(dbmsg), dbmsg->body_text_len);
                     break;
                 case DB_MESSAGE_NICK:
                     evbuffer_add(plain, dbmsg->body_nick, dbmsg->body_nick_len);
@@ -95,12 +111,13 @@ static void tran_setup(struct prot_main *pmain, struct prot_tran_handler *phand)
             }
 
             rsa_buffer_encrypt(plain, cont->remote_enc_key_pub, encrypted, NULL);
-            evbuffer_free(plain);
+            prot_pool_buffer_put(plain);
 
             ed25519_buffer_sign(encrypted, 0, cont->local_sig_key_priv);
             evbuffer_add_buffer_reference(phand->buffer, encrypted);
 
             length += evbuffer_get_length(encrypted);
+            // Referenced by the transmit buffer, can't be reused
             evbuffer_free(encrypted);
         }
 
@@ -117,19 +134,41 @@ static void tran_setup(struct prot_main *pmain, struct prot_tran_handler *phand)
     if (pmain->mode == PROT_MODE_MAILBOX) {
         int i;
         uint8_t mb_sig_priv_key[ONION_PRIV_KEY_LEN];
-        
-        for (i = 0; i < msg->n_mailbox_msgs; i++) {
-            length += msg->mailbox_msgs[i]->data_len;
-            evbuffer_add(phand->buffer, msg->mailbox_msgs[i]->data, msg->mailbox_msgs[i]->data_len);
-        }
+        struct ed25519_stream *stream;
 
+        // Message data is added to the buffer and signed as it is read from the
+        // database, so length has to be known from batch ahead of time
+        for (i = 0; i < msg->n_mailbox_msgs; i++)
+            length += msg->mailbox_msgs[i]->data_len;
         length = htonl(length);
-        evbuffer_prepend(phand->buffer, &length, sizeof(length));
-        evbuffer_prepend(phand->buffer, pmain->transaction_id, TRANSACTION_ID_LEN);
-        evbuffer_prepend(phand->buffer, prot_header(PROT_MESSAGE_LIST), PROT_HEADER_LEN);
 
         db_options_get_bin(msg->db, "onion_private_key", mb_sig_priv_key, ONION_PRIV_KEY_LEN);
-        ed25519_buffer_sign(phand->buffer, 0, mb_sig_priv_key);
+        if (!(stream = ed25519_stream_new(mb_sig_priv_key))) {
+            prot_main_set_error(pmain, PROT_ERR_SETUP);
+            return;
+        }
+
+        evbuffer_add(phand->buffer, prot_header(PROT_MESSAGE_LIST), PROT_HEADER_LEN);
+        evbuffer_add(phand->buffer, pmain->transaction_id, TRANSACTION_ID_LEN);
+        evbuffer_add(phand->buffer, &length, sizeof(length));
+
+        ed25519_stream_update(stream, prot_header(PROT_MESSAGE_LIST), PROT_HEADER_LEN);
+        ed25519_stream_update(stream, pmain->transaction_id, TRANSACTION_ID_LEN);
+        ed25519_stream_update(stream, &length, sizeof(length));
+
+        // Messages deleted since the fetch request can't be sent anymore,
+        // list length is already in the buffer so the transaction fails
+        if (
+            msg->mailbox_batch &&
+            db_mb_message_stream_batch(msg->db, msg->mailbox_batch, phand->buffer, stream_cb, stream)
+        ) {
+            ed25519_stream_free(stream);
+            prot_main_set_error(pmain, PROT_ERR_SETUP);
+            return;
+        }
+
+        if (ed25519_stream_sign(stream, phand->buffer) != 0)
+            prot_main_set_error(pmain, PROT_ERR_SETUP);
     }
 }
 
@@ -210,6 +249,9 @@ static void recv_handle(struct prot_main *pmain, struct prot_recv_handler *phand
         uint8_t *plain_data;             // Pointer to decrypted message body
         struct evbuffer *plain = NULL;   // Buffer that contains decrypted message body
         struct db_message *dbmsg = NULL; // Message object
+        const struct db_contact *cont;   // Message sender
+        struct db_contact cont_upd;      // Sender with changes from the message
+        int cont_changed = 0;
 
         size_t header_len = PROT_HEADER_LEN + TRANSACTION_ID_LEN + MAILBOX_ID_LEN +
             CLIENT_SIG_KEY_PUB_LEN + MESSAGE_ID_LEN + sizeof(data_len);
@@ -250,7 +292,7 @@ static void recv_handle(struct prot_main *pmain, struct prot_recv_handler *phand
         }
 
         // Search for the sender in the database
-        if (!(msg->client_cont = db_contact_get_by_rsk_pub(msg->db, contact_sig_key, msg->client_cont))) {
+        if (!(cont = db_contact_ref_by_rsk_pub(msg->db, contact_sig_key))) {
             goto message_free;
         }
 
@@ -267,10 +309,10 @@ static void recv_handle(struct prot_main *pmain, struct prot_recv_handler *phand
         }
         debug("Message doesn't exist OK");
 
-        plain = evbuffer_new();
+        plain = prot_pool_buffer_get();
         dbmsg = db_message_new();
 
-        if (rc = rsa_buffer_decrypt(input, msg->client_cont->local_enc_key_priv, plain, NULL)) {
+        if (rc = rsa_buffer_decrypt(input, cont->local_enc_key_priv, plain, NULL)) {
             debug("Failed to decrypt: %d", rc);
             goto message_free;
         }
@@ -282,7 +324,7 @@ static void recv_handle(struct prot_main *pmain, struct prot_recv_handler *phand
 
         dbmsg->type = ctype;
         dbmsg->sender = DB_MESSAGE_SENDER_FRIEND;
-        dbmsg->contact_id = msg->client_cont->id;
+        dbmsg->contact_id = cont->id;
         memcpy(dbmsg->global_id, gid, MESSAGE_ID_LEN);
 
         dbmsg->status = msg->from == PROT_MESSAGE_LIST_FROM_CLIENT ? 
@@ -301,9 +343,11 @@ static void recv_handle(struct prot_main *pmain, struct prot_recv_handler *phand
                 memcpy(dbmsg->body_nick, plain_data, plain_len);
                 dbmsg->body_nick_len = plain_len;
                 // Update nickname
-                memcpy(msg->client_cont->nickname, plain_data, plain_len);
-                msg->client_cont->nickname_len = plain_len;
-                msg->client_cont->nickname[plain_len] = '\0';
+                memcpy(&cont_upd, cont, sizeof(struct db_contact));
+                memcpy(cont_upd.nickname, plain_data, plain_len);
+                cont_upd.nickname_len = plain_len;
+                cont_upd.nickname[plain_len] = '\0';
+                cont_changed = 1;
                 break;
             case DB_MESSAGE_MBOX:
                 if (plain_len < MAILBOX_ID_LEN + ONION_ADDRESS_LEN) {
@@ -320,12 +364,14 @@ static void recv_handle(struct prot_main *pmain, struct prot_recv_handler *phand
                     if (dbmsg->body_mbox_id[i] != 0)
                         break;
 
-                msg->client_cont->has_mailbox = i < MAILBOX_ID_LEN;
+                memcpy(&cont_upd, cont, sizeof(struct db_contact));
+                cont_upd.has_mailbox = i < MAILBOX_ID_LEN;
                     
-                if (msg->client_cont->has_mailbox) {
-                    memcpy(msg->client_cont->mailbox_id, plain_data, MAILBOX_ID_LEN);
-                    memcpy(msg->client_cont->mailbox_onion, plain_data + MAILBOX_ID_LEN, ONION_ADDRESS_LEN);
+                if (cont_upd.has_mailbox) {
+                    memcpy(cont_upd.mailbox_id, plain_data, MAILBOX_ID_LEN);
+                    memcpy(cont_upd.mailbox_onion, plain_data + MAILBOX_ID_LEN, ONION_ADDRESS_LEN);
                 }
+                cont_changed = 1;
                 break;
             case DB_MESSAGE_RECV:
                 if (plain_len < MESSAGE_ID_LEN) {
@@ -342,7 +388,8 @@ static void recv_handle(struct prot_main *pmain, struct prot_recv_handler *phand
         }
 
         db_message_save(msg->db, dbmsg);
-        db_contact_save(msg->db, msg->client_cont);
+        if (cont_changed)
+            db_contact_save(msg->db, &cont_upd);
 
         // Save message object to event (hook) data
         array_set(evdata.messages, evdata.n_messages, dbmsg);
@@ -352,7 +399,7 @@ static void recv_handle(struct prot_main *pmain, struct prot_recv_handler *phand
         message_free:
         evbuffer_drain(input, message_len);
         if (plain)
-            evbuffer_free(plain);
+            prot_pool_buffer_put(plain);
         if (dbmsg)
             db_message_free(dbmsg);
     }
@@ -390,7 +437,7 @@ static struct prot_message_list * prot_message_list_new(sqlite3 *db) {
     msg->htran.done_cb = tran_done;
     msg->htran.setup_cb = tran_setup;
     msg->htran.cleanup_cb = tran_cleanup;
-    msg->htran.buffer = evbuffer_new();
+    msg->htran.buffer = NULL;
 
     msg->hrecv.msg = msg;
     msg->hrecv.msg_code = PROT_MESSAGE_LIST;
@@ -401,28 +448,36 @@ static struct prot_message_list * prot_message_list_new(sqlite3 *db) {
     return msg;
 }
 
-// Allocate new message list handler (when in the client mode)
+// Allocate new message list handler (when in the client mode), handler
+// takes ownership of given batch, batch can be NULL
 struct prot_message_list * prot_message_list_client_new(
-    sqlite3 *db, struct db_contact *cont, struct db_message **msgs, int n_msgs
+    sqlite3 *db, const struct db_contact *cont, struct db_message_batch *batch
 ) {
     struct prot_message_list *msg;
 
     msg = prot_message_list_new(db);
     msg->client_cont = cont;
-    msg->client_msgs = msgs;
-    msg->n_client_msgs = n_msgs;
-    debug("Creating list for %d messages", n_msgs);
+    msg->client_batch = batch;
+    if (batch) {
+        msg->client_msgs = batch->msgs;
+        msg->n_client_msgs = batch->n_msgs;
+    }
+    debug("Creating list for %d messages", msg->n_client_msgs);
 
     return msg;
 }
 
-// Allocate new message list handler (when in the mailbox mode)
-struct prot_message_list * prot_message_list_mailbox_new(sqlite3 *db, struct db_mb_message **msgs, int n_msgs) {
+// Allocate new message list handler (when in the mailbox mode), handler
+// takes ownership of given batch, batch can be NULL
+struct prot_message_list * prot_message_list_mailbox_new(sqlite3 *db, struct db_mb_message_batch *batch) {
     struct prot_message_list *msg;
 
     msg = prot_message_list_new(db);
-    msg->mailbox_msgs = msgs;
-    msg->n_mailbox_msgs = n_msgs;
+    msg->mailbox_batch = batch;
+    if (batch) {
+        msg->mailbox_msgs = batch->msgs;
+        msg->n_mailbox_msgs = batch->n_msgs;
+    }
 
     return msg;
 }
@@ -433,14 +488,14 @@ void prot_message_list_from(struct prot_message_list *msg, enum prot_message_lis
     msg->from = from;
 }
 
-// Free given message list handler and messages given to new method
+// Free given message list handler and batch given to new method
 void prot_message_list_free(struct prot_message_list *msg) {
     if (!msg) return;
     debug("message list free");
 
-    if (msg->n_mailbox_msgs > 0)
-        db_mb_message_free_all(msg->mailbox_msgs, msg->n_mailbox_msgs);
+    db_message_batch_free(msg->client_batch);
+    db_mb_message_batch_free(msg->mailbox_batch);
 
-    evbuffer_free(msg->htran.buffer);
+    prot_pool_buffer_put(msg->htran.buffer);
     free(msg);
 }
\ No newline at end of file
@@ -0,0 +1,66 @@
+#include <string.h>
+#include <stdlib.h>
+#include <prot_pool.h>
+#include <sys_memory.h>
+#include <event2/buffer.h>
+
+// Idle evbuffers ready for reuse
+static struct evbuffer *buffers[PROT_POOL_MAX_BUFFERS];
+static int n_buffers = 0;
+
+// Get an empty evbuffer, pooled one is reused if available
+struct evbuffer * prot_pool_buffer_get(void) {
+    struct evbuffer *buff;
+
+    if (n_buffers > 0)
+        return buffers[--n_buffers];
+
+    if (!(buff = evbuffer_new()))
+        sys_memory_crash("Failed to allocate evbuffer");
+    return buff;
+}
+
+// Empty given evbuffer and return it to the pool, buffer is freed if
+// pool is already full, does nothing if buff is NULL
+void prot_pool_buffer_put(struct evbuffer *buff) {
+    if (!buff) return;
+
+    if (n_buffers >= PROT_POOL_MAX_BUFFERS) {
+        evbuffer_free(buff);
+        return;
+    }
+
+    evbuffer_drain(buff, evbuffer_get_length(buff));
+    buffers[n_buffers++] = buff;
+}
+
+// Free all idle evbuffers held by the pool
+void prot_pool_buffer_clear(void) {
+    while (n_buffers > 0)
+        evbuffer_free(buffers[--n_buffers]);
+}
+
+// Get zeroed object from given pool, new one is allocated if pool is empty
+void * prot_pool_alloc(struct prot_pool *pool, const char *error_str) {
+    void *obj;
+
+    if (pool->n_free > 0)
+        obj = pool->free[--pool->n_free];
+    else
+        obj = safe_malloc(pool->obj_size, error_str);
+
+    memset(obj, 0, pool->obj_size);
+    return obj;
+}
+
+// Return object to given pool, object is freed if pool is already full,
+// does nothing if obj is NULL
+void prot_pool_release(struct prot_pool *pool, void *obj) {
+    if (!obj) return;
+
+    if (pool->n_free >= PROT_POOL_MAX_OBJECTS) {
+        free(obj);
+        return;
+    }
+    pool->free[pool->n_free++] = obj;
+}
\ No newline at end of file
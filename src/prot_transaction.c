@@ -9,6 +9,7 @@
 #include <openssl/err.h>
 #include <debug.h>
 #include <constants.h>
+#include <prot_pool.h>
 
 /**
  * Transaction REQUEST message
@@ -73,14 +74,14 @@ struct prot_txn_req * prot_txn_req_new(void) {
     msg->htran.done_cb = req_tran_done;
     msg->htran.setup_cb = req_tran_setup;
     msg->htran.cleanup_cb = req_tran_cleanup;
-    msg->htran.buffer = evbuffer_new();
+    msg->htran.buffer = NULL;
 
     return msg;
 }
 
 // Free given transaction request handler
 void prot_txn_req_free(struct prot_txn_req *msg) {
-    evbuffer_free(msg->htran.buffer);
+    prot_pool_buffer_put(msg->htran.buffer);
     free(msg);
 }
 
@@ -150,7 +151,7 @@ struct prot_txn_res * prot_txn_res_new(void) {
     msg->htran.done_cb = res_tran_done;
     msg->htran.setup_cb = res_tran_setup;
     msg->htran.cleanup_cb = res_tran_cleanup;
-    msg->htran.buffer = evbuffer_new();
+    msg->htran.buffer = NULL;
 
     msg->hrecv.msg = msg;
     msg->hrecv.msg_code = PROT_TRANSACTION_RESPONSE;
@@ -163,6 +164,6 @@ struct prot_txn_res * prot_txn_res_new(void) {
 
 // Free given transaction response header
 void prot_txn_res_free(struct prot_txn_res *msg) {
-    evbuffer_free(msg->htran.buffer);
+    prot_pool_buffer_put(msg->htran.buffer);
     free(msg);
 }
\ No newline at end of file
@@ -1,22 +1,37 @@
 #include <queue.h>
 #include <sys_memory.h>
 #include <stdlib.h>
+#include <string.h>
 
-struct queue_node {
-    void *data;
-    struct queue_node *next;
-};
+// Get pointer to the slot of element at given index (from the front)
+static uint8_t * queue_slot(struct queue *q, int index) {
+    index += q->front;
+    if (index >= q->capacity)
+        index -= q->capacity;
 
-// Allocate new queue node with given size and copy data to it
-struct queue_node * queue_node_new(void *data, size_t size) {
-    struct queue_node *node;
+    return q->items + (size_t)index * q->item_size;
+}
+
+// Double the queue capacity, elements are moved so that front is at slot 0
+static void queue_grow(struct queue *q) {
+    uint8_t *items;
+    int capacity, n_head;
+
+    capacity = q->capacity * 2;
+    items = safe_malloc((size_t)capacity * q->item_size, "Failed to expand the queue");
 
-    node = safe_malloc(sizeof(struct queue_node), "Failed to allocate queue node");
-    node->data = safe_malloc(size, "Failed to allocate memory for queue data");
-    node->next = NULL;
+    // Elements from front to the end of the buffer, then wrapped ones
+    n_head = q->capacity - q->front;
+    if (n_head > q->length)
+        n_head = q->length;
 
-    memcpy(node->data, data, size);
-    return node;
+    memcpy(items, q->items + (size_t)q->front * q->item_size, (size_t)n_head * q->item_size);
+    memcpy(items + (size_t)n_head * q->item_size, q->items, (size_t)(q->length - n_head) * q->item_size);
+
+    free(q->items);
+    q->items = items;
+    q->capacity = capacity;
+    q->front = 0;
 }
 
 // Allocate new queue
@@ -26,76 +41,54 @@ struct queue * queue_new(size_t item_size) {
     q = safe_malloc(sizeof(struct queue), "Failed to allocate the queue");
 
     q->length = 0;
+    q->front = 0;
     q->item_size = item_size;
-    q->front = q->rear = NULL;
+    q->capacity = QUEUE_INITIAL_CAPACITY;
+    q->items = safe_malloc((size_t)q->capacity * item_size, "Failed to allocate queue storage");
 
     return q;
 }
 
-// Free given queue and all it's elements (nodes)
+// Free given queue and all it's elements
 void queue_free(struct queue *q) {
-    
-    if (q->length > 0) {
-        while (q->front != NULL) {
-            struct queue_node *next = q->front->next;
-
-            free(q->front->data);
-            free(q->front);
-            q->front = next;
-        }
-    }
-
+    free(q->items);
     free(q);
 }
 
 // Insert given data into queue
 void queue_enqueue(struct queue *q, void *data) {
-    if (q->length == 0) {
-        q->front = queue_node_new(data, q->item_size);
-        q->rear = q->front;
-    } else {
-        q->rear->next = queue_node_new(data, q->item_size);
-        q->rear = q->rear->next;
-    }
+    if (q->length == q->capacity)
+        queue_grow(q);
 
+    memcpy(queue_slot(q, q->length), data, q->item_size);
     ++q->length;
 }
 
 // Read data from queue to data, if data is NULL
-// queue node will be deleted
+// front element is just removed
 int queue_dequeue(struct queue *q, void *data) {
-    struct queue_node *next;
-
     if (q->length == 0)
         return 1;
 
     if (data != NULL)
-        memcpy(data, q->front->data, q->item_size);
+        memcpy(data, q->items + (size_t)q->front * q->item_size, q->item_size);
 
-    next = q->front->next;
-    free(q->front->data);
-    free(q->front);
-    q->front = next;
+    if (++q->front == q->capacity)
+        q->front = 0;
 
-    if (q->length == 1)
-        q->rear = NULL;
+    // Restart from the beginning of the buffer when emptied
+    if (--q->length == 0)
+        q->front = 0;
 
-    --q->length;
     return 0;
 }
 
 // Get a pointer to the queue element at given index
 void * queue_peek(struct queue *q, int index) {
-    int i;
-    struct queue_node *node = q->front;
-
-    if (index > q->length - 1)
+    if (index < 0 || index > q->length - 1)
         return NULL;
 
-    for (i = 0; i < index; i++)
-        node = node->next;
-
-    return node->data;
+    return queue_slot(q, index);
 }
 
 // Get the number of elements in the queue
@@ -17,6 +17,11 @@ static void socks5_read_cb(struct bufferevent *buffev, void *data);
 static void socks5_event_cb(struct bufferevent *buffev, short events, void *data);
 // Called when something fails to free bufferevent and socks5 data structures
 static void socks5_internal_fail(struct socks5_data *data, enum socks5_errors err);
+// Start connection process, send connect request now if optimistic is 1
+static void socks5_internal_start(struct bufferevent *buffev, const uint8_t *onion_address,
+    uint16_t port, socks5_done_cb done_cb, void *attr, int optimistic);
+// Add connect request for onion address to given buffer
+static void socks5_internal_add_connect(struct socks5_data *data, struct evbuffer *buff_out);
 
 /**
  * Function definitions
@@ -36,6 +41,31 @@ void socks5_connect_onion(
     uint16_t port,
     socks5_done_cb done_cb,
     void *attr
+) {
+    socks5_internal_start(buffev, onion_address, port, done_cb, attr, 0);
+}
+
+// Same as socks5_connect_onion, but connect request is sent right after
+// the method selection without waiting for the server to reply, both
+// replies are then handled in order, this saves one round trip
+void socks5_connect_onion_optimistic(
+    struct bufferevent *buffev,
+    const uint8_t *onion_address,
+    uint16_t port,
+    socks5_done_cb done_cb,
+    void *attr
+) {
+    socks5_internal_start(buffev, onion_address, port, done_cb, attr, 1);
+}
+
+// Start connection process, send connect request now if optimistic is 1
+static void socks5_internal_start(
+    struct bufferevent *buffev,
+    const uint8_t *onion_address,
+    uint16_t port,
+    socks5_done_cb done_cb,
+    void *attr,
+    int optimistic
 ) {
     int i;
     struct evbuffer *buff;
@@ -55,6 +85,7 @@ void socks5_connect_onion(
     data->done_cb = done_cb;
     data->step = SOCKS5_STEP_AUTH;
     data->port = port;
+    data->optimistic = optimistic;
 
     // Copy onion address to connect to
     for (i = 0; i < ONION_ADDRESS_LEN; i++) {
@@ -66,6 +97,32 @@ void socks5_connect_onion(
     buff = bufferevent_get_output(buffev);
     // Add packet to buffer
     evbuffer_add(buff, method_selection, sizeof(method_selection));
+
+    // Both packets leave in the same flight
+    if (optimistic)
+        socks5_internal_add_connect(data, buff);
+}
+
+// Add connect request for onion address to given buffer
+static void socks5_internal_add_connect(struct socks5_data *data, struct evbuffer *buff_out) {
+    uint16_t port;
+
+    // Create first 4 (static) fields to send in connection request
+    uint8_t request_header[] = 
+        { SOCKS5_VERSION, SOCKS5_CONNECT_CMD, 0x00, SOCKS5_ADDRESS_DOMAIN };
+    // Set address length byte
+    uint8_t onion_address_len = ONION_ADDRESS_LEN;
+
+    // Add static fields
+    evbuffer_add(buff_out, request_header, sizeof(request_header));
+    // Add onion address length field
+    evbuffer_add(buff_out, &onion_address_len, 1);
+    // Add onion address
+    evbuffer_add(buff_out, data->onion_address, onion_address_len);
+
+    // Add port number
+    port = htons(data->port);
+    evbuffer_add(buff_out, &port, sizeof(port));
 }
 
 // Callback called by libevent when data arrives
@@ -81,12 +138,6 @@ void socks5_read_cb(struct bufferevent *buffev, void *data) {
         // Array to hold method selection response (length 2 bytes)
         uint8_t method_response[2];
 
-        // Create first 4 (static) fields to send in connection request
-        uint8_t request_header[] = 
-            { SOCKS5_VERSION, SOCKS5_CONNECT_CMD, 0x00, SOCKS5_ADDRESS_DOMAIN };
-        // Set address length byte
-        uint8_t onion_address_len = ONION_ADDRESS_LEN;
-
         // When response arrives check if server accepted SOCKS5_AUTH_METHOD (nothing)
         // as auth method (it should since it's tor client)
         if (evbuffer_get_length(buff_in) < 2)
@@ -99,22 +150,16 @@ void socks5_read_cb(struct bufferevent *buffev, void *data) {
             return;
         }
 
-        // Add static fields
-        evbuffer_add(buff_out, request_header, sizeof(request_header));
-        // Add onion address length field
-        evbuffer_add(buff_out, &onion_address_len, 1);
-        // Add onion address
-        evbuffer_add(buff_out, dat->onion_address, onion_address_len);
-
-        // Add port number
-        dat->port = htons(dat->port);
-        evbuffer_add(buff_out, &(dat->port), sizeof(dat->port));
+        // Optimistic connect request is already sent, it's reply
+        // may have arrived together with this one
+        if (!dat->optimistic)
+            socks5_internal_add_connect(dat, buff_out);
         
         dat->step = SOCKS5_STEP_CONNECT;
     }
 
     // Handle server connect response
-    else if (dat->step == SOCKS5_STEP_CONNECT) {
+    if (dat->step == SOCKS5_STEP_CONNECT) {
         size_t buff_len, address_len;
         uint8_t response_header[5];
 
@@ -1,8 +1,216 @@
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <time.h>
 #include <sys_memory.h>
 #include <debug.h>
 
+#ifdef SYS_MEMSTAT
+
+// Allocation profiler, enabled with SYS_MEMSTAT. Each allocation made
+// by safe_malloc and safe_realloc is recorded in the pointer table
+// under it's tag. Calls to free are redirected to __wrap_free by the
+// linker (-Wl,--wrap=free), pointers not found in the table are
+// simply passed to the real free.
+
+// Initial number of slots in the pointer table
+#define SYS_MEMSTAT_INITIAL_SLOTS 4096
+
+void __real_free(void *ptr);
+
+// Statistics for one tag
+struct memstat_tag {
+    struct sys_memstat stat;
+    long n_allocs_reported;
+};
+
+// Live allocation
+struct memstat_entry {
+    void *ptr;
+    size_t size;
+    struct memstat_tag *tag;
+};
+
+static struct {
+    // Open addressing table of tags, keyed by tag pointer
+    const char *tag_keys[SYS_MEMSTAT_MAX_TAGS * 2];
+    struct memstat_tag *tags[SYS_MEMSTAT_MAX_TAGS * 2];
+    struct memstat_tag *tag_other;
+    int n_tags;
+
+    // Open addressing table of live allocations, keyed by pointer
+    struct memstat_entry *entries;
+    size_t n_slots;
+    size_t n_entries;
+
+    // Beginning of the current allocation rate window
+    struct timespec report_time;
+} memstat;
+
+// Hash given pointer into table of given size (power of two)
+static size_t memstat_hash(const void *ptr, size_t n_slots) {
+    uint64_t hash = (uint64_t)(uintptr_t)ptr * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(hash >> 32) & (n_slots - 1);
+}
+
+// Allocate statistics record for given tag
+static struct memstat_tag * memstat_tag_new(const char *tag) {
+    struct memstat_tag *mt;
+
+    if (!(mt = calloc(1, sizeof(struct memstat_tag))))
+        sys_memory_crash("Failed to allocate memory statistics tag");
+
+    mt->stat.tag = tag;
+    return mt;
+}
+
+// Get statistics record for given tag, tags are compared by pointer
+static struct memstat_tag * memstat_tag_get(const char *tag) {
+    size_t i;
+
+    i = memstat_hash(tag, SYS_MEMSTAT_MAX_TAGS * 2);
+    for (; memstat.tag_keys[i] != NULL; i = (i + 1) & (SYS_MEMSTAT_MAX_TAGS * 2 - 1)) {
+        if (memstat.tag_keys[i] == tag)
+            return memstat.tags[i];
+    }
+
+    if (memstat.n_tags >= SYS_MEMSTAT_MAX_TAGS) {
+        if (!memstat.tag_other)
+            memstat.tag_other = memstat_tag_new("(other tags)");
+        return memstat.tag_other;
+    }
+
+    ++memstat.n_tags;
+    memstat.tag_keys[i] = tag;
+    memstat.tags[i] = memstat_tag_new(tag);
+    return memstat.tags[i];
+}
+
+// Double the size of the pointer table
+static void memstat_grow(void) {
+    size_t i, j, n_slots;
+    struct memstat_entry *entries;
+
+    // First allocation also starts the first allocation rate window
+    if (memstat.n_slots == 0)
+        clock_gettime(CLOCK_MONOTONIC, &memstat.report_time);
+
+    n_slots = memstat.n_slots ? memstat.n_slots * 2 : SYS_MEMSTAT_INITIAL_SLOTS;
+    if (!(entries = calloc(n_slots, sizeof(struct memstat_entry))))
+        sys_memory_crash("Failed to expand memory statistics table");
+
+    for (i = 0; i < memstat.n_slots; i++) {
+        if (memstat.entries[i].ptr == NULL)
+            continue;
+
+        j = memstat_hash(memstat.entries[i].ptr, n_slots);
+        while (entries[j].ptr != NULL)
+            j = (j + 1) & (n_slots - 1);
+        entries[j] = memstat.entries[i];
+    }
+
+    __real_free(memstat.entries);
+    memstat.entries = entries;
+    memstat.n_slots = n_slots;
+}
+
+// Find slot of given pointer, returns -1 if pointer is not tracked
+static long memstat_find(const void *ptr) {
+    size_t i;
+
+    if (memstat.n_slots == 0)
+        return -1;
+
+    i = memstat_hash(ptr, memstat.n_slots);
+    for (; memstat.entries[i].ptr != NULL; i = (i + 1) & (memstat.n_slots - 1)) {
+        if (memstat.entries[i].ptr == ptr)
+            return i;
+    }
+    return -1;
+}
+
+// Stop tracking given pointer, returns 0 if pointer was not tracked
+static int memstat_untrack(const void *ptr) {
+    long slot;
+    size_t i, j, home;
+    struct memstat_tag *mt;
+
+    if ((slot = memstat_find(ptr)) < 0)
+        return 0;
+
+    mt = memstat.entries[slot].tag;
+    mt->stat.live_bytes -= memstat.entries[slot].size;
+    --mt->stat.live_count;
+
+    // Shift following entries back so lookups don't stop at the hole
+    i = slot;
+    j = i;
+    for (;;) {
+        j = (j + 1) & (memstat.n_slots - 1);
+        if (memstat.entries[j].ptr == NULL)
+            break;
+
+        home = memstat_hash(memstat.entries[j].ptr, memstat.n_slots);
+        // Entry can be moved only if hole is between it's home slot and it
+        if ((j > i && (home <= i || home > j)) || (j < i && (home <= i && home > j))) {
+            memstat.entries[i] = memstat.entries[j];
+            i = j;
+        }
+    }
+    memstat.entries[i].ptr = NULL;
+
+    --memstat.n_entries;
+    return 1;
+}
+
+// Start tracking given allocation under given tag
+static void memstat_track(void *ptr, size_t size, const char *tag) {
+    size_t i;
+    struct memstat_tag *mt;
+
+    // Memory freed by a library is never seen by __wrap_free,
+    // if it's address is reused forget the old allocation
+    memstat_untrack(ptr);
+
+    if ((memstat.n_entries + 1) * 2 > memstat.n_slots)
+        memstat_grow();
+
+    i = memstat_hash(ptr, memstat.n_slots);
+    while (memstat.entries[i].ptr != NULL)
+        i = (i + 1) & (memstat.n_slots - 1);
+
+    mt = memstat_tag_get(tag);
+    memstat.entries[i].ptr = ptr;
+    memstat.entries[i].size = size;
+    memstat.entries[i].tag = mt;
+    ++memstat.n_entries;
+
+    mt->stat.live_bytes += size;
+    ++mt->stat.live_count;
+    ++mt->stat.n_allocs;
+    if (mt->stat.live_bytes > mt->stat.peak_bytes)
+        mt->stat.peak_bytes = mt->stat.live_bytes;
+}
+
+// All calls to free are redirected here by the linker
+void __wrap_free(void *ptr) {
+    if (ptr)
+        memstat_untrack(ptr);
+    __real_free(ptr);
+}
+
+// Order tags by live bytes, largest first
+static int memstat_compare(const void *a, const void *b) {
+    const struct memstat_tag *ta = *(struct memstat_tag * const *)a;
+    const struct memstat_tag *tb = *(struct memstat_tag * const *)b;
+
+    if (ta->stat.live_bytes != tb->stat.live_bytes)
+        return ta->stat.live_bytes < tb->stat.live_bytes ? 1 : -1;
+    return 0;
+}
+
+#endif
+
 // Allocate memory and exit program on fail
 void * safe_malloc(size_t chunk_size, const char *error_str) {
     void *ptr;
@@ -10,6 +218,9 @@ void * safe_malloc(size_t chunk_size, const char *error_str) {
     if (!(ptr = malloc(chunk_size))) {
         sys_memory_crash(error_str);
     }
+#ifdef SYS_MEMSTAT
+    memstat_track(ptr, chunk_size, error_str);
+#endif
     return ptr;
 }
 
@@ -20,5 +231,62 @@ void * safe_realloc(void *old_ptr, size_t chunk_size, const char *error_str) {
     if (!(ptr = realloc(old_ptr, chunk_size))) {
         sys_memory_crash(error_str);
     }
+#ifdef SYS_MEMSTAT
+    if (old_ptr)
+        memstat_untrack(old_ptr);
+    memstat_track(ptr, chunk_size, error_str);
+#endif
     return ptr;
+}
+
+// Returns 1 if app is built with allocation profiler (make MEMSTAT=1)
+int sys_memstat_enabled(void) {
+#ifdef SYS_MEMSTAT
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+// Call cb for each allocation tag, ordered by live bytes, and start
+// a new allocation rate window, does nothing if profiler is disabled
+void sys_memstat_foreach(sys_memstat_cb cb, void *cbarg) {
+#ifdef SYS_MEMSTAT
+    int i, n = 0;
+    double elapsed;
+    struct timespec now;
+    struct memstat_tag *sorted[SYS_MEMSTAT_MAX_TAGS + 1];
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - memstat.report_time.tv_sec) +
+        (now.tv_nsec - memstat.report_time.tv_nsec) / 1e9;
+
+    for (i = 0; i < SYS_MEMSTAT_MAX_TAGS * 2; i++) {
+        if (memstat.tags[i])
+            sorted[n++] = memstat.tags[i];
+    }
+    if (memstat.tag_other)
+        sorted[n++] = memstat.tag_other;
+
+    qsort(sorted, n, sizeof(struct memstat_tag *), memstat_compare);
+
+    for (i = 0; i < n; i++) {
+        struct memstat_tag *mt = sorted[i];
+
+        mt->stat.alloc_rate = elapsed > 0 ?
+            (mt->stat.n_allocs - mt->n_allocs_reported) / elapsed : 0;
+        mt->n_allocs_reported = mt->stat.n_allocs;
+
+        cb(&(mt->stat), cbarg);
+    }
+
+    memstat.report_time = now;
+#endif
+}
+
+// Format given statistics as a single line of text
+void sys_memstat_format(const struct sys_memstat *stat, char *dest, size_t dest_len) {
+    snprintf(dest, dest_len, "%10zu B live %10zu B peak %7ld blocks %8ld allocs %9.1f/s  %s",
+        stat->live_bytes, stat->peak_bytes, stat->live_count,
+        stat->n_allocs, stat->alloc_rate, stat->tag);
 }
\ No newline at end of file
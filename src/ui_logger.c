@@ -46,6 +46,9 @@ void ui_logger_clear(struct ui_logger *logr) {
         wclrtobot(logr->win->content);
     }
 
+    array_clear(logr->lines);
+    array_clear(logr->line_sizes);
+
     logr->size = 0;
     logr->i_line = 0;
     logr->i_wrap = 0;
@@ -89,8 +92,8 @@ void ui_logger_log_wc(struct ui_logger *logr, const wchar_t *text) {
             wchp[i - line_start] = 0;
 
             // Store line data
-            array_set(logr->lines, logr->size, wchp);
-            array_set(logr->line_sizes, logr->size, i - line_start);
+            array_push(logr->lines, wchp);
+            array_push(logr->line_sizes, i - line_start);
 
             ++logr->size;
             line_start = i + 1;
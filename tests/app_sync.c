@@ -0,0 +1,246 @@
+#include <string.h>
+#include <sqlite3.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/listener.h>
+#include <debug.h>
+#include <hooks.h>
+#include <queue.h>
+#include <prot_main.h>
+#include <db_init.h>
+#include <db_storage.h>
+#include <db_contact.h>
+#include <db_message.h>
+
+#include <app.h>
+
+// Length of optimistic socks greeting together with the onion connect request
+#define SOCKS_REQUEST_LEN (3 + 5 + ONION_ADDRESS_LEN + 2)
+
+#define N_CONTACTS 7
+
+static struct app_data app;
+
+// Test contacts, only the first 5 are active
+static const char *nicks[N_CONTACTS] = { "old", "two", "one", "recent", "silent", "deleted", "pending" };
+static int ids[N_CONTACTS];
+static char onions[N_CONTACTS][ONION_ADDRESS_LEN + 1];
+
+// Order in which fake socks server got connect requests
+static const char *order[N_CONTACTS];
+static int n_order = 0;
+
+// Number of DONE and CLOSE events called on watched connection
+static int n_done = 0, n_close = 0;
+
+// Get nickname of contact with given id or onion address
+static const char * nick_of(int id, const char *onion) {
+    int i;
+
+    for (i = 0; i < N_CONTACTS; i++) {
+        if (ids[i] == id || (onion && !strncmp(onions[i], onion, ONION_ADDRESS_LEN)))
+            return nicks[i];
+    }
+    return id == APP_SYNC_MAILBOX ? "mailbox" : "?";
+}
+
+// Print scheduler state with nicknames of all queued contacts
+static void print_sync_state(const char *title) {
+    int i, n;
+
+    n = queue_get_length(app.sync.queue);
+    debug("%s: %d active, %d queued", title, app.sync.n_active, n);
+    for (i = 0; i < n; i++)
+        debug("  queued: %s", nick_of(*(int *)queue_peek(app.sync.queue, i), NULL));
+}
+
+// Record requested onion address and close the connection so sync fails
+static void fake_socks_read_cb(struct bufferevent *bev, void *ctx) {
+    char onion[ONION_ADDRESS_LEN];
+    struct evbuffer *in = bufferevent_get_input(bev);
+
+    if (evbuffer_get_length(in) < SOCKS_REQUEST_LEN)
+        return;
+
+    evbuffer_drain(in, 8);
+    evbuffer_remove(in, onion, ONION_ADDRESS_LEN);
+    order[n_order++] = nick_of(-1, onion);
+    debug("Socks server got request for %s, %d active", order[n_order - 1], app.sync.n_active);
+
+    bufferevent_free(bev);
+}
+
+static void fake_socks_accept_cb(struct evconnlistener *listener,
+    evutil_socket_t sock, struct sockaddr *addr, int len, void *ptr
+) {
+    struct bufferevent *bev;
+
+    bev = bufferevent_socket_new(evconnlistener_get_base(listener), sock, BEV_OPT_CLOSE_ON_FREE);
+    bufferevent_setcb(bev, fake_socks_read_cb, NULL, NULL, NULL);
+    bufferevent_enable(bev, EV_READ);
+}
+
+// Stop the loop once all syncs are done
+static void check_cb(evutil_socket_t fd, short what, void *arg) {
+    if (n_order == 5 && app.sync.n_active == 0 && queue_is_empty(app.sync.queue))
+        event_base_loopbreak(app.base);
+}
+
+// Count DONE and CLOSE events of watched connection
+static void count_cb(int ev, void *data, void *cbarg) {
+    if (ev == PROT_MAIN_EV_DONE)
+        ++n_done;
+    else if (ev == PROT_MAIN_EV_CLOSE)
+        ++n_close;
+}
+
+// Put one byte into transmission buffer
+static void test_setup_cb(struct prot_main *pmain, struct prot_tran_handler *phand) {
+    evbuffer_add(phand->buffer, "x", 1);
+}
+
+// Run connection which frees itself when done over a bufferevent pair, other side of
+// the pair is closed afterwards, if tran_enabled is 0 message is never sent
+static void test_free_on_done(int tran_enabled) {
+    struct bufferevent *pair[2];
+    struct prot_main *pmain;
+    struct prot_tran_handler phand = { 0 };
+
+    n_done = n_close = 0;
+    phand.setup_cb = test_setup_cb;
+    bufferevent_pair_new(app.base, BEV_OPT_CLOSE_ON_FREE, pair);
+
+    pmain = prot_main_new(app.base, app.db);
+    prot_main_free_on_done(pmain, 1);
+    hook_add(pmain->hooks, PROT_MAIN_EV_DONE, count_cb, NULL);
+    hook_add(pmain->hooks, PROT_MAIN_EV_CLOSE, count_cb, NULL);
+    pmain->tran_enabled = tran_enabled;
+    prot_main_assign(pmain, pair[0]);
+    prot_main_push_tran(pmain, &phand);
+    event_base_loop(app.base, EVLOOP_NONBLOCK);
+
+    bufferevent_flush(pair[1], EV_READ | EV_WRITE, BEV_FINISHED);
+    bufferevent_free(pair[1]);
+    event_base_loop(app.base, EVLOOP_NONBLOCK);
+
+    debug("Message %s, done called %d time(s), close called %d time(s)",
+        tran_enabled ? "sent" : "not sent", n_done, n_close);
+}
+
+// Create contact with given index, onion address differs in the first character
+static void save_contact(int i) {
+    struct db_contact *cont = db_contact_new();
+
+    memset(onions[i], 'a' + i, ONION_ADDRESS_LEN - 6);
+    strcpy(onions[i] + ONION_ADDRESS_LEN - 6, ".onion");
+
+    cont->status = (i == 6) ? DB_CONTACT_PENDING_OUT : DB_CONTACT_ACTIVE;
+    cont->deleted = (i == 5);
+    strcpy(cont->nickname, nicks[i]);
+    strcpy(cont->onion_address, onions[i]);
+    db_contact_save(app.db, cont);
+    ids[i] = cont->id;
+    db_contact_free(cont);
+}
+
+// Save n text messages with given status for contact with given index
+static void save_msgs(int i, enum db_message_sender sender, enum db_message_status status, int n) {
+    struct db_message *msg;
+
+    for (; n > 0; n--) {
+        msg = db_message_new();
+        msg->contact_id = ids[i];
+        msg->type = DB_MESSAGE_TEXT;
+        msg->sender = sender;
+        msg->status = status;
+        db_message_gen_id(msg);
+        db_message_set_text(msg, "Sync test", -1);
+        db_message_save(app.db, msg);
+        db_message_free(msg);
+    }
+}
+
+// Set last activity of contact with given index
+static void set_activity(int i, int64_t last_activity) {
+    char sql[128];
+
+    sprintf(sql, "UPDATE client_contact_summary SET last_activity = %lld WHERE contact_id = %d",
+        (long long)last_activity, ids[i]);
+    sqlite3_exec(app.db, sql, NULL, NULL, NULL);
+}
+
+int main() {
+    int i;
+    struct event *check_event;
+    struct sockaddr_in sin;
+    socklen_t sin_len = sizeof(sin);
+    struct evconnlistener *listener;
+    struct timeval check = { 0, 100000 };
+
+    debug_set_fp(stdout);
+
+    db_storage_select("memory");
+    db_init_global("deep_messenger.db");
+    db_init_schema(dbg);
+
+    app.db = dbg;
+    app.base = event_base_new();
+    event_base_priority_init(app.base, APP_EV_PRIORITY_COUNT);
+    app.cf.app_port = "9000";
+
+    // Fake socks server on a free local port stands in for tor
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    listener = evconnlistener_new_bind(app.base, fake_socks_accept_cb, NULL,
+        LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE, -1, (struct sockaddr *)&sin, sizeof(sin));
+    getsockname(evconnlistener_get_fd(listener), (struct sockaddr *)&sin, &sin_len);
+    memcpy(&app.tor_socks_addr, &sin, sin_len);
+    app.tor_socks_addr_len = sin_len;
+
+    app_sync_init(&app);
+    app_outbox_init(&app);
+
+    debug("Testing connection freed when done: ");
+    test_free_on_done(1);
+    test_free_on_done(0);
+
+    // Undelivered messages go first, then the most recent activity
+    for (i = 0; i < N_CONTACTS; i++)
+        save_contact(i);
+    save_msgs(0, DB_MESSAGE_SENDER_FRIEND, DB_MESSAGE_STATUS_RECV_CONFIRMED, 1);
+    save_msgs(1, DB_MESSAGE_SENDER_ME, DB_MESSAGE_STATUS_UNDELIVERED, 2);
+    save_msgs(2, DB_MESSAGE_SENDER_ME, DB_MESSAGE_STATUS_UNDELIVERED, 1);
+    save_msgs(3, DB_MESSAGE_SENDER_FRIEND, DB_MESSAGE_STATUS_RECV_CONFIRMED, 1);
+    set_activity(0, 1000);
+    set_activity(1, 500);
+    set_activity(2, 3000);
+    set_activity(3, 2000);
+
+    debug("Testing sync scheduler (expected order: two, one, recent, old, silent): ");
+
+    // There is no mailbox so it's slot is freed right away
+    app_sync_all(&app);
+    print_sync_state("After sync all");
+
+    app_sync_contact(&app, ids[0]);
+    print_sync_state("After queueing old again");
+
+    app_sync_all(&app);
+
+    check_event = event_new(app.base, -1, EV_PERSIST, check_cb, NULL);
+    event_add(check_event, &check);
+    event_base_dispatch(app.base);
+
+    for (i = 0; i < n_order; i++)
+        debug("Synced %d: %s", i + 1, order[i]);
+    print_sync_state("After all syncs");
+
+    event_free(check_event);
+    evconnlistener_free(listener);
+
+    return 0;
+}
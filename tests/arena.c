@@ -0,0 +1,28 @@
+#include <string.h>
+#include <arena.h>
+#include <debug.h>
+
+int main() {
+    int i;
+    char *str;
+    void *big;
+    struct arena *a;
+
+    debug_set_fp(stdout);
+
+    a = arena_new(256);
+
+    for (i = 0; i < 100; i++) {
+        str = arena_memdup(a, "Some message text", 18);
+    }
+    debug("Last string: %s", str);
+
+    big = arena_alloc(a, 10000);
+    memset(big, 0, 10000);
+
+    str = arena_memdup(a, "After big allocation", 21);
+    debug("String after big allocation: %s", str);
+
+    arena_free(a);
+    return 0;
+}
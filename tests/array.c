@@ -4,21 +4,36 @@
 #define ONION_ADDRESS "i4mcwgorejxtforxrd7dsf73hsiiphhlgxxz3aeuef3hixdcv4vg3bid.onion"
 
 int main() {
-    int *arr;
+    int i, *arr;
+    char *str;
     debug_set_fp(stdout);
 
-    void *ptr;
-
     arr = array(int);
     array_expand(arr, 20);
-    array_length(arr);
+    debug("Array len: %d cap: %d", array_length(arr), array_capacity(arr));
 
     array_set(arr, 1330, 1300);
 
     arr[5] = 12;
 
-    debug("Array len: %d", array_length(arr));
+    debug("Array len: %d cap: %d", array_length(arr), array_capacity(arr));
+
+    // Push and pop
+    array_clear(arr);
+    for (i = 0; i < 100; i++)
+        array_push(arr, i * 2);
+
+    debug("Array len: %d cap: %d", array_length(arr), array_capacity(arr));
+    debug("Popped: %d", array_pop(arr));
+    debug("Popped: %d", array_pop(arr));
+    debug("Array len: %d, last: %d", array_length(arr), arr[array_length(arr) - 1]);
 
     array_free(arr);
+
+    str = array(char);
+    array_strcpy(str, ONION_ADDRESS, -1);
+    debug("String: %s (%d)", str, array_length(str));
+    array_free(str);
+
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,40 @@
+#include <stdio.h>
+#include <string.h>
+#include <bloom.h>
+#include <debug.h>
+
+int main() {
+    int i, n_false;
+    char key[32];
+    struct bloom *bf;
+
+    debug_set_fp(stdout);
+
+    bf = bloom_new(1000);
+    debug("Filter bits: %d", (int)bf->n_bits);
+
+    for (i = 0; i < 1000; i++) {
+        sprintf(key, "key%d", i);
+        bloom_add(bf, key, strlen(key));
+    }
+
+    for (i = 0; i < 1000; i++) {
+        sprintf(key, "key%d", i);
+        if (!bloom_maybe_contains(bf, key, strlen(key)))
+            debug("False negative for %s", key);
+    }
+
+    n_false = 0;
+    for (i = 1000; i < 11000; i++) {
+        sprintf(key, "key%d", i);
+        n_false += bloom_maybe_contains(bf, key, strlen(key));
+    }
+    debug("False positives: %d of 10000", n_false);
+    debug("Filter full: %d", bloom_is_full(bf));
+
+    bloom_add(bf, "one more", 8);
+    debug("Filter full: %d", bloom_is_full(bf));
+
+    bloom_free(bf);
+    return 0;
+}
@@ -1,6 +1,11 @@
 #include <debug.h>
 #include <stdio.h>
+#include <string.h>
 #include <cmd_parse.h>
+#include <db_init.h>
+#include <db_storage.h>
+#include <db_contact.h>
+#include <db_message.h>
 
 void command_name(int argc, char **argv, void *cbarg) {
     debug("Hi %s", argv[1]);
@@ -20,24 +25,102 @@ void command_version(int argc, char **argv, void *cbarg) {
     debug("I don't know my version :)");
 }
 
+// Raw command, prints the argument exactly as it was received
+void command_echo(int argc, char **argv, void *cbarg) {
+    debug("echo argc(%d) arg(%s)", argc, argv[1]);
+}
+
+// Raw command which passes the query to message search like console search command
+void command_search(int argc, char **argv, void *cbarg) {
+    struct db_message_batch *batch;
+
+    batch = db_message_search(dbg, argv[1], 10);
+    debug("search [%s]: %d hit(s)%s%s", argv[1], batch->n_msgs,
+        batch->n_msgs ? ", first: " : "", batch->n_msgs ? db_message_get_text(batch->msgs[0]) : "");
+    db_message_batch_free(batch);
+}
+
+// Save text message from friend into the test database
+void save_text(int contact_id, const char *text) {
+    struct db_message *msg = db_message_new();
+
+    msg->contact_id = contact_id;
+    msg->type = DB_MESSAGE_TEXT;
+    msg->status = DB_MESSAGE_STATUS_RECV_CONFIRMED;
+    msg->sender = DB_MESSAGE_SENDER_FRIEND;
+    db_message_gen_id(msg);
+    db_message_set_text(msg, text, -1);
+    db_message_save(dbg, msg);
+    db_message_free(msg);
+}
+
 int main() {
+    int i;
     char buffer[255];
+    const char *err;
+    struct db_contact *cont;
     struct cmd_template cmds[] = {
-        {"name",    1, command_name,    NULL},
-        {"add",     2, command_add,     NULL},
-        {"version", 0, command_version, NULL},
+        {"name",    1, command_name,    NULL, 0},
+        {"add",     2, command_add,     NULL, 0},
+        {"version", 0, command_version, NULL, 0},
+        {"echo",   -1, command_echo,    NULL, 1},
+        {"search", -1, command_search,  NULL, 1},
+    };
+    const char *raw_lines[] = {
+        "echo hello world\n",
+        "echo   two   spaces   kept  \n",
+        "echo \"quoted  text\" and 'single'\n",
+        "search\n",
+        "search    \n",
+    };
+    const char *search_lines[] = {
+        "search pizza\n",
+        "search   pineapple    pizza  \n",
+        "search \"pineapple pizza\"\n",
+        "search say \"hi\n",
+        "search NOT AND OR\n",
+        "search col:umn * ^\n",
     };
 
     debug_set_fp(stdout);
 
+    debug("Testing raw mode: ");
+    for (i = 0; i < sizeof(raw_lines) / sizeof(raw_lines[0]); i++) {
+        if (err = cmd_parse(cmds, 5, raw_lines[i]))
+            debug("error: %s", err);
+    }
+
+    // Every query word is quoted by search so FTS syntax typed by the user is matched as text
+    debug("Testing search query quoting: ");
+    db_storage_select("memory");
+    db_init_global("deep_messenger.db");
+    db_init_schema(dbg);
+
+    cont = db_contact_new();
+    cont->status = DB_CONTACT_ACTIVE;
+    strcpy(cont->nickname, "friend");
+    strcpy(cont->onion_address, "i4mcwgorejxtforxrd7dsf73hsiiphhlgxxz3aeuef3hixdcv4vg3bid.onion");
+    db_contact_save(dbg, cont);
+
+    save_text(cont->id, "pineapple pizza");
+    save_text(cont->id, "say \"hi to everyone");
+    save_text(cont->id, "NOT AND OR are just words here");
+    save_text(cont->id, "col:umn * ^");
+    db_contact_free(cont);
+
+    for (i = 0; i < sizeof(search_lines) / sizeof(search_lines[0]); i++) {
+        if (err = cmd_parse(cmds, 5, search_lines[i]))
+            debug("error: %s", err);
+    }
+
     while (1) {
-        const char *err;
         printf("> ");
-        fgets(buffer, sizeof(buffer), stdin);
+        if (fgets(buffer, sizeof(buffer), stdin) == NULL)
+            break;
 
-        if (err = cmd_parse(cmds, 3, buffer))
+        if (err = cmd_parse(cmds, 5, buffer))
             debug("error: %s", err);
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -2,9 +2,11 @@
 #include <db_contact.h>
 #include <db_options.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <debug.h>
 #include <sys_crash.h>
 #include <string.h>
+#include <time.h>
 #include <stdint.h>
 #include <db_message.h>
 #include <db_mb_account.h>
@@ -13,6 +15,130 @@
 #include <db_mb_contact.h>
 #include <db_mb_message.h>
 #include <constants.h>
+#include <db_job.h>
+#include <db_storage.h>
+#include <db_compress.h>
+#include <db_shard.h>
+
+// Count rows of given table which match given SQL condition
+static int count_rows(sqlite3 *db, const char *table, const char *where) {
+    int n;
+    char sql[256];
+    sqlite3_stmt *stmt;
+
+    snprintf(sql, sizeof(sql), "SELECT COUNT(*) FROM %s WHERE %s", table, where);
+    sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    sqlite3_step(stmt);
+    n = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+    return n;
+}
+
+// Print conversation summary of given contact, message IDs are printed relative to base_id
+static void print_summary(sqlite3 *db, int contact_id, int base_id) {
+    int i, n;
+    struct db_contact_summary **sums;
+
+    sums = db_contact_get_summaries(db, &n);
+    for (i = 0; i < n; i++) {
+        if (sums[i]->id != contact_id)
+            continue;
+
+        debug("- last_message(+%d) n_unread(%d) n_undelivered(%d) last_activity(%s)",
+            sums[i]->last_message_id - base_id, sums[i]->n_unread, sums[i]->n_undelivered,
+            llabs(time(NULL) - sums[i]->last_activity) < 60 ? "now" : "NOT SET");
+    }
+    db_contact_free_summaries(sums, n);
+}
+
+// Save message of given type into the database, returns new message
+static struct db_message * save_summary_msg(sqlite3 *db, int contact_id, enum db_message_sender sender, enum db_message_status status) {
+    struct db_message *msg = db_message_new();
+
+    msg->contact_id = contact_id;
+    msg->type = DB_MESSAGE_TEXT;
+    msg->sender = sender;
+    msg->status = status;
+    db_message_gen_id(msg);
+    db_message_set_text(msg, "Summary test", -1);
+    db_message_save(db, msg);
+    return msg;
+}
+
+// Store mailbox message from buffer built out of separate references to given data split
+// at given offsets, so store has to write it from multiple iovecs, returns message id
+static int mb_store_split(
+    sqlite3 *db, int account_id, int contact_id, const uint8_t *data, int len, const int *splits, int n_splits
+) {
+    int i, id, pos = 0;
+    struct evbuffer *buff = evbuffer_new();
+
+    for (i = 0; i <= n_splits; i++) {
+        int end = (i < n_splits) ? splits[i] : len;
+
+        evbuffer_add_reference(buff, data + pos, end - pos, NULL, NULL);
+        pos = end;
+    }
+
+    debug("- buffer of %d bytes in %d iovecs", (int)evbuffer_get_length(buff), evbuffer_peek(buff, -1, NULL, NULL, 0));
+    id = db_mb_message_store(db, account_id, contact_id, data + 66, buff);
+    evbuffer_free(buff);
+    return id;
+}
+
+// Store mailbox message from buffer referencing given data, returns message id
+static int mb_store(sqlite3 *db, int account_id, int contact_id, const uint8_t *data, int len) {
+    int id;
+    struct evbuffer *buff = evbuffer_new();
+
+    evbuffer_add_reference(buff, data, len, NULL, NULL);
+    id = db_mb_message_store(db, account_id, contact_id, data + 66, buff);
+    evbuffer_free(buff);
+    return id;
+}
+
+// Print how many messages of given account are served from the hot queue, data of all stored
+// rows is replaced with one byte first, so only messages read from the database have it
+static void mb_print_hot(sqlite3 *db, struct db_mb_account *acc) {
+    int i, n_hot = 0;
+    char sql[128];
+    struct db_mb_message_batch *batch;
+
+    snprintf(sql, sizeof(sql), "UPDATE mailbox_messages SET data = x'EE' WHERE account_id = %d", acc->id);
+    sqlite3_exec(db, sql, NULL, NULL, NULL);
+
+    batch = db_mb_message_get_batch(db, acc);
+    for (i = 0; i < batch->n_msgs; i++)
+        n_hot += batch->msgs[i]->data_len > 1;
+
+    debug("- account %d: %d messages, %d from hot queue, %d from database, oldest from %s", acc->id,
+        batch->n_msgs, n_hot, batch->n_msgs - n_hot, batch->n_msgs == 0 ? "-" : batch->msgs[0]->data_len > 1 ? "hot queue" : "database");
+    db_mb_message_batch_free(batch);
+}
+
+// Count messages streamed by db_mb_message_stream_batch
+static void mb_stream_count(const uint8_t *data, size_t len, void *cbarg) {
+    ++*(int *)cbarg;
+}
+
+// Print contact update statements run on the connection
+static int print_contact_update(unsigned type, void *ctx, void *p, void *x) {
+    const char *sql = sqlite3_sql(p);
+
+    if (strncmp(sql, "UPDATE client_contacts", 22) == 0)
+        debug("%s: %s", (char *)ctx, sql);
+    return 0;
+}
+
+// Print number of search hits for given query and text of the first one
+static void print_search(sqlite3 *db, const char *query) {
+    struct db_message_batch *batch;
+
+    batch = db_message_search(db, query, 10);
+    debug("Search '%s': %d hit(s)%s%.20s", query, batch->n_msgs,
+        batch->n_msgs ? ", first: " : "", batch->n_msgs ? db_message_get_text(batch->msgs[0]) : "");
+    db_message_batch_free(batch);
+}
 
 int main(void) {
     sqlite3 *db;
@@ -20,12 +146,18 @@ int main(void) {
     struct db_contact *cont;
     struct db_contact **conts;
     struct db_message *msg;
+    struct db_message_outbox *outbox;
+    int outbox_n;
     struct db_mb_key *key;
     struct db_mb_key **keys;
 
     struct db_mb_account *acc;
+    uint8_t mbid_old[MAILBOX_ID_LEN];
     struct db_mb_contact *mcont;
     struct db_mb_message *mmsg;
+    sqlite3 *db2;
+    char where[64];
+    int n_runs;
 
     uint8_t gid[] = { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, };
     
@@ -78,6 +210,46 @@ int main(void) {
     }
     debug("Done");
 
+    debug("Testing contact save columns: ");
+
+    sqlite3_trace_v2(dbg, SQLITE_TRACE_STMT, print_contact_update, "dbg");
+    struct db_contact *cont2 = db_contact_get_by_pk(dbg, cont->id, NULL);
+
+    strcpy(cont2->nickname, "rdobovic_changed");
+    db_contact_save(dbg, cont2);
+    cont2->has_mailbox = 0;
+    cont2->mailbox_id[0] = 0x42;
+    db_contact_save(dbg, cont2);
+    debug("Saving unchanged contact:");
+    db_contact_save(dbg, cont2);
+
+    // Second connection has no stored copy, it must not trust the other one
+    const struct db_contact *cont_ref = db_contact_ref_by_pk(dbg, cont2->id);
+
+    db2 = db_storage_open("deep_messenger.db");
+    sqlite3_trace_v2(db2, SQLITE_TRACE_STMT, print_contact_update, "db2");
+    strcpy(cont2->nickname, "rdobovic");
+    db_contact_save(db2, cont2);
+
+    // Directory of the first connection picks up the change, reference stays valid
+    debug("Nickname through first: %s, reference: %s, same entry: %s",
+        db_contact_ref_by_pk(dbg, cont2->id)->nickname, cont_ref->nickname,
+        db_contact_ref_by_pk(dbg, cont2->id) == cont_ref ? "yes" : "NO");
+
+    // Lookup loads directory of the second connection, so it has stored copy now
+    db_contact_ref_by_pk(db2, cont2->id);
+    strcpy(cont2->nickname, "rdobovic_db2");
+    db_contact_save(db2, cont2);
+    debug("Nickname through first: %s", db_contact_ref_by_pk(dbg, cont2->id)->nickname);
+    strcpy(cont2->nickname, "rdobovic");
+    db_contact_save(dbg, cont2);
+    debug("Nickname through second: %s", db_contact_ref_by_pk(db2, cont2->id)->nickname);
+
+    sqlite3_close(db2);
+    db_contact_dir_clear();
+    sqlite3_trace_v2(dbg, 0, NULL, NULL);
+    db_contact_free(cont2);
+
     msg = db_message_new();
 
     msg->contact_id = cont->id;
@@ -88,6 +260,77 @@ int main(void) {
     db_message_save(dbg, msg);
     db_message_free(msg);
 
+    debug("Testing outbox: ");
+
+    msg = db_message_new();
+    msg->contact_id = cont->id;
+    msg->type = DB_MESSAGE_TEXT;
+    msg->status = DB_MESSAGE_STATUS_UNDELIVERED;
+    msg->sender = DB_MESSAGE_SENDER_ME;
+    db_message_gen_id(msg);
+    db_message_set_text(msg, "Are you there?", -1);
+    db_message_save(dbg, msg);
+
+    debug("Attempts after first failure: %d", db_message_outbox_failed(dbg, &(msg->id), 1));
+    debug("Attempts after second failure: %d", db_message_outbox_failed(dbg, &(msg->id), 1));
+    db_message_outbox_delay(dbg, &(msg->id), 1, 1234);
+
+    outbox = db_message_outbox_get(dbg, &outbox_n);
+    for (i = 0; i < outbox_n; i++) {
+        debug("- contact [%d] attempts %d, next at %lld", outbox[i].contact_id,
+            outbox[i].attempts, (long long)outbox[i].next_attempt);
+    }
+    free(outbox);
+
+    msg->status = DB_MESSAGE_STATUS_SENT;
+    db_message_save(dbg, msg);
+    debug("Attempts once delivered: %d", db_message_outbox_failed(dbg, &(msg->id), 1));
+    db_message_free(msg);
+
+    debug("Testing message compression and search: ");
+
+    char long_text[512];
+
+    db_compress_set_enabled(1);
+    long_text[0] = '\0';
+    while (strlen(long_text) < 400)
+        strcat(long_text, "pineapple pizza is good, ");
+
+    msg = db_message_new();
+    msg->contact_id = cont->id;
+    msg->type = DB_MESSAGE_TEXT;
+    msg->status = DB_MESSAGE_STATUS_RECV_CONFIRMED;
+    msg->sender = DB_MESSAGE_SENDER_FRIEND;
+    db_message_gen_id(msg);
+    db_message_set_text(msg, long_text, -1);
+    db_message_save(dbg, msg);
+
+    snprintf(where, sizeof(where), "id = %d AND body_format = %d", msg->id, DB_FORMAT_ZLIB);
+    debug("Stored compressed: %d, text length %d", count_rows(dbg, "client_messages", where), (int)strlen(long_text));
+
+    struct db_message *msg2 = db_message_get_by_pk(dbg, msg->id, NULL);
+    debug("Text after round trip: %s, length %d",
+        strcmp(db_message_get_text(msg2), long_text) == 0 ? "same" : "DIFFERENT", msg2->body_text_len);
+    db_message_free(msg2);
+
+    print_search(dbg, "pineapple");
+    print_search(dbg, "pizza good");
+    print_search(dbg, "anchovies");
+    db_compress_set_enabled(0);
+
+    // Message changed through another connection must be reindexed too
+    db2 = db_storage_open("deep_messenger.db");
+    db_message_set_text(msg, "anchovies only, please", -1);
+    db_message_save(db2, msg);
+    sqlite3_close(db2);
+
+    print_search(dbg, "pineapple");
+    print_search(dbg, "anchovies");
+
+    db_message_delete(dbg, msg);
+    db_message_free(msg);
+    print_search(dbg, "anchovies");
+
     msg = db_message_get_by_gid(dbg, gid, NULL);
     debug("MSG: %s", msg == NULL ? "NONE" : msg->body_text);
     db_message_free(msg);
@@ -162,5 +405,393 @@ int main(void) {
     db_mb_contact_free(mcont);
     db_mb_message_free(mmsg);*/
 
+    debug("Testing contact summaries: ");
+
+    struct db_message *sum_msgs[4];
+
+    cont = db_contact_new();
+    cont->status = DB_CONTACT_ACTIVE;
+    strcpy(cont->nickname, "summary");
+    strcpy(cont->onion_address, "g7kfkvigtyx45az27obwydfq3zrxfwl77so3n3tqv22cw3qvz6cuv4qd.onion");
+    db_contact_save(dbg, cont);
+
+    sum_msgs[0] = save_summary_msg(dbg, cont->id, DB_MESSAGE_SENDER_FRIEND, DB_MESSAGE_STATUS_RECV_CONFIRMED);
+    sum_msgs[1] = save_summary_msg(dbg, cont->id, DB_MESSAGE_SENDER_FRIEND, DB_MESSAGE_STATUS_RECV_CONFIRMED);
+    sum_msgs[2] = save_summary_msg(dbg, cont->id, DB_MESSAGE_SENDER_ME, DB_MESSAGE_STATUS_UNDELIVERED);
+    debug("After two received and one undelivered:");
+    print_summary(dbg, cont->id, sum_msgs[0]->id);
+
+    sum_msgs[2]->status = DB_MESSAGE_STATUS_SENT;
+    db_message_save(dbg, sum_msgs[2]);
+    debug("After undelivered one is sent:");
+    print_summary(dbg, cont->id, sum_msgs[0]->id);
+
+    db_message_delete(dbg, sum_msgs[1]);
+    debug("After unread message +1 is deleted:");
+    print_summary(dbg, cont->id, sum_msgs[0]->id);
+
+    db_message_delete(dbg, sum_msgs[2]);
+    debug("After last message +2 is deleted:");
+    print_summary(dbg, cont->id, sum_msgs[0]->id);
+
+    db_contact_mark_read(dbg, cont->id);
+    debug("After mark read:");
+    print_summary(dbg, cont->id, sum_msgs[0]->id);
+
+    sum_msgs[3] = save_summary_msg(dbg, cont->id, DB_MESSAGE_SENDER_FRIEND, DB_MESSAGE_STATUS_RECV_CONFIRMED);
+    debug("After new message is received:");
+    print_summary(dbg, cont->id, sum_msgs[0]->id);
+
+    for (i = 0; i < 4; i++)
+        db_message_free(sum_msgs[i]);
+    db_contact_free(cont);
+
+    debug("Testing delete jobs: ");
+
+    cont = db_contact_new();
+    cont->status = DB_CONTACT_ACTIVE;
+    strcpy(cont->nickname, "job");
+    db_contact_save(dbg, cont);
+    snprintf(where, sizeof(where), "contact_id = %d", cont->id);
+
+    sqlite3_exec(dbg, "BEGIN", NULL, NULL, NULL);
+    for (i = 0; i < DB_JOB_CHUNK_SIZE * 2 + 10; i++) {
+        msg = db_message_new();
+        msg->contact_id = cont->id;
+        msg->type = DB_MESSAGE_TEXT;
+        db_message_gen_id(msg);
+        db_message_set_text(msg, "To be deleted", -1);
+        db_message_save(dbg, msg);
+        db_message_free(msg);
+    }
+    sqlite3_exec(dbg, "COMMIT", NULL, NULL, NULL);
+
+    // Jobs added earlier are finished first
+    while (db_job_run(dbg))
+        /* Do nothing */;
+
+    db_contact_delete(dbg, cont);
+    debug("Messages before job: %d", count_rows(dbg, "client_messages", where));
+
+    // Interrupted after the first chunk, resumed on a new connection
+    db_job_run(dbg);
+    debug("Messages after one chunk: %d", count_rows(dbg, "client_messages", where));
+
+    db2 = db_storage_open("deep_messenger.db");
+    for (n_runs = 0; db_job_run(db2); n_runs++)
+        /* Do nothing */;
+    sqlite3_close(db2);
+
+    debug("Resumed job runs: %d", n_runs);
+    debug("Messages after job: %d", count_rows(dbg, "client_messages", where));
+    snprintf(where, sizeof(where), "id = %d", cont->id);
+    debug("Contact rows after job: %d", count_rows(dbg, "client_contacts", where));
+    debug("Jobs left: %d", count_rows(dbg, "delete_jobs", "1"));
+    db_contact_free(cont);
+
+    cont = db_contact_new();
+    cont->status = DB_CONTACT_ACTIVE;
+    strcpy(cont->nickname, "restored");
+    db_contact_save(dbg, cont);
+
+    msg = db_message_new();
+    msg->contact_id = cont->id;
+    msg->type = DB_MESSAGE_TEXT;
+    db_message_gen_id(msg);
+    db_message_set_text(msg, "Still here", -1);
+    db_message_save(dbg, msg);
+    db_message_free(msg);
+
+    // Deleted flag is removed before the job runs, like friendadd does
+    db_contact_delete(dbg, cont);
+    cont->deleted = 0;
+    db_contact_save(dbg, cont);
+
+    while (db_job_run(dbg))
+        /* Do nothing */;
+
+    snprintf(where, sizeof(where), "contact_id = %d", cont->id);
+    debug("Restored contact messages: %d", count_rows(dbg, "client_messages", where));
+    snprintf(where, sizeof(where), "id = %d", cont->id);
+    debug("Restored contact rows: %d", count_rows(dbg, "client_contacts", where));
+    debug("Jobs left: %d", count_rows(dbg, "delete_jobs", "1"));
+    db_contact_free(cont);
+
+    debug("Testing mailbox account cache: ");
+
+    acc = db_mb_account_new();
+    acc->mailbox_id[0] = 0x01;
+    db_mb_account_save(dbg, acc);
+
+    memcpy(mbid_old, acc->mailbox_id, MAILBOX_ID_LEN);
+    acc->mailbox_id[0] = 0x02;
+    db_mb_account_save(dbg, acc);
+
+    debug("Old mailbox ID: %s", db_mb_account_get_by_mbid(dbg, mbid_old, acc) ? "FOUND" : "NONE");
+    debug("New mailbox ID: %s", db_mb_account_get_by_mbid(dbg, acc->mailbox_id, acc) ? "FOUND" : "NONE");
+
+    db_mb_account_delete(dbg, acc);
+    db_mb_account_free(acc);
+
+    debug("Testing mailbox message store: ");
+
+    // Container is header, transaction ID, mailbox ID, signing key, global ID and the rest,
+    // buffer is split inside the part packed format leaves out and around it
+    uint8_t container[200];
+    int splits[] = { 5, 28, 70, 120 };
+
+    acc = db_mb_account_new();
+    acc->mailbox_id[0] = 0x39;
+    db_mb_account_save(dbg, acc);
+    mcont = db_mb_contact_new();
+    mcont->account_id = acc->id;
+    mcont->signing_pub_key[0] = 0x5A;
+    db_mb_contact_save(dbg, mcont);
+
+    for (i = 0; i < sizeof(container); i++)
+        container[i] = i * 7;
+    memcpy(container + 18, acc->mailbox_id, MAILBOX_ID_LEN);
+    memcpy(container + 34, mcont->signing_pub_key, CLIENT_SIG_KEY_PUB_LEN);
+
+    for (n_runs = 0; n_runs < 2; n_runs++) {
+        int id;
+
+        db_compress_set_enabled(n_runs);
+        container[66] = n_runs;
+        id = mb_store_split(dbg, acc->id, mcont->id, container, sizeof(container), splits, 4);
+
+        snprintf(where, sizeof(where), "id = %d AND data_format = %d", id, n_runs ? DB_FORMAT_PACKED : DB_FORMAT_RAW);
+        debug("- stored %s: %d", n_runs ? "packed" : "raw", count_rows(dbg, "mailbox_messages", where));
+
+        mmsg = db_mb_message_get_by_pk(dbg, id, NULL);
+        debug("- read back %d bytes, %s", mmsg->data_len,
+            mmsg->data_len == sizeof(container) && memcmp(mmsg->data, container, sizeof(container)) == 0 ? "same" : "DIFFERENT");
+        db_mb_message_free(mmsg);
+    }
+    debug("Testing mailbox message stream: ");
+
+    struct evbuffer *stream_buff;
+    struct db_mb_message_batch *mbatch;
+    uint8_t expected[4 * sizeof(container)];
+    int n_streamed;
+
+    // Fresh account, so batch holds only messages stored here
+    acc->id = 0;
+    acc->mailbox_id[0] = 0x38;
+    db_mb_account_save(dbg, acc);
+    mcont->id = 0;
+    mcont->account_id = acc->id;
+    db_mb_contact_save(dbg, mcont);
+    memcpy(container + 18, acc->mailbox_id, MAILBOX_ID_LEN);
+
+    // Every other message is stored packed
+    for (i = 0; i < 3; i++) {
+        db_compress_set_enabled(i % 2);
+        container[66] = 0x10 + i;
+        container[199] = i;
+        mb_store_split(dbg, acc->id, mcont->id, container, sizeof(container), splits, 4);
+    }
+    db_compress_set_enabled(0);
+
+    // Without hot queue all data is read through one blob handle which is reopened for each row
+    db_mb_message_hot_clear();
+    mbatch = db_mb_message_get_stream_batch(dbg, acc);
+    debug("- batch of %d messages, data loaded: %s", mbatch->n_msgs, mbatch->msgs[0]->data ? "yes" : "no");
+
+    // Message stored after the batch was listed is served from the hot queue
+    container[66] = 0x13;
+    container[199] = 3;
+    mb_store_split(dbg, acc->id, mcont->id, container, sizeof(container), splits, 4);
+    db_mb_message_batch_free(mbatch);
+    mbatch = db_mb_message_get_stream_batch(dbg, acc);
+    debug("- batch of %d messages, newest loaded: %s", mbatch->n_msgs, mbatch->msgs[mbatch->n_msgs - 1]->data ? "yes" : "no");
+
+    stream_buff = evbuffer_new();
+    n_streamed = 0;
+    debug("- stream result: %d", db_mb_message_stream_batch(dbg, mbatch, stream_buff, mb_stream_count, &n_streamed));
+
+    for (i = 0; i < 4; i++) {
+        container[66] = 0x10 + i;
+        container[199] = i;
+        memcpy(expected + i * sizeof(container), container, sizeof(container));
+    }
+    debug("- streamed %d messages, %d bytes, %s", n_streamed, (int)evbuffer_get_length(stream_buff),
+        evbuffer_get_length(stream_buff) == sizeof(expected) &&
+        memcmp(evbuffer_pullup(stream_buff, -1), expected, sizeof(expected)) == 0 ? "same" : "DIFFERENT");
+    evbuffer_free(stream_buff);
+    db_mb_message_batch_free(mbatch);
+
+    // Row deleted after the batch was fetched stops the stream
+    db_mb_message_hot_clear();
+    mbatch = db_mb_message_get_stream_batch(dbg, acc);
+    snprintf(where, sizeof(where), "DELETE FROM mailbox_messages WHERE id = %d", mbatch->msgs[2]->id);
+    sqlite3_exec(dbg, where, NULL, NULL, NULL);
+
+    stream_buff = evbuffer_new();
+    n_streamed = 0;
+    i = db_mb_message_stream_batch(dbg, mbatch, stream_buff, mb_stream_count, &n_streamed);
+    debug("- stream result after delete: %d, streamed %d messages", i, n_streamed);
+    evbuffer_free(stream_buff);
+    db_mb_message_batch_free(mbatch);
+    db_mb_message_hot_clear();
+
+    debug("Testing mailbox message hot queue: ");
+
+    struct db_mb_account *acc2;
+    uint8_t *big = malloc(DB_MB_MESSAGE_HOT_MAX_BYTES / 16 + 1);
+
+    for (i = 0; i < DB_MB_MESSAGE_HOT_MAX_BYTES / 16 + 1; i++)
+        big[i] = i;
+
+    // Oldest messages are evicted once account has more than allowed
+    acc->id = 0;
+    acc->mailbox_id[0] = 0x40;
+    db_mb_account_save(dbg, acc);
+    for (i = 0; i < DB_MB_MESSAGE_HOT_ACCOUNT_MAX + 2; i++)
+        mb_store(dbg, acc->id, mcont->id, container, sizeof(container));
+    debug("Stored %d messages:", DB_MB_MESSAGE_HOT_ACCOUNT_MAX + 2);
+    mb_print_hot(dbg, acc);
+
+    // All stored messages are in the queue, database is not read at all
+    acc->id = 0;
+    acc->mailbox_id[0] = 0x41;
+    db_mb_account_save(dbg, acc);
+    for (i = 0; i < 3; i++)
+        mb_store(dbg, acc->id, mcont->id, container, sizeof(container));
+    debug("Stored 3 messages:");
+    mb_print_hot(dbg, acc);
+
+    mbatch = db_mb_message_get_batch(dbg, acc);
+    db_mb_message_delete(dbg, mbatch->msgs[1]);
+    db_mb_message_batch_free(mbatch);
+    debug("Deleted one of them:");
+    mb_print_hot(dbg, acc);
+
+    // Global cap, oldest messages of all accounts are evicted first
+    db_mb_message_hot_clear();
+    acc->id = 0;
+    acc->mailbox_id[0] = 0x42;
+    db_mb_account_save(dbg, acc);
+    acc2 = db_mb_account_new();
+    acc2->mailbox_id[0] = 0x43;
+    db_mb_account_save(dbg, acc2);
+
+    for (i = 0; i < 9; i++)
+        mb_store(dbg, acc->id, mcont->id, big, DB_MB_MESSAGE_HOT_MAX_BYTES / 16);
+    for (i = 0; i < 8; i++)
+        mb_store(dbg, acc2->id, mcont->id, big, DB_MB_MESSAGE_HOT_MAX_BYTES / 16);
+    debug("Stored 9 + 8 messages of 1/16 of the cap:");
+    mb_print_hot(dbg, acc);
+    mb_print_hot(dbg, acc2);
+
+    // Message too big for the queue drops older messages of the account too
+    mb_store(dbg, acc2->id, mcont->id, big, DB_MB_MESSAGE_HOT_MAX_BYTES / 16 + 1);
+    debug("Stored message bigger than 1/16 of the cap:");
+    mb_print_hot(dbg, acc2);
+
+    free(big);
+    db_mb_account_free(acc2);
+    db_mb_message_hot_clear();
+
+    debug("Testing global ID filters of two connections: ");
+
+    uint8_t gid_unknown[MESSAGE_ID_LEN] = { 0xFF };
+
+    db2 = db_storage_open("deep_messenger.db");
+
+    cont = db_contact_new();
+    cont->status = DB_CONTACT_ACTIVE;
+    strcpy(cont->nickname, "filters");
+    db_contact_save(dbg, cont);
+
+    msg = db_message_new();
+    msg->contact_id = cont->id;
+    msg->type = DB_MESSAGE_TEXT;
+    db_message_gen_id(msg);
+    db_message_set_text(msg, "Saved through first", -1);
+    db_message_save(dbg, msg);
+
+    // Each connection builds it's own filter
+    debug("- message saved through first, lookup through first: %s, through second: %s",
+        db_message_get_by_gid(dbg, msg->global_id, msg) ? "FOUND" : "NONE",
+        db_message_get_by_gid(db2, msg->global_id, msg) ? "FOUND" : "NONE");
+
+    // Saves are added to the filter of the other connection too
+    msg->id = 0;
+    db_message_gen_id(msg);
+    db_message_save(db2, msg);
+    debug("- message saved through second, lookup through first: %s, unknown: %s",
+        db_message_get_by_gid(dbg, msg->global_id, msg) ? "FOUND" : "NONE",
+        db_message_get_by_gid(dbg, gid_unknown, msg) ? "FOUND" : "NONE");
+    db_message_free(msg);
+    db_contact_free(cont);
+
+    container[66] = 0x50;
+    mb_store(dbg, acc->id, mcont->id, container, sizeof(container));
+    debug("- mailbox message stored through first, exists through first: %d, through second: %d",
+        db_mb_message_exists(dbg, acc, container + 66), db_mb_message_exists(db2, acc, container + 66));
+
+    container[66] = 0x51;
+    mb_store(db2, acc->id, mcont->id, container, sizeof(container));
+    debug("- mailbox message stored through second, exists through first: %d, unknown: %d",
+        db_mb_message_exists(dbg, acc, container + 66), db_mb_message_exists(dbg, acc, gid_unknown));
+
+    // Filters of closed connection must not be picked up by the next one
+    sqlite3_close(db2);
+    db_message_gid_filter_clear();
+    db_mb_message_gid_filter_clear();
+    db_mb_message_hot_clear();
+
+    db_mb_account_free(acc);
+    db_mb_contact_free(mcont);
+
+    debug("Testing mailbox shards: ");
+
+    sqlite3 *sh, *sdb = db_storage_open("shard_test.db");
+    int shard_used[4] = { 0 }, n_used = 0;
+
+    db_init_schema(sdb);
+    db_mb_account_cache_clear();
+    debug("Shard init: %d", db_shard_init(sdb, "shard_test.db", 4));
+
+    acc = db_mb_account_new();
+    mcont = db_mb_contact_new();
+
+    // Pick mailbox IDs until every shard holds one account
+    for (i = 0; i < 256 && n_used < 4; i++) {
+        acc->id = 0;
+        acc->mailbox_id[0] = i;
+
+        sh = db_shard_by_mbid(sdb, acc->mailbox_id);
+        db_mb_account_save(sdb, acc);
+        if (shard_used[acc->id >> DB_SHARD_ID_BITS]++)
+            continue;
+        n_used++;
+
+        mcont->id = 0;
+        mcont->account_id = acc->id;
+        db_mb_contact_save(sdb, mcont);
+
+        debug("- shard %d: account(+%d) routed back %s, contact shard %d routed back %s",
+            acc->id >> DB_SHARD_ID_BITS, acc->id & ((1 << DB_SHARD_ID_BITS) - 1),
+            db_shard_by_id(sdb, acc->id) == sh ? "yes" : "NO",
+            mcont->id >> DB_SHARD_ID_BITS, db_shard_by_id(sdb, mcont->id) == sh ? "yes" : "NO");
+    }
+
+    // Next ID of shard 1 would belong to shard 2
+    sh = db_shard_by_id(sdb, 1 << DB_SHARD_ID_BITS);
+    snprintf(where, sizeof(where), "UPDATE sqlite_sequence SET seq = %lld", (long long)DB_SHARD_ID_LAST(1) - 1);
+    sqlite3_exec(sh, where, NULL, NULL, NULL);
+    debug("Insert of last ID: %s", sqlite3_exec(sh,
+        "INSERT INTO mailbox_accounts (mailbox_id) VALUES (x'00')", NULL, NULL, NULL) == SQLITE_OK ? "OK" : sqlite3_errmsg(sh));
+    debug("Insert past the limit: %s", sqlite3_exec(sh,
+        "INSERT INTO mailbox_accounts (mailbox_id) VALUES (x'00')", NULL, NULL, NULL) == SQLITE_OK ? "OK" : sqlite3_errmsg(sh));
+
+    db_mb_account_free(acc);
+    db_mb_contact_free(mcont);
+    db_mb_account_cache_clear();
+    db_shard_close(sdb);
+    sqlite3_close(sdb);
+
     sqlite3_close(dbg);
 }
\ No newline at end of file
@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <string.h>
+#include <hash_table.h>
+#include <debug.h>
+
+static void print_cb(const void *key, size_t key_len, void *value, void *cbarg) {
+    debug("%.*s = %d", (int)key_len, (const char *)key, *(int *)value);
+}
+
+int main() {
+    int i;
+    char key[32];
+    int values[100];
+    struct hash_table *ht;
+
+    debug_set_fp(stdout);
+
+    ht = hash_table_new();
+
+    for (i = 0; i < 100; i++) {
+        values[i] = i * i;
+        sprintf(key, "key%d", i);
+        hash_table_set(ht, key, strlen(key), &values[i]);
+    }
+
+    debug("Table length: %d", hash_table_get_length(ht));
+    debug("key7 = %d", *(int *)hash_table_get(ht, "key7", 4));
+    debug("key99 = %d", *(int *)hash_table_get(ht, "key99", 5));
+
+    for (i = 10; i < 100; i++) {
+        sprintf(key, "key%d", i);
+        hash_table_remove(ht, key, strlen(key));
+    }
+
+    debug("Removing missing key: %d", hash_table_remove(ht, "key50", 5));
+    debug("Missing key: %p", hash_table_get(ht, "key50", 5));
+    debug("Table length: %d", hash_table_get_length(ht));
+
+    hash_table_foreach(ht, print_cb, NULL);
+
+    hash_table_free(ht);
+    return 0;
+}
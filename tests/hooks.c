@@ -1,13 +1,26 @@
 #include <hooks.h>
 #include <debug.h>
+#include <event2/event.h>
+
+struct hook_list *hooks;
 
 void print_info(int hevent, void *data, void *cbarg) {
     debug("HOOK CB: d(%s) a(%s)", (char *)data, (char *)cbarg);
 }
 
+// Removes itself and the hook after it while being dispatched
+void remove_self(int hevent, void *data, void *cbarg) {
+    debug("HOOK CB: removing self and A3");
+    hook_remove(hooks, hevent, remove_self, cbarg);
+    hook_remove(hooks, hevent, print_info, "A3");
+}
+
+void free_data(void *data) {
+    debug("Freeing deferred data (%s)", (char *)data);
+}
+
 int main() {
-    int *arr;
-    struct hook_list *hooks;
+    struct event_base *base;
 
     char str[] = "This is str";
 
@@ -16,6 +29,7 @@ int main() {
     hooks = hook_list_new();
 
     hook_list_call(hooks, 2, "BEF");
+    hook_remove(hooks, 2, print_info, "EMPTY");
 
     hook_add(hooks, 1, print_info, "A1");
     hook_add(hooks, 2, print_info, "A2");
@@ -27,7 +41,26 @@ int main() {
     hook_remove(hooks, 2, print_info, str);
     hook_list_call(hooks, 2, "MSG");
 
+    // Remove hooks from inside of the dispatch
+    hook_add(hooks, 3, remove_self, NULL);
+    hook_add(hooks, 3, print_info, "A3");
+    hook_add(hooks, 3, print_info, "A4");
+
+    hook_list_call(hooks, 3, "RM1");
+    hook_list_call(hooks, 3, "RM2");
+
+    // Deferred call is dispatched from the loop
+    base = event_base_new();
+
+    hook_list_call_deferred(hooks, base, 1, "DEF", free_data);
+    debug("Deferred call scheduled");
+    event_base_dispatch(base);
+
+    // If list is freed before, hooks are skipped and only data is freed
+    hook_list_call_deferred(hooks, base, 1, "DEF-FREED", free_data);
     hook_list_free(hooks);
-    
+    event_base_dispatch(base);
+    event_base_free(base);
+
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,100 @@
+#include <string.h>
+#include <debug.h>
+#include <prot_pool.h>
+#include <event2/buffer.h>
+
+struct test_obj {
+    int id;
+    char name[20];
+};
+
+static struct prot_pool pool = PROT_POOL_INIT(struct test_obj);
+
+// Check if pointer is one of the first n in given list
+static int in_list(void **list, int n, void *ptr) {
+    int i;
+
+    for (i = 0; i < n; i++)
+        if (list[i] == ptr)
+            return 1;
+    return 0;
+}
+
+int main() {
+    int i, n_reused;
+    struct evbuffer *buff, *buff2;
+    struct evbuffer *buffs[PROT_POOL_MAX_BUFFERS + 6];
+    struct test_obj *obj, *obj2;
+    struct test_obj *objs[PROT_POOL_MAX_OBJECTS + 6];
+
+    debug_set_fp(stdout);
+
+    debug("Testing buffer pool: ");
+
+    buff = prot_pool_buffer_get();
+    evbuffer_add(buff, "Some data", 9);
+    prot_pool_buffer_put(buff);
+
+    buff2 = prot_pool_buffer_get();
+    debug("Buffer reused: %s, length: %d", buff2 == buff ? "yes" : "NO", (int)evbuffer_get_length(buff2));
+    prot_pool_buffer_put(buff2);
+    prot_pool_buffer_put(NULL);
+
+    // Pool keeps only up to the limit, extra buffers are freed
+    for (i = 0; i < PROT_POOL_MAX_BUFFERS + 6; i++)
+        buffs[i] = prot_pool_buffer_get();
+    for (i = 0; i < PROT_POOL_MAX_BUFFERS + 6; i++)
+        prot_pool_buffer_put(buffs[i]);
+
+    for (i = 0, n_reused = 0; i < PROT_POOL_MAX_BUFFERS + 6; i++) {
+        buff = prot_pool_buffer_get();
+        n_reused += in_list((void **)buffs, PROT_POOL_MAX_BUFFERS + 6, buff);
+        buffs[PROT_POOL_MAX_BUFFERS + 6 - 1 - i] = buff;
+    }
+    debug("Buffers reused after putting back %d: %d (limit %d)",
+        PROT_POOL_MAX_BUFFERS + 6, n_reused, PROT_POOL_MAX_BUFFERS);
+
+    for (i = 0; i < PROT_POOL_MAX_BUFFERS + 6; i++)
+        prot_pool_buffer_put(buffs[i]);
+
+    // Clear frees every idle buffer, the pool then starts from empty again
+    prot_pool_buffer_clear();
+    buff = prot_pool_buffer_get();
+    evbuffer_add(buff, "More data", 9);
+    prot_pool_buffer_put(buff);
+    buff2 = prot_pool_buffer_get();
+    debug("Buffer reused after clear: %s, length: %d", buff2 == buff ? "yes" : "NO", (int)evbuffer_get_length(buff2));
+    prot_pool_buffer_put(buff2);
+    prot_pool_buffer_clear();
+
+    debug("Testing object pool: ");
+
+    obj = prot_pool_alloc(&pool, "Failed to allocate test object");
+    obj->id = 42;
+    strcpy(obj->name, "dirty");
+    prot_pool_release(&pool, obj);
+
+    obj2 = prot_pool_alloc(&pool, "Failed to allocate test object");
+    debug("Object reused: %s, zeroed: %s", obj2 == obj ? "yes" : "NO",
+        obj2->id == 0 && obj2->name[0] == '\0' ? "yes" : "NO");
+    prot_pool_release(&pool, obj2);
+    prot_pool_release(&pool, NULL);
+    debug("Free objects after releasing NULL: %d", pool.n_free);
+
+    // Objects over the limit are freed on release
+    for (i = 0; i < PROT_POOL_MAX_OBJECTS + 6; i++)
+        objs[i] = prot_pool_alloc(&pool, "Failed to allocate test object");
+    for (i = 0; i < PROT_POOL_MAX_OBJECTS + 6; i++)
+        prot_pool_release(&pool, objs[i]);
+    debug("Free objects after releasing %d: %d (limit %d)",
+        PROT_POOL_MAX_OBJECTS + 6, pool.n_free, PROT_POOL_MAX_OBJECTS);
+
+    for (i = 0, n_reused = 0; i < PROT_POOL_MAX_OBJECTS; i++)
+        n_reused += in_list((void **)objs, PROT_POOL_MAX_OBJECTS, prot_pool_alloc(&pool, "Failed to allocate test object"));
+    debug("First %d objects reused: %d, free objects left: %d", PROT_POOL_MAX_OBJECTS, n_reused, pool.n_free);
+
+    for (i = 0; i < PROT_POOL_MAX_OBJECTS; i++)
+        free(objs[i]);
+
+    return 0;
+}
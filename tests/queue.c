@@ -28,5 +28,21 @@ int main() {
     queue_dequeue(q, &value);
     debug("value = %d", value);
 
+    // Wrap around the end of the buffer and grow while wrapped
+    for (i = 0; i < 6; i++)
+        queue_enqueue(q, &i);
+    for (i = 0; i < 4; i++)
+        queue_dequeue(q, NULL);
+    for (i = 6; i < 20; i++)
+        queue_enqueue(q, &i);
+
+    debug("length = %d, peek[5] = %d", queue_get_length(q), *(int *)queue_peek(q, 5));
+    debug("peek past the end = %p", queue_peek(q, queue_get_length(q)));
+
+    while (!queue_is_empty(q)) {
+        queue_dequeue(q, &value);
+        debug("value = %d", value);
+    }
+
     queue_free(q);
 }
\ No newline at end of file
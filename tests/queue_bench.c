@@ -0,0 +1,102 @@
+#include <time.h>
+#include <queue.h>
+#include <debug.h>
+
+#define BENCH_OPS 1000000
+
+// Get time elapsed since start in nanoseconds
+static double elapsed_ns(const struct timespec *start) {
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+// Enqueue and dequeue pointer sized items keeping given number of items queued
+static void bench_fifo(int n_queued) {
+    int i;
+    void *item;
+    struct queue *q;
+    struct timespec start;
+
+    q = queue_new(sizeof(void *));
+
+    for (i = 0; i < n_queued; i++) {
+        item = &i;
+        queue_enqueue(q, &item);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < BENCH_OPS; i++) {
+        item = &i;
+        queue_enqueue(q, &item);
+        queue_dequeue(q, &item);
+    }
+
+    debug("enqueue/dequeue with %4d queued: %6.1f ns/op", n_queued, elapsed_ns(&start) / BENCH_OPS);
+    queue_free(q);
+}
+
+// Enqueue given number of items into a new queue including growth, then drain it
+static void bench_fill(int n_items) {
+    int i, n_runs = BENCH_OPS / n_items;
+    void *item;
+    struct queue *q;
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (; n_runs > 0; n_runs--) {
+        q = queue_new(sizeof(void *));
+        for (i = 0; i < n_items; i++) {
+            item = &i;
+            queue_enqueue(q, &item);
+        }
+        while (!queue_dequeue(q, &item))
+            /* Do nothing */;
+        queue_free(q);
+    }
+
+    debug("fill and drain %6d items:      %6.1f ns/item", n_items, elapsed_ns(&start) / BENCH_OPS);
+}
+
+// Peek at the item in the middle of queue holding given number of items
+static void bench_peek(int n_items) {
+    int i;
+    void *item;
+    volatile void *sink;
+    struct queue *q;
+    struct timespec start;
+
+    q = queue_new(sizeof(void *));
+
+    for (i = 0; i < n_items; i++) {
+        item = &i;
+        queue_enqueue(q, &item);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < BENCH_OPS; i++)
+        sink = queue_peek(q, (n_items / 2 + i) % n_items);
+
+    debug("peek in %6d items:             %6.1f ns/op", n_items, elapsed_ns(&start) / BENCH_OPS);
+    queue_free(q);
+    (void)sink;
+}
+
+int main() {
+    debug_set_fp(stdout);
+    debug("Queue benchmark, %d operations per case", BENCH_OPS);
+
+    bench_fifo(0);
+    bench_fifo(16);
+    bench_fifo(1000);
+
+    bench_fill(100);
+    bench_fill(10000);
+
+    bench_peek(10);
+    bench_peek(1000);
+    bench_peek(100000);
+
+    return 0;
+}
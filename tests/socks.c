@@ -5,6 +5,7 @@
 #include <sys/socket.h>
 #include <debug.h>
 #include <event2/util.h>
+#include <string.h>
 
 #define LOCALHOST        0x7F000001
 #define ONION_ADDRESS    "g7kfkvigtyx45az27obwydfq3zrxfwl77so3n3tqv22cw3qvz6cuv4qd.onion"
@@ -53,6 +54,84 @@ void cb(struct bufferevent *buffev, enum socks5_errors err, void *attr)
     debug("OUT BUFFER LEN = %d", evbuffer_get_length(out));
 }
 
+// Fake socks server side of the optimistic connect test
+struct fake_server {
+    int n_reads;        // Number of reads needed to get the whole request
+    size_t n_request;   // Number of request bytes received
+    int split;          // Send replies in two writes instead of one
+    uint8_t reply;      // Reply code of connect response
+};
+
+void fake_server_read_cb(struct bufferevent *bev, void *ctx)
+{
+    struct fake_server *srv = ctx;
+    struct evbuffer *in = bufferevent_get_input(bev);
+    uint8_t request[128];
+    size_t len;
+
+    uint8_t auth_reply[] = { 0x05, 0x00 };
+    uint8_t conn_reply[] = { 0x05, srv->reply, 0x00, 0x01, 127, 0, 0, 1, 0x00, 0x50 };
+
+    ++srv->n_reads;
+    len = evbuffer_remove(in, request, sizeof(request));
+    srv->n_request += len;
+
+    // Greeting (3 bytes) and connect request (7 bytes + address)
+    if (srv->n_request < 3 + 7 + ONION_ADDRESS_LEN)
+        return;
+
+    debug("Request received in %d read(s), %d bytes, greeting(%02x %02x %02x) connect(%02x %02x %02x %02x %d) onion(%.*s)",
+        srv->n_reads, (int)srv->n_request, request[0], request[1], request[2],
+        request[3], request[4], request[5], request[6], request[7], ONION_ADDRESS_LEN, request + 8);
+
+    if (srv->split) {
+        bufferevent_write(bev, auth_reply, sizeof(auth_reply));
+        bufferevent_write(bev, conn_reply, 4);
+        bufferevent_write(bev, conn_reply + 4, sizeof(conn_reply) - 4);
+    } else {
+        uint8_t replies[sizeof(auth_reply) + sizeof(conn_reply)];
+
+        memcpy(replies, auth_reply, sizeof(auth_reply));
+        memcpy(replies + sizeof(auth_reply), conn_reply, sizeof(conn_reply));
+        bufferevent_write(bev, replies, sizeof(replies));
+    }
+    bufferevent_write(bev, "DATA", 4);
+}
+
+void optimistic_cb(struct bufferevent *bev, enum socks5_errors err, void *attr)
+{
+    if (!bev) {
+        debug("Optimistic connect failed: %s", socks5_error_string(err));
+        return;
+    }
+
+    debug("Optimistic connect done: %s, %d byte(s) of data left for the caller",
+        socks5_error_string(err), (int)evbuffer_get_length(bufferevent_get_input(bev)));
+}
+
+// Run optimistic connect against fake server on the other end of a pair
+void test_optimistic(struct event_base *base, int split, uint8_t reply)
+{
+    struct bufferevent *pair[2];
+    struct fake_server srv = { 0, 0, split, reply };
+
+    bufferevent_pair_new(base, BEV_OPT_CLOSE_ON_FREE, pair);
+    bufferevent_setcb(pair[1], fake_server_read_cb, NULL, NULL, &srv);
+    bufferevent_enable(pair[0], EV_READ | EV_WRITE);
+    bufferevent_enable(pair[1], EV_READ | EV_WRITE);
+
+    socks5_connect_onion_optimistic(pair[0], (uint8_t *)ONION_ADDRESS, HTTP_SERVER_PORT, optimistic_cb, NULL);
+    // Greeting and connect request must both be written before any reply
+    debug("Written before any reply: %d bytes",
+        (int)(evbuffer_get_length(bufferevent_get_output(pair[0])) + evbuffer_get_length(bufferevent_get_input(pair[1]))));
+
+    event_base_loop(base, EVLOOP_NONBLOCK);
+    event_base_loop(base, EVLOOP_NONBLOCK);
+
+    bufferevent_free(pair[0]);
+    bufferevent_free(pair[1]);
+}
+
 int main(void)
 {
     struct event_base *base;
@@ -68,6 +147,13 @@ int main(void)
 
     base = event_base_new();
 
+    debug("Testing optimistic connect, replies in one write:");
+    test_optimistic(base, 0, 0x00);
+    debug("Testing optimistic connect, replies split:");
+    test_optimistic(base, 1, 0x00);
+    debug("Testing optimistic connect, connection refused:");
+    test_optimistic(base, 0, 0x05);
+
     sin.sin_family = AF_INET;
     sin.sin_addr.s_addr = htonl(LOCALHOST);
     sin.sin_port = htons(9050);